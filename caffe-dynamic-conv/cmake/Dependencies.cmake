@@ -104,6 +104,14 @@ if(USE_OPENCV)
   list(APPEND Caffe_DEFINITIONS PUBLIC -DUSE_OPENCV)
 endif()
 
+# ---[ libjpeg
+if(USE_LIBJPEG)
+  find_package(JPEG REQUIRED)
+  list(APPEND Caffe_INCLUDE_DIRS PRIVATE ${JPEG_INCLUDE_DIR})
+  list(APPEND Caffe_LINKER_LIBS PRIVATE ${JPEG_LIBRARIES})
+  list(APPEND Caffe_DEFINITIONS PUBLIC -DUSE_LIBJPEG)
+endif()
+
 # ---[ BLAS
 if(NOT APPLE)
   set(BLAS "Atlas" CACHE STRING "Selected BLAS library")
@@ -97,6 +97,13 @@ using std::vector;
 // Currently it initializes google flags and google logging.
 void GlobalInit(int* pargc, char*** pargv);
 
+// Whether the BLAS library may be called from several threads at once, as
+// the CPU layers do when Caffe::cpu_threads() is above one. MKL, ATLAS and
+// threaded OpenBLAS builds from 0.3.7 on are; a sequential OpenBLAS build
+// shares its buffers between callers unless built with USE_LOCKING, which
+// it does not report.
+bool BlasIsThreadSafe();
+
 // A singleton class to hold common caffe stuff, such as the handler that
 // caffe is going to use for cublas, curand, etc.
 class Caffe {
@@ -166,6 +173,11 @@ class Caffe {
   inline static bool multiprocess() { return Get().multiprocess_; }
   inline static void set_multiprocess(bool val) { Get().multiprocess_ = val; }
   inline static bool root_solver() { return Get().solver_rank_ == 0; }
+  // Number of threads CPU layers may split a batch across (see
+  // caffe_parallel_for). Defaults to the hardware concurrency divided by the
+  // number of BLAS threads, or to one if !BlasIsThreadSafe().
+  inline static int cpu_threads() { return Get().cpu_threads_; }
+  inline static void set_cpu_threads(int val) { Get().cpu_threads_ = val; }
 
  protected:
 #ifndef CPU_ONLY
@@ -180,6 +192,7 @@ class Caffe {
   int solver_count_;
   int solver_rank_;
   bool multiprocess_;
+  int cpu_threads_;
 
  private:
   // The private constructor to avoid duplicate instantiation.
@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/attention_sampler.hpp"
 
 namespace caffe {
 
@@ -24,6 +25,13 @@ class DataTransformer {
    *    transformation.
    */
   void InitRand();
+  /**
+   * @brief Initialize the Random number generations from the given seed,
+   *    e.g. to make the transformation of an item independent of the thread
+   *    that runs it. An existing generator is reseeded rather than replaced,
+   *    so this is cheap enough to call per item.
+   */
+  void InitRand(unsigned int seed);
 
   /**
    * @brief Applies the transformation defined in the data layer's
@@ -75,10 +83,32 @@ class DataTransformer {
    *    set_cpu_data() is used. See image_data_layer.cpp for an example.
    */
   void Transform(const cv::Mat& cv_img, Blob<Dtype>* transformed_blob);
-  void Attention_Transform(const cv::Mat& cv_img, Blob<Dtype>* transformed_blob, float* attention_array);
-  int Find_center(float* array, int len);
+  /**
+   * @brief Like Transform(cv::Mat), but in the TRAIN phase the random-area
+   *    crop is centered on a point drawn from the attention map, whose cells
+   *    are spread evenly over the image. attention is only read for those
+   *    crops, and may be NULL otherwise.
+   */
+  void Attention_Transform(const cv::Mat& cv_img,
+      Blob<Dtype>* transformed_blob, const AttentionSampler* attention);
+  /**
+   * @brief Like the Blob versions above, but into a channels x height x
+   *    width item at transformed_data. They touch no Blob, so that several
+   *    transformers can run on worker threads; call PrepareCroppedMean for
+   *    the item size first.
+   */
+  void Transform(const cv::Mat& cv_img, int channels, int height, int width,
+      Dtype* transformed_data);
+  void Attention_Transform(const cv::Mat& cv_img, int channels, int height,
+      int width, Dtype* transformed_data, const AttentionSampler* attention);
 #endif  // USE_OPENCV
 
+  /**
+   * @brief Crops the mean image for height x width items ahead of time, so
+   *    that the raw pointer Transform never allocates.
+   */
+  void PrepareCroppedMean(int height, int width);
+
   /**
    * @brief Applies the same transformation defined in the data layer's
    * transform_param block to all the num images in a input_blob.
@@ -142,6 +172,22 @@ class DataTransformer {
   virtual float Randfloat(float n, float m);
 
   void Transform(const Datum& datum, Dtype* transformed_data);
+  // Returns data_mean_ cropped at (h_off, w_off) in the CHW layout of a
+  // height x width output, computed again only when the crop changes.
+  const Dtype* CroppedMean(int h_off, int w_off, int height, int width);
+  // Samples the size of a random-area crop of an img_height x img_width
+  // image from crop_area_ and aspect_ratio_.
+  void SampleCropArea(int img_height, int img_width, int* crop_h,
+      int* crop_w);
+  // Resamples the crop_h x crop_w window at (h_off, w_off) of an image
+  // bilinearly to the height x width output in one pass, subtracting the
+  // mean and scaling on the way. Element (c, h, w) of the image is
+  // src[c * channel_stride + h * row_stride + w * pixel_stride].
+  template <typename SrcType>
+  void CropResize(const SrcType* src, int channels, int channel_stride,
+      int row_stride, int pixel_stride, int img_height, int img_width,
+      int h_off, int w_off, int crop_h, int crop_w, bool mirror, int height,
+      int width, Dtype* transformed_data);
 
   // Tranformation parameters
   TransformationParameter param_;
@@ -149,9 +195,21 @@ class DataTransformer {
   shared_ptr<Caffe::RNG> rng_;
   Phase phase_;
   Blob<Dtype> data_mean_;
+  // Whether data_mean_ is subtracted: mean files that are constant per
+  // channel are folded into mean_values_ instead.
+  bool has_mean_image_;
+  Blob<Dtype> cropped_mean_;
+  int cropped_mean_h_off_;
+  int cropped_mean_w_off_;
   vector<Dtype> mean_values_;
   vector<Dtype> crop_area_;
   vector<Dtype> aspect_ratio_;
+  // Scratch for CropResize, reused across images: the two source rows and
+  // columns of each output row and column, and the weight of the second.
+  vector<int> resize_rows_;
+  vector<int> resize_cols_;
+  vector<Dtype> resize_row_weights_;
+  vector<Dtype> resize_col_weights_;
 };
 
 }  // namespace caffe
@@ -43,7 +43,7 @@ class InternalThread {
 
  private:
   void entry(int device, Caffe::Brew mode, int rand_seed,
-      int solver_count, int solver_rank, bool multiprocess);
+      int solver_count, int solver_rank, bool multiprocess, int cpu_threads);
 
   shared_ptr<boost::thread> thread_;
 };
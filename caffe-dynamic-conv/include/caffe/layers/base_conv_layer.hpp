@@ -31,16 +31,97 @@ class BaseConvolutionLayer : public Layer<Dtype> {
 
  protected:
   // Helper functions that abstract away the column buffer and gemm arguments.
-  // The last argument in forward_cpu_gemm is so that we can skip the im2col if
-  // we just called weight_cpu_gemm with the same input.
+  // The skip_im2col argument in forward_cpu_gemm is so that we can skip the
+  // im2col if we just called weight_cpu_gemm with the same input.
+  // The CPU helpers optionally take their own column buffer (of
+  // col_buffer_count() elements) so that several samples can be processed
+  // concurrently; by default the shared col_buffer_ is used. Likewise
+  // forward_cpu_bias takes the bias_multiplier() resolved by the caller, so
+  // that it can run on worker threads.
   void forward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output, bool skip_im2col = false);
-  void forward_cpu_bias(Dtype* output, const Dtype* bias);
+      Dtype* output, bool skip_im2col = false, Dtype* col_buffer = NULL);
+  void forward_cpu_bias(Dtype* output, const Dtype* bias,
+      const Dtype* bias_multiplier = NULL);
   void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output);
+      Dtype* output, Dtype* col_buffer = NULL);
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
-      weights);
+      weights, Dtype* col_buffer = NULL);
+  // Same as weight_cpu_gemm, but overwrites weights instead of accumulating.
+  void weight_cpu_gemm2(const Dtype* input, const Dtype* output, Dtype*
+      weights, Dtype* col_buffer = NULL);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
+  /// @brief The number of elements of one column buffer.
+  inline int col_buffer_count() const { return col_buffer_.count(); }
+  /// @brief out_spatial_dim_ ones, to broadcast the bias over the output.
+  inline const Dtype* bias_multiplier() { return bias_multiplier_.cpu_data(); }
+  // Batched counterparts of the helpers above for per-sample weights: all
+  // num_ samples are processed at once, sample n using weights +
+  // n * weight_stride. col_buffer must hold num_ * col_buffer_count()
+  // elements. weight_cpu_gemm_batched overwrites one weight gradient per
+  // sample, each blobs_[0]->count() elements apart.
+  void forward_cpu_gemm_batched(const Dtype* input, const Dtype* weights,
+      const int weight_stride, Dtype* output, Dtype* col_buffer);
+  void forward_cpu_bias_batched(Dtype* output, const Dtype* bias);
+  void backward_cpu_gemm_batched(const Dtype* output, const Dtype* weights,
+      const int weight_stride, Dtype* input, Dtype* col_buffer);
+  void weight_cpu_gemm_batched(const Dtype* input, const Dtype* output,
+      Dtype* weights, Dtype* col_buffer);
+  // Fused counterparts for a sample whose weights are weights and filter
+  // combined by op, applied inside the gemms so that the combined filter is
+  // never stored. The CPU versions need fused_tile_count() elements of
+  // tile_buffer. weight_cpu_gemm_fused adds the blobs_[0] gradient to
+  // weight_diff and writes (or adds) the filter gradient to filter_diff;
+  // either may be NULL.
+  void forward_cpu_gemm_fused(const Dtype* input, const Dtype* weights,
+      const Dtype* filter, const ConvolutionParameter_WeightOp op,
+      Dtype* output, Dtype* col_buffer, Dtype* tile_buffer);
+  void backward_cpu_gemm_fused(const Dtype* output, const Dtype* weights,
+      const Dtype* filter, const ConvolutionParameter_WeightOp op,
+      Dtype* input, Dtype* col_buffer, Dtype* tile_buffer);
+  void weight_cpu_gemm_fused(const Dtype* input, const Dtype* output,
+      const Dtype* weights, const Dtype* filter,
+      const ConvolutionParameter_WeightOp op, Dtype* weight_diff,
+      Dtype* filter_diff, const bool accumulate_filter_diff,
+      Dtype* col_buffer, Dtype* tile_buffer);
+  int fused_tile_count() const;
+  // Counterparts for a basis of num_basis filters shared by the whole batch
+  // (consecutive, blobs_[0]->count() elements apart). forward_cpu_gemm_basis
+  // writes one num_ x top_dim_ output block per basis filter;
+  // backward_cpu_gemm_basis sums the input gradients of such blocks, and
+  // weight_cpu_gemm_basis accumulates one gradient per basis filter, summed
+  // over the batch. col_buffer must hold num_ * col_buffer_count() elements.
+  void forward_cpu_gemm_basis(const Dtype* input, const Dtype* basis,
+      const int num_basis, Dtype* output, Dtype* col_buffer);
+  void backward_cpu_gemm_basis(const Dtype* output, const Dtype* basis,
+      const int num_basis, Dtype* input, Dtype* col_buffer);
+  void weight_cpu_gemm_basis(const Dtype* input, const Dtype* output,
+      const int num_basis, Dtype* basis_diff, Dtype* col_buffer);
+  // Counterparts for the num_samples samples listed in samples, which share
+  // one filter: their columns are laid side by side, so that each group
+  // takes a single gemm over num_samples times the output spatial size.
+  // col_buffer must hold (num_samples + 1) * col_buffer_count() elements and
+  // output_buffer num_samples outputs. weight_cpu_gemm_shared overwrites
+  // weights with the gradient summed over the samples.
+  void forward_cpu_gemm_shared(const Dtype* input, const int* samples,
+      const int num_samples, const Dtype* weights, Dtype* output,
+      Dtype* col_buffer, Dtype* output_buffer);
+  void backward_cpu_gemm_shared(const Dtype* output, const int* samples,
+      const int num_samples, const Dtype* weights, Dtype* input,
+      Dtype* col_buffer, Dtype* output_buffer);
+  void weight_cpu_gemm_shared(const Dtype* input, const Dtype* output,
+      const int* samples, const int num_samples, Dtype* weights,
+      Dtype* col_buffer, Dtype* output_buffer);
+  // Per-sample filters, for layers given one more bottom than tops: a sample
+  // is convolved with blobs_[0] and its filter row combined as set by
+  // weight_operation. dynamic_combine_* writes that combination to
+  // new_weight and returns it (COPY returns filter itself).
+  // dynamic_combine_backward_* maps the gradient w.r.t. the combination to
+  // blobs_[0] (added to weight_diff) and to the filter row (written to, or
+  // added to when accumulate, filter_diff); either may be NULL.
+  const Dtype* dynamic_combine_cpu(const Dtype* filter, Dtype* new_weight);
+  void dynamic_combine_backward_cpu(const Dtype* filter,
+      const Dtype* new_weight_diff, Dtype* weight_diff, Dtype* filter_diff,
+      const bool accumulate);
 
 #ifndef CPU_ONLY
   void forward_gpu_gemm(const Dtype* col_input, const Dtype* weights,
@@ -54,6 +135,33 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   void weight_gpu_gemm2(const Dtype* col_input, const Dtype* output, Dtype*
       weights);
   void backward_gpu_bias(Dtype* bias, const Dtype* input);
+  void forward_gpu_gemm_batched(const Dtype* input, const Dtype* weights,
+      const int weight_stride, Dtype* output, Dtype* col_buffer);
+  void forward_gpu_bias_batched(Dtype* output, const Dtype* bias);
+  void backward_gpu_gemm_batched(const Dtype* output, const Dtype* weights,
+      const int weight_stride, Dtype* input, Dtype* col_buffer);
+  void weight_gpu_gemm_batched(const Dtype* input, const Dtype* output,
+      Dtype* weights, Dtype* col_buffer);
+  void forward_gpu_gemm_fused(const Dtype* input, const Dtype* weights,
+      const Dtype* filter, const ConvolutionParameter_WeightOp op,
+      Dtype* output);
+  void backward_gpu_gemm_fused(const Dtype* output, const Dtype* weights,
+      const Dtype* filter, const ConvolutionParameter_WeightOp op,
+      Dtype* input);
+  void weight_gpu_gemm_fused(const Dtype* input, const Dtype* output,
+      const Dtype* weights, const Dtype* filter,
+      const ConvolutionParameter_WeightOp op, Dtype* weight_diff,
+      Dtype* filter_diff, const bool accumulate_filter_diff);
+  void forward_gpu_gemm_basis(const Dtype* input, const Dtype* basis,
+      const int num_basis, Dtype* output, Dtype* col_buffer);
+  void backward_gpu_gemm_basis(const Dtype* output, const Dtype* basis,
+      const int num_basis, Dtype* input, Dtype* col_buffer);
+  void weight_gpu_gemm_basis(const Dtype* input, const Dtype* output,
+      const int num_basis, Dtype* basis_diff, Dtype* col_buffer);
+  const Dtype* dynamic_combine_gpu(const Dtype* filter, Dtype* new_weight);
+  void dynamic_combine_backward_gpu(const Dtype* filter,
+      const Dtype* new_weight_diff, Dtype* weight_diff, Dtype* filter_diff,
+      const bool accumulate);
 #endif
 
   /// @brief The spatial dimensions of the input.
@@ -63,6 +171,9 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   // reverse_dimensions should return true iff we are implementing deconv, so
   // that conv helpers know which dimensions are which.
   virtual bool reverse_dimensions() = 0;
+  // Whether the layer takes per-sample filters factorized as coefficient and
+  // basis bottoms (two more bottoms than tops).
+  virtual inline bool factorized_filters() { return false; }
   // Compute height_out_ and width_out_ from other parameters.
   virtual void compute_output_shape() = 0;
 
@@ -129,6 +240,52 @@ class BaseConvolutionLayer : public Layer<Dtype> {
           pad_.cpu_data(), stride_.cpu_data(), dilation_.cpu_data(), data);
     }
   }
+  // The num_ images of a batch are contiguous, so the 2D kernels can treat
+  // them as one image with num_ times the channels.
+  inline void conv_im2col_batch_cpu(const Dtype* data, Dtype* col_buff) {
+    if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
+      im2col_cpu(data, conv_in_channels_ * num_,
+          conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+          kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+          pad_.cpu_data()[0], pad_.cpu_data()[1],
+          stride_.cpu_data()[0], stride_.cpu_data()[1],
+          dilation_.cpu_data()[0], dilation_.cpu_data()[1], col_buff);
+    } else {
+      for (int n = 0; n < num_; ++n) {
+        conv_im2col_cpu(data + n * conv_input_dim(),
+            col_buff + n * col_buffer_.count());
+      }
+    }
+  }
+  inline void conv_col2im_batch_cpu(const Dtype* col_buff, Dtype* data) {
+    if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
+      col2im_cpu(col_buff, conv_in_channels_ * num_,
+          conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+          kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+          pad_.cpu_data()[0], pad_.cpu_data()[1],
+          stride_.cpu_data()[0], stride_.cpu_data()[1],
+          dilation_.cpu_data()[0], dilation_.cpu_data()[1], data);
+    } else {
+      for (int n = 0; n < num_; ++n) {
+        conv_col2im_cpu(col_buff + n * col_buffer_.count(),
+            data + n * conv_input_dim());
+      }
+    }
+  }
+  // The number of elements of one im2col input image.
+  inline int conv_input_dim() {
+    return reverse_dimensions() ? top_dim_ : bottom_dim_;
+  }
+  // Gather the columns (or outputs) of the listed samples side by side:
+  // row r of sample s goes to row r, column block s of the gathered matrix.
+  // conv_im2col_shared_cpu stages im2col in the last of its
+  // num_samples + 1 column buffers.
+  void conv_im2col_shared_cpu(const Dtype* data, const int* samples,
+      const int num_samples, Dtype* col_buff);
+  void conv_gather_output_cpu(const Dtype* output, const int* samples,
+      const int num_samples, Dtype* output_buffer);
+  void conv_scatter_output_cpu(const Dtype* output_buffer, const int* samples,
+      const int num_samples, Dtype* output);
 #ifndef CPU_ONLY
   inline void conv_im2col_gpu(const Dtype* data, Dtype* col_buff) {
     if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
@@ -160,6 +317,36 @@ class BaseConvolutionLayer : public Layer<Dtype> {
           dilation_.gpu_data(), data);
     }
   }
+  inline void conv_im2col_batch_gpu(const Dtype* data, Dtype* col_buff) {
+    if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
+      im2col_gpu(data, conv_in_channels_ * num_,
+          conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+          kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+          pad_.cpu_data()[0], pad_.cpu_data()[1],
+          stride_.cpu_data()[0], stride_.cpu_data()[1],
+          dilation_.cpu_data()[0], dilation_.cpu_data()[1], col_buff);
+    } else {
+      for (int n = 0; n < num_; ++n) {
+        conv_im2col_gpu(data + n * conv_input_dim(),
+            col_buff + n * col_buffer_.count());
+      }
+    }
+  }
+  inline void conv_col2im_batch_gpu(const Dtype* col_buff, Dtype* data) {
+    if (!force_nd_im2col_ && num_spatial_axes_ == 2) {
+      col2im_gpu(col_buff, conv_in_channels_ * num_,
+          conv_input_shape_.cpu_data()[1], conv_input_shape_.cpu_data()[2],
+          kernel_shape_.cpu_data()[0], kernel_shape_.cpu_data()[1],
+          pad_.cpu_data()[0], pad_.cpu_data()[1],
+          stride_.cpu_data()[0], stride_.cpu_data()[1],
+          dilation_.cpu_data()[0], dilation_.cpu_data()[1], data);
+    } else {
+      for (int n = 0; n < num_; ++n) {
+        conv_col2im_gpu(col_buff + n * col_buffer_.count(),
+            data + n * conv_input_dim());
+      }
+    }
+  }
 #endif
 
   int num_kernels_im2col_;
@@ -1,6 +1,8 @@
 #ifndef CAFFE_DATA_LAYERS_HPP_
 #define CAFFE_DATA_LAYERS_HPP_
 
+#include <boost/function.hpp>
+
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -47,6 +49,9 @@ template <typename Dtype>
 class Batch {
  public:
   Blob<Dtype> data_, label_;
+  // Auxiliary blobs for the tops after data and label (e.g. per-sample
+  // attributes), one per top, shaped by the layer's DataLayerSetUp.
+  vector<shared_ptr<Blob<Dtype> > > extra_;
 };
 
 template <typename Dtype>
@@ -69,12 +74,34 @@ class BasePrefetchingDataLayer :
   virtual void InternalThreadEntry();
   virtual void load_batch(Batch<Dtype>* batch) = 0;
 
+  // The items of [0, num) this solver reads, in order: in TRAIN every solver
+  // reads every solver_count-th item, from its rank on; TEST only runs on
+  // the root solver.
+  void ShardItems(int num, vector<int>* items) const;
+
+  // For layers that transform the items of a batch concurrently: sets up one
+  // transformer per worker, the layer's own as the first, for batches of
+  // batch_size items and num_workers workers (0 for Caffe::cpu_threads()).
+  void SetUpTransformWorkers(int batch_size, int num_workers);
+  typedef boost::function<void(int, DataTransformer<Dtype>*, Dtype*)>
+      TransformItemFunction;
+  // Calls transform_item(item_id, transformer, transformed_data) for every
+  // item of batch on the workers, with the worker's transformer seeded for
+  // the item and transformed_data pointing at the item's slot of
+  // batch->data_. transform_item must not touch any Blob. The seeds
+  // are drawn in item order, so the batch only depends on the random seed
+  // and not on how the items are spread over the workers.
+  void TransformBatch(Batch<Dtype>* batch,
+      const TransformItemFunction& transform_item);
+
   vector<shared_ptr<Batch<Dtype> > > prefetch_;
   BlockingQueue<Batch<Dtype>*> prefetch_free_;
   BlockingQueue<Batch<Dtype>*> prefetch_full_;
   Batch<Dtype>* prefetch_current_;
 
   Blob<Dtype> transformed_data_;
+  // One transformer per transform worker.
+  vector<shared_ptr<DataTransformer<Dtype> > > transformers_;
 };
 
 }  // namespace caffe
@@ -50,11 +50,17 @@ class BNLayer : public Layer<Dtype> {
   int height_;
   int width_;
 
+  // The GPU path broadcasts through broadcast_buffer_ and keeps x_norm_ for
+  // backprop. The CPU path computes the statistics and the output per channel
+  // and only fills x_norm_ when the layer runs in place and the input is
+  // overwritten; blob memory is allocated on first use, so the unused buffers
+  // cost nothing.
   Blob<Dtype> broadcast_buffer_;
   Blob<Dtype> spatial_statistic_;
   Blob<Dtype> batch_statistic_;
 
   Blob<Dtype> x_norm_;
+  Blob<Dtype> x_mean_;
   Blob<Dtype> x_inv_std_;
 
   Blob<Dtype> spatial_sum_multiplier_;
@@ -60,12 +60,40 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
    *  - bias_term (\b optional, default true). Whether to have a bias.
    *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
    *    kernels + stream parallelism) engines.
+   *  - weight_operation (\b optional, default COPY). When the layer is given
+   *  one more bottom than tops, the last bottom holds one filter per sample
+   *  (N x weight count) and each sample is convolved with blobs_[0] * filter
+   *  (MUL), blobs_[0] + filter (ADD) or the filter alone (COPY). On the CPU
+   *  the samples are split across Caffe::cpu_threads() workers.
+   *  - dynamic_engine (\b optional, default PER_SAMPLE). BATCHED combines
+   *  the filters of the whole batch at once and runs strided batched gemms
+   *  instead of one gemm per sample, at the cost of num column buffers.
+   *  FUSED combines MUL/ADD filters tile by tile inside the gemms, on both
+   *  the CPU and the GPU, instead of writing them out first. On the CPU,
+   *  both PER_SAMPLE and FUSED group the samples whose filters are
+   *  byte-identical and convolve each group with one gemm over the columns
+   *  of all its samples; a batch of distinct filters runs sample by sample.
+   *  The GPU ignores this grouping.
+   *
+   *  Given two more bottoms than tops, the per-sample filters come factorized
+   *  as a coefficient bottom (N x K) and a basis bottom (K x weight count),
+   *  e.g. from a DynamicFilterGenerator layer, with filter n being
+   *  sum_k coefficient(n, k) * basis(k). The batch is then convolved once
+   *  with each of the K basis filters (combined with blobs_[0] as set by
+   *  weight_operation) and the results are mixed per sample, so the N
+   *  filters are never materialized. That saves their memory, but costs K
+   *  times the convolution work of a static layer, where materialized
+   *  filters cost about one.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
-      : BaseConvolutionLayer<Dtype>(param) {}
+      : BaseConvolutionLayer<Dtype>(param), dynamic_gemms_saved_(0) {}
 
   virtual inline const char* type() const { return "Convolution"; }
 
+  /// @brief The number of gemms the dynamic path has saved so far by
+  /// grouping samples that share a filter.
+  inline uint64_t dynamic_gemms_saved() const { return dynamic_gemms_saved_; }
+
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -76,7 +104,113 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual inline bool reverse_dimensions() { return false; }
+  virtual inline bool factorized_filters() { return true; }
   virtual void compute_output_shape();
+
+ private:
+  // Pointers shared by the workers of the dynamic (per-sample filter) CPU
+  // path, resolved on the calling thread before the batch is split.
+  struct DynamicArgs {
+    ConvolutionParameter_WeightOp op;
+    int weight_count;
+    const Dtype* weight;
+    const Dtype* bias;
+    const Dtype* bias_multiplier;
+    const Dtype* bottom_weight;
+    const Dtype* bottom_data;
+    Dtype* top_data;
+    const Dtype* top_diff;
+    // Gradient outputs; NULL when the gradient is not needed.
+    Dtype* bottom_diff;
+    Dtype* bottom_weight_diff;
+    Dtype* weight_diff;
+    // Add to bottom_weight_diff instead of overwriting it (tops after the
+    // first one share the filter bottom).
+    bool accumulate_bottom_weight_diff;
+    // Apply MUL/ADD inside the gemms (the FUSED engine).
+    bool fused;
+    // Per-worker scratch: new_weight holds a combined filter, or a gemm
+    // tile of scratch_count elements when fused, and col_buffer holds
+    // col_stride elements.
+    int scratch_count;
+    int col_stride;
+    Dtype* new_weight;
+    Dtype* new_weight_diff;
+    Dtype* col_buffer;
+    Dtype* weight_diff_buffer;
+    // Grouped samples: the gathered outputs, top_stride elements per worker.
+    Dtype* top_buffer;
+    int top_stride;
+  };
+  int DynamicSetUp_cpu(const Dtype* bottom_weight, bool need_weight_diff);
+  int DynamicGroupSetUp(const Dtype* bottom_weight);
+  inline bool dynamic_grouped() const {
+    return static_cast<int>(dynamic_group_start_.size()) <= this->num_;
+  }
+  bool dynamic_fused() const;
+  void Forward_dynamic_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void Backward_dynamic_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  const Dtype* dynamic_weight_cpu(const DynamicArgs& args, int n, int worker);
+  void forward_dynamic_sample(const DynamicArgs& args, int n, int worker);
+  void backward_dynamic_sample(const DynamicArgs& args, int n, int worker);
+  void backward_dynamic_sample_fused(const DynamicArgs& args, int n,
+      int worker);
+  void forward_dynamic_group(const DynamicArgs& args, int group, int worker);
+  void backward_dynamic_group(const DynamicArgs& args, int group, int worker);
+
+  // The BATCHED dynamic engine.
+  void DynamicBatchedSetUp();
+  void Forward_dynamic_batched_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void Backward_dynamic_batched_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  const Dtype* dynamic_weight_batched_cpu(const Dtype* bottom_weight);
+  // The factorized (coefficient x basis) dynamic path.
+  int FactorizedSetUp(const vector<Blob<Dtype>*>& bottom, int num_top);
+  void Forward_factorized_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void Backward_factorized_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  const Dtype* factorized_basis_cpu(const Dtype* basis, int num_coefficients);
+
+#ifndef CPU_ONLY
+  void Forward_dynamic_batched_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void Backward_dynamic_batched_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  const Dtype* dynamic_weight_batched_gpu(const Dtype* bottom_weight);
+  void Forward_dynamic_fused_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void Backward_dynamic_fused_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  void Forward_factorized_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  void Backward_factorized_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  const Dtype* factorized_basis_gpu(const Dtype* basis, int num_coefficients);
+#endif
+
+  /// @brief im2col buffers of the dynamic path, one (or, grouped, largest
+  /// group + 1) per worker (PER_SAMPLE, CPU) or one per sample (BATCHED,
+  /// factorized).
+  Blob<Dtype> dynamic_col_buffer_;
+  /// @brief blobs_[0] gradient accumulators of workers 1, 2, ...
+  Blob<Dtype> dynamic_weight_diff_;
+  /// @brief The samples ordered by filter, and where each group of samples
+  /// sharing a filter starts in that order (plus num_ at the end).
+  vector<int> dynamic_group_order_;
+  vector<int> dynamic_group_start_;
+  /// @brief The gathered outputs of the largest group, per worker.
+  Blob<Dtype> dynamic_group_top_buffer_;
+  uint64_t dynamic_gemms_saved_;
+  /// @brief num_ ones, to sum the per-sample filter gradients (BATCHED).
+  Blob<Dtype> dynamic_sum_multiplier_;
+  /// @brief The outputs of each basis filter, for every top (factorized).
+  Blob<Dtype> factorized_top_buffer_;
+  /// @brief top_dim_ ones, to sum the coefficient gradients (factorized).
+  Blob<Dtype> factorized_sum_multiplier_;
 };
 
 }  // namespace caffe
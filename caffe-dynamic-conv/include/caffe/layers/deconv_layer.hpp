@@ -24,6 +24,10 @@ namespace caffe {
  *   parameters, but they take the opposite sense as in ConvolutionLayer (so
  *   padding is removed from the output rather than added to the input, and
  *   stride results in upsampling rather than downsampling).
+ *
+ *   Like ConvolutionLayer, given one more bottom than tops the last bottom
+ *   holds one filter per sample (N x weight count), which is combined with
+ *   blobs_[0] as set by weight_operation (MUL, ADD or COPY).
  */
 template <typename Dtype>
 class DeconvolutionLayer : public BaseConvolutionLayer<Dtype> {
@@ -35,6 +35,10 @@ namespace caffe {
  *   inputs so that the im2col matrix has a column for each input region to
  *   be filtered. col2im restores the output spatial structure by rolling up
  *   the output channel N' columns of the output matrix.
+ *
+ *   On the CPU, a 2D convolution with group == channels == num_output (one
+ *   filter per channel) skips im2col and the per-channel GEMMs it would need,
+ *   and runs the direct kernels of caffe/util/depthwise_conv.hpp instead.
  */
 template <typename Dtype>
 class DepthwiseConvolutionLayer : public BaseConvolutionLayer<Dtype> {
@@ -69,6 +73,11 @@ class DepthwiseConvolutionLayer : public BaseConvolutionLayer<Dtype> {
    *  - bias_term (\b optional, default true). Whether to have a bias.
    *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
    *    kernels + stream parallelism) engines.
+   *  - weight_operation (\b optional, default COPY). As in ConvolutionLayer,
+   *  given one more bottom than tops the last bottom holds one filter per
+   *  sample (N x channels x kernel height x kernel width), convolved as
+   *  blobs_[0] * filter (MUL), blobs_[0] + filter (ADD) or the filter alone
+   *  (COPY).
    */
   explicit DepthwiseConvolutionLayer(const LayerParameter& param)
       : BaseConvolutionLayer<Dtype>(param) {}
@@ -86,6 +95,30 @@ class DepthwiseConvolutionLayer : public BaseConvolutionLayer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual inline bool reverse_dimensions() { return false; }
   virtual void compute_output_shape();
+
+ private:
+  // Whether the direct CPU kernels apply: a 2D convolution with one filter
+  // per channel.
+  inline bool direct_cpu() const {
+    return this->num_spatial_axes_ == 2 &&
+        this->group_ == this->channels_ &&
+        this->num_output_ == this->channels_;
+  }
+  // Direct counterparts of forward_cpu_gemm, backward_cpu_gemm and
+  // weight_cpu_gemm over the whole batch; weight_stride is 0 for blobs_[0],
+  // or the filter size for one filter per sample.
+  void forward_cpu_direct(const Dtype* input, const Dtype* weight,
+      const int weight_stride, Dtype* output);
+  void backward_cpu_direct(const Dtype* output, const Dtype* weight,
+      const int weight_stride, Dtype* input);
+  void weight_cpu_direct(const Dtype* input, const Dtype* output,
+      Dtype* weight, const int weight_stride);
+  // Combines the filters of the whole batch into new_weight_.
+  const Dtype* dynamic_weight_cpu(const Dtype* bottom_weight);
+#ifndef CPU_ONLY
+  // Combines the filters of the whole batch into new_weight_.
+  const Dtype* dynamic_weight_gpu(const Dtype* bottom_weight);
+#endif
 };
 
 }  // namespace caffe
@@ -0,0 +1,70 @@
+#ifndef CAFFE_DYNAMIC_FILTER_GENERATOR_LAYER_HPP_
+#define CAFFE_DYNAMIC_FILTER_GENERATOR_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/syncedmem.hpp"
+
+#include "caffe/layers/inner_product_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Generates the per-sample filters of a dynamic ConvolutionLayer from
+ *        an embedding, as a learned basis mixed by per-sample coefficients.
+ *
+ * The filter of sample n is @f$ W x_n + b @f$, i.e. the InnerProduct of the
+ * embedding @f$ x_n @f$ (K_ values) with num_output = the convolution weight
+ * count, and takes the same inner_product_param and parameter blobs, so the
+ * weights of an InnerProduct filter generator load unchanged. Seen as a
+ * basis, the filter is @f$ \sum_k c_{nk} B_k @f$ with the K_ + 1 rows of
+ * @f$ B = [W^\top; b^\top] @f$ and @f$ c_n = [x_n, 1] @f$ (without the last
+ * row and coefficient when bias_term is false).
+ *
+ * With one top the layer outputs the N x num_output filters, like
+ * InnerProduct. With two tops it outputs the coefficients (N x (K_ + 1)) and
+ * the basis ((K_ + 1) x num_output) instead, which a ConvolutionLayer takes
+ * as its last two bottoms, so that the N filters are never materialized.
+ * The basis is only rebuilt when the parameters change.
+ */
+template <typename Dtype>
+class DynamicFilterGeneratorLayer : public InnerProductLayer<Dtype> {
+ public:
+  explicit DynamicFilterGeneratorLayer(const LayerParameter& param)
+      : InnerProductLayer<Dtype>(param) {}
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "DynamicFilterGenerator"; }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return -1; }
+  virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline int MaxTopBlobs() const { return 2; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  // Whether the basis top no longer holds the current parameters, and
+  // marking it as current once rebuilt.
+  bool basis_stale(const Blob<Dtype>& basis) const;
+  void basis_rebuilt(const Blob<Dtype>& basis);
+
+  /// @brief The number of basis filters, K_ + bias_term_.
+  int rank_;
+  /// @brief The weight, bias and basis top memory as of the last rebuild.
+  SyncedMemoryVersion basis_sources_[3];
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_DYNAMIC_FILTER_GENERATOR_LAYER_HPP_
@@ -0,0 +1,59 @@
+#ifndef CAFFE_IMAGE_CACHE_DATA_LAYER_HPP_
+#define CAFFE_IMAGE_CACHE_DATA_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/data_transformer.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/layers/base_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/image_cache.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Provides data to the Net from an image cache written by
+ *        convert_image_cache: images are resized once and transformed in
+ *        place from the memory-mapped file, without decoding or opening
+ *        files per epoch.
+ *
+ * Takes image_data_param: source is the cache, and batch_size, shuffle,
+ * rand_skip and num_workers behave as for ImageDataLayer, as does the
+ * sharding of TRAIN among solvers; new_height, new_width and is_color were
+ * fixed when the cache was written. decoder and attention_guided_crop are
+ * rejected. A third top receives the cached attributes of each image.
+ */
+template <typename Dtype>
+class ImageCacheDataLayer : public BasePrefetchingDataLayer<Dtype> {
+ public:
+  explicit ImageCacheDataLayer(const LayerParameter& param)
+      : BasePrefetchingDataLayer<Dtype>(param) {}
+  virtual ~ImageCacheDataLayer();
+  virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "ImageCacheData"; }
+  virtual inline int ExactNumBottomBlobs() const { return 0; }
+  virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline int MaxTopBlobs() const { return 3; }
+
+ protected:
+  shared_ptr<Caffe::RNG> prefetch_rng_;
+  virtual void load_batch(Batch<Dtype>* batch);
+  // With shuffle, swaps the image at order_id_ with a random one of the rest
+  // of the epoch, as ImageDataLayer::DrawLine does.
+  void DrawItem();
+  // Moves order_id_ to the next image of the epoch and draws it.
+  void NextItem();
+
+  shared_ptr<ImageCache> cache_;
+  // This solver's shard of the cached images in the order they are read.
+  vector<int> order_;
+  int order_id_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_IMAGE_CACHE_DATA_LAYER_HPP_
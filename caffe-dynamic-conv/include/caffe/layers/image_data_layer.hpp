@@ -11,9 +11,49 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/attention_sampler.hpp"
 
 namespace caffe {
 
+/**
+ * @brief Reads the (gender, ethnicity) attributes coded in a face image
+ *        filename as +1/-1 for female/male and for yellow/white, as in the
+ *        trained models. Returns false if either one is missing.
+ */
+bool FilenameAttributes(const string& filename, float* attributes);
+
+/**
+ * @brief The filenames and labels of an image list. The filenames are packed
+ *        end to end in one arena, so an image costs its characters, an
+ *        offset and a label rather than a heap string each.
+ */
+class ImageList {
+ public:
+  ImageList() : offsets_(1, 0) {}
+
+  void Add(const string& name, float label);
+  inline int size() const { return labels_.size(); }
+  inline bool empty() const { return labels_.empty(); }
+  // The NUL-terminated filename of image i.
+  inline const char* name(int i) const { return &arena_[offsets_[i]]; }
+  inline float label(int i) const { return labels_[i]; }
+
+ private:
+  vector<char> arena_;
+  vector<size_t> offsets_;
+  vector<float> labels_;
+};
+
+/**
+ * @brief Reads an image list of "path label [attribute ...]" lines, with the
+ *        same number of numeric attribute columns on every line (the last
+ *        space-separated part of a path must not be a number). Returns that
+ *        number; the attributes of line i start at
+ *        (*attributes)[i * num_attributes].
+ */
+int ReadImageList(const string& source, ImageList* lines,
+    vector<float>* attributes);
+
 /**
  * @brief Provides data to the Net from image files.
  *
@@ -33,19 +73,27 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
   // virtual inline int ExactNumTopBlobs() const { return 2; }
   virtual inline int MaxTopBlobs() const { return 3; }
 
-  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top);
-  virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top);
-
  protected:
   shared_ptr<Caffe::RNG> prefetch_rng_;
-  virtual void ShuffleImages();
   virtual void load_batch(Batch<Dtype>* batch);
+  // With shuffle, swaps the line at lines_id_ with a random one of the rest
+  // of the epoch: the epoch's permutation is drawn one Fisher-Yates step per
+  // image instead of all at once at the wraparound.
+  void DrawLine();
+  // Moves lines_id_ to the next line of the epoch and draws it.
+  void NextLine();
 
-  vector<std::pair<std::string, float> > lines_;
+  ImageList lines_;
+  // The attributes of line i, contiguous from attributes_[i * num_attributes_].
+  vector<Dtype> attributes_;
+  int num_attributes_;
+  // This solver's shard of lines_ in the order it is read this epoch;
+  // lines_id_ indexes it.
+  vector<int> lines_order_;
   int lines_id_;
-  Blob<Dtype> extra_data_;
+  // The alias tables of the attention maps, one per line of lines_; only
+  // opened for the random-area crops of TRAIN, which draw from them.
+  shared_ptr<AttentionTables> attention_tables_;
 };
 
 
@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/interp.hpp"
 
 namespace caffe {
 /**
@@ -43,6 +44,8 @@ class InterpLayer : public Layer<Dtype> {
   int height_out_, width_out_;
   int pad_beg_, pad_end_;
   int height_in_eff_, width_in_eff_;
+  // The CPU source taps of the rows and columns, computed in Reshape.
+  InterpTaps<Dtype> taps_h_, taps_w_;
 };
 
 }  // namespace caffe
@@ -54,6 +54,9 @@ class PoolingLayer : public Layer<Dtype> {
   Blob<Dtype> rand_idx_;
   Blob<int> max_idx_;
   bool ceil_mode_;
+  // Whether a mask top holds int indices (in the memory of its Dtype
+  // values) rather than Dtype ones.
+  bool int_mask_;
 };
 
 }  // namespace caffe
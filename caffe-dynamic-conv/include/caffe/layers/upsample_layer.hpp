@@ -40,6 +40,10 @@ class UpsampleLayer : public Layer<Dtype> {
   int scale_h_, scale_w_;
   bool pad_out_h_, pad_out_w_;
   int upsample_h_, upsample_w_;
+  // Whether the mask holds int indices, from a PoolingLayer with int_mask.
+  bool int_mask_;
+  // The size of the top tile each bottom value was pooled from, at most.
+  int tile_h_, tile_w_;
 };
 
 }  // namespace caffe
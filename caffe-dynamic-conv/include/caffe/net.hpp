@@ -277,6 +277,9 @@ class Net {
   string name_;
   /// @brief The phase: TRAIN or TEST
   Phase phase_;
+  /// @brief With fold_batch_norm, the filtered net before folding, whose
+  ///        trained weights CopyTrainedLayersFrom folds; else empty.
+  NetParameter unfolded_param_;
   /// @brief Individual layers in the net
   vector<shared_ptr<Layer<Dtype> > > layers_;
   vector<string> layer_names_;
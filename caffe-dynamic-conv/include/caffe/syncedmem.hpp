@@ -1,8 +1,11 @@
 #ifndef CAFFE_SYNCEDMEM_HPP_
 #define CAFFE_SYNCEDMEM_HPP_
 
+#include <stdint.h>
 #include <cstdlib>
 
+#include <boost/weak_ptr.hpp>
+
 #ifdef USE_MKL
   #include "mkl.h"
 #endif
@@ -68,6 +71,9 @@ class SyncedMemory {
   enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED };
   SyncedHead head() { return head_; }
   size_t size() { return size_; }
+  /// @brief The number of times the data has been handed out for writing,
+  /// so that a consumer can tell whether it may have changed since.
+  uint64_t version() const { return version_; }
 
 #ifndef CPU_ONLY
   void async_gpu_push(const cudaStream_t& stream);
@@ -82,6 +88,7 @@ class SyncedMemory {
   void* gpu_ptr_;
   size_t size_;
   SyncedHead head_;
+  uint64_t version_;
   bool own_cpu_data_;
   bool cpu_malloc_use_cuda_;
   bool own_gpu_data_;
@@ -90,6 +97,28 @@ class SyncedMemory {
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
 
+/**
+ * @brief Remembers a SyncedMemory and its version, to tell later whether the
+ *        memory has since been replaced or handed out for writing.
+ *
+ * Does not keep the memory alive: memory freed since never matches.
+ */
+class SyncedMemoryVersion {
+ public:
+  SyncedMemoryVersion() : version_(0) {}
+  bool Matches(const shared_ptr<SyncedMemory>& memory) const {
+    return memory_.lock() == memory && memory->version() == version_;
+  }
+  void Remember(const shared_ptr<SyncedMemory>& memory) {
+    memory_ = memory;
+    version_ = memory->version();
+  }
+
+ private:
+  boost::weak_ptr<SyncedMemory> memory_;
+  uint64_t version_;
+};
+
 }  // namespace caffe
 
 #endif  // CAFFE_SYNCEDMEM_HPP_
@@ -39,6 +39,19 @@ class MultiDeviceTest : public ::testing::Test {
 
 typedef ::testing::Types<float, double> TestDtypes;
 
+// Restores Caffe::cpu_threads() when it goes out of scope, so a test that
+// sets it, even one that fails midway, leaves later tests the default.
+class CPUThreadsGuard {
+ public:
+  CPUThreadsGuard() : cpu_threads_(Caffe::cpu_threads()) {}
+  ~CPUThreadsGuard() { Caffe::set_cpu_threads(cpu_threads_); }
+
+ private:
+  const int cpu_threads_;
+
+  DISABLE_COPY_AND_ASSIGN(CPUThreadsGuard);
+};
+
 template <typename TypeParam>
 struct CPUDevice {
   typedef TypeParam Dtype;
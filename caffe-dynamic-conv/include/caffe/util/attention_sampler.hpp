@@ -0,0 +1,104 @@
+#ifndef CAFFE_UTIL_ATTENTION_SAMPLER_HPP_
+#define CAFFE_UTIL_ATTENTION_SAMPLER_HPP_
+
+#include <stdint.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Draws positions of a height x width attention map with probability
+// proportional to their (non-negative) weights, from an alias table built
+// once for the map: every draw takes constant time and reads two cells.
+// The sampler only points at the table, which lives in an AttentionTables
+// file or in the caller's memory, so it is cheap to pass by value.
+class AttentionSampler {
+ public:
+  AttentionSampler(const uint16_t* prob, const uint32_t* alias, int height,
+      int width)
+      : prob_(prob), alias_(alias), height_(height), width_(width) {}
+
+  // Builds the table of a map of n cells into prob and alias (n each). Cell
+  // i is kept with probability prob[i] / 65535 and replaced by alias[i]
+  // otherwise. A map without any weight is sampled uniformly.
+  static void BuildTable(const float* attention, int n, uint16_t* prob,
+      uint32_t* alias);
+
+  inline int height() const { return height_; }
+  inline int width() const { return width_; }
+  // Maps two uniform numbers in [0, 1) to a position (*h, *w).
+  void Sample(float u, float v, int* h, int* w) const;
+
+ private:
+  const uint16_t* prob_;
+  const uint32_t* alias_;
+  int height_;
+  int width_;
+};
+
+// An attention table file holds the alias tables of num attention maps, one
+// per line of an image list and in its order, as written by
+// tools/convert_attention_tables. Every table is 2 + 4 bytes per cell and
+// starts on a 64-byte boundary; the file ends with an index of table offsets
+// and map sizes.
+struct AttentionTablesHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num;
+  uint64_t index_offset;
+};
+
+struct AttentionTablesEntry {
+  uint64_t offset;
+  uint32_t height;
+  uint32_t width;
+};
+
+// Writes an attention table file one map at a time.
+class AttentionTablesWriter {
+ public:
+  explicit AttentionTablesWriter(const string& filename);
+  ~AttentionTablesWriter();
+
+  // Appends the table of a height x width map.
+  void Add(const float* attention, int height, int width);
+  // Writes the index and the header; called by the destructor if need be.
+  void Close();
+
+ private:
+  FILE* file_;
+  AttentionTablesHeader header_;
+  uint64_t offset_;
+  vector<AttentionTablesEntry> index_;
+  vector<uint16_t> prob_;
+  vector<uint32_t> alias_;
+
+  DISABLE_COPY_AND_ASSIGN(AttentionTablesWriter);
+};
+
+// Memory-maps an attention table file for reading. sampler(i) only computes
+// addresses into the mapping, so a draw pages in just the cells it reads.
+class AttentionTables {
+ public:
+  explicit AttentionTables(const string& filename);
+  ~AttentionTables();
+
+  inline int num() const { return header_->num; }
+  AttentionSampler sampler(int i) const;
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  const AttentionTablesHeader* header_;
+  const AttentionTablesEntry* index_;
+
+  DISABLE_COPY_AND_ASSIGN(AttentionTables);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_ATTENTION_SAMPLER_HPP_
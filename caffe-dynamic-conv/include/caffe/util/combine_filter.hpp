@@ -0,0 +1,29 @@
+#ifndef CAFFE_UTIL_COMBINE_FILTER_HPP_
+#define CAFFE_UTIL_COMBINE_FILTER_HPP_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Combines count static weights with a per-sample filter as the
+// weight_operation op of a dynamic convolution sets. MUL and ADD write
+// weight * filter or weight + filter to combined (which may be filter) and
+// return it; COPY returns filter itself.
+template <typename Dtype>
+const Dtype* caffe_combine_filter(const ConvolutionParameter_WeightOp op,
+    const int count, const Dtype* weight, const Dtype* filter,
+    Dtype* combined);
+
+// Maps the gradient w.r.t. the combination to the static weights (added to
+// weight_diff, which COPY leaves alone) and to the filter (written to, or
+// added to when accumulate, filter_diff). Either may be NULL, and without
+// accumulate filter_diff may be combined_diff.
+template <typename Dtype>
+void caffe_combine_filter_backward(const ConvolutionParameter_WeightOp op,
+    const int count, const Dtype* weight, const Dtype* filter,
+    const Dtype* combined_diff, Dtype* weight_diff, Dtype* filter_diff,
+    const bool accumulate);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_COMBINE_FILTER_HPP_
@@ -0,0 +1,46 @@
+#ifndef CAFFE_UTIL_DEPTHWISE_CONV_HPP_
+#define CAFFE_UTIL_DEPTHWISE_CONV_HPP_
+
+namespace caffe {
+
+// Direct 2D depthwise convolution: every channel of a num x channels x
+// height x width input is convolved with its own kernel_h x kernel_w filter,
+// without an im2col buffer. weight holds channels filters, and weight_stride
+// is 0 to share them across the batch or the filter size to give every
+// sample its own (num x channels x kernel_h x kernel_w). The output spatial
+// size follows im2col_cpu. Planes are split across num_workers threads
+// (see caffe_parallel_for); each one is processed a row at a time so that
+// the rows it touches stay in cache, and the inner loops run branch-free
+// over the columns whose taps fall inside the image so they vectorize.
+
+// Writes the output.
+template <typename Dtype>
+void depthwise_conv_cpu(const Dtype* data_im, const int num,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const Dtype* weight, const int weight_stride,
+    Dtype* data_out, const int num_workers);
+
+// Writes the gradient w.r.t. the input given the output gradient.
+template <typename Dtype>
+void depthwise_conv_backward_cpu(const Dtype* out_diff, const int num,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const Dtype* weight, const int weight_stride,
+    Dtype* im_diff, const int num_workers);
+
+// Accumulates the gradient w.r.t. the filters into weight_diff, summed over
+// the batch when weight_stride is 0.
+template <typename Dtype>
+void depthwise_conv_weight_cpu(const Dtype* data_im, const Dtype* out_diff,
+    const int num, const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, Dtype* weight_diff, const int weight_stride,
+    const int num_workers);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DEPTHWISE_CONV_HPP_
@@ -0,0 +1,63 @@
+#ifndef CAFFE_UTIL_DYNAMIC_GEMM_HPP_
+#define CAFFE_UTIL_DYNAMIC_GEMM_HPP_
+
+#include <algorithm>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/mkl_alternate.hpp"
+
+namespace caffe {
+
+// Gemms whose A operand is the combination of a static weight W and a
+// per-sample filter F under a dynamic convolution's weight_operation
+// (W * F, W + F or F), computed while the operand is consumed instead of
+// being written out in full first.
+
+// The number of scratch elements the CPU routines need when the rows of the
+// stored operands have at most row_len elements: at least one row, and
+// otherwise enough rows to fill about 64KB of cache.
+inline int caffe_gemm_combined_tile_count(const int row_len) {
+  return std::max(row_len, 16384);
+}
+
+// C = op(W, F) * B, where W and F are stored as M x K (CblasNoTrans) or
+// K x M (CblasTrans) matrices, B is K x N and C is M x N. C is overwritten.
+// The CPU version combines tile_count elements of W and F at a time into
+// tile and multiplies them while they are still in cache.
+template <typename Dtype>
+void caffe_cpu_gemm_combined(const CBLAS_TRANSPOSE TransA, const int M,
+    const int N, const int K, const ConvolutionParameter_WeightOp op,
+    const Dtype* W, const Dtype* F, const Dtype* B, Dtype* C, Dtype* tile,
+    const int tile_count);
+
+// G = A * B^T for A M x K and B N x K, consumed directly as the gradient of
+// the combined M x N filter and mapped to weight_diff (added to) and
+// filter_diff (written, or added to when accumulate_filter_diff) as
+// caffe_combine_filter_backward does. Either output may be NULL.
+template <typename Dtype>
+void caffe_cpu_gemm_combined_diff(const int M, const int N, const int K,
+    const ConvolutionParameter_WeightOp op, const Dtype* A, const Dtype* B,
+    const Dtype* W, const Dtype* F, Dtype* weight_diff, Dtype* filter_diff,
+    const bool accumulate_filter_diff, Dtype* tile, const int tile_count);
+
+#ifndef CPU_ONLY
+
+// The GPU versions combine W and F while loading shared-memory tiles, so
+// the combined filter is never stored; COPY runs as a plain cuBLAS gemm.
+template <typename Dtype>
+void caffe_gpu_gemm_combined(const CBLAS_TRANSPOSE TransA, const int M,
+    const int N, const int K, const ConvolutionParameter_WeightOp op,
+    const Dtype* W, const Dtype* F, const Dtype* B, Dtype* C);
+
+template <typename Dtype>
+void caffe_gpu_gemm_combined_diff(const int M, const int N, const int K,
+    const ConvolutionParameter_WeightOp op, const Dtype* A, const Dtype* B,
+    const Dtype* W, const Dtype* F, Dtype* weight_diff, Dtype* filter_diff,
+    const bool accumulate_filter_diff);
+
+#endif  // !CPU_ONLY
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DYNAMIC_GEMM_HPP_
@@ -0,0 +1,27 @@
+#ifndef CAFFE_UTIL_FOLD_BATCH_NORM_HPP_
+#define CAFFE_UTIL_FOLD_BATCH_NORM_HPP_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameters with the BatchNorm, BN and Scale layers that directly
+// follow a Convolution or InnerProduct layer removed, for inference: with the
+// moving statistics they are a per-channel affine map, which
+// FoldBatchNormWeights folds into that layer's weights and bias. A dynamic
+// convolution takes the scale in its static weights (MUL), in the
+// InnerProduct layer generating its filters (COPY), or in both (ADD); those
+// whose filters are not generated that way keep their layers.
+void FoldBatchNormLayers(const NetParameter& param,
+    NetParameter* param_folded);
+
+// Copy the trained weights of the net param describes (before folding) as
+// they are for the net FoldBatchNormLayers(param) describes. Layers the
+// weights hold no normalization layers for are taken as already folded.
+template <typename Dtype>
+void FoldBatchNormWeights(const NetParameter& param,
+    const NetParameter& weights, NetParameter* weights_folded);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FOLD_BATCH_NORM_HPP_
@@ -0,0 +1,86 @@
+#ifndef CAFFE_UTIL_IMAGE_CACHE_HPP_
+#define CAFFE_UTIL_IMAGE_CACHE_HPP_
+
+#include <stdint.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// An image cache holds num already resized height x width x channels uint8
+// images (interleaved like a cv::Mat) with a label and num_attributes float
+// attributes each. Every image starts on a 64-byte boundary of a page-aligned
+// data section, so it can be read in place from a memory-mapped file. The
+// file is a header, the data section and the index of labels and
+// attributes.
+struct ImageCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num;
+  uint32_t channels;
+  uint32_t height;
+  uint32_t width;
+  uint32_t num_attributes;
+  uint64_t item_stride;
+  uint64_t data_offset;
+  uint64_t index_offset;
+};
+
+// Writes an image cache one image at a time.
+class ImageCacheWriter {
+ public:
+  ImageCacheWriter(const string& filename, int channels, int height,
+      int width, int num_attributes);
+  ~ImageCacheWriter();
+
+  // Appends an image of channels x height x width bytes (interleaved).
+  void Add(const uint8_t* image, float label, const float* attributes);
+  // Writes the index and the header; called by the destructor if need be.
+  void Close();
+
+ private:
+  FILE* file_;
+  ImageCacheHeader header_;
+  vector<float> index_;
+
+  DISABLE_COPY_AND_ASSIGN(ImageCacheWriter);
+};
+
+// Memory-maps an image cache for reading; the accessors only compute
+// addresses into the mapping.
+class ImageCache {
+ public:
+  explicit ImageCache(const string& filename);
+  ~ImageCache();
+
+  inline int num() const { return header_->num; }
+  inline int channels() const { return header_->channels; }
+  inline int height() const { return header_->height; }
+  inline int width() const { return header_->width; }
+  inline int num_attributes() const { return header_->num_attributes; }
+  inline const uint8_t* image(int i) const {
+    return data_ + header_->data_offset + i * header_->item_stride;
+  }
+  inline float label(int i) const {
+    return index_[i * (header_->num_attributes + 1)];
+  }
+  inline const float* attributes(int i) const {
+    return index_ + i * (header_->num_attributes + 1) + 1;
+  }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  const ImageCacheHeader* header_;
+  const float* index_;
+
+  DISABLE_COPY_AND_ASSIGN(ImageCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_IMAGE_CACHE_HPP_
@@ -3,7 +3,12 @@
 #ifndef CAFFE_UTIL_INTERP_H_
 #define CAFFE_UTIL_INTERP_H_
 
+#ifndef CPU_ONLY
 #include <cublas_v2.h>
+#endif
+#include <vector>
+
+#include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 
 namespace caffe {
@@ -33,6 +38,42 @@ void caffe_gpu_interp2_backward(const int channels,
 	  Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
     const Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2);
 
+// The source taps of bi-linear interpolation along one axis, resizing size1
+// samples to index.size(): output i is (1 - lambda[i]) times input index[i]
+// plus lambda[i] times input index[i] + step[i] (step is 0 at the border).
+template <typename Dtype>
+struct InterpTaps {
+  int size1;
+  vector<int> index;
+  vector<int> step;
+  vector<Dtype> lambda;
+};
+
+template <typename Dtype>
+void caffe_interp_taps(const int size1, const int size2,
+    InterpTaps<Dtype>* taps);
+
+// caffe_cpu_interp2 and its backward for planar data with the taps of both
+// axes computed beforehand, e.g. once per Reshape. Each channel is done as
+// a whole: rows interpolated horizontally are blended vertically, and the
+// backward pass accumulates whole rows rather than scattering per pixel.
+// The channels are split among Caffe::cpu_threads() threads.
+template <typename Dtype>
+void caffe_cpu_interp2(const int channels,
+    const Dtype *data1, const int x1, const int y1, const int Height1,
+    const int Width1,
+    Dtype *data2, const int x2, const int y2, const int Height2,
+    const int Width2,
+    const InterpTaps<Dtype>& taps_h, const InterpTaps<Dtype>& taps_w);
+
+template <typename Dtype>
+void caffe_cpu_interp2_backward(const int channels,
+    Dtype *data1, const int x1, const int y1, const int Height1,
+    const int Width1,
+    const Dtype *data2, const int x2, const int y2, const int Height2,
+    const int Width2,
+    const InterpTaps<Dtype>& taps_h, const InterpTaps<Dtype>& taps_w);
+
 // Create Gaussian pyramid of an image. Assume output space is pre-allocated.
 // IN : [channels height width]
 template <typename Dtype, bool packed>
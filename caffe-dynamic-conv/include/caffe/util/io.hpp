@@ -141,6 +141,14 @@ cv::Mat ReadImageToCVMat(const string& filename,
 
 cv::Mat ReadImageToCVMat(const string& filename);
 
+// Like ReadImageToCVMat, but JPEGs are decoded by libjpeg with its scaled
+// IDCT straight to the smallest multiple of 1/8 of their size that is not
+// smaller than height x width, and only then resized. Other formats, and
+// JPEGs libjpeg cannot convert, go through ReadImageToCVMat. Requires
+// USE_LIBJPEG.
+cv::Mat ReadImageToCVMatScaled(const string& filename,
+    const int height, const int width, const bool is_color);
+
 cv::Mat DecodeDatumToCVMatNative(const Datum& datum);
 cv::Mat DecodeDatumToCVMat(const Datum& datum, bool is_color);
 
@@ -20,6 +20,16 @@ void caffe_cpu_gemm(const CBLAS_TRANSPOSE TransA,
     const Dtype alpha, const Dtype* A, const Dtype* B, const Dtype beta,
     Dtype* C);
 
+// Runs batch_count gemms whose i-th operands start at A + i * stride_A,
+// B + i * stride_B and C + i * stride_C. A zero stride shares that operand
+// across the batch.
+template <typename Dtype>
+void caffe_cpu_gemm_strided_batched(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const Dtype alpha, const Dtype* A, const int stride_A, const Dtype* B,
+    const int stride_B, const Dtype beta, Dtype* C, const int stride_C,
+    const int batch_count);
+
 template <typename Dtype>
 void caffe_cpu_gemv(const CBLAS_TRANSPOSE TransA, const int M, const int N,
     const Dtype alpha, const Dtype* A, const Dtype* x, const Dtype beta,
@@ -156,6 +166,13 @@ void caffe_gpu_gemm(const CBLAS_TRANSPOSE TransA,
     const Dtype alpha, const Dtype* A, const Dtype* B, const Dtype beta,
     Dtype* C);
 
+template <typename Dtype>
+void caffe_gpu_gemm_strided_batched(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const Dtype alpha, const Dtype* A, const int stride_A, const Dtype* B,
+    const int stride_B, const Dtype beta, Dtype* C, const int stride_C,
+    const int batch_count);
+
 template <typename Dtype>
 void caffe_gpu_gemv(const CBLAS_TRANSPOSE TransA, const int M, const int N,
     const Dtype alpha, const Dtype* A, const Dtype* x, const Dtype beta,
@@ -0,0 +1,49 @@
+#ifndef CAFFE_UTIL_PARALLEL_FOR_HPP_
+#define CAFFE_UTIL_PARALLEL_FOR_HPP_
+
+#include <boost/function.hpp>
+
+namespace caffe {
+
+/**
+ * @brief Calls func(i, worker) for every i in [0, n), splitting the range
+ *        into contiguous chunks that run concurrently.
+ *
+ * The first chunk runs on the calling thread and the others on a pool of
+ * boost threads that persists across calls (a call made on a pool thread
+ * runs all of its chunks on that thread), so worker lies in
+ * [0, caffe_parallel_workers(n, num_workers)) and can be used to index
+ * per-worker scratch memory. func must not go through Blob data accessors or
+ * Caffe::Get() (SyncedMemory is not thread safe and Caffe is thread local):
+ * resolve every pointer before the call. The only exception is cpu_data() of
+ * blobs that never leave the host, such as the kernel, stride and pad shapes
+ * read by the im2col wrappers. Several workers may call BLAS at once, which
+ * needs a thread-safe BLAS (see BlasIsThreadSafe), as Caffe::cpu_threads()
+ * ensures by default.
+ */
+void caffe_parallel_for(const int n, const int num_workers,
+    const boost::function<void(int, int)>& func);
+
+// The number of workers caffe_parallel_for uses to process n items.
+int caffe_parallel_workers(const int n, const int num_workers);
+
+/**
+ * @brief Calls func(begin, end, worker) on contiguous ranges that split
+ *        [0, n) among at most num_workers workers, giving none of them fewer
+ *        than grain items.
+ *
+ * For many small items, such as the (sample, channel) planes of a
+ * normalization layer: there is one call per worker rather than per item,
+ * and work too small to pay for a thread stays on the calling thread. The
+ * same rules as for caffe_parallel_for apply to func.
+ */
+void caffe_parallel_ranges(const int n, const int grain, const int num_workers,
+    const boost::function<void(int, int, int)>& func);
+
+// The grain of caffe_parallel_ranges for items of item_size values each of
+// elementwise work.
+int caffe_parallel_grain(const int item_size);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PARALLEL_FOR_HPP_
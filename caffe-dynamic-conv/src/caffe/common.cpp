@@ -1,10 +1,12 @@
 #include <boost/thread.hpp>
 #include <glog/logging.h>
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <ctime>
 
 #include "caffe/common.hpp"
+#include "caffe/util/mkl_alternate.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
@@ -19,6 +21,37 @@ Caffe& Caffe::Get() {
   return *(thread_instance_.get());
 }
 
+bool BlasIsThreadSafe() {
+#if defined(OPENBLAS_VERSION)
+  if (openblas_get_parallel() == 0) {
+    return false;
+  }
+  // The library that is loaded, not the headers it was built against.
+  int major = 0, minor = 0, patch = 0;
+  sscanf(openblas_get_config(), "OpenBLAS %d.%d.%d", &major, &minor, &patch);
+  return major > 0 || minor > 3 || (minor == 3 && patch >= 7);
+#else
+  return true;
+#endif
+}
+
+// Every worker of a CPU layer may run gemms with as many threads as BLAS
+// uses, so the default leaves one worker per BLAS thread group rather than
+// oversubscribing the cores.
+static int default_cpu_threads() {
+  if (!BlasIsThreadSafe()) {
+    return 1;
+  }
+  int blas_threads = 1;
+#if defined(USE_MKL)
+  blas_threads = mkl_get_max_threads();
+#elif defined(OPENBLAS_VERSION)
+  blas_threads = openblas_get_num_threads();
+#endif
+  return std::max(1, static_cast<int>(boost::thread::hardware_concurrency())
+      / std::max(1, blas_threads));
+}
+
 // random seeding
 int64_t cluster_seedgen(void) {
   int64_t s, seed, pid;
@@ -47,13 +80,17 @@ void GlobalInit(int* pargc, char*** pargv) {
   ::google::InitGoogleLogging(*(pargv)[0]);
   // Provide a backtrace on segfault.
   ::google::InstallFailureSignalHandler();
+  LOG_IF(WARNING, !BlasIsThreadSafe()) << "BLAS is not thread safe, so CPU "
+      "layers run on one thread; use MKL, ATLAS or a threaded OpenBLAS 0.3.7 "
+      "or later to split them.";
 }
 
 #ifdef CPU_ONLY  // CPU-only Caffe.
 
 Caffe::Caffe()
     : random_generator_(), mode_(Caffe::CPU),
-      solver_count_(1), solver_rank_(0), multiprocess_(false) { }
+      solver_count_(1), solver_rank_(0), multiprocess_(false),
+      cpu_threads_(default_cpu_threads()) { }
 
 Caffe::~Caffe() { }
 
@@ -107,7 +144,8 @@ void* Caffe::RNG::generator() {
 Caffe::Caffe()
     : cublas_handle_(NULL), curand_generator_(NULL), random_generator_(),
     mode_(Caffe::CPU),
-    solver_count_(1), solver_rank_(0), multiprocess_(false) {
+    solver_count_(1), solver_rank_(0), multiprocess_(false),
+    cpu_threads_(default_cpu_threads()) {
   // Try to create a cublas handler, and report an error if failed (but we will
   // keep the program running as one might just want to run CPU code).
   if (cublasCreate(&cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
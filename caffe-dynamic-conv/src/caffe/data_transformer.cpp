@@ -2,7 +2,9 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #endif  // USE_OPENCV
+#include <boost/random.hpp>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -10,15 +12,14 @@
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
-#include <time.h>
-#include <stdlib.h>
 
 namespace caffe {
 
 template<typename Dtype>
 DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
     Phase phase)
-    : param_(param), phase_(phase) {
+    : param_(param), phase_(phase), has_mean_image_(false),
+      cropped_mean_h_off_(0), cropped_mean_w_off_(0) {
   // check if we want to use mean_file
   if (param_.has_mean_file()) {
     CHECK_EQ(param_.mean_value_size(), 0) <<
@@ -30,6 +31,26 @@ DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
     BlobProto blob_proto;
     ReadProtoFromBinaryFileOrDie(mean_file.c_str(), &blob_proto);
     data_mean_.FromProto(blob_proto);
+    // A mean image that is constant per channel (up to a thousandth of a
+    // pixel level) is subtracted as mean values. data_mean_ is kept either
+    // way, so inputs are still checked against the shape of the file.
+    const int channels = data_mean_.channels();
+    const int dim = data_mean_.count() / channels;
+    const Dtype* mean = data_mean_.cpu_data();
+    for (int c = 0; c < channels; ++c) {
+      const Dtype* channel_mean = mean + c * dim;
+      const Dtype min = *std::min_element(channel_mean, channel_mean + dim);
+      const Dtype max = *std::max_element(channel_mean, channel_mean + dim);
+      if (max - min > 1e-3) {
+        has_mean_image_ = true;
+      }
+      mean_values_.push_back((min + max) / 2);
+    }
+    if (has_mean_image_) {
+      mean_values_.clear();
+    } else if (Caffe::root_solver()) {
+      LOG(INFO) << "Subtracting the constant mean file as mean values";
+    }
   }
   // check if we want to use mean_value
   if (param_.mean_value_size() > 0) {
@@ -39,6 +60,96 @@ DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
       mean_values_.push_back(param_.mean_value(c));
     }
   }
+  if (param_.random_crop() && phase_ == TRAIN) {
+    CHECK_GT(param_.crop_size(), 0) << "random_crop resizes to crop_size";
+    CHECK_EQ(param_.crop_area_size(), 2) << "crop_area is (min, max)";
+    CHECK_EQ(param_.aspect_ratio_size(), 2) << "aspect_ratio is (min, max)";
+    for (int i = 0; i < 2; ++i) {
+      crop_area_.push_back(param_.crop_area(i));
+      aspect_ratio_.push_back(param_.aspect_ratio(i));
+    }
+    CHECK_GT(crop_area_[1], crop_area_[0]);
+    CHECK_GT(aspect_ratio_[1], aspect_ratio_[0]);
+  }
+}
+
+// Fills the two source positions of each of the dst_size output positions
+// and the weight of the second, sampling the pixel centers as cv::resize
+// does with INTER_LINEAR.
+template <typename Dtype>
+static void bilinear_table(const int src_size, const int dst_size,
+    int* positions, Dtype* weights) {
+  const float ratio = static_cast<float>(src_size) / dst_size;
+  for (int i = 0; i < dst_size; ++i) {
+    float x = (i + 0.5f) * ratio - 0.5f;
+    x = std::max(x, 0.f);
+    const int x0 = std::min(static_cast<int>(x), src_size - 1);
+    positions[2 * i] = x0;
+    positions[2 * i + 1] = std::min(x0 + 1, src_size - 1);
+    weights[i] = x - x0;
+  }
+}
+
+template <typename Dtype>
+void DataTransformer<Dtype>::SampleCropArea(const int img_height,
+    const int img_width, int* crop_h, int* crop_w) {
+  const float area =
+      Randfloat(crop_area_[0], crop_area_[1]) * img_height * img_width;
+  const float ratio = Randfloat(aspect_ratio_[0], aspect_ratio_[1]);
+  *crop_h = std::max(1, std::min(img_height,
+      static_cast<int>(sqrt(area * ratio))));
+  *crop_w = std::max(1, std::min(img_width,
+      static_cast<int>(sqrt(area / ratio))));
+}
+
+template <typename Dtype>
+template <typename SrcType>
+void DataTransformer<Dtype>::CropResize(const SrcType* src,
+    const int channels, const int channel_stride, const int row_stride,
+    const int pixel_stride, const int img_height, const int img_width,
+    const int h_off, const int w_off, const int crop_h, const int crop_w,
+    const bool mirror, const int height, const int width,
+    Dtype* transformed_data) {
+  resize_rows_.resize(2 * height);
+  resize_cols_.resize(2 * width);
+  resize_row_weights_.resize(height);
+  resize_col_weights_.resize(width);
+  bilinear_table(crop_h, height, &resize_rows_[0], &resize_row_weights_[0]);
+  bilinear_table(crop_w, width, &resize_cols_[0], &resize_col_weights_[0]);
+  const Dtype scale = param_.scale();
+  const Dtype* mean = has_mean_image_ ? data_mean_.cpu_data() : NULL;
+  for (int c = 0; c < channels; ++c) {
+    const Dtype mean_value = mean_values_.empty() ? 0 : mean_values_[c];
+    for (int h = 0; h < height; ++h) {
+      const int y0 = h_off + resize_rows_[2 * h];
+      const int y1 = h_off + resize_rows_[2 * h + 1];
+      const Dtype wy = resize_row_weights_[h];
+      const SrcType* row0 = src + c * channel_stride + y0 * row_stride;
+      const SrcType* row1 = src + c * channel_stride + y1 * row_stride;
+      const Dtype* mean_row0 = mean ?
+          mean + (c * img_height + y0) * img_width : NULL;
+      const Dtype* mean_row1 = mean ?
+          mean + (c * img_height + y1) * img_width : NULL;
+      Dtype* dst = transformed_data + (c * height + h) * width;
+      for (int w = 0; w < width; ++w) {
+        const int x0 = w_off + resize_cols_[2 * w];
+        const int x1 = w_off + resize_cols_[2 * w + 1];
+        const Dtype wx = resize_col_weights_[w];
+        Dtype value =
+            (1 - wy) * ((1 - wx) * static_cast<Dtype>(row0[x0 * pixel_stride])
+                + wx * static_cast<Dtype>(row0[x1 * pixel_stride]))
+            + wy * ((1 - wx) * static_cast<Dtype>(row1[x0 * pixel_stride])
+                + wx * static_cast<Dtype>(row1[x1 * pixel_stride]));
+        if (mean) {
+          value -= (1 - wy) * ((1 - wx) * mean_row0[x0] + wx * mean_row0[x1])
+              + wy * ((1 - wx) * mean_row1[x0] + wx * mean_row1[x1]);
+        } else {
+          value -= mean_value;
+        }
+        dst[mirror ? width - 1 - w : w] = value * scale;
+      }
+    }
+  }
 }
 
 template<typename Dtype>
@@ -52,7 +163,7 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
   const int crop_size = param_.crop_size();
   const Dtype scale = param_.scale();
   const bool do_mirror = param_.mirror() && Rand(2);
-  const bool has_mean_file = param_.has_mean_file();
+  const bool has_mean_file = has_mean_image_;
   const bool has_uint8 = data.size() > 0;
   const bool has_mean_values = mean_values_.size() > 0;
 
@@ -61,10 +172,12 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
   CHECK_GE(datum_width, crop_size);
 
   Dtype* mean = NULL;
-  if (has_mean_file) {
+  if (param_.has_mean_file()) {
     CHECK_EQ(datum_channels, data_mean_.channels());
     CHECK_EQ(datum_height, data_mean_.height());
     CHECK_EQ(datum_width, data_mean_.width());
+  }
+  if (has_mean_file) {
     mean = data_mean_.mutable_cpu_data();
   }
   if (has_mean_values) {
@@ -98,84 +211,25 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
 
 //// linluojun
   Dtype datum_element;
-  int tmp_index, data_index, top_index;
+  int data_index, top_index;
 
   if (param_.random_crop() && phase_ == TRAIN) {
-    if (param_.crop_area_size() > 0) {
-      for (int c = 0; c < param_.crop_area_size(); ++c) {
-        crop_area_.push_back(param_.crop_area(c));
-        aspect_ratio_.push_back(param_.aspect_ratio(c));
-      }
-    }
-    CHECK_GT(crop_area_[1], crop_area_[0]);
-    CHECK_GT(aspect_ratio_[1], aspect_ratio_[0]);
-    float area = Randfloat(crop_area_[0], crop_area_[1]) * datum_height * datum_width;
-    float ratio = Randfloat(aspect_ratio_[0], aspect_ratio_[1]);
     int crop_h, crop_w;
-    crop_h = sqrt(area * ratio);
-    crop_w = sqrt(area / ratio);
-    if (phase_ == TRAIN) {
-      h_off = Rand(datum_height - crop_h + 1);
-      w_off = Rand(datum_width - crop_w + 1);
-    } 
-    // transform data
-    Dtype* tmp = new Dtype(datum_channels * crop_h * crop_w);
-    for (int c = 0; c < datum_channels; ++c) {
-      for (int h = 0; h < crop_h; ++h) {
-        for (int w = 0; w < crop_w; ++w) {
-          data_index = (c * datum_height + h_off + h) * datum_width + w_off + w;
-          if (do_mirror) {
-            tmp_index = (c * crop_h + h) * crop_w + (crop_w - 1 - w);
-          } else {
-            tmp_index = (c * crop_h + h) * crop_w + w;
-          }
-          if (has_uint8) {
-            datum_element = static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-          } else {
-            datum_element = datum.float_data(data_index);
-          }
-          if (has_mean_file) {
-            tmp[tmp_index] = (datum_element - mean[data_index]) * scale;
-          } else {
-            if (has_mean_values) {
-              tmp[tmp_index] = (datum_element - mean_values_[c]) * scale;
-            } else {
-              tmp[tmp_index] = datum_element * scale;
-            }
-          }
-        }
-      }
-    } 
-    // billinear interpolation
-    const float rheight = static_cast<float>(crop_h - 1) / (height - 1);
-    const float rwidth = static_cast<float>(crop_w - 1) / (width - 1);
-    for (int h2 = 0; h2 < height; ++h2) {
-      const float h1r = rheight * h2;
-      const int h1 = h1r;
-      const int h1p = (h1 < crop_h - 1) ? 1 : 0; // chao guo bian jie??
-      const Dtype h1lambda = h1r - h1;
-      const Dtype h0lambda = Dtype(1.) - h1lambda;
-      for (int w2 = 0; w2 < width; ++w2) {
-        const float w1r = rwidth * w2;
-        const int w1 = w1r;
-        const int w1p = (w1 < crop_w - 1) ? 1 : 0;
-        const Dtype w1lambda = w1r - w1;
-        const Dtype w0lambda = Dtype(1.) - w1lambda;
-        tmp_index = h1 * crop_h + w1;
-        top_index = h2 * height + w2;
-        Dtype* pos1 = &tmp[tmp_index];
-        Dtype* pos2 = &transformed_data[top_index];
-        for (int c = 0; c < datum_channels; ++c) {
-          pos2[0] =
-            h0lambda * (w0lambda * pos1[0]            + w1lambda * pos1[w1p]) + 
-            h1lambda * (w0lambda * pos1[h1p * crop_w] + w1lambda * pos1[h1p * crop_w + w1p]);
-          pos1 += crop_w * crop_h;
-          pos2 += height * width;
-        }
-      }
+    SampleCropArea(datum_height, datum_width, &crop_h, &crop_w);
+    h_off = Rand(datum_height - crop_h + 1);
+    w_off = Rand(datum_width - crop_w + 1);
+    if (has_uint8) {
+      CropResize(reinterpret_cast<const uint8_t*>(data.data()),
+          datum_channels, datum_height * datum_width, datum_width, 1,
+          datum_height, datum_width, h_off, w_off, crop_h, crop_w, do_mirror,
+          height, width, transformed_data);
+    } else {
+      CropResize(datum.float_data().data(), datum_channels,
+          datum_height * datum_width, datum_width, 1, datum_height,
+          datum_width, h_off, w_off, crop_h, crop_w, do_mirror, height,
+          width, transformed_data);
     }
-  delete tmp;
-  } else { 
+  } else {
     for (int c = 0; c < datum_channels; ++c) {
       for (int h = 0; h < height; ++h) {
         for (int w = 0; w < width; ++w) {
@@ -304,30 +358,63 @@ void DataTransformer<Dtype>::Transform(const vector<cv::Mat> & mat_vector,
   }
 }
 
+// Writes a row of width interleaved 3-channel pixels to the rows dst[c] of
+// the three output channels as (pixel - mean) * scale, mirrored if kMirror.
+// The mean is the row mean_row[c] of the mean image if kMeanImage, and the
+// constant mean_value[c] otherwise. Each case is one straight loop that reads
+// every pixel once, so the compiler can vectorize the deinterleave.
+template <typename Dtype, bool kMirror, bool kMeanImage>
+static void transform_row3(const uchar* src, const int width,
+    const Dtype* const* mean_row, const Dtype* mean_value, const Dtype scale,
+    Dtype* const* dst) {
+  Dtype* dst0 = dst[0];
+  Dtype* dst1 = dst[1];
+  Dtype* dst2 = dst[2];
+  const Dtype mean0 = mean_value[0];
+  const Dtype mean1 = mean_value[1];
+  const Dtype mean2 = mean_value[2];
+  for (int w = 0; w < width; ++w) {
+    const int x = kMirror ? width - 1 - w : w;
+    const uchar* pixel = src + 3 * w;
+    if (kMeanImage) {
+      dst0[x] = (static_cast<Dtype>(pixel[0]) - mean_row[0][w]) * scale;
+      dst1[x] = (static_cast<Dtype>(pixel[1]) - mean_row[1][w]) * scale;
+      dst2[x] = (static_cast<Dtype>(pixel[2]) - mean_row[2][w]) * scale;
+    } else {
+      dst0[x] = (static_cast<Dtype>(pixel[0]) - mean0) * scale;
+      dst1[x] = (static_cast<Dtype>(pixel[1]) - mean1) * scale;
+      dst2[x] = (static_cast<Dtype>(pixel[2]) - mean2) * scale;
+    }
+  }
+}
+
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
                                        Blob<Dtype>* transformed_blob) {
+  CHECK_GE(transformed_blob->num(), 1);
+  Transform(cv_img, transformed_blob->channels(), transformed_blob->height(),
+      transformed_blob->width(), transformed_blob->mutable_cpu_data());
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
+    const int channels, const int height, const int width,
+    Dtype* transformed_data) {
   const int crop_size = param_.crop_size();
   const int img_channels = cv_img.channels();
   const int img_height = cv_img.rows;
   const int img_width = cv_img.cols;
 
   // Check dimensions.
-  const int channels = transformed_blob->channels();
-  const int height = transformed_blob->height();
-  const int width = transformed_blob->width();
-  const int num = transformed_blob->num();
-
   CHECK_EQ(channels, img_channels);
   CHECK_LE(height, img_height);
   CHECK_LE(width, img_width);
-  CHECK_GE(num, 1);
 
   CHECK(cv_img.depth() == CV_8U) << "Image data type must be unsigned byte";
 
   const Dtype scale = param_.scale();
   const bool do_mirror = param_.mirror() && Rand(2);
-  const bool has_mean_file = param_.has_mean_file();
+  const bool has_mean_file = has_mean_image_;
   const bool has_mean_values = mean_values_.size() > 0;
 
   CHECK_GT(img_channels, 0);
@@ -335,10 +422,12 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
   CHECK_GE(img_width, crop_size);
 
   Dtype* mean = NULL;
-  if (has_mean_file) {
+  if (param_.has_mean_file()) {
     CHECK_EQ(img_channels, data_mean_.channels());
     CHECK_EQ(img_height, data_mean_.height());
     CHECK_EQ(img_width, data_mean_.width());
+  }
+  if (has_mean_file) {
     mean = data_mean_.mutable_cpu_data();
   }
   if (has_mean_values) {
@@ -374,34 +463,76 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
   }
 
   CHECK(cv_cropped_img.data);
-  Dtype* transformed_data = transformed_blob->mutable_cpu_data();
   int top_index;
 
 ////linluojun
   if (param_.random_crop() && phase_ == TRAIN) {
-    if (param_.crop_area_size() > 0) {
-      for (int c = 0; c < param_.crop_area_size(); ++c) {
-        crop_area_.push_back(param_.crop_area(c));
-        aspect_ratio_.push_back(param_.aspect_ratio(c));
-      }
-    }
-    CHECK_GT(crop_area_[1], crop_area_[0]);
-    CHECK_GT(aspect_ratio_[1], aspect_ratio_[0]);
-    float area = Randfloat(crop_area_[0], crop_area_[1]) * img_height * img_width;
-    float ratio = Randfloat(aspect_ratio_[0], aspect_ratio_[1]);
     int crop_h, crop_w;
-    crop_h = sqrt(area * ratio);
-    crop_h = crop_h > img_height ? img_height : crop_h;
-    crop_w = sqrt(area / ratio);
-    crop_w = crop_w > img_width ? img_width : crop_w;
-    // LOG(INFO) << area / img_height / img_width << " " << ratio << " " << crop_h << " " << crop_w << " " << img_height << " " << img_width;
+    SampleCropArea(img_height, img_width, &crop_h, &crop_w);
     h_off = Rand(img_height - crop_h + 1);
     w_off = Rand(img_width - crop_w + 1);
-    // LOG(INFO) << w_off << " " << h_off << " " << crop_h << " " << crop_w;
-    cv::Rect roi(w_off, h_off, crop_w, crop_h);
-    cv::Mat tmp = cv_img;
-    tmp = cv_img(roi);
-    cv::resize(tmp, cv_cropped_img, cv::Size(crop_size, crop_size));
+    CropResize(cv_img.ptr<uchar>(0), img_channels, 1,
+        static_cast<int>(cv_img.step), img_channels, img_height, img_width,
+        h_off, w_off, crop_h, crop_w, do_mirror, height, width,
+        transformed_data);
+    return;
+  }
+
+  // The mean image as seen from the crop: its origin and strides. When the
+  // crop is always at the same place (at TEST or without cropping), it is
+  // cropped once into the output layout.
+  const Dtype* mean_origin = NULL;
+  int mean_channel_stride = 0;
+  int mean_row_stride = 0;
+  if (has_mean_file) {
+    if (phase_ != TRAIN || !(crop_size || param_.random_crop())) {
+      mean_origin = CroppedMean(h_off, w_off, height, width);
+      mean_channel_stride = height * width;
+      mean_row_stride = width;
+    } else {
+      mean_origin = mean + h_off * img_width + w_off;
+      mean_channel_stride = img_height * img_width;
+      mean_row_stride = img_width;
+    }
+  }
+
+  if (img_channels == 3) {
+    // The common color case: one fused pass per row, without branches in
+    // the loops.
+    Dtype mean_value[3] = {0, 0, 0};
+    if (has_mean_values) {
+      for (int c = 0; c < 3; ++c) {
+        mean_value[c] = mean_values_[c];
+      }
+    }
+    for (int h = 0; h < height; ++h) {
+      const uchar* ptr = cv_cropped_img.ptr<uchar>(h);
+      Dtype* dst[3];
+      const Dtype* mean_row[3];
+      for (int c = 0; c < 3; ++c) {
+        dst[c] = transformed_data + (c * height + h) * width;
+        mean_row[c] = has_mean_file ?
+            mean_origin + c * mean_channel_stride + h * mean_row_stride : NULL;
+      }
+      if (has_mean_file) {
+        if (do_mirror) {
+          transform_row3<Dtype, true, true>(ptr, width, mean_row, mean_value,
+              scale, dst);
+        } else {
+          transform_row3<Dtype, false, true>(ptr, width, mean_row, mean_value,
+              scale, dst);
+        }
+      } else {
+        if (do_mirror) {
+          transform_row3<Dtype, true, false>(ptr, width, mean_row, mean_value,
+              scale, dst);
+        } else {
+          transform_row3<Dtype, false, false>(ptr, width, mean_row,
+              mean_value, scale, dst);
+        }
+      }
+    }
+    return;
   }
 
   for (int h = 0; h < height; ++h) {
@@ -417,9 +548,9 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
         // int top_index = (c * height + h) * width + w;
         Dtype pixel = static_cast<Dtype>(ptr[img_index++]);
         if (has_mean_file) {
-          int mean_index = (c * img_height + h_off + h) * img_width + w_off + w;
+          int mean_index = c * mean_channel_stride + h * mean_row_stride + w;
           transformed_data[top_index] =
-            (pixel - mean[mean_index]) * scale;
+            (pixel - mean_origin[mean_index]) * scale;
         } else {
           if (has_mean_values) {
             transformed_data[top_index] =
@@ -435,51 +566,34 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
 
 
 
-// linluojun
 template<typename Dtype>
-int DataTransformer<Dtype>::Find_center(float* array, int len) {
-  float count = 0;
-  for(int k=0; k<len; k++) {
-    count += array[k];
-  }
-  float seed = Randfloat(0.0, count);
-  if(seed <= array[0]) {
-    return 0;
-  }
-  for(int i=1; i<len; i++) {
-    array[i] += array[i-1];
-    if(seed <= array[i]) {
-    // if(seed <= *(array + i)) {
-      return i;
-    }
-  }
+void DataTransformer<Dtype>::Attention_Transform(const cv::Mat& cv_img,
+    Blob<Dtype>* transformed_blob, const AttentionSampler* attention) {
+  CHECK_GE(transformed_blob->num(), 1);
+  Attention_Transform(cv_img, transformed_blob->channels(),
+      transformed_blob->height(), transformed_blob->width(),
+      transformed_blob->mutable_cpu_data(), attention);
 }
 
 template<typename Dtype>
 void DataTransformer<Dtype>::Attention_Transform(const cv::Mat& cv_img,
-                                       Blob<Dtype>* transformed_blob,
-                                       float* attention_array) {
+    const int channels, const int height, const int width,
+    Dtype* transformed_data, const AttentionSampler* attention) {
   const int crop_size = param_.crop_size();
   const int img_channels = cv_img.channels();
   const int img_height = cv_img.rows;
   const int img_width = cv_img.cols;
 
   // Check dimensions.
-  const int channels = transformed_blob->channels();
-  const int height = transformed_blob->height();
-  const int width = transformed_blob->width();
-  const int num = transformed_blob->num();
-
   CHECK_EQ(channels, img_channels);
   CHECK_LE(height, img_height);
   CHECK_LE(width, img_width);
-  CHECK_GE(num, 1);
 
   CHECK(cv_img.depth() == CV_8U) << "Image data type must be unsigned byte";
 
   const Dtype scale = param_.scale();
   const bool do_mirror = param_.mirror() && Rand(2);
-  const bool has_mean_file = param_.has_mean_file();
+  const bool has_mean_file = has_mean_image_;
   const bool has_mean_values = mean_values_.size() > 0;
 
   CHECK_GT(img_channels, 0);
@@ -487,10 +601,12 @@ void DataTransformer<Dtype>::Attention_Transform(const cv::Mat& cv_img,
   CHECK_GE(img_width, crop_size);
 
   Dtype* mean = NULL;
-  if (has_mean_file) {
+  if (param_.has_mean_file()) {
     CHECK_EQ(img_channels, data_mean_.channels());
     CHECK_EQ(img_height, data_mean_.height());
     CHECK_EQ(img_width, data_mean_.width());
+  }
+  if (has_mean_file) {
     mean = data_mean_.mutable_cpu_data();
   }
   if (has_mean_values) {
@@ -517,51 +633,27 @@ void DataTransformer<Dtype>::Attention_Transform(const cv::Mat& cv_img,
 
 
   CHECK(cv_cropped_img.data);
-  Dtype* transformed_data = transformed_blob->mutable_cpu_data();
   int top_index;
 
 ////linluojun
-  float* attention_array_h = new float[img_height]();
-  int idx = 0;
-  for(int h = 0; h < img_height; ++h){
-    attention_array_h[h] = 0;
-    for(int w = 0; w < img_width; ++w, ++idx){
-      attention_array_h[h] += attention_array[idx];
-    }
-  }
-  int pos_h = Find_center(attention_array_h, img_height);
-  int pos_w = Find_center(attention_array + pos_h * img_width, img_width);
-  delete[] attention_array_h;
-
-
   if (param_.random_crop() && phase_ == TRAIN) {
-    if (param_.crop_area_size() > 0) {
-      for (int c = 0; c < param_.crop_area_size(); ++c) {
-        crop_area_.push_back(param_.crop_area(c));
-        aspect_ratio_.push_back(param_.aspect_ratio(c));
-      }
-    }
-    CHECK_GT(crop_area_[1], crop_area_[0]);
-    CHECK_GT(aspect_ratio_[1], aspect_ratio_[0]);
-    float area = Randfloat(crop_area_[0], crop_area_[1]) * img_height * img_width;
-    float ratio = Randfloat(aspect_ratio_[0], aspect_ratio_[1]);
     int crop_h, crop_w;
-    crop_h = sqrt(area * ratio);
-    crop_w = sqrt(area / ratio);
-    // LOG(INFO) << area / img_height / img_width << " " << ratio << " " << crop_h << " " << crop_w << " " << img_height << " " << img_width;
-    h_off = pos_h - crop_h / 2;
-    h_off = h_off > 0 ? h_off: 0;
-    w_off = pos_w - crop_w / 2;
-    w_off = w_off > 0 ? w_off: 0;
-    crop_h = (h_off + crop_h) > img_height ? (img_height - h_off) : crop_h;
-    crop_w = (w_off + crop_w) > img_width ? (img_width - w_off) : crop_w;
-
-
-    // LOG(INFO) << w_off << " " << h_off << " " << crop_h << " " << crop_w;
-    cv::Rect roi(w_off, h_off, crop_w, crop_h);
-    cv::Mat tmp = cv_img;
-    tmp = cv_img(roi);
-    cv::resize(tmp, cv_cropped_img, cv::Size(crop_size, crop_size));
+    SampleCropArea(img_height, img_width, &crop_h, &crop_w);
+    CHECK(attention) << "Attention-guided crops need an attention map.";
+    int pos_h, pos_w;
+    attention->Sample(Randfloat(0, 1), Randfloat(0, 1), &pos_h, &pos_w);
+    pos_h = (2 * pos_h + 1) * img_height / (2 * attention->height());
+    pos_w = (2 * pos_w + 1) * img_width / (2 * attention->width());
+    // Center the crop on the sampled point, clipped to the image.
+    h_off = std::max(pos_h - crop_h / 2, 0);
+    w_off = std::max(pos_w - crop_w / 2, 0);
+    crop_h = std::min(crop_h, img_height - h_off);
+    crop_w = std::min(crop_w, img_width - w_off);
+    CropResize(cv_img.ptr<uchar>(0), img_channels, 1,
+        static_cast<int>(cv_img.step), img_channels, img_height, img_width,
+        h_off, w_off, crop_h, crop_w, do_mirror, height, width,
+        transformed_data);
+    return;
   } else {  // phase = test
       h_off = (img_height - crop_size) / 2;
       w_off = (img_width - crop_size) / 2;
@@ -634,7 +726,7 @@ void DataTransformer<Dtype>::Transform(Blob<Dtype>* input_blob,
 
   const Dtype scale = param_.scale();
   const bool do_mirror = param_.mirror() && Rand(2);
-  const bool has_mean_file = param_.has_mean_file();
+  const bool has_mean_file = has_mean_image_;
   const bool has_mean_values = mean_values_.size() > 0;
 
   int h_off = 0;
@@ -656,10 +748,12 @@ void DataTransformer<Dtype>::Transform(Blob<Dtype>* input_blob,
   }
 
   Dtype* input_data = input_blob->mutable_cpu_data();
-  if (has_mean_file) {
+  if (param_.has_mean_file()) {
     CHECK_EQ(input_channels, data_mean_.channels());
     CHECK_EQ(input_height, data_mean_.height());
     CHECK_EQ(input_width, data_mean_.width());
+  }
+  if (has_mean_file) {
     for (int n = 0; n < input_num; ++n) {
       int offset = input_blob->offset(n);
       caffe_sub(data_mean_.count(), input_data + offset,
@@ -794,18 +888,64 @@ vector<int> DataTransformer<Dtype>::InferBlobShape(
 }
 #endif  // USE_OPENCV
 
+template <typename Dtype>
+const Dtype* DataTransformer<Dtype>::CroppedMean(const int h_off,
+    const int w_off, const int height, const int width) {
+  if (cropped_mean_.count() == 0 || h_off != cropped_mean_h_off_ ||
+      w_off != cropped_mean_w_off_ || height != cropped_mean_.height() ||
+      width != cropped_mean_.width()) {
+    const int channels = data_mean_.channels();
+    const int mean_height = data_mean_.height();
+    const int mean_width = data_mean_.width();
+    cropped_mean_.Reshape(1, channels, height, width);
+    const Dtype* mean = data_mean_.cpu_data();
+    Dtype* cropped_mean = cropped_mean_.mutable_cpu_data();
+    for (int c = 0; c < channels; ++c) {
+      for (int h = 0; h < height; ++h) {
+        const Dtype* row =
+            mean + (c * mean_height + h_off + h) * mean_width + w_off;
+        std::copy(row, row + width, cropped_mean + (c * height + h) * width);
+      }
+    }
+    cropped_mean_h_off_ = h_off;
+    cropped_mean_w_off_ = w_off;
+  }
+  return cropped_mean_.cpu_data();
+}
+
+template <typename Dtype>
+void DataTransformer<Dtype>::PrepareCroppedMean(const int height,
+    const int width) {
+  // Transform crops the mean at the center of the mean image (which has the
+  // size of the images) whenever the crop does not move.
+  const int mean_height = data_mean_.height();
+  const int mean_width = data_mean_.width();
+  if (has_mean_image_ && height <= mean_height && width <= mean_width) {
+    CroppedMean((mean_height - height) / 2, (mean_width - width) / 2, height,
+        width);
+  }
+}
+
 template <typename Dtype>
 void DataTransformer<Dtype>::InitRand() {
   const bool needs_rand = param_.mirror() ||
-      (phase_ == TRAIN && param_.crop_size());
+      (phase_ == TRAIN && (param_.crop_size() || param_.random_crop()));
   if (needs_rand) {
-    const unsigned int rng_seed = caffe_rng_rand();
-    rng_.reset(new Caffe::RNG(rng_seed));
+    InitRand(caffe_rng_rand());
   } else {
     rng_.reset();
   }
 }
 
+template <typename Dtype>
+void DataTransformer<Dtype>::InitRand(unsigned int seed) {
+  if (rng_) {
+    static_cast<caffe::rng_t*>(rng_->generator())->seed(seed);
+  } else {
+    rng_.reset(new Caffe::RNG(seed));
+  }
+}
+
 template <typename Dtype>
 int DataTransformer<Dtype>::Rand(int n) {
   CHECK(rng_);
@@ -814,12 +954,17 @@ int DataTransformer<Dtype>::Rand(int n) {
       static_cast<caffe::rng_t*>(rng_->generator());
   return ((*rng)() % n);
 }
+
 template <typename Dtype>
 float DataTransformer<Dtype>::Randfloat(float n, float m) {
+  CHECK(rng_);
   CHECK_GT(m, n);
-  float random = float(rand()) / RAND_MAX;
-  float result = random * (m - n) + n;
-  return result;
+  caffe::rng_t* rng =
+      static_cast<caffe::rng_t*>(rng_->generator());
+  boost::uniform_real<float> random_distribution(n, m);
+  boost::variate_generator<caffe::rng_t*, boost::uniform_real<float> >
+      variate_generator(rng, random_distribution);
+  return variate_generator();
 }
 
 INSTANTIATE_CLASS(DataTransformer);
@@ -30,17 +30,18 @@ void InternalThread::StartInternalThread() {
   int solver_count = Caffe::solver_count();
   int solver_rank = Caffe::solver_rank();
   bool multiprocess = Caffe::multiprocess();
+  int cpu_threads = Caffe::cpu_threads();
 
   try {
     thread_.reset(new boost::thread(&InternalThread::entry, this, device, mode,
-          rand_seed, solver_count, solver_rank, multiprocess));
+          rand_seed, solver_count, solver_rank, multiprocess, cpu_threads));
   } catch (std::exception& e) {
     LOG(FATAL) << "Thread exception: " << e.what();
   }
 }
 
 void InternalThread::entry(int device, Caffe::Brew mode, int rand_seed,
-    int solver_count, int solver_rank, bool multiprocess) {
+    int solver_count, int solver_rank, bool multiprocess, int cpu_threads) {
 #ifndef CPU_ONLY
   CUDA_CHECK(cudaSetDevice(device));
 #endif
@@ -49,6 +50,7 @@ void InternalThread::entry(int device, Caffe::Brew mode, int rand_seed,
   Caffe::set_solver_count(solver_count);
   Caffe::set_solver_rank(solver_rank);
   Caffe::set_multiprocess(multiprocess);
+  Caffe::set_cpu_threads(cpu_threads);
 
   InternalThreadEntry();
 }
@@ -1,8 +1,11 @@
 #include <algorithm>
+#include <cstring>
 #include <vector>
 
 #include "caffe/filler.hpp"
 #include "caffe/layers/base_conv_layer.hpp"
+#include "caffe/util/combine_filter.hpp"
+#include "caffe/util/dynamic_gemm.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
 
@@ -184,8 +187,15 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   int bottom_size = bottom.size();
   int top_size = top.size();
   int weight_count = this->new_weight_->count();
+  CHECK_LE(bottom_size, top_size + 2)
+      << "At most two bottoms may hold the per-sample filters.";
   if (bottom_size - top_size == 1){
     CHECK_EQ(bottom[bottom_size - 1]->count(1), weight_count) << "bottom_size inequal to weight_size";
+  } else if (bottom_size - top_size == 2) {
+    CHECK(factorized_filters()) << this->type()
+        << " does not take factorized (coefficient and basis) filters.";
+    CHECK_EQ(bottom[bottom_size - 1]->count(1), weight_count)
+        << "The basis bottom must hold one filter per row.";
   }
 }
 
@@ -204,6 +214,18 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   //   CHECK(bottom[0]->shape() == bottom[bottom_id]->shape())
   //       << "All inputs must have the same shape.";
   // }
+  if (bottom.size() - top.size() == 1) {
+    CHECK_EQ(bottom[bottom.size() - 1]->count(),
+        num_ * this->blobs_[0]->count())
+        << "The filter bottom must hold one filter per sample.";
+  } else if (bottom.size() - top.size() == 2) {
+    const Blob<Dtype>* coefficients = bottom[bottom.size() - 2];
+    CHECK_EQ(coefficients->shape(0), num_)
+        << "The coefficient bottom must hold one row per sample.";
+    CHECK_EQ(bottom[bottom.size() - 1]->count(),
+        coefficients->count(1) * this->blobs_[0]->count())
+        << "The basis bottom must hold one filter per coefficient.";
+  }
   // Shape the tops.
   bottom_shape_ = &bottom[0]->shape();
   compute_output_shape();
@@ -263,13 +285,17 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
-    const Dtype* weights, Dtype* output, bool skip_im2col) {
+    const Dtype* weights, Dtype* output, bool skip_im2col,
+    Dtype* col_buffer) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
+    if (!col_buffer) {
+      col_buffer = col_buffer_.mutable_cpu_data();
+    }
     if (!skip_im2col) {
-      conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+      conv_im2col_cpu(input, col_buffer);
     }
-    col_buff = col_buffer_.cpu_data();
+    col_buff = col_buffer;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
@@ -281,18 +307,21 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
-    const Dtype* bias) {
+    const Dtype* bias, const Dtype* bias_multiplier) {
+  if (!bias_multiplier) {
+    bias_multiplier = bias_multiplier_.cpu_data();
+  }
   caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-      out_spatial_dim_, 1, (Dtype)1., bias, bias_multiplier_.cpu_data(),
+      out_spatial_dim_, 1, (Dtype)1., bias, bias_multiplier,
       (Dtype)1., output);
 }
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
-    const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_.mutable_cpu_data();
-  if (is_1x1_) {
-    col_buff = input;
+    const Dtype* weights, Dtype* input, Dtype* col_buffer) {
+  Dtype* col_buff = input;
+  if (!is_1x1_) {
+    col_buff = col_buffer ? col_buffer : col_buffer_.mutable_cpu_data();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_,
@@ -307,11 +336,14 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
-    const Dtype* output, Dtype* weights) {
+    const Dtype* output, Dtype* weights, Dtype* col_buffer) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
-    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
-    col_buff = col_buffer_.cpu_data();
+    if (!col_buffer) {
+      col_buffer = col_buffer_.mutable_cpu_data();
+    }
+    conv_im2col_cpu(input, col_buffer);
+    col_buff = col_buffer;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
@@ -321,6 +353,25 @@ void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
   }
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_gemm2(const Dtype* input,
+    const Dtype* output, Dtype* weights, Dtype* col_buffer) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    if (!col_buffer) {
+      col_buffer = col_buffer_.mutable_cpu_data();
+    }
+    conv_im2col_cpu(input, col_buffer);
+    col_buff = col_buffer;
+  }
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
+        kernel_dim_, conv_out_spatial_dim_,
+        (Dtype)1., output + output_offset_ * g, col_buff + col_offset_ * g,
+        (Dtype)0., weights + weight_offset_ * g);
+  }
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
     const Dtype* input) {
@@ -328,6 +379,328 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
       input, bias_multiplier_.cpu_data(), 1., bias);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_gemm_batched(const Dtype* input,
+    const Dtype* weights, const int weight_stride, Dtype* output,
+    Dtype* col_buffer) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_batch_cpu(input, col_buffer);
+    col_buff = col_buffer;
+  }
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm_strided_batched<Dtype>(CblasNoTrans, CblasNoTrans,
+        conv_out_channels_ / group_, conv_out_spatial_dim_, kernel_dim_,
+        (Dtype)1., weights + weight_offset_ * g, weight_stride,
+        col_buff + col_offset_ * g, col_offset_ * group_,
+        (Dtype)0., output + output_offset_ * g, output_offset_ * group_, num_);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_bias_batched(Dtype* output,
+    const Dtype* bias) {
+  caffe_cpu_gemm_strided_batched<Dtype>(CblasNoTrans, CblasNoTrans,
+      num_output_, out_spatial_dim_, 1, (Dtype)1., bias, 0,
+      bias_multiplier_.cpu_data(), 0, (Dtype)1., output, top_dim_, num_);
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_gemm_batched(
+    const Dtype* output, const Dtype* weights, const int weight_stride,
+    Dtype* input, Dtype* col_buffer) {
+  Dtype* col_buff = is_1x1_ ? input : col_buffer;
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm_strided_batched<Dtype>(CblasTrans, CblasNoTrans,
+        kernel_dim_, conv_out_spatial_dim_, conv_out_channels_ / group_,
+        (Dtype)1., weights + weight_offset_ * g, weight_stride,
+        output + output_offset_ * g, output_offset_ * group_,
+        (Dtype)0., col_buff + col_offset_ * g, col_offset_ * group_, num_);
+  }
+  if (!is_1x1_) {
+    conv_col2im_batch_cpu(col_buff, input);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_gemm_batched(const Dtype* input,
+    const Dtype* output, Dtype* weights, Dtype* col_buffer) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_batch_cpu(input, col_buffer);
+    col_buff = col_buffer;
+  }
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm_strided_batched<Dtype>(CblasNoTrans, CblasTrans,
+        conv_out_channels_ / group_, kernel_dim_, conv_out_spatial_dim_,
+        (Dtype)1., output + output_offset_ * g, output_offset_ * group_,
+        col_buff + col_offset_ * g, col_offset_ * group_,
+        (Dtype)0., weights + weight_offset_ * g, weight_offset_ * group_, num_);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_gemm_fused(const Dtype* input,
+    const Dtype* weights, const Dtype* filter,
+    const ConvolutionParameter_WeightOp op, Dtype* output, Dtype* col_buffer,
+    Dtype* tile_buffer) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_cpu(input, col_buffer);
+    col_buff = col_buffer;
+  }
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm_combined<Dtype>(CblasNoTrans, conv_out_channels_ / group_,
+        conv_out_spatial_dim_, kernel_dim_, op, weights + weight_offset_ * g,
+        filter + weight_offset_ * g, col_buff + col_offset_ * g,
+        output + output_offset_ * g, tile_buffer, fused_tile_count());
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_gemm_fused(const Dtype* output,
+    const Dtype* weights, const Dtype* filter,
+    const ConvolutionParameter_WeightOp op, Dtype* input, Dtype* col_buffer,
+    Dtype* tile_buffer) {
+  Dtype* col_buff = is_1x1_ ? input : col_buffer;
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm_combined<Dtype>(CblasTrans, kernel_dim_,
+        conv_out_spatial_dim_, conv_out_channels_ / group_, op,
+        weights + weight_offset_ * g, filter + weight_offset_ * g,
+        output + output_offset_ * g, col_buff + col_offset_ * g,
+        tile_buffer, fused_tile_count());
+  }
+  if (!is_1x1_) {
+    conv_col2im_cpu(col_buff, input);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_gemm_fused(const Dtype* input,
+    const Dtype* output, const Dtype* weights, const Dtype* filter,
+    const ConvolutionParameter_WeightOp op, Dtype* weight_diff,
+    Dtype* filter_diff, const bool accumulate_filter_diff, Dtype* col_buffer,
+    Dtype* tile_buffer) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_cpu(input, col_buffer);
+    col_buff = col_buffer;
+  }
+  for (int g = 0; g < group_; ++g) {
+    const int offset = weight_offset_ * g;
+    caffe_cpu_gemm_combined_diff<Dtype>(conv_out_channels_ / group_,
+        kernel_dim_, conv_out_spatial_dim_, op, output + output_offset_ * g,
+        col_buff + col_offset_ * g, weights + offset, filter + offset,
+        weight_diff ? weight_diff + offset : NULL,
+        filter_diff ? filter_diff + offset : NULL, accumulate_filter_diff,
+        tile_buffer, fused_tile_count());
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_gemm_basis(const Dtype* input,
+    const Dtype* basis, const int num_basis, Dtype* output,
+    Dtype* col_buffer) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_batch_cpu(input, col_buffer);
+    col_buff = col_buffer;
+  }
+  // A zero weight stride applies the same basis filter to every sample.
+  const int weight_count = weight_offset_ * group_;
+  const int output_count = output_offset_ * group_ * num_;
+  for (int k = 0; k < num_basis; ++k) {
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_gemm_strided_batched<Dtype>(CblasNoTrans, CblasNoTrans,
+          conv_out_channels_ / group_, conv_out_spatial_dim_, kernel_dim_,
+          (Dtype)1., basis + weight_count * k + weight_offset_ * g, 0,
+          col_buff + col_offset_ * g, col_offset_ * group_, (Dtype)0.,
+          output + output_count * k + output_offset_ * g,
+          output_offset_ * group_, num_);
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_gemm_basis(
+    const Dtype* output, const Dtype* basis, const int num_basis,
+    Dtype* input, Dtype* col_buffer) {
+  Dtype* col_buff = is_1x1_ ? input : col_buffer;
+  const int weight_count = weight_offset_ * group_;
+  const int output_count = output_offset_ * group_ * num_;
+  for (int k = 0; k < num_basis; ++k) {
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_gemm_strided_batched<Dtype>(CblasTrans, CblasNoTrans,
+          kernel_dim_, conv_out_spatial_dim_, conv_out_channels_ / group_,
+          (Dtype)1., basis + weight_count * k + weight_offset_ * g, 0,
+          output + output_count * k + output_offset_ * g,
+          output_offset_ * group_, (Dtype)(k > 0),
+          col_buff + col_offset_ * g, col_offset_ * group_, num_);
+    }
+  }
+  if (!is_1x1_) {
+    conv_col2im_batch_cpu(col_buff, input);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_gemm_basis(const Dtype* input,
+    const Dtype* output, const int num_basis, Dtype* basis_diff,
+    Dtype* col_buffer) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_batch_cpu(input, col_buffer);
+    col_buff = col_buffer;
+  }
+  const int weight_count = weight_offset_ * group_;
+  const int output_dim = output_offset_ * group_;
+  for (int k = 0; k < num_basis; ++k) {
+    for (int n = 0; n < num_; ++n) {
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans,
+            conv_out_channels_ / group_, kernel_dim_, conv_out_spatial_dim_,
+            (Dtype)1., output + output_dim * (num_ * k + n) +
+            output_offset_ * g, col_buff + col_offset_ * (group_ * n + g),
+            (Dtype)1., basis_diff + weight_count * k + weight_offset_ * g);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::conv_im2col_shared_cpu(const Dtype* data,
+    const int* samples, const int num_samples, Dtype* col_buff) {
+  const int col_count = col_buffer_.count();
+  const int rows = col_count / conv_out_spatial_dim_;
+  const size_t row_size = conv_out_spatial_dim_ * sizeof(Dtype);
+  Dtype* stage = col_buff + num_samples * col_count;
+  for (int s = 0; s < num_samples; ++s) {
+    const Dtype* cols = data + samples[s] * conv_input_dim();
+    if (!is_1x1_) {
+      conv_im2col_cpu(cols, stage);
+      cols = stage;
+    }
+    for (int r = 0; r < rows; ++r) {
+      memcpy(col_buff + (r * num_samples + s) * conv_out_spatial_dim_,
+          cols + r * conv_out_spatial_dim_, row_size);
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::conv_gather_output_cpu(const Dtype* output,
+    const int* samples, const int num_samples, Dtype* output_buffer) {
+  const size_t row_size = conv_out_spatial_dim_ * sizeof(Dtype);
+  for (int s = 0; s < num_samples; ++s) {
+    const Dtype* sample = output + samples[s] * output_offset_ * group_;
+    for (int c = 0; c < conv_out_channels_; ++c) {
+      memcpy(output_buffer + (c * num_samples + s) * conv_out_spatial_dim_,
+          sample + c * conv_out_spatial_dim_, row_size);
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::conv_scatter_output_cpu(
+    const Dtype* output_buffer, const int* samples, const int num_samples,
+    Dtype* output) {
+  const size_t row_size = conv_out_spatial_dim_ * sizeof(Dtype);
+  for (int s = 0; s < num_samples; ++s) {
+    Dtype* sample = output + samples[s] * output_offset_ * group_;
+    for (int c = 0; c < conv_out_channels_; ++c) {
+      memcpy(sample + c * conv_out_spatial_dim_,
+          output_buffer + (c * num_samples + s) * conv_out_spatial_dim_,
+          row_size);
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_gemm_shared(const Dtype* input,
+    const int* samples, const int num_samples, const Dtype* weights,
+    Dtype* output, Dtype* col_buffer, Dtype* output_buffer) {
+  conv_im2col_shared_cpu(input, samples, num_samples, col_buffer);
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
+        group_, conv_out_spatial_dim_ * num_samples, kernel_dim_,
+        (Dtype)1., weights + weight_offset_ * g,
+        col_buffer + col_offset_ * num_samples * g,
+        (Dtype)0., output_buffer + output_offset_ * num_samples * g);
+  }
+  conv_scatter_output_cpu(output_buffer, samples, num_samples, output);
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_gemm_shared(
+    const Dtype* output, const int* samples, const int num_samples,
+    const Dtype* weights, Dtype* input, Dtype* col_buffer,
+    Dtype* output_buffer) {
+  conv_gather_output_cpu(output, samples, num_samples, output_buffer);
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_,
+        conv_out_spatial_dim_ * num_samples, conv_out_channels_ / group_,
+        (Dtype)1., weights + weight_offset_ * g,
+        output_buffer + output_offset_ * num_samples * g,
+        (Dtype)0., col_buffer + col_offset_ * num_samples * g);
+  }
+  const int col_count = col_buffer_.count();
+  const int rows = col_count / conv_out_spatial_dim_;
+  const size_t row_size = conv_out_spatial_dim_ * sizeof(Dtype);
+  Dtype* stage = col_buffer + num_samples * col_count;
+  for (int s = 0; s < num_samples; ++s) {
+    Dtype* sample = input + samples[s] * conv_input_dim();
+    Dtype* cols = is_1x1_ ? sample : stage;
+    for (int r = 0; r < rows; ++r) {
+      memcpy(cols + r * conv_out_spatial_dim_,
+          col_buffer + (r * num_samples + s) * conv_out_spatial_dim_,
+          row_size);
+    }
+    if (!is_1x1_) {
+      conv_col2im_cpu(stage, sample);
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_gemm_shared(const Dtype* input,
+    const Dtype* output, const int* samples, const int num_samples,
+    Dtype* weights, Dtype* col_buffer, Dtype* output_buffer) {
+  conv_im2col_shared_cpu(input, samples, num_samples, col_buffer);
+  conv_gather_output_cpu(output, samples, num_samples, output_buffer);
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
+        kernel_dim_, conv_out_spatial_dim_ * num_samples,
+        (Dtype)1., output_buffer + output_offset_ * num_samples * g,
+        col_buffer + col_offset_ * num_samples * g,
+        (Dtype)0., weights + weight_offset_ * g);
+  }
+}
+
+template <typename Dtype>
+const Dtype* BaseConvolutionLayer<Dtype>::dynamic_combine_cpu(
+    const Dtype* filter, Dtype* new_weight) {
+  return caffe_combine_filter(
+      this->layer_param_.convolution_param().weight_operation(),
+      this->blobs_[0]->count(), this->blobs_[0]->cpu_data(), filter,
+      new_weight);
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::dynamic_combine_backward_cpu(
+    const Dtype* filter, const Dtype* new_weight_diff, Dtype* weight_diff,
+    Dtype* filter_diff, const bool accumulate) {
+  caffe_combine_filter_backward(
+      this->layer_param_.convolution_param().weight_operation(),
+      this->blobs_[0]->count(), this->blobs_[0]->cpu_data(), filter,
+      new_weight_diff, weight_diff, filter_diff, accumulate);
+}
+
+template <typename Dtype>
+int BaseConvolutionLayer<Dtype>::fused_tile_count() const {
+  return caffe_gemm_combined_tile_count(
+      std::max(kernel_dim_, conv_out_channels_ / group_));
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
@@ -413,6 +786,192 @@ void BaseConvolutionLayer<Dtype>::backward_gpu_bias(Dtype* bias,
       input, bias_multiplier_.gpu_data(), 1., bias);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_gpu_gemm_batched(const Dtype* input,
+    const Dtype* weights, const int weight_stride, Dtype* output,
+    Dtype* col_buffer) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_batch_gpu(input, col_buffer);
+    col_buff = col_buffer;
+  }
+  for (int g = 0; g < group_; ++g) {
+    caffe_gpu_gemm_strided_batched<Dtype>(CblasNoTrans, CblasNoTrans,
+        conv_out_channels_ / group_, conv_out_spatial_dim_, kernel_dim_,
+        (Dtype)1., weights + weight_offset_ * g, weight_stride,
+        col_buff + col_offset_ * g, col_offset_ * group_,
+        (Dtype)0., output + output_offset_ * g, output_offset_ * group_, num_);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_gpu_bias_batched(Dtype* output,
+    const Dtype* bias) {
+  caffe_gpu_gemm_strided_batched<Dtype>(CblasNoTrans, CblasNoTrans,
+      num_output_, out_spatial_dim_, 1, (Dtype)1., bias, 0,
+      bias_multiplier_.gpu_data(), 0, (Dtype)1., output, top_dim_, num_);
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_gpu_gemm_batched(
+    const Dtype* output, const Dtype* weights, const int weight_stride,
+    Dtype* input, Dtype* col_buffer) {
+  Dtype* col_buff = is_1x1_ ? input : col_buffer;
+  for (int g = 0; g < group_; ++g) {
+    caffe_gpu_gemm_strided_batched<Dtype>(CblasTrans, CblasNoTrans,
+        kernel_dim_, conv_out_spatial_dim_, conv_out_channels_ / group_,
+        (Dtype)1., weights + weight_offset_ * g, weight_stride,
+        output + output_offset_ * g, output_offset_ * group_,
+        (Dtype)0., col_buff + col_offset_ * g, col_offset_ * group_, num_);
+  }
+  if (!is_1x1_) {
+    conv_col2im_batch_gpu(col_buff, input);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_gpu_gemm_batched(const Dtype* input,
+    const Dtype* output, Dtype* weights, Dtype* col_buffer) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_batch_gpu(input, col_buffer);
+    col_buff = col_buffer;
+  }
+  for (int g = 0; g < group_; ++g) {
+    caffe_gpu_gemm_strided_batched<Dtype>(CblasNoTrans, CblasTrans,
+        conv_out_channels_ / group_, kernel_dim_, conv_out_spatial_dim_,
+        (Dtype)1., output + output_offset_ * g, output_offset_ * group_,
+        col_buff + col_offset_ * g, col_offset_ * group_,
+        (Dtype)0., weights + weight_offset_ * g, weight_offset_ * group_, num_);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_gpu_gemm_fused(const Dtype* input,
+    const Dtype* weights, const Dtype* filter,
+    const ConvolutionParameter_WeightOp op, Dtype* output) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_gpu(input, col_buffer_.mutable_gpu_data());
+    col_buff = col_buffer_.gpu_data();
+  }
+  for (int g = 0; g < group_; ++g) {
+    caffe_gpu_gemm_combined<Dtype>(CblasNoTrans, conv_out_channels_ / group_,
+        conv_out_spatial_dim_, kernel_dim_, op, weights + weight_offset_ * g,
+        filter + weight_offset_ * g, col_buff + col_offset_ * g,
+        output + output_offset_ * g);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_gpu_gemm_fused(const Dtype* output,
+    const Dtype* weights, const Dtype* filter,
+    const ConvolutionParameter_WeightOp op, Dtype* input) {
+  Dtype* col_buff = col_buffer_.mutable_gpu_data();
+  if (is_1x1_) {
+    col_buff = input;
+  }
+  for (int g = 0; g < group_; ++g) {
+    caffe_gpu_gemm_combined<Dtype>(CblasTrans, kernel_dim_,
+        conv_out_spatial_dim_, conv_out_channels_ / group_, op,
+        weights + weight_offset_ * g, filter + weight_offset_ * g,
+        output + output_offset_ * g, col_buff + col_offset_ * g);
+  }
+  if (!is_1x1_) {
+    conv_col2im_gpu(col_buff, input);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_gpu_gemm_fused(const Dtype* input,
+    const Dtype* output, const Dtype* weights, const Dtype* filter,
+    const ConvolutionParameter_WeightOp op, Dtype* weight_diff,
+    Dtype* filter_diff, const bool accumulate_filter_diff) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_gpu(input, col_buffer_.mutable_gpu_data());
+    col_buff = col_buffer_.gpu_data();
+  }
+  for (int g = 0; g < group_; ++g) {
+    const int offset = weight_offset_ * g;
+    caffe_gpu_gemm_combined_diff<Dtype>(conv_out_channels_ / group_,
+        kernel_dim_, conv_out_spatial_dim_, op, output + output_offset_ * g,
+        col_buff + col_offset_ * g, weights + offset, filter + offset,
+        weight_diff ? weight_diff + offset : NULL,
+        filter_diff ? filter_diff + offset : NULL, accumulate_filter_diff);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_gpu_gemm_basis(const Dtype* input,
+    const Dtype* basis, const int num_basis, Dtype* output,
+    Dtype* col_buffer) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_batch_gpu(input, col_buffer);
+    col_buff = col_buffer;
+  }
+  // A zero weight stride applies the same basis filter to every sample.
+  const int weight_count = weight_offset_ * group_;
+  const int output_count = output_offset_ * group_ * num_;
+  for (int k = 0; k < num_basis; ++k) {
+    for (int g = 0; g < group_; ++g) {
+      caffe_gpu_gemm_strided_batched<Dtype>(CblasNoTrans, CblasNoTrans,
+          conv_out_channels_ / group_, conv_out_spatial_dim_, kernel_dim_,
+          (Dtype)1., basis + weight_count * k + weight_offset_ * g, 0,
+          col_buff + col_offset_ * g, col_offset_ * group_, (Dtype)0.,
+          output + output_count * k + output_offset_ * g,
+          output_offset_ * group_, num_);
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_gpu_gemm_basis(
+    const Dtype* output, const Dtype* basis, const int num_basis,
+    Dtype* input, Dtype* col_buffer) {
+  Dtype* col_buff = is_1x1_ ? input : col_buffer;
+  const int weight_count = weight_offset_ * group_;
+  const int output_count = output_offset_ * group_ * num_;
+  for (int k = 0; k < num_basis; ++k) {
+    for (int g = 0; g < group_; ++g) {
+      caffe_gpu_gemm_strided_batched<Dtype>(CblasTrans, CblasNoTrans,
+          kernel_dim_, conv_out_spatial_dim_, conv_out_channels_ / group_,
+          (Dtype)1., basis + weight_count * k + weight_offset_ * g, 0,
+          output + output_count * k + output_offset_ * g,
+          output_offset_ * group_, (Dtype)(k > 0),
+          col_buff + col_offset_ * g, col_offset_ * group_, num_);
+    }
+  }
+  if (!is_1x1_) {
+    conv_col2im_batch_gpu(col_buff, input);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_gpu_gemm_basis(const Dtype* input,
+    const Dtype* output, const int num_basis, Dtype* basis_diff,
+    Dtype* col_buffer) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_batch_gpu(input, col_buffer);
+    col_buff = col_buffer;
+  }
+  const int weight_count = weight_offset_ * group_;
+  const int output_dim = output_offset_ * group_;
+  for (int k = 0; k < num_basis; ++k) {
+    for (int n = 0; n < num_; ++n) {
+      for (int g = 0; g < group_; ++g) {
+        caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans,
+            conv_out_channels_ / group_, kernel_dim_, conv_out_spatial_dim_,
+            (Dtype)1., output + output_dim * (num_ * k + n) +
+            output_offset_ * g, col_buff + col_offset_ * (group_ * n + g),
+            (Dtype)1., basis_diff + weight_count * k + weight_offset_ * g);
+      }
+    }
+  }
+}
+
 #endif  // !CPU_ONLY
 
 INSTANTIATE_CLASS(BaseConvolutionLayer);
@@ -0,0 +1,75 @@
+#include <vector>
+
+#include "caffe/layers/base_conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+__global__ void DynamicCombineBackward(const int nthreads, const bool mul,
+    const Dtype* weight, const Dtype* filter, const Dtype* new_weight_diff,
+    Dtype* weight_diff, Dtype* filter_diff, const bool accumulate) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const Dtype diff = new_weight_diff[index];
+    if (weight_diff) {
+      weight_diff[index] += mul ? diff * filter[index] : diff;
+    }
+    if (filter_diff) {
+      const Dtype product = mul ? diff * weight[index] : diff;
+      filter_diff[index] = accumulate ? filter_diff[index] + product : product;
+    }
+  }
+}
+
+template <typename Dtype>
+const Dtype* BaseConvolutionLayer<Dtype>::dynamic_combine_gpu(
+    const Dtype* filter, Dtype* new_weight) {
+  const int weight_count = this->blobs_[0]->count();
+  switch (this->layer_param_.convolution_param().weight_operation()) {
+  case ConvolutionParameter_WeightOp_MUL:
+    caffe_gpu_mul(weight_count, this->blobs_[0]->gpu_data(), filter,
+        new_weight);
+    return new_weight;
+  case ConvolutionParameter_WeightOp_ADD:
+    caffe_gpu_add(weight_count, this->blobs_[0]->gpu_data(), filter,
+        new_weight);
+    return new_weight;
+  case ConvolutionParameter_WeightOp_COPY:
+    return filter;
+  default:
+    LOG(FATAL) << "Unknown weight operation.";
+  }
+  return NULL;
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::dynamic_combine_backward_gpu(
+    const Dtype* filter, const Dtype* new_weight_diff, Dtype* weight_diff,
+    Dtype* filter_diff, const bool accumulate) {
+  const int weight_count = this->blobs_[0]->count();
+  const ConvolutionParameter_WeightOp op =
+      this->layer_param_.convolution_param().weight_operation();
+  // COPY ignores blobs_[0].
+  if (op == ConvolutionParameter_WeightOp_COPY) {
+    weight_diff = NULL;
+  }
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  DynamicCombineBackward<Dtype><<<CAFFE_GET_BLOCKS(weight_count),
+      CAFFE_CUDA_NUM_THREADS>>>(weight_count,
+      op == ConvolutionParameter_WeightOp_MUL, this->blobs_[0]->gpu_data(),
+      filter, new_weight_diff, weight_diff, filter_diff, accumulate);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template const float* BaseConvolutionLayer<float>::dynamic_combine_gpu(
+    const float* filter, float* new_weight);
+template const double* BaseConvolutionLayer<double>::dynamic_combine_gpu(
+    const double* filter, double* new_weight);
+template void BaseConvolutionLayer<float>::dynamic_combine_backward_gpu(
+    const float* filter, const float* new_weight_diff, float* weight_diff,
+    float* filter_diff, const bool accumulate);
+template void BaseConvolutionLayer<double>::dynamic_combine_backward_gpu(
+    const double* filter, const double* new_weight_diff, double* weight_diff,
+    double* filter_diff, const bool accumulate);
+
+}  // namespace caffe
@@ -1,4 +1,6 @@
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
+#include <algorithm>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -8,6 +10,8 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -47,6 +51,13 @@ BasePrefetchingDataLayer<Dtype>::BasePrefetchingDataLayer(
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  // Tops after data and label are prefetched too.
+  for (int i = 0; i < prefetch_.size(); ++i) {
+    prefetch_[i]->extra_.resize(std::max(0, static_cast<int>(top.size()) - 2));
+    for (int j = 0; j < prefetch_[i]->extra_.size(); ++j) {
+      prefetch_[i]->extra_[j].reset(new Blob<Dtype>());
+    }
+  }
   BaseDataLayer<Dtype>::LayerSetUp(bottom, top);
 
   // Before starting the prefetch thread, we make cpu_data and gpu_data
@@ -58,6 +69,11 @@ void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
     if (this->output_labels_) {
       prefetch_[i]->label_.mutable_cpu_data();
     }
+    for (int j = 0; j < prefetch_[i]->extra_.size(); ++j) {
+      if (prefetch_[i]->extra_[j]->count()) {
+        prefetch_[i]->extra_[j]->mutable_cpu_data();
+      }
+    }
   }
 #ifndef CPU_ONLY
   if (Caffe::mode() == Caffe::GPU) {
@@ -66,6 +82,11 @@ void BasePrefetchingDataLayer<Dtype>::LayerSetUp(
       if (this->output_labels_) {
         prefetch_[i]->label_.mutable_gpu_data();
       }
+      for (int j = 0; j < prefetch_[i]->extra_.size(); ++j) {
+        if (prefetch_[i]->extra_[j]->count()) {
+          prefetch_[i]->extra_[j]->mutable_gpu_data();
+        }
+      }
     }
   }
 #endif
@@ -94,6 +115,11 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
         if (this->output_labels_) {
           batch->label_.data().get()->async_gpu_push(stream);
         }
+        for (int i = 0; i < batch->extra_.size(); ++i) {
+          if (batch->extra_[i]->count()) {
+            batch->extra_[i]->data().get()->async_gpu_push(stream);
+          }
+        }
         CUDA_CHECK(cudaStreamSynchronize(stream));
       }
 #endif
@@ -109,6 +135,88 @@ void BasePrefetchingDataLayer<Dtype>::InternalThreadEntry() {
 #endif
 }
 
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::ShardItems(const int num,
+    vector<int>* items) const {
+  const int num_shards = this->phase_ == TRAIN ? Caffe::solver_count() : 1;
+  const int shard = this->phase_ == TRAIN ? Caffe::solver_rank() : 0;
+  items->clear();
+  for (int i = shard; i < num; i += num_shards) {
+    items->push_back(i);
+  }
+  CHECK(!items->empty()) << "No items for solver " << shard;
+  if (num_shards > 1) {
+    LOG(INFO) << "Reading " << items->size() << " items of shard " << shard
+        << " of " << num_shards << ".";
+  }
+}
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::SetUpTransformWorkers(
+    const int batch_size, const int num_workers) {
+  const int workers = caffe_parallel_workers(batch_size,
+      num_workers > 0 ? num_workers : Caffe::cpu_threads());
+  transformers_.clear();
+  for (int i = 0; i < workers; ++i) {
+    if (i == 0) {
+      transformers_.push_back(this->data_transformer_);
+    } else {
+      transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+          new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+    }
+  }
+}
+
+namespace {
+
+// What a transform worker needs, resolved on the prefetch thread beforehand,
+// so that the workers touch no Blob (which could reach Caffe::Get()).
+template <typename Dtype>
+struct TransformWorkerArgs {
+  const boost::function<void(int, DataTransformer<Dtype>*, Dtype*)>*
+      transform_item;
+  const unsigned int* seeds;
+  DataTransformer<Dtype>* const* transformers;
+  Dtype* data;
+  int item_dim;
+};
+
+template <typename Dtype>
+void transform_worker_item(const TransformWorkerArgs<Dtype>& args,
+    const int item_id, const int worker) {
+  args.transformers[worker]->InitRand(args.seeds[item_id]);
+  (*args.transform_item)(item_id, args.transformers[worker],
+      args.data + item_id * args.item_dim);
+}
+
+}  // namespace
+
+template <typename Dtype>
+void BasePrefetchingDataLayer<Dtype>::TransformBatch(Batch<Dtype>* batch,
+    const TransformItemFunction& transform_item) {
+  const int batch_size = batch->data_.shape(0);
+  vector<unsigned int> seeds(batch_size);
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    seeds[item_id] = caffe_rng_rand();
+  }
+  vector<DataTransformer<Dtype>*> transformers(transformers_.size());
+  for (int i = 0; i < transformers_.size(); ++i) {
+    transformers[i] = transformers_[i].get();
+    if (batch->data_.num_axes() == 4) {
+      transformers[i]->PrepareCroppedMean(batch->data_.height(),
+          batch->data_.width());
+    }
+  }
+  TransformWorkerArgs<Dtype> args;
+  args.transform_item = &transform_item;
+  args.seeds = &seeds[0];
+  args.transformers = &transformers[0];
+  args.data = batch->data_.mutable_cpu_data();
+  args.item_dim = batch->data_.count(1);
+  caffe_parallel_for(batch_size, transformers_.size(),
+      boost::bind(&transform_worker_item<Dtype>, boost::cref(args), _1, _2));
+}
+
 template <typename Dtype>
 void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
@@ -124,6 +232,14 @@ void BasePrefetchingDataLayer<Dtype>::Forward_cpu(
     top[1]->ReshapeLike(prefetch_current_->label_);
     top[1]->set_cpu_data(prefetch_current_->label_.mutable_cpu_data());
   }
+  for (int i = 0; i < prefetch_current_->extra_.size(); ++i) {
+    Blob<Dtype>* extra = prefetch_current_->extra_[i].get();
+    if (extra->count() == 0) {
+      continue;  // Not produced by this layer's configuration.
+    }
+    top[i + 2]->ReshapeLike(*extra);
+    top[i + 2]->set_cpu_data(extra->mutable_cpu_data());
+  }
 }
 
 #ifdef CPU_ONLY
@@ -19,6 +19,14 @@ void BasePrefetchingDataLayer<Dtype>::Forward_gpu(
     top[1]->ReshapeLike(prefetch_current_->label_);
     top[1]->set_gpu_data(prefetch_current_->label_.mutable_gpu_data());
   }
+  for (int i = 0; i < prefetch_current_->extra_.size(); ++i) {
+    Blob<Dtype>* extra = prefetch_current_->extra_[i].get();
+    if (extra->count() == 0) {
+      continue;  // Not produced by this layer's configuration.
+    }
+    top[i + 2]->ReshapeLike(*extra);
+    top[i + 2]->set_gpu_data(extra->mutable_gpu_data());
+  }
 }
 
 INSTANTIATE_LAYER_GPU_FORWARD(BasePrefetchingDataLayer);
@@ -1,8 +1,11 @@
- #include <algorithm>
+#include <boost/bind.hpp>
+
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layers/batch_norm_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -83,17 +86,148 @@ void BatchNormLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+namespace {
+
+// What the workers of BatchNormLayer need, resolved beforehand. Items are
+// either channels or (sample, channel) planes, indexed n * channels + c.
 template <typename Dtype>
-void BatchNormLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-    const vector<Blob<Dtype>*>& top) {
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
-  int num = bottom[0]->shape(0);
-  int spatial_dim = bottom[0]->count()/(bottom[0]->shape(0)*channels_);
+struct BatchNormArgs {
+  const Dtype* bottom_data;
+  Dtype* top_data;
+  Dtype* x_norm;
+  Dtype* mean;
+  // The variance, or sqrt(variance + eps) once normalizing.
+  Dtype* variance;
+  // Backward only reads what forward kept: x_norm_ and sqrt(variance + eps).
+  const Dtype* top_diff;
+  Dtype* bottom_diff;
+  const Dtype* saved_x_norm;
+  const Dtype* saved_std;
+  int num;
+  int channels;
+  int spatial_dim;
+};
+
+// The batch mean and (biased) variance of channels [begin, end).
+template <typename Dtype>
+void batch_norm_statistics(const BatchNormArgs<Dtype>& args, const int begin,
+    const int end, const int worker) {
+  const int spatial_dim = args.spatial_dim;
+  for (int c = begin; c < end; ++c) {
+    Dtype sum = 0;
+    for (int n = 0; n < args.num; ++n) {
+      const Dtype* x = args.bottom_data
+          + (n * args.channels + c) * spatial_dim;
+      for (int i = 0; i < spatial_dim; ++i) {
+        sum += x[i];
+      }
+    }
+    const Dtype mean = sum / (args.num * spatial_dim);
+    Dtype sum_sq = 0;
+    for (int n = 0; n < args.num; ++n) {
+      const Dtype* x = args.bottom_data
+          + (n * args.channels + c) * spatial_dim;
+      for (int i = 0; i < spatial_dim; ++i) {
+        sum_sq += (x[i] - mean) * (x[i] - mean);
+      }
+    }
+    args.mean[c] = mean;
+    args.variance[c] = sum_sq / (args.num * spatial_dim);
+  }
+}
 
-  if (bottom[0] != top[0]) {
-    caffe_copy(bottom[0]->count(), bottom_data, top_data);
+// top = x_norm = (x - mean) / sqrt(variance + eps) on planes [begin, end).
+template <typename Dtype>
+void batch_norm_normalize(const BatchNormArgs<Dtype>& args, const int begin,
+    const int end, const int worker) {
+  const int spatial_dim = args.spatial_dim;
+  for (int plane = begin; plane < end; ++plane) {
+    const int c = plane % args.channels;
+    const Dtype mean = args.mean[c];
+    const Dtype inv_std = 1 / args.variance[c];
+    const Dtype* x = args.bottom_data + plane * spatial_dim;
+    Dtype* y = args.top_data + plane * spatial_dim;
+    Dtype* x_norm = args.x_norm + plane * spatial_dim;
+    for (int i = 0; i < spatial_dim; ++i) {
+      y[i] = (x[i] - mean) * inv_std;
+      x_norm[i] = y[i];
+    }
+  }
+}
+
+// With the stored statistics, which are constants: dE/dX = dE/dY ./ std,
+// on planes [begin, end).
+template <typename Dtype>
+void batch_norm_backward_global(const BatchNormArgs<Dtype>& args,
+    const int begin, const int end, const int worker) {
+  const int spatial_dim = args.spatial_dim;
+  for (int plane = begin; plane < end; ++plane) {
+    const Dtype inv_std = 1 / args.saved_std[plane % args.channels];
+    const Dtype* dy = args.top_diff + plane * spatial_dim;
+    Dtype* dx = args.bottom_diff + plane * spatial_dim;
+    for (int i = 0; i < spatial_dim; ++i) {
+      dx[i] = dy[i] * inv_std;
+    }
+  }
+}
+
+// if Y = (X-mean(X))/(sqrt(var(X)+eps)), then
+//
+// dE(Y)/dX =
+//   (dE/dY - mean(dE/dY) - mean(dE/dY \cdot Y) \cdot Y)
+//     ./ sqrt(var(X) + eps)
+//
+// where \cdot and ./ are hadamard product and elementwise division,
+// respectively, dE/dY is the top diff, and mean/var/sum are all computed
+// along all dimensions except the channels dimension. Each of channels
+// [begin, end) takes both means in one pass and the gradient in another.
+template <typename Dtype>
+void batch_norm_backward(const BatchNormArgs<Dtype>& args, const int begin,
+    const int end, const int worker) {
+  const int spatial_dim = args.spatial_dim;
+  const Dtype m = args.num * spatial_dim;
+  for (int c = begin; c < end; ++c) {
+    Dtype sum_dy = 0;
+    Dtype sum_dy_y = 0;
+    for (int n = 0; n < args.num; ++n) {
+      const int offset = (n * args.channels + c) * spatial_dim;
+      const Dtype* dy = args.top_diff + offset;
+      const Dtype* y = args.saved_x_norm + offset;
+      for (int i = 0; i < spatial_dim; ++i) {
+        sum_dy += dy[i];
+        sum_dy_y += dy[i] * y[i];
+      }
+    }
+    const Dtype mean_dy = sum_dy / m;
+    const Dtype mean_dy_y = sum_dy_y / m;
+    const Dtype inv_std = 1 / args.saved_std[c];
+    for (int n = 0; n < args.num; ++n) {
+      const int offset = (n * args.channels + c) * spatial_dim;
+      const Dtype* dy = args.top_diff + offset;
+      const Dtype* y = args.saved_x_norm + offset;
+      Dtype* dx = args.bottom_diff + offset;
+      for (int i = 0; i < spatial_dim; ++i) {
+        dx[i] = (dy[i] - mean_dy - mean_dy_y * y[i]) * inv_std;
+      }
+    }
   }
+}
+
+}  // namespace
+
+template <typename Dtype>
+void BatchNormLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+  // Channels (for the statistics) and (sample, channel) planes (to
+  // normalize) are split among Caffe::cpu_threads() workers.
+  BatchNormArgs<Dtype> args = BatchNormArgs<Dtype>();
+  args.bottom_data = bottom[0]->cpu_data();
+  args.num = bottom[0]->shape(0);
+  args.channels = channels_;
+  args.spatial_dim = bottom[0]->count()/(bottom[0]->shape(0)*channels_);
+  args.mean = mean_.mutable_cpu_data();
+  args.variance = variance_.mutable_cpu_data();
+  const int channel_size = args.num * args.spatial_dim;
 
   if (use_global_stats_) {
     // use the stored mean/variance estimates.
@@ -107,60 +241,11 @@ void BatchNormLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     caffe_cpu_scale(variance_.count(), scale_factor,
         this->blobs_[1]->cpu_data(), variance_.mutable_cpu_data());
   } else {
-    // compute mean
-    // 如果没有提供mean和variance，我们需要自己去计算
-    // 这个矩阵与向量相乘，目的是计算每个feature map的数值和，
-    // 然后在除以1./(num*spatial_dim) 
-    // bottom_data: (channels_*num) x (spatial_dim) 
-    // spatial_sum_multiplier: spatial_dim x 1 
-    // alpha : 1./(num*spatial_dim); beta : 0 
-    // num_by_chans = alpha * (bottom_data x spatial_sum_multiplier) + beta * num_by_chans 
-    // 其中spatial_sum_multiplier的值都为1
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim,
-        1. / (num * spatial_dim), bottom_data,
-        spatial_sum_multiplier_.cpu_data(), 0.,
-        num_by_chans_.mutable_cpu_data());
-
-    // 注意关键字是CblasTrans！！ 
-    // num_by_chans_ : channels_ x num; 
-    // batch_sum_multiplier_ : num x 1; 
-    // mean_ = 1. x (num_by_chans_ x batch_sum_multiplier_) 
-    // mean_ : channels_ x 1 
-    // 计算得到对应channels的平均值，
-    // 这也解释了为什么之前要除以1./(num*spatial_dim) 
-    caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
-        num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
-        mean_.mutable_cpu_data());
-  }
-
-  // subtract mean
-  // batch_sum_multiplier_ : num * 1
-  // mean_ : 1 * channels_
-  // num_by_chans_ : num * channels_
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
-      batch_sum_multiplier_.cpu_data(), mean_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-
-  // num_by_chans_: (channels_ * num) x 1 
-  // spatial_sum_multiplier_ : 1 * spatial_dim (all values are 1) 
-  // top_data = 1 * top_data + (-1) * (num_by_chans_ * spatial_sum_multiplier_) 
-  // 这里num_by_chans_ * spatial_sum_multiplier_求得的是每个值对应的平均值 
-  // 最后的top_data保存的就是每个值减去对应channel的均值后的结果
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_ * num,
-      spatial_dim, 1, -1, num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 1., top_data);
-
-  if (!use_global_stats_) {
-    // compute variance using var(X) = E((X-EX)^2)
-    caffe_sqr<Dtype>(top[0]->count(), top_data,
-                     temp_.mutable_cpu_data());  // (X-EX)^2
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim,
-        1. / (num * spatial_dim), temp_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), 0.,
-        num_by_chans_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
-        num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
-        variance_.mutable_cpu_data());  // E((X_EX)^2)
+    // 如果没有提供mean和variance，我们需要自己去计算：
+    // var(X) = E((X-EX)^2)，在每个channel的所有样本和空间位置上求平均
+    caffe_parallel_ranges(channels_, caffe_parallel_grain(channel_size),
+        Caffe::cpu_threads(), boost::bind(&batch_norm_statistics<Dtype>,
+        boost::cref(args), _1, _2, _3));
 
     // compute and save moving average
     // blobs_[2]中只有一个值，最开始值为0
@@ -191,18 +276,15 @@ void BatchNormLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   caffe_sqrt(variance_.count(), variance_.cpu_data(),
              variance_.mutable_cpu_data());
 
-  // replicate variance to input size
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
-      batch_sum_multiplier_.cpu_data(), variance_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_ * num,
-      spatial_dim, 1, 1., num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 0., temp_.mutable_cpu_data());
-  caffe_div(temp_.count(), top_data, temp_.cpu_data(), top_data);
+  // Normalize, keeping the result in x_norm_ for backprop.
   // TODO(cdoersch): The caching is only needed because later in-place layers
   //                 might clobber the data.  Can we skip this if they won't?
-  caffe_copy(x_norm_.count(), top_data,
-      x_norm_.mutable_cpu_data());
+  args.top_data = top[0]->mutable_cpu_data();
+  args.x_norm = x_norm_.mutable_cpu_data();
+  caffe_parallel_ranges(args.num * channels_,
+      caffe_parallel_grain(args.spatial_dim), Caffe::cpu_threads(),
+      boost::bind(&batch_norm_normalize<Dtype>, boost::cref(args),
+      _1, _2, _3));
 }
 
 // 这里需要解释一下blobs_的计算方式，我们是在Train的过程中，完成计算blobs_的，
@@ -215,76 +297,28 @@ template <typename Dtype>
 void BatchNormLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
-  const Dtype* top_diff;
-  if (bottom[0] != top[0]) {
-    top_diff = top[0]->cpu_diff();
-  } else {
-    caffe_copy(x_norm_.count(), top[0]->cpu_diff(), x_norm_.mutable_cpu_diff());
-    top_diff = x_norm_.cpu_diff();
-  }
-  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  // Each value's gradient only depends on its own top diff once the channel
+  // sums are taken, so in place needs no copy of the top diff.
+  BatchNormArgs<Dtype> args = BatchNormArgs<Dtype>();
+  args.top_diff = top[0]->cpu_diff();
+  args.bottom_diff = bottom[0]->mutable_cpu_diff();
+  args.saved_x_norm = x_norm_.cpu_data();
+  // sqrt(var(X) + eps), computed during the forward pass.
+  args.saved_std = variance_.cpu_data();
+  args.num = bottom[0]->shape(0);
+  args.channels = channels_;
+  args.spatial_dim = bottom[0]->count()/(bottom[0]->shape(0)*channels_);
   if (use_global_stats_) {
-    caffe_div(temp_.count(), top_diff, temp_.cpu_data(), bottom_diff);
+    caffe_parallel_ranges(args.num * channels_,
+        caffe_parallel_grain(args.spatial_dim), Caffe::cpu_threads(),
+        boost::bind(&batch_norm_backward_global<Dtype>, boost::cref(args),
+        _1, _2, _3));
     return;
   }
-  const Dtype* top_data = x_norm_.cpu_data();
-  int num = bottom[0]->shape()[0];
-  int spatial_dim = bottom[0]->count()/(bottom[0]->shape(0)*channels_);
-  // if Y = (X-mean(X))/(sqrt(var(X)+eps)), then
-  //
-  // dE(Y)/dX =
-  //   (dE/dY - mean(dE/dY) - mean(dE/dY \cdot Y) \cdot Y)
-  //     ./ sqrt(var(X) + eps)
-  //
-  // where \cdot and ./ are hadamard product and elementwise division,
-  // respectively, dE/dY is the top diff, and mean/var/sum are all computed
-  // along all dimensions except the channels dimension.  In the above
-  // equation, the operations allow for expansion (i.e. broadcast) along all
-  // dimensions except the channels dimension where required.
-
-  // sum(dE/dY \cdot Y)
-  caffe_mul(temp_.count(), top_data, top_diff, bottom_diff);
-  caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim, 1.,
-      bottom_diff, spatial_sum_multiplier_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
-      num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
-      mean_.mutable_cpu_data());
-
-  // reshape (broadcast) the above
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
-      batch_sum_multiplier_.cpu_data(), mean_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_ * num,
-      spatial_dim, 1, 1., num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 0., bottom_diff);
-
-  // sum(dE/dY \cdot Y) \cdot Y
-  caffe_mul(temp_.count(), top_data, bottom_diff, bottom_diff);
-
-  // sum(dE/dY)-sum(dE/dY \cdot Y) \cdot Y
-  caffe_cpu_gemv<Dtype>(CblasNoTrans, channels_ * num, spatial_dim, 1.,
-      top_diff, spatial_sum_multiplier_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemv<Dtype>(CblasTrans, num, channels_, 1.,
-      num_by_chans_.cpu_data(), batch_sum_multiplier_.cpu_data(), 0.,
-      mean_.mutable_cpu_data());
-  // reshape (broadcast) the above to make
-  // sum(dE/dY)-sum(dE/dY \cdot Y) \cdot Y
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, channels_, 1, 1,
-      batch_sum_multiplier_.cpu_data(), mean_.cpu_data(), 0.,
-      num_by_chans_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num * channels_,
-      spatial_dim, 1, 1., num_by_chans_.cpu_data(),
-      spatial_sum_multiplier_.cpu_data(), 1., bottom_diff);
-
-  // dE/dY - mean(dE/dY)-mean(dE/dY \cdot Y) \cdot Y
-  caffe_cpu_axpby(temp_.count(), Dtype(1), top_diff,
-      Dtype(-1. / (num * spatial_dim)), bottom_diff);
-
-  // note: temp_ still contains sqrt(var(X)+eps), computed during the forward
-  // pass.
-  caffe_div(temp_.count(), bottom_diff, temp_.cpu_data(), bottom_diff);
+  caffe_parallel_ranges(channels_,
+      caffe_parallel_grain(args.num * args.spatial_dim), Caffe::cpu_threads(),
+      boost::bind(&batch_norm_backward<Dtype>, boost::cref(args),
+      _1, _2, _3));
 }
 
 
@@ -1,9 +1,13 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layers/bn_layer.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -81,6 +85,7 @@ void BNLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   batch_statistic_.Reshape(1, channels_, 1, 1);
 
   x_norm_.ReshapeLike(*(bottom[0]));
+  x_mean_.ReshapeLike(batch_statistic_);
   x_inv_std_.ReshapeLike(batch_statistic_);
 
   spatial_sum_multiplier_.Reshape(1, 1, height_, width_);
@@ -91,250 +96,266 @@ void BNLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       batch_sum_multiplier_.mutable_cpu_data());
 }
 
-template <typename Dtype>
-void BNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-  const vector<Blob<Dtype>*>& top) {
-  const Dtype* const_bottom_data = bottom[0]->cpu_data();
-  const Dtype* const_top_data = top[0]->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
+namespace {
 
-  const Dtype* scale_data = this->blobs_[0]->cpu_data();
-  const Dtype* shift_data = this->blobs_[1]->cpu_data();
-
-  // Mean normalization
-  if (frozen_ || this->phase_ == TEST) {
-    // Use the moving average mean
-    caffe_copy(batch_statistic_.count(), this->blobs_[2]->cpu_data(),
-        batch_statistic_.mutable_cpu_data());
-  } else {
-    // Compute the mean by averaging over spatial and batch dimensions.
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1) / (height_ * width_), const_bottom_data,
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_,
-        Dtype(1) / num_, spatial_statistic_.cpu_data(),
-        batch_sum_multiplier_.cpu_data(), Dtype(0),
-        batch_statistic_.mutable_cpu_data());
-    // Add to the moving average
-    if (!frozen_) {
-      caffe_cpu_axpby(batch_statistic_.count(),
-          Dtype(1) - bn_momentum_, batch_statistic_.cpu_data(),
-          bn_momentum_, this->blobs_[2]->mutable_cpu_data());
+// What a worker needs to normalize its channels, resolved beforehand.
+template <typename Dtype>
+struct BNArgs {
+  const Dtype* bottom_data;
+  Dtype* top_data;
+  const Dtype* top_diff;
+  Dtype* bottom_diff;
+  const Dtype* scale_data;
+  const Dtype* shift_data;
+  Dtype* scale_diff;
+  Dtype* shift_diff;
+  Dtype* moving_mean;
+  Dtype* moving_var;
+  // The statistics the output was normalized with, kept for backprop (NULL
+  // in frozen mode, which does not need them).
+  Dtype* mean;
+  Dtype* inv_std;
+  // The normalized input, only kept when the layer runs in place.
+  Dtype* x_norm;
+  int num;
+  int channels;
+  int spatial_dim;
+  bool use_global_stats;
+  bool frozen;
+  Dtype momentum;
+  Dtype eps;
+};
+
+// Computes the mean and the variance of channel c in one pass. Each plane is
+// summed shifted by its first value, which keeps the squares small, and the
+// planes are merged with the pairwise Welford update.
+template <typename Dtype>
+void bn_channel_statistics(const BNArgs<Dtype>& args, const int c,
+    Dtype* mean, Dtype* variance) {
+  const int spatial_dim = args.spatial_dim;
+  double count = 0;
+  double running_mean = 0;
+  double running_m2 = 0;
+  for (int n = 0; n < args.num; ++n) {
+    const Dtype* x = args.bottom_data
+        + (n * args.channels + c) * spatial_dim;
+    const Dtype shift = x[0];
+    Dtype sum = 0;
+    Dtype sum_sq = 0;
+    for (int i = 0; i < spatial_dim; ++i) {
+      const Dtype d = x[i] - shift;
+      sum += d;
+      sum_sq += d * d;
     }
+    const double plane_mean = shift + double(sum) / spatial_dim;
+    const double plane_m2 = sum_sq - double(sum) * sum / spatial_dim;
+    const double total = count + spatial_dim;
+    const double delta = plane_mean - running_mean;
+    running_mean += delta * spatial_dim / total;
+    running_m2 += plane_m2 + delta * delta * count * spatial_dim / total;
+    count = total;
   }
-  // Broadcast the mean vector
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(-1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  // Subtract
-  caffe_add(broadcast_buffer_.count(), const_bottom_data,
-      broadcast_buffer_.cpu_data(), top_data);
+  *mean = running_mean;
+  *variance = std::max(running_m2 / count, 0.);
+}
 
-  // Variance normalization
-  if (frozen_ || this->phase_ == TEST) {
-    // Use the moving average variance
-    caffe_copy(batch_statistic_.count(), this->blobs_[3]->cpu_data(),
-        batch_statistic_.mutable_cpu_data());
+template <typename Dtype>
+void bn_forward_channel(const BNArgs<Dtype>& args, const int c,
+    const int worker) {
+  const int spatial_dim = args.spatial_dim;
+  Dtype mean;
+  Dtype variance;
+  if (args.use_global_stats) {
+    mean = args.moving_mean[c];
+    variance = args.moving_var[c];
   } else {
-    // calculate batch variance
-    caffe_powx(broadcast_buffer_.count(), const_top_data, Dtype(2),
-        broadcast_buffer_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1) / (height_ * width_), broadcast_buffer_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1) / num_,
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(0), batch_statistic_.mutable_cpu_data());
-
-    // Add to the moving average
-    caffe_cpu_axpby(batch_statistic_.count(),
-        Dtype(1) - bn_momentum_, batch_statistic_.cpu_data(),
-        bn_momentum_, this->blobs_[3]->mutable_cpu_data());
+    bn_channel_statistics(args, c, &mean, &variance);
+    args.moving_mean[c] = args.momentum * args.moving_mean[c]
+        + (1 - args.momentum) * mean;
+    args.moving_var[c] = args.momentum * args.moving_var[c]
+        + (1 - args.momentum) * variance;
   }
-
-  // Add eps
-  caffe_add_scalar(batch_statistic_.count(), bn_eps_,
-                   batch_statistic_.mutable_cpu_data());
-  // Inverse standard deviation
-  caffe_powx(batch_statistic_.count(), batch_statistic_.cpu_data(),
-             Dtype(-0.5), batch_statistic_.mutable_cpu_data());
-
-  // Broadcast the inverse std
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  // Multiply with the inverse std
-  caffe_mul(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
-
-  // Save the normalized inputs and std for backprop
-  if (!frozen_) {
-    caffe_copy(broadcast_buffer_.count(), const_top_data,
-        x_norm_.mutable_cpu_data());
-    caffe_copy(batch_statistic_.count(), batch_statistic_.cpu_data(),
-        x_inv_std_.mutable_cpu_data());
+  const Dtype inv_std = 1 / std::sqrt(variance + args.eps);
+  if (args.mean) {
+    args.mean[c] = mean;
+    args.inv_std[c] = inv_std;
+  }
+  // y = (x - mean) * inv_std * scale + shift = x * a + b
+  const Dtype scale = args.scale_data[c];
+  const Dtype shift = args.shift_data[c];
+  const Dtype a = scale * inv_std;
+  const Dtype b = shift - mean * a;
+  for (int n = 0; n < args.num; ++n) {
+    const int offset = (n * args.channels + c) * spatial_dim;
+    const Dtype* x = args.bottom_data + offset;
+    Dtype* y = args.top_data + offset;
+    if (args.x_norm) {
+      Dtype* x_norm = args.x_norm + offset;
+      for (int i = 0; i < spatial_dim; ++i) {
+        x_norm[i] = (x[i] - mean) * inv_std;
+        y[i] = x_norm[i] * scale + shift;
+      }
+    } else {
+      for (int i = 0; i < spatial_dim; ++i) {
+        y[i] = x[i] * a + b;
+      }
+    }
   }
-
-  // Scale
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), scale_data,
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  caffe_mul(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
-
-  // Shift
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), shift_data,
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  caffe_add(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
 }
 
+// With batch statistics, for x_hat the normalized input and m the number of
+// values per channel:
+//   dl/dx = scale * inv_std
+//       * (dl/dy - sum(dl/dy) / m - x_hat * sum(dl/dy * x_hat) / m)
+// In frozen mode the statistics are constants and dl/dx = scale * inv_std
+// * dl/dy.
 template <typename Dtype>
-void BNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
-  const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  if (frozen_) {
-    if (propagate_down[0]) {
-      const Dtype* const_top_diff = top[0]->cpu_diff();
-      Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-      // Use the moving average variance
-      caffe_copy(batch_statistic_.count(), this->blobs_[3]->cpu_data(),
-          batch_statistic_.mutable_cpu_data());
-      caffe_add_scalar(batch_statistic_.count(), bn_eps_,
-          batch_statistic_.mutable_cpu_data());
-      caffe_powx(batch_statistic_.count(), batch_statistic_.cpu_data(),
-          Dtype(-0.5), batch_statistic_.mutable_cpu_data());
-      // Divide slope with std
-      caffe_mul(batch_statistic_.count(), this->blobs_[0]->cpu_data(),
-          batch_statistic_.cpu_data(), batch_statistic_.mutable_cpu_data());
-      // Broadcast
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-          Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-          Dtype(0), spatial_statistic_.mutable_cpu_data());
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-          height_ * width_, 1, Dtype(1),
-          spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-          Dtype(0), broadcast_buffer_.mutable_cpu_data());
-      // Elementwise multiply top grad with (slope / std)
-      caffe_mul(broadcast_buffer_.count(), const_top_diff,
-          broadcast_buffer_.cpu_data(), bottom_diff);
+void bn_backward_channel(const BNArgs<Dtype>& args, const int c,
+    const int worker) {
+  const int spatial_dim = args.spatial_dim;
+  if (args.frozen) {
+    const Dtype k = args.scale_data[c]
+        / std::sqrt(args.moving_var[c] + args.eps);
+    for (int n = 0; n < args.num; ++n) {
+      const int offset = (n * args.channels + c) * spatial_dim;
+      const Dtype* dy = args.top_diff + offset;
+      Dtype* dx = args.bottom_diff + offset;
+      for (int i = 0; i < spatial_dim; ++i) {
+        dx[i] = k * dy[i];
+      }
     }
     return;
   }
-
-  // gradient w.r.t. slope
-  if (this->param_propagate_down_[0]) {
-    const Dtype* const_top_diff = top[0]->cpu_diff();
-    Dtype* scale_diff = this->blobs_[0]->mutable_cpu_diff();
-    caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(), const_top_diff,
-        broadcast_buffer_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), broadcast_buffer_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(1), scale_diff);
+  const Dtype mean = args.mean[c];
+  const Dtype inv_std = args.inv_std[c];
+  Dtype sum_dy = 0;
+  Dtype sum_dy_x_norm = 0;
+  for (int n = 0; n < args.num; ++n) {
+    const int offset = (n * args.channels + c) * spatial_dim;
+    const Dtype* dy = args.top_diff + offset;
+    if (args.x_norm) {
+      const Dtype* x_norm = args.x_norm + offset;
+      for (int i = 0; i < spatial_dim; ++i) {
+        sum_dy += dy[i];
+        sum_dy_x_norm += dy[i] * x_norm[i];
+      }
+    } else {
+      const Dtype* x = args.bottom_data + offset;
+      Dtype sum_dy_x_centered = 0;
+      for (int i = 0; i < spatial_dim; ++i) {
+        sum_dy += dy[i];
+        sum_dy_x_centered += dy[i] * (x[i] - mean);
+      }
+      sum_dy_x_norm += sum_dy_x_centered * inv_std;
+    }
   }
-
-  // gradient w.r.t. bias
-  if (this->param_propagate_down_[1]) {
-    const Dtype* const_top_diff = top[0]->cpu_diff();
-    Dtype* shift_diff = this->blobs_[1]->mutable_cpu_diff();
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), const_top_diff, spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(1), shift_diff);
+  if (args.scale_diff) {
+    args.scale_diff[c] += sum_dy_x_norm;
   }
+  if (args.shift_diff) {
+    args.shift_diff[c] += sum_dy;
+  }
+  if (!args.bottom_diff) {
+    return;
+  }
+  const Dtype m = args.num * spatial_dim;
+  const Dtype k = args.scale_data[c] * inv_std;
+  const Dtype mean_dy = sum_dy / m;
+  const Dtype mean_dy_x_norm = sum_dy_x_norm / m;
+  for (int n = 0; n < args.num; ++n) {
+    const int offset = (n * args.channels + c) * spatial_dim;
+    const Dtype* dy = args.top_diff + offset;
+    Dtype* dx = args.bottom_diff + offset;
+    if (args.x_norm) {
+      const Dtype* x_norm = args.x_norm + offset;
+      for (int i = 0; i < spatial_dim; ++i) {
+        dx[i] = k * (dy[i] - mean_dy - x_norm[i] * mean_dy_x_norm);
+      }
+    } else {
+      const Dtype* x = args.bottom_data + offset;
+      for (int i = 0; i < spatial_dim; ++i) {
+        dx[i] = k * (dy[i] - mean_dy
+            - (x[i] - mean) * inv_std * mean_dy_x_norm);
+      }
+    }
+  }
+}
 
-  // gradient w.r.t. normalized inputs
-  if (propagate_down[0]) {
-    const Dtype* const_top_diff = top[0]->cpu_diff();
-    const Dtype* const_bottom_diff = bottom[0]->cpu_diff();
-    Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-    const Dtype* scale_data = this->blobs_[0]->cpu_data();
-
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), scale_data,
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1), spatial_statistic_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        broadcast_buffer_.mutable_cpu_data());
-    caffe_mul(broadcast_buffer_.count(), const_top_diff,
-        broadcast_buffer_.cpu_data(), broadcast_buffer_.mutable_cpu_data());
-
-    // sum of x_hat * (dl / dx_hat)
-    caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(),
-        broadcast_buffer_.cpu_data(), bottom_diff);
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), const_bottom_diff, spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(0), batch_statistic_.mutable_cpu_data());
-
-    // x_hat times the sum
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1),
-        spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), bottom_diff);
-    caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(),
-        const_bottom_diff, bottom_diff);
+}  // namespace
 
-    // Subtract the average of x_hat times the sum
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), broadcast_buffer_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(0), batch_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1),
-        spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-        Dtype(1), bottom_diff);
-    caffe_cpu_axpby(broadcast_buffer_.count(), Dtype(1),
-        broadcast_buffer_.cpu_data(), Dtype(-1) / (num_ * height_ * width_),
-        bottom_diff);
+template <typename Dtype>
+void BNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+  const vector<Blob<Dtype>*>& top) {
+  // Each channel is normalized by one worker: a pass over its values for the
+  // batch statistics (none with the moving averages) and a pass that writes
+  // the output.
+  BNArgs<Dtype> args = BNArgs<Dtype>();
+  args.bottom_data = bottom[0]->cpu_data();
+  args.top_data = top[0]->mutable_cpu_data();
+  args.scale_data = this->blobs_[0]->cpu_data();
+  args.shift_data = this->blobs_[1]->cpu_data();
+  args.use_global_stats = frozen_ || this->phase_ == TEST;
+  if (args.use_global_stats) {
+    args.moving_mean = const_cast<Dtype*>(this->blobs_[2]->cpu_data());
+    args.moving_var = const_cast<Dtype*>(this->blobs_[3]->cpu_data());
+  } else {
+    args.moving_mean = this->blobs_[2]->mutable_cpu_data();
+    args.moving_var = this->blobs_[3]->mutable_cpu_data();
+  }
+  // Save the statistics, and the normalized inputs if the input is about to
+  // be overwritten, for backprop
+  if (!frozen_) {
+    args.mean = x_mean_.mutable_cpu_data();
+    args.inv_std = x_inv_std_.mutable_cpu_data();
+    if (bottom[0] == top[0]) {
+      args.x_norm = x_norm_.mutable_cpu_data();
+    }
+  }
+  args.num = num_;
+  args.channels = channels_;
+  args.spatial_dim = height_ * width_;
+  args.momentum = bn_momentum_;
+  args.eps = bn_eps_;
+  caffe_parallel_for(channels_, Caffe::cpu_threads(),
+      boost::bind(&bn_forward_channel<Dtype>, boost::cref(args), _1, _2));
+}
 
-    // Multiply with the inverse std
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), x_inv_std_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1),
-        spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), broadcast_buffer_.mutable_cpu_data());
-    caffe_mul(broadcast_buffer_.count(), const_bottom_diff,
-        broadcast_buffer_.cpu_data(), bottom_diff);
+template <typename Dtype>
+void BNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+  const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  BNArgs<Dtype> args = BNArgs<Dtype>();
+  args.frozen = frozen_;
+  args.top_diff = top[0]->cpu_diff();
+  args.scale_data = this->blobs_[0]->cpu_data();
+  args.num = num_;
+  args.channels = channels_;
+  args.spatial_dim = height_ * width_;
+  args.eps = bn_eps_;
+  if (propagate_down[0]) {
+    args.bottom_diff = bottom[0]->mutable_cpu_diff();
+  }
+  if (frozen_) {
+    if (!propagate_down[0]) {
+      return;
+    }
+    args.moving_var = const_cast<Dtype*>(this->blobs_[3]->cpu_data());
+  } else {
+    if (this->param_propagate_down_[0]) {
+      args.scale_diff = this->blobs_[0]->mutable_cpu_diff();
+    }
+    if (this->param_propagate_down_[1]) {
+      args.shift_diff = this->blobs_[1]->mutable_cpu_diff();
+    }
+    args.mean = const_cast<Dtype*>(x_mean_.cpu_data());
+    args.inv_std = const_cast<Dtype*>(x_inv_std_.cpu_data());
+    if (bottom[0] == top[0]) {
+      args.x_norm = const_cast<Dtype*>(x_norm_.cpu_data());
+    } else {
+      args.bottom_data = bottom[0]->cpu_data();
+    }
   }
+  caffe_parallel_for(channels_, Caffe::cpu_threads(),
+      boost::bind(&bn_backward_channel<Dtype>, boost::cref(args), _1, _2));
 }
 
 
@@ -1,6 +1,12 @@
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <cstring>
 #include <vector>
 
 #include "caffe/layers/conv_layer.hpp"
+#include "caffe/util/combine_filter.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -24,6 +30,19 @@ void ConvolutionLayer<Dtype>::compute_output_shape() {
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  if (bottom.size() - top.size() == 2) {
+    Forward_factorized_cpu(bottom, top);
+    return;
+  }
+  if (bottom.size() - top.size() == 1) {
+    if (this->layer_param_.convolution_param().dynamic_engine() ==
+        ConvolutionParameter_DynamicEngine_BATCHED) {
+      Forward_dynamic_batched_cpu(bottom, top);
+    } else {
+      Forward_dynamic_cpu(bottom, top);
+    }
+    return;
+  }
   const Dtype* weight = this->blobs_[0]->cpu_data();
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
@@ -42,6 +61,19 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (bottom.size() - top.size() == 2) {
+    Backward_factorized_cpu(top, propagate_down, bottom);
+    return;
+  }
+  if (bottom.size() - top.size() == 1) {
+    if (this->layer_param_.convolution_param().dynamic_engine() ==
+        ConvolutionParameter_DynamicEngine_BATCHED) {
+      Backward_dynamic_batched_cpu(top, propagate_down, bottom);
+    } else {
+      Backward_dynamic_cpu(top, propagate_down, bottom);
+    }
+    return;
+  }
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   for (int i = 0; i < top.size(); ++i) {
@@ -72,6 +104,667 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
 }
 
+template <typename Dtype>
+bool ConvolutionLayer<Dtype>::dynamic_fused() const {
+  const ConvolutionParameter& param = this->layer_param_.convolution_param();
+  // COPY has nothing to combine.
+  return param.dynamic_engine() == ConvolutionParameter_DynamicEngine_FUSED &&
+      param.weight_operation() != ConvolutionParameter_WeightOp_COPY;
+}
+
+namespace {
+
+// Orders filters by their bytes, so that identical filters become adjacent.
+template <typename Dtype>
+class DynamicFilterLess {
+ public:
+  DynamicFilterLess(const Dtype* filters, int weight_count)
+      : filters_(filters), weight_count_(weight_count) {}
+  bool operator()(int a, int b) const {
+    return memcmp(filters_ + a * weight_count_, filters_ + b * weight_count_,
+        weight_count_ * sizeof(Dtype)) < 0;
+  }
+
+ private:
+  const Dtype* filters_;
+  int weight_count_;
+};
+
+}  // namespace
+
+template <typename Dtype>
+int ConvolutionLayer<Dtype>::DynamicGroupSetUp(const Dtype* bottom_weight) {
+  const int weight_count = this->blobs_[0]->count();
+  dynamic_group_order_.resize(this->num_);
+  for (int n = 0; n < this->num_; ++n) {
+    dynamic_group_order_[n] = n;
+  }
+  // Stable, so that each group lists its samples in batch order.
+  std::stable_sort(dynamic_group_order_.begin(), dynamic_group_order_.end(),
+      DynamicFilterLess<Dtype>(bottom_weight, weight_count));
+  dynamic_group_start_.clear();
+  for (int j = 0; j < this->num_; ++j) {
+    if (j == 0 || memcmp(bottom_weight + dynamic_group_order_[j - 1] *
+        weight_count, bottom_weight + dynamic_group_order_[j] * weight_count,
+        weight_count * sizeof(Dtype))) {
+      dynamic_group_start_.push_back(j);
+    }
+  }
+  dynamic_group_start_.push_back(this->num_);
+  return dynamic_group_start_.size() - 1;
+}
+
+template <typename Dtype>
+int ConvolutionLayer<Dtype>::DynamicSetUp_cpu(const Dtype* bottom_weight,
+    bool need_weight_diff) {
+  const int num_groups = DynamicGroupSetUp(bottom_weight);
+  const int num_workers =
+      caffe_parallel_workers(num_groups, Caffe::cpu_threads());
+  // One combined filter (and its diff), or one gemm tile when fused, and one
+  // column buffer per worker. Grouped, a worker runs one group at a time, so
+  // it takes largest group + 1 column buffers and the largest group's
+  // gathered outputs.
+  vector<int> scratch_shape(2, num_workers);
+  if (dynamic_grouped()) {
+    int max_group_size = 0;
+    for (int g = 0; g < num_groups; ++g) {
+      max_group_size = std::max(max_group_size,
+          dynamic_group_start_[g + 1] - dynamic_group_start_[g]);
+    }
+    scratch_shape[1] = this->blobs_[0]->count();
+    this->new_weight_->Reshape(scratch_shape);
+    vector<int> group_shape(3, num_workers);
+    group_shape[1] = max_group_size + 1;
+    group_shape[2] = this->col_buffer_count();
+    dynamic_col_buffer_.Reshape(group_shape);
+    group_shape[1] = max_group_size;
+    group_shape[2] = this->top_dim_;
+    dynamic_group_top_buffer_.Reshape(group_shape);
+  } else {
+    scratch_shape[1] = dynamic_fused() ?
+        this->fused_tile_count() : this->blobs_[0]->count();
+    this->new_weight_->Reshape(scratch_shape);
+    scratch_shape[1] = this->col_buffer_count();
+    dynamic_col_buffer_.Reshape(scratch_shape);
+  }
+  // Worker 0 accumulates straight into blobs_[0]'s diff.
+  if (need_weight_diff && num_workers > 1) {
+    scratch_shape[0] = num_workers - 1;
+    scratch_shape[1] = this->blobs_[0]->count();
+    dynamic_weight_diff_.Reshape(scratch_shape);
+    caffe_set(dynamic_weight_diff_.count(), Dtype(0),
+        dynamic_weight_diff_.mutable_cpu_data());
+  }
+  return num_workers;
+}
+
+template <typename Dtype>
+const Dtype* ConvolutionLayer<Dtype>::dynamic_weight_cpu(
+    const DynamicArgs& args, int n, int worker) {
+  return caffe_combine_filter(args.op, args.weight_count, args.weight,
+      args.bottom_weight + n * args.weight_count,
+      args.new_weight + worker * args.scratch_count);
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::forward_dynamic_sample(const DynamicArgs& args,
+    int n, int worker) {
+  Dtype* top_data = args.top_data + n * this->top_dim_;
+  Dtype* col_buff = args.col_buffer + worker * args.col_stride;
+  if (args.fused) {
+    this->forward_cpu_gemm_fused(args.bottom_data + n * this->bottom_dim_,
+        args.weight, args.bottom_weight + n * args.weight_count, args.op,
+        top_data, col_buff, args.new_weight + worker * args.scratch_count);
+  } else {
+    this->forward_cpu_gemm(args.bottom_data + n * this->bottom_dim_,
+        dynamic_weight_cpu(args, n, worker), top_data, false, col_buff);
+  }
+  if (args.bias) {
+    this->forward_cpu_bias(top_data, args.bias, args.bias_multiplier);
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::backward_dynamic_sample(const DynamicArgs& args,
+    int n, int worker) {
+  const int weight_count = args.weight_count;
+  const Dtype* top_diff = args.top_diff + n * this->top_dim_;
+  Dtype* col_buff = args.col_buffer + worker * args.col_stride;
+  if (args.fused) {
+    backward_dynamic_sample_fused(args, n, worker);
+    return;
+  }
+  // gradient w.r.t. bottom data, if necessary.
+  if (args.bottom_diff) {
+    this->backward_cpu_gemm(top_diff, dynamic_weight_cpu(args, n, worker),
+        args.bottom_diff + n * this->bottom_dim_, col_buff);
+  }
+  if (!args.weight_diff && !args.bottom_weight_diff) {
+    return;
+  }
+  // gradient w.r.t. the combined filter of this sample, computed in place
+  // in the filter bottom's diff unless that accumulates.
+  Dtype* bottom_weight_diff = args.bottom_weight_diff ?
+      args.bottom_weight_diff + n * weight_count : NULL;
+  Dtype* new_weight_diff = args.new_weight_diff + worker * weight_count;
+  if (bottom_weight_diff && !args.accumulate_bottom_weight_diff) {
+    new_weight_diff = bottom_weight_diff;
+  }
+  this->weight_cpu_gemm2(args.bottom_data + n * this->bottom_dim_, top_diff,
+      new_weight_diff, col_buff);
+  Dtype* weight_diff = !args.weight_diff ? NULL : (worker == 0) ?
+      args.weight_diff : args.weight_diff_buffer + (worker - 1) * weight_count;
+  caffe_combine_filter_backward(args.op, weight_count, args.weight,
+      args.bottom_weight + n * weight_count, new_weight_diff, weight_diff,
+      bottom_weight_diff, args.accumulate_bottom_weight_diff);
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::backward_dynamic_sample_fused(
+    const DynamicArgs& args, int n, int worker) {
+  const int weight_count = args.weight_count;
+  const Dtype* filter = args.bottom_weight + n * weight_count;
+  const Dtype* top_diff = args.top_diff + n * this->top_dim_;
+  Dtype* col_buff = args.col_buffer + worker * args.col_stride;
+  Dtype* tile = args.new_weight + worker * args.scratch_count;
+  if (args.weight_diff || args.bottom_weight_diff) {
+    Dtype* weight_diff = NULL;
+    if (args.weight_diff) {
+      weight_diff = (worker == 0) ? args.weight_diff :
+          args.weight_diff_buffer + (worker - 1) * weight_count;
+    }
+    this->weight_cpu_gemm_fused(args.bottom_data + n * this->bottom_dim_,
+        top_diff, args.weight, filter, args.op, weight_diff,
+        args.bottom_weight_diff ?
+            args.bottom_weight_diff + n * weight_count : NULL,
+        args.accumulate_bottom_weight_diff, col_buff, tile);
+  }
+  // gradient w.r.t. bottom data, if necessary.
+  if (args.bottom_diff) {
+    this->backward_cpu_gemm_fused(top_diff, args.weight, filter, args.op,
+        args.bottom_diff + n * this->bottom_dim_, col_buff, tile);
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::forward_dynamic_group(const DynamicArgs& args,
+    int group, int worker) {
+  const int start = dynamic_group_start_[group];
+  const int num_samples = dynamic_group_start_[group + 1] - start;
+  const int* samples = &dynamic_group_order_[start];
+  this->forward_cpu_gemm_shared(args.bottom_data, samples, num_samples,
+      dynamic_weight_cpu(args, samples[0], worker), args.top_data,
+      args.col_buffer + worker * args.col_stride,
+      args.top_buffer + worker * args.top_stride);
+  for (int s = 0; args.bias && s < num_samples; ++s) {
+    this->forward_cpu_bias(args.top_data + samples[s] * this->top_dim_,
+        args.bias, args.bias_multiplier);
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::backward_dynamic_group(const DynamicArgs& args,
+    int group, int worker) {
+  const int weight_count = args.weight_count;
+  const int start = dynamic_group_start_[group];
+  const int num_samples = dynamic_group_start_[group + 1] - start;
+  const int* samples = &dynamic_group_order_[start];
+  Dtype* col_buff = args.col_buffer + worker * args.col_stride;
+  Dtype* top_buff = args.top_buffer + worker * args.top_stride;
+  // gradient w.r.t. bottom data, if necessary.
+  if (args.bottom_diff) {
+    this->backward_cpu_gemm_shared(args.top_diff, samples, num_samples,
+        dynamic_weight_cpu(args, samples[0], worker), args.bottom_diff,
+        col_buff, top_buff);
+  }
+  if (args.bottom_weight_diff) {
+    // Every sample owns its filter row, so the filter gradients stay per
+    // sample. They reuse this worker's scratch.
+    DynamicArgs sample_args = args;
+    sample_args.bottom_diff = NULL;
+    for (int s = 0; s < num_samples; ++s) {
+      backward_dynamic_sample(sample_args, samples[s], worker);
+    }
+    return;
+  }
+  if (!args.weight_diff) {
+    return;
+  }
+  // blobs_[0] only needs the filter gradient summed over the group.
+  Dtype* filter_diff = args.new_weight_diff + worker * weight_count;
+  this->weight_cpu_gemm_shared(args.bottom_data, args.top_diff, samples,
+      num_samples, filter_diff, col_buff, top_buff);
+  Dtype* weight_diff = (worker == 0) ? args.weight_diff :
+      args.weight_diff_buffer + (worker - 1) * weight_count;
+  caffe_combine_filter_backward(args.op, weight_count, args.weight,
+      args.bottom_weight + samples[0] * weight_count, filter_diff, weight_diff,
+      static_cast<Dtype*>(NULL), false);
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Forward_dynamic_cpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  DynamicArgs args = DynamicArgs();
+  args.bottom_weight = bottom[bottom.size() - 1]->cpu_data();
+  const int num_workers = DynamicSetUp_cpu(args.bottom_weight, false);
+  const bool grouped = dynamic_grouped();
+  const int num_groups = dynamic_group_start_.size() - 1;
+  args.op = this->layer_param_.convolution_param().weight_operation();
+  args.weight_count = this->blobs_[0]->count();
+  args.weight = this->blobs_[0]->cpu_data();
+  if (this->bias_term_) {
+    args.bias = this->blobs_[1]->cpu_data();
+    args.bias_multiplier = this->bias_multiplier();
+  }
+  // Groups combine their filter once, so they never fuse.
+  args.fused = !grouped && dynamic_fused();
+  args.scratch_count = this->new_weight_->count(1);
+  args.new_weight = this->new_weight_->mutable_cpu_data();
+  args.col_stride = dynamic_col_buffer_.count(1);
+  args.col_buffer = dynamic_col_buffer_.mutable_cpu_data();
+  if (grouped) {
+    args.top_buffer = dynamic_group_top_buffer_.mutable_cpu_data();
+    args.top_stride = dynamic_group_top_buffer_.count(1);
+  }
+  for (int i = 0; i < top.size(); ++i) {
+    args.bottom_data = bottom[i]->cpu_data();
+    args.top_data = top[i]->mutable_cpu_data();
+    if (grouped) {
+      caffe_parallel_for(num_groups, num_workers,
+          boost::bind(&ConvolutionLayer<Dtype>::forward_dynamic_group, this,
+              boost::cref(args), _1, _2));
+      dynamic_gemms_saved_ += (this->num_ - num_groups) * this->group_;
+    } else {
+      caffe_parallel_for(this->num_, num_workers,
+          boost::bind(&ConvolutionLayer<Dtype>::forward_dynamic_sample, this,
+              boost::cref(args), _1, _2));
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Backward_dynamic_cpu(
+      const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+      const vector<Blob<Dtype>*>& bottom) {
+  const int filter_id = bottom.size() - 1;
+  DynamicArgs args = DynamicArgs();
+  args.op = this->layer_param_.convolution_param().weight_operation();
+  // COPY ignores blobs_[0], so it receives no gradient.
+  const bool need_weight_diff = this->param_propagate_down_[0] &&
+      args.op != ConvolutionParameter_WeightOp_COPY;
+  args.bottom_weight = bottom[filter_id]->cpu_data();
+  const int num_workers =
+      DynamicSetUp_cpu(args.bottom_weight, need_weight_diff);
+  const bool grouped = dynamic_grouped();
+  const int num_groups = dynamic_group_start_.size() - 1;
+  args.weight_count = this->blobs_[0]->count();
+  args.weight = this->blobs_[0]->cpu_data();
+  args.bottom_weight_diff = propagate_down[filter_id] ?
+      bottom[filter_id]->mutable_cpu_diff() : NULL;
+  args.weight_diff = need_weight_diff ?
+      this->blobs_[0]->mutable_cpu_diff() : NULL;
+  args.fused = !grouped && dynamic_fused();
+  args.scratch_count = this->new_weight_->count(1);
+  args.new_weight = this->new_weight_->mutable_cpu_data();
+  args.new_weight_diff = this->new_weight_->mutable_cpu_diff();
+  args.col_stride = dynamic_col_buffer_.count(1);
+  args.col_buffer = dynamic_col_buffer_.mutable_cpu_data();
+  if (need_weight_diff && num_workers > 1) {
+    args.weight_diff_buffer = dynamic_weight_diff_.mutable_cpu_data();
+  }
+  if (grouped) {
+    args.top_buffer = dynamic_group_top_buffer_.mutable_cpu_data();
+    args.top_stride = dynamic_group_top_buffer_.count(1);
+  }
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->cpu_diff();
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
+      for (int n = 0; n < this->num_; ++n) {
+        this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
+      }
+    }
+    args.top_diff = top_diff;
+    args.bottom_data = bottom[i]->cpu_data();
+    args.bottom_diff = propagate_down[i] ? bottom[i]->mutable_cpu_diff() : NULL;
+    args.accumulate_bottom_weight_diff = (i > 0);
+    if (grouped) {
+      caffe_parallel_for(num_groups, num_workers,
+          boost::bind(&ConvolutionLayer<Dtype>::backward_dynamic_group, this,
+              boost::cref(args), _1, _2));
+      // The filter gradients of samples with their own filter row stay per
+      // sample.
+      const int saved = (args.bottom_diff != NULL) +
+          (args.weight_diff && !args.bottom_weight_diff);
+      dynamic_gemms_saved_ +=
+          saved * (this->num_ - num_groups) * this->group_;
+    } else if (args.bottom_diff || args.bottom_weight_diff ||
+        args.weight_diff) {
+      caffe_parallel_for(this->num_, num_workers,
+          boost::bind(&ConvolutionLayer<Dtype>::backward_dynamic_sample, this,
+              boost::cref(args), _1, _2));
+    }
+  }
+  // Reduce the blobs_[0] gradients of the other workers.
+  for (int w = 1; args.weight_diff_buffer && w < num_workers; ++w) {
+    caffe_axpy(args.weight_count, Dtype(1),
+        args.weight_diff_buffer + (w - 1) * args.weight_count,
+        args.weight_diff);
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::DynamicBatchedSetUp() {
+  // One combined filter (and its diff) and one column buffer per sample.
+  vector<int> scratch_shape(2, this->num_);
+  scratch_shape[1] = this->blobs_[0]->count();
+  this->new_weight_->Reshape(scratch_shape);
+  scratch_shape[1] = this->col_buffer_count();
+  dynamic_col_buffer_.Reshape(scratch_shape);
+  if (dynamic_sum_multiplier_.count() != this->num_) {
+    vector<int> multiplier_shape(1, this->num_);
+    dynamic_sum_multiplier_.Reshape(multiplier_shape);
+    caffe_set(dynamic_sum_multiplier_.count(), Dtype(1),
+        dynamic_sum_multiplier_.mutable_cpu_data());
+  }
+}
+
+template <typename Dtype>
+const Dtype* ConvolutionLayer<Dtype>::dynamic_weight_batched_cpu(
+    const Dtype* bottom_weight) {
+  const ConvolutionParameter_WeightOp op =
+      this->layer_param_.convolution_param().weight_operation();
+  if (op == ConvolutionParameter_WeightOp_COPY) {
+    return bottom_weight;
+  }
+  const int weight_count = this->blobs_[0]->count();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* new_weight = this->new_weight_->mutable_cpu_data();
+  for (int n = 0; n < this->num_; ++n) {
+    caffe_combine_filter(op, weight_count, weight,
+        bottom_weight + n * weight_count, new_weight + n * weight_count);
+  }
+  return new_weight;
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Forward_dynamic_batched_cpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  DynamicBatchedSetUp();
+  const int weight_count = this->blobs_[0]->count();
+  const Dtype* weight =
+      dynamic_weight_batched_cpu(bottom[bottom.size() - 1]->cpu_data());
+  Dtype* col_buffer = dynamic_col_buffer_.mutable_cpu_data();
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    this->forward_cpu_gemm_batched(bottom_data, weight, weight_count,
+        top_data, col_buffer);
+    if (this->bias_term_) {
+      const Dtype* bias = this->blobs_[1]->cpu_data();
+      this->forward_cpu_bias_batched(top_data, bias);
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Backward_dynamic_batched_cpu(
+      const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+      const vector<Blob<Dtype>*>& bottom) {
+  DynamicBatchedSetUp();
+  const ConvolutionParameter_WeightOp op =
+      this->layer_param_.convolution_param().weight_operation();
+  const int filter_id = bottom.size() - 1;
+  const int weight_count = this->blobs_[0]->count();
+  const int batch_weight_count = this->num_ * weight_count;
+  // COPY ignores blobs_[0], so it receives no gradient.
+  const bool need_weight_diff = this->param_propagate_down_[0] &&
+      op != ConvolutionParameter_WeightOp_COPY;
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* bottom_weight = bottom[filter_id]->cpu_data();
+  Dtype* bottom_weight_diff = propagate_down[filter_id] ?
+      bottom[filter_id]->mutable_cpu_diff() : NULL;
+  Dtype* col_buffer = dynamic_col_buffer_.mutable_cpu_data();
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->cpu_diff();
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
+      for (int n = 0; n < this->num_; ++n) {
+        this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
+      }
+    }
+    if (need_weight_diff || bottom_weight_diff) {
+      // gradient w.r.t. the combined filters. The first top writes straight
+      // into the filter bottom's diff, later tops accumulate into it.
+      Dtype* filter_diff = (bottom_weight_diff && i == 0) ?
+          bottom_weight_diff : this->new_weight_->mutable_cpu_diff();
+      this->weight_cpu_gemm_batched(bottom_data, top_diff, filter_diff,
+          col_buffer);
+      if (need_weight_diff) {
+        const Dtype* sum_diff = filter_diff;
+        if (op == ConvolutionParameter_WeightOp_MUL) {
+          Dtype* product = this->new_weight_->mutable_cpu_data();
+          caffe_mul(batch_weight_count, filter_diff, bottom_weight, product);
+          sum_diff = product;
+        }
+        caffe_cpu_gemv<Dtype>(CblasTrans, this->num_, weight_count, 1.,
+            sum_diff, dynamic_sum_multiplier_.cpu_data(), 1.,
+            this->blobs_[0]->mutable_cpu_diff());
+      }
+      if (bottom_weight_diff) {
+        for (int n = 0; n < this->num_; ++n) {
+          caffe_combine_filter_backward(op, weight_count, weight,
+              bottom_weight + n * weight_count, filter_diff + n * weight_count,
+              static_cast<Dtype*>(NULL), bottom_weight_diff + n * weight_count,
+              filter_diff != bottom_weight_diff);
+        }
+      }
+    }
+    // gradient w.r.t. bottom data, if necessary.
+    if (propagate_down[i]) {
+      this->backward_cpu_gemm_batched(top_diff,
+          dynamic_weight_batched_cpu(bottom_weight), weight_count,
+          bottom[i]->mutable_cpu_diff(), col_buffer);
+    }
+  }
+}
+
+template <typename Dtype>
+int ConvolutionLayer<Dtype>::FactorizedSetUp(
+    const vector<Blob<Dtype>*>& bottom, int num_top) {
+  // ADD also convolves with blobs_[0], as one more basis filter whose
+  // coefficient is always 1.
+  const int num_basis = bottom[bottom.size() - 2]->count(1) +
+      (this->layer_param_.convolution_param().weight_operation() ==
+       ConvolutionParameter_WeightOp_ADD);
+  // The combined basis filters (and their diff), one column buffer per
+  // sample and the output of every basis filter for every top.
+  vector<int> scratch_shape(2, num_basis);
+  scratch_shape[1] = this->blobs_[0]->count();
+  this->new_weight_->Reshape(scratch_shape);
+  scratch_shape[0] = this->num_;
+  scratch_shape[1] = this->col_buffer_count();
+  dynamic_col_buffer_.Reshape(scratch_shape);
+  vector<int> top_buffer_shape(3, num_top * num_basis);
+  top_buffer_shape[1] = this->num_;
+  top_buffer_shape[2] = this->top_dim_;
+  factorized_top_buffer_.Reshape(top_buffer_shape);
+  if (factorized_sum_multiplier_.count() != this->top_dim_) {
+    vector<int> multiplier_shape(1, this->top_dim_);
+    factorized_sum_multiplier_.Reshape(multiplier_shape);
+    caffe_set(factorized_sum_multiplier_.count(), Dtype(1),
+        factorized_sum_multiplier_.mutable_cpu_data());
+  }
+  return num_basis;
+}
+
+template <typename Dtype>
+const Dtype* ConvolutionLayer<Dtype>::factorized_basis_cpu(
+    const Dtype* basis, int num_coefficients) {
+  const int weight_count = this->blobs_[0]->count();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* new_weight = this->new_weight_->mutable_cpu_data();
+  switch (this->layer_param_.convolution_param().weight_operation()) {
+  case ConvolutionParameter_WeightOp_MUL:
+    // blobs_[0] * sum_k c_k * basis_k == sum_k c_k * (blobs_[0] * basis_k)
+    for (int k = 0; k < num_coefficients; ++k) {
+      caffe_mul(weight_count, weight, basis + k * weight_count,
+          new_weight + k * weight_count);
+    }
+    return new_weight;
+  case ConvolutionParameter_WeightOp_ADD:
+    caffe_copy(num_coefficients * weight_count, basis, new_weight);
+    caffe_copy(weight_count, weight,
+        new_weight + num_coefficients * weight_count);
+    return new_weight;
+  case ConvolutionParameter_WeightOp_COPY:
+    return basis;
+  default:
+    LOG(FATAL) << "Unknown weight operation.";
+  }
+  return NULL;
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Forward_factorized_cpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const int coefficient_id = bottom.size() - 2;
+  const int num_basis = FactorizedSetUp(bottom, top.size());
+  const int num_coefficients = bottom[coefficient_id]->count(1);
+  const int batch_count = this->num_ * this->top_dim_;
+  const Dtype* coefficients = bottom[coefficient_id]->cpu_data();
+  const Dtype* basis = factorized_basis_cpu(
+      bottom[coefficient_id + 1]->cpu_data(), num_coefficients);
+  Dtype* col_buffer = dynamic_col_buffer_.mutable_cpu_data();
+  for (int i = 0; i < top.size(); ++i) {
+    Dtype* basis_top = factorized_top_buffer_.mutable_cpu_data() +
+        i * num_basis * batch_count;
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    this->forward_cpu_gemm_basis(bottom[i]->cpu_data(), basis, num_basis,
+        basis_top, col_buffer);
+    // Mix the basis outputs of each sample with its coefficients.
+    caffe_set(batch_count, Dtype(0), top_data);
+    for (int n = 0; n < this->num_; ++n) {
+      const Dtype* coefficient = coefficients + n * num_coefficients;
+      for (int k = 0; k < num_basis; ++k) {
+        caffe_axpy(this->top_dim_,
+            k < num_coefficients ? coefficient[k] : Dtype(1),
+            basis_top + k * batch_count + n * this->top_dim_,
+            top_data + n * this->top_dim_);
+      }
+    }
+    if (this->bias_term_) {
+      const Dtype* bias = this->blobs_[1]->cpu_data();
+      this->forward_cpu_bias_batched(top_data, bias);
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Backward_factorized_cpu(
+      const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+      const vector<Blob<Dtype>*>& bottom) {
+  const ConvolutionParameter_WeightOp op =
+      this->layer_param_.convolution_param().weight_operation();
+  const int coefficient_id = bottom.size() - 2;
+  const int basis_id = bottom.size() - 1;
+  const int num_basis = FactorizedSetUp(bottom, top.size());
+  const int num_coefficients = bottom[coefficient_id]->count(1);
+  const int weight_count = this->blobs_[0]->count();
+  const int batch_count = this->num_ * this->top_dim_;
+  // COPY ignores blobs_[0], so it receives no gradient.
+  const bool need_weight_diff = this->param_propagate_down_[0] &&
+      op != ConvolutionParameter_WeightOp_COPY;
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* coefficients = bottom[coefficient_id]->cpu_data();
+  const Dtype* basis = bottom[basis_id]->cpu_data();
+  const Dtype* new_basis = factorized_basis_cpu(basis, num_coefficients);
+  Dtype* col_buffer = dynamic_col_buffer_.mutable_cpu_data();
+  // gradient w.r.t. the combined basis filters, summed over the tops.
+  Dtype* basis_diff = NULL;
+  if (need_weight_diff || propagate_down[basis_id]) {
+    basis_diff = this->new_weight_->mutable_cpu_diff();
+    caffe_set(num_basis * weight_count, Dtype(0), basis_diff);
+  }
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->cpu_diff();
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
+      for (int n = 0; n < this->num_; ++n) {
+        this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
+      }
+    }
+    Dtype* basis_top = factorized_top_buffer_.mutable_cpu_data() +
+        i * num_basis * batch_count;
+    // gradient w.r.t. the coefficients. Tops after the first one
+    // accumulate into it.
+    if (propagate_down[coefficient_id]) {
+      Dtype* coefficient_diff = bottom[coefficient_id]->mutable_cpu_diff();
+      for (int n = 0; n < this->num_; ++n) {
+        for (int k = 0; k < num_coefficients; ++k) {
+          const Dtype dot = caffe_cpu_dot(this->top_dim_,
+              top_diff + n * this->top_dim_,
+              basis_top + k * batch_count + n * this->top_dim_);
+          Dtype* diff = coefficient_diff + n * num_coefficients + k;
+          *diff = (i > 0) ? *diff + dot : dot;
+        }
+      }
+    }
+    if (!basis_diff && !propagate_down[i]) {
+      continue;
+    }
+    // The top diff seen by each basis filter, in place of its outputs.
+    for (int k = 0; k < num_basis; ++k) {
+      for (int n = 0; n < this->num_; ++n) {
+        caffe_cpu_scale(this->top_dim_, k < num_coefficients ?
+            coefficients[n * num_coefficients + k] : Dtype(1),
+            top_diff + n * this->top_dim_,
+            basis_top + k * batch_count + n * this->top_dim_);
+      }
+    }
+    if (basis_diff) {
+      this->weight_cpu_gemm_basis(bottom[i]->cpu_data(), basis_top,
+          num_basis, basis_diff, col_buffer);
+    }
+    // gradient w.r.t. bottom data, if necessary.
+    if (propagate_down[i]) {
+      this->backward_cpu_gemm_basis(basis_top, new_basis, num_basis,
+          bottom[i]->mutable_cpu_diff(), col_buffer);
+    }
+  }
+  if (need_weight_diff) {
+    Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+    if (op == ConvolutionParameter_WeightOp_MUL) {
+      for (int k = 0; k < num_coefficients; ++k) {
+        const Dtype* diff = basis_diff + k * weight_count;
+        const Dtype* filter = basis + k * weight_count;
+        for (int j = 0; j < weight_count; ++j) {
+          weight_diff[j] += diff[j] * filter[j];
+        }
+      }
+    } else {
+      caffe_axpy(weight_count, Dtype(1),
+          basis_diff + num_coefficients * weight_count, weight_diff);
+    }
+  }
+  if (propagate_down[basis_id]) {
+    Dtype* bottom_basis_diff = bottom[basis_id]->mutable_cpu_diff();
+    if (op == ConvolutionParameter_WeightOp_MUL) {
+      for (int k = 0; k < num_coefficients; ++k) {
+        caffe_mul(weight_count, basis_diff + k * weight_count, weight,
+            bottom_basis_diff + k * weight_count);
+      }
+    } else {
+      caffe_copy(num_coefficients * weight_count, basis_diff,
+          bottom_basis_diff);
+    }
+  }
+}
+
 #ifdef CPU_ONLY
 STUB_GPU(ConvolutionLayer);
 #endif
@@ -65,13 +65,447 @@
 
 namespace caffe {
 
+template <typename Dtype>
+__global__ void DynamicWeightMul(const int nthreads, const int weight_count,
+    const Dtype* weight, const Dtype* filter, Dtype* new_weight) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    new_weight[index] = weight[index % weight_count] * filter[index];
+  }
+}
+
+template <typename Dtype>
+__global__ void DynamicWeightAdd(const int nthreads, const int weight_count,
+    const Dtype* weight, const Dtype* filter, Dtype* new_weight) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    new_weight[index] = weight[index % weight_count] + filter[index];
+  }
+}
+
+template <typename Dtype>
+const Dtype* ConvolutionLayer<Dtype>::dynamic_weight_batched_gpu(
+    const Dtype* bottom_weight) {
+  const int weight_count = this->blobs_[0]->count();
+  const int count = this->num_ * weight_count;
+  const Dtype* weight = this->blobs_[0]->gpu_data();
+  Dtype* new_weight = this->new_weight_->mutable_gpu_data();
+  switch (this->layer_param_.convolution_param().weight_operation()) {
+  case ConvolutionParameter_WeightOp_MUL:
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    DynamicWeightMul<Dtype><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS>>>(count, weight_count, weight, bottom_weight,
+        new_weight);
+    CUDA_POST_KERNEL_CHECK;
+    return new_weight;
+  case ConvolutionParameter_WeightOp_ADD:
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    DynamicWeightAdd<Dtype><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS>>>(count, weight_count, weight, bottom_weight,
+        new_weight);
+    CUDA_POST_KERNEL_CHECK;
+    return new_weight;
+  case ConvolutionParameter_WeightOp_COPY:
+    return bottom_weight;
+  default:
+    LOG(FATAL) << "Unknown weight operation.";
+  }
+  return NULL;
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Forward_dynamic_batched_gpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  DynamicBatchedSetUp();
+  const int weight_count = this->blobs_[0]->count();
+  const Dtype* weight =
+      dynamic_weight_batched_gpu(bottom[bottom.size() - 1]->gpu_data());
+  Dtype* col_buffer = dynamic_col_buffer_.mutable_gpu_data();
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->gpu_data();
+    Dtype* top_data = top[i]->mutable_gpu_data();
+    this->forward_gpu_gemm_batched(bottom_data, weight, weight_count,
+        top_data, col_buffer);
+    if (this->bias_term_) {
+      const Dtype* bias = this->blobs_[1]->gpu_data();
+      this->forward_gpu_bias_batched(top_data, bias);
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Backward_dynamic_batched_gpu(
+      const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+      const vector<Blob<Dtype>*>& bottom) {
+  DynamicBatchedSetUp();
+  const ConvolutionParameter_WeightOp op =
+      this->layer_param_.convolution_param().weight_operation();
+  const int filter_id = bottom.size() - 1;
+  const int weight_count = this->blobs_[0]->count();
+  const int batch_weight_count = this->num_ * weight_count;
+  // COPY ignores blobs_[0], so it receives no gradient.
+  const bool need_weight_diff = this->param_propagate_down_[0] &&
+      op != ConvolutionParameter_WeightOp_COPY;
+  const Dtype* weight = this->blobs_[0]->gpu_data();
+  const Dtype* bottom_weight = bottom[filter_id]->gpu_data();
+  Dtype* bottom_weight_diff = propagate_down[filter_id] ?
+      bottom[filter_id]->mutable_gpu_diff() : NULL;
+  Dtype* col_buffer = dynamic_col_buffer_.mutable_gpu_data();
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->gpu_diff();
+    const Dtype* bottom_data = bottom[i]->gpu_data();
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_gpu_diff();
+      for (int n = 0; n < this->num_; ++n) {
+        this->backward_gpu_bias(bias_diff, top_diff + n * this->top_dim_);
+      }
+    }
+    if (need_weight_diff || bottom_weight_diff) {
+      // gradient w.r.t. the combined filters. The first top writes straight
+      // into the filter bottom's diff, later tops accumulate into it.
+      Dtype* filter_diff = (bottom_weight_diff && i == 0) ?
+          bottom_weight_diff : this->new_weight_->mutable_gpu_diff();
+      this->weight_gpu_gemm_batched(bottom_data, top_diff, filter_diff,
+          col_buffer);
+      if (need_weight_diff) {
+        const Dtype* sum_diff = filter_diff;
+        if (op == ConvolutionParameter_WeightOp_MUL) {
+          Dtype* product = this->new_weight_->mutable_gpu_data();
+          caffe_gpu_mul(batch_weight_count, filter_diff, bottom_weight,
+              product);
+          sum_diff = product;
+        }
+        caffe_gpu_gemv<Dtype>(CblasTrans, this->num_, weight_count, 1.,
+            sum_diff, dynamic_sum_multiplier_.gpu_data(), 1.,
+            this->blobs_[0]->mutable_gpu_diff());
+      }
+      if (bottom_weight_diff) {
+        if (op == ConvolutionParameter_WeightOp_MUL) {
+          // NOLINT_NEXT_LINE(whitespace/operators)
+          DynamicWeightMul<Dtype><<<CAFFE_GET_BLOCKS(batch_weight_count),
+              CAFFE_CUDA_NUM_THREADS>>>(batch_weight_count, weight_count,
+              weight, filter_diff, filter_diff);
+          CUDA_POST_KERNEL_CHECK;
+        }
+        if (filter_diff != bottom_weight_diff) {
+          caffe_gpu_axpy(batch_weight_count, Dtype(1), filter_diff,
+              bottom_weight_diff);
+        }
+      }
+    }
+    // gradient w.r.t. bottom data, if necessary.
+    if (propagate_down[i]) {
+      this->backward_gpu_gemm_batched(top_diff,
+          dynamic_weight_batched_gpu(bottom_weight), weight_count,
+          bottom[i]->mutable_gpu_diff(), col_buffer);
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Forward_dynamic_fused_gpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const ConvolutionParameter_WeightOp op =
+      this->layer_param_.convolution_param().weight_operation();
+  const int weight_count = this->blobs_[0]->count();
+  const Dtype* weight = this->blobs_[0]->gpu_data();
+  const Dtype* bottom_weight = bottom[bottom.size() - 1]->gpu_data();
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->gpu_data();
+    Dtype* top_data = top[i]->mutable_gpu_data();
+    for (int n = 0; n < this->num_; ++n) {
+      this->forward_gpu_gemm_fused(bottom_data + n * this->bottom_dim_, weight,
+          bottom_weight + n * weight_count, op, top_data + n * this->top_dim_);
+      if (this->bias_term_) {
+        const Dtype* bias = this->blobs_[1]->gpu_data();
+        this->forward_gpu_bias(top_data + n * this->top_dim_, bias);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Backward_dynamic_fused_gpu(
+      const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+      const vector<Blob<Dtype>*>& bottom) {
+  const ConvolutionParameter_WeightOp op =
+      this->layer_param_.convolution_param().weight_operation();
+  const int filter_id = bottom.size() - 1;
+  const int weight_count = this->blobs_[0]->count();
+  const Dtype* weight = this->blobs_[0]->gpu_data();
+  Dtype* weight_diff = this->param_propagate_down_[0] ?
+      this->blobs_[0]->mutable_gpu_diff() : NULL;
+  const Dtype* bottom_weight = bottom[filter_id]->gpu_data();
+  Dtype* bottom_weight_diff = propagate_down[filter_id] ?
+      bottom[filter_id]->mutable_gpu_diff() : NULL;
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->gpu_diff();
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_gpu_diff();
+      for (int n = 0; n < this->num_; ++n) {
+        this->backward_gpu_bias(bias_diff, top_diff + n * this->top_dim_);
+      }
+    }
+    const Dtype* bottom_data = bottom[i]->gpu_data();
+    Dtype* bottom_diff = propagate_down[i] ?
+        bottom[i]->mutable_gpu_diff() : NULL;
+    for (int n = 0; n < this->num_; ++n) {
+      const Dtype* filter = bottom_weight + n * weight_count;
+      // gradients w.r.t. blobs_[0] and the filter; tops after the first one
+      // accumulate into the filter bottom's diff.
+      if (weight_diff || bottom_weight_diff) {
+        this->weight_gpu_gemm_fused(bottom_data + n * this->bottom_dim_,
+            top_diff + n * this->top_dim_, weight, filter, op, weight_diff,
+            bottom_weight_diff ? bottom_weight_diff + n * weight_count : NULL,
+            i > 0);
+      }
+      // gradient w.r.t. bottom data, if necessary.
+      if (bottom_diff) {
+        this->backward_gpu_gemm_fused(top_diff + n * this->top_dim_, weight,
+            filter, op, bottom_diff + n * this->bottom_dim_);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+__global__ void FactorizedMix(const int nthreads, const int dim,
+    const int num_coefficients, const bool add_weight,
+    const Dtype* coefficients, const Dtype* basis_top, Dtype* top) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const Dtype* coefficient = coefficients + (index / dim) * num_coefficients;
+    Dtype sum = add_weight ?
+        basis_top[num_coefficients * nthreads + index] : Dtype(0);
+    for (int k = 0; k < num_coefficients; ++k) {
+      sum += coefficient[k] * basis_top[k * nthreads + index];
+    }
+    top[index] = sum;
+  }
+}
+
+template <typename Dtype>
+__global__ void FactorizedScale(const int nthreads, const int batch_count,
+    const int dim, const int num_coefficients, const Dtype* coefficients,
+    const Dtype* top_diff, Dtype* basis_top_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int k = index / batch_count;
+    const int i = index % batch_count;
+    const Dtype scale = (k < num_coefficients) ?
+        coefficients[(i / dim) * num_coefficients + k] : Dtype(1);
+    basis_top_diff[index] = scale * top_diff[i];
+  }
+}
+
+template <typename Dtype>
+__global__ void FactorizedCoefficientDiff(const int nthreads,
+    const int num, const int num_coefficients, const bool accumulate,
+    const Dtype* sums, Dtype* coefficient_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int n = index / num_coefficients;
+    const int k = index % num_coefficients;
+    const Dtype diff = sums[k * num + n];
+    coefficient_diff[index] = accumulate ?
+        coefficient_diff[index] + diff : diff;
+  }
+}
+
+template <typename Dtype>
+__global__ void FactorizedWeightDiff(const int nthreads,
+    const int num_coefficients, const Dtype* basis_diff, const Dtype* basis,
+    Dtype* weight_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    Dtype sum = 0;
+    for (int k = 0; k < num_coefficients; ++k) {
+      sum += basis_diff[k * nthreads + index] * basis[k * nthreads + index];
+    }
+    weight_diff[index] += sum;
+  }
+}
+
+template <typename Dtype>
+const Dtype* ConvolutionLayer<Dtype>::factorized_basis_gpu(
+    const Dtype* basis, int num_coefficients) {
+  const int weight_count = this->blobs_[0]->count();
+  const int count = num_coefficients * weight_count;
+  const Dtype* weight = this->blobs_[0]->gpu_data();
+  Dtype* new_weight = this->new_weight_->mutable_gpu_data();
+  switch (this->layer_param_.convolution_param().weight_operation()) {
+  case ConvolutionParameter_WeightOp_MUL:
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    DynamicWeightMul<Dtype><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS>>>(count, weight_count, weight, basis,
+        new_weight);
+    CUDA_POST_KERNEL_CHECK;
+    return new_weight;
+  case ConvolutionParameter_WeightOp_ADD:
+    caffe_copy(count, basis, new_weight);
+    caffe_copy(weight_count, weight, new_weight + count);
+    return new_weight;
+  case ConvolutionParameter_WeightOp_COPY:
+    return basis;
+  default:
+    LOG(FATAL) << "Unknown weight operation.";
+  }
+  return NULL;
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Forward_factorized_gpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const int coefficient_id = bottom.size() - 2;
+  const int num_basis = FactorizedSetUp(bottom, top.size());
+  const int num_coefficients = bottom[coefficient_id]->count(1);
+  const int batch_count = this->num_ * this->top_dim_;
+  const Dtype* coefficients = bottom[coefficient_id]->gpu_data();
+  const Dtype* basis = factorized_basis_gpu(
+      bottom[coefficient_id + 1]->gpu_data(), num_coefficients);
+  Dtype* col_buffer = dynamic_col_buffer_.mutable_gpu_data();
+  for (int i = 0; i < top.size(); ++i) {
+    Dtype* basis_top = factorized_top_buffer_.mutable_gpu_data() +
+        i * num_basis * batch_count;
+    Dtype* top_data = top[i]->mutable_gpu_data();
+    this->forward_gpu_gemm_basis(bottom[i]->gpu_data(), basis, num_basis,
+        basis_top, col_buffer);
+    // Mix the basis outputs of each sample with its coefficients.
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    FactorizedMix<Dtype><<<CAFFE_GET_BLOCKS(batch_count),
+        CAFFE_CUDA_NUM_THREADS>>>(batch_count, this->top_dim_,
+        num_coefficients, num_basis > num_coefficients, coefficients,
+        basis_top, top_data);
+    CUDA_POST_KERNEL_CHECK;
+    if (this->bias_term_) {
+      const Dtype* bias = this->blobs_[1]->gpu_data();
+      this->forward_gpu_bias_batched(top_data, bias);
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Backward_factorized_gpu(
+      const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+      const vector<Blob<Dtype>*>& bottom) {
+  const ConvolutionParameter_WeightOp op =
+      this->layer_param_.convolution_param().weight_operation();
+  const int coefficient_id = bottom.size() - 2;
+  const int basis_id = bottom.size() - 1;
+  const int num_basis = FactorizedSetUp(bottom, top.size());
+  const int num_coefficients = bottom[coefficient_id]->count(1);
+  const int weight_count = this->blobs_[0]->count();
+  const int batch_count = this->num_ * this->top_dim_;
+  // COPY ignores blobs_[0], so it receives no gradient.
+  const bool need_weight_diff = this->param_propagate_down_[0] &&
+      op != ConvolutionParameter_WeightOp_COPY;
+  const Dtype* weight = this->blobs_[0]->gpu_data();
+  const Dtype* coefficients = bottom[coefficient_id]->gpu_data();
+  const Dtype* basis = bottom[basis_id]->gpu_data();
+  const Dtype* new_basis = factorized_basis_gpu(basis, num_coefficients);
+  Dtype* col_buffer = dynamic_col_buffer_.mutable_gpu_data();
+  // gradient w.r.t. the combined basis filters, summed over the tops.
+  Dtype* basis_diff = NULL;
+  if (need_weight_diff || propagate_down[basis_id]) {
+    basis_diff = this->new_weight_->mutable_gpu_diff();
+    caffe_gpu_set(num_basis * weight_count, Dtype(0), basis_diff);
+  }
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->gpu_diff();
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_gpu_diff();
+      for (int n = 0; n < this->num_; ++n) {
+        this->backward_gpu_bias(bias_diff, top_diff + n * this->top_dim_);
+      }
+    }
+    Dtype* basis_top = factorized_top_buffer_.mutable_gpu_data() +
+        i * num_basis * batch_count;
+    // gradient w.r.t. the coefficients: the basis outputs are weighted by
+    // the top diff in place (FactorizedScale overwrites them below anyway),
+    // summed into K x N dots with one gemv and transposed on the device.
+    // Tops after the first one accumulate into it.
+    if (propagate_down[coefficient_id]) {
+      const int count = num_coefficients * batch_count;
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      DynamicWeightMul<Dtype><<<CAFFE_GET_BLOCKS(count),
+          CAFFE_CUDA_NUM_THREADS>>>(count, batch_count, top_diff, basis_top,
+          basis_top);
+      CUDA_POST_KERNEL_CHECK;
+      Dtype* sums = factorized_top_buffer_.mutable_gpu_diff();
+      caffe_gpu_gemv<Dtype>(CblasNoTrans, num_coefficients * this->num_,
+          this->top_dim_, 1., basis_top,
+          factorized_sum_multiplier_.gpu_data(), 0., sums);
+      const int coefficient_count = this->num_ * num_coefficients;
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      FactorizedCoefficientDiff<Dtype><<<CAFFE_GET_BLOCKS(coefficient_count),
+          CAFFE_CUDA_NUM_THREADS>>>(coefficient_count, this->num_,
+          num_coefficients, i > 0, sums,
+          bottom[coefficient_id]->mutable_gpu_diff());
+      CUDA_POST_KERNEL_CHECK;
+    }
+    if (!basis_diff && !propagate_down[i]) {
+      continue;
+    }
+    // The top diff seen by each basis filter, in place of its outputs.
+    const int count = num_basis * batch_count;
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    FactorizedScale<Dtype><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS>>>(count, batch_count, this->top_dim_,
+        num_coefficients, coefficients, top_diff, basis_top);
+    CUDA_POST_KERNEL_CHECK;
+    if (basis_diff) {
+      this->weight_gpu_gemm_basis(bottom[i]->gpu_data(), basis_top,
+          num_basis, basis_diff, col_buffer);
+    }
+    // gradient w.r.t. bottom data, if necessary.
+    if (propagate_down[i]) {
+      this->backward_gpu_gemm_basis(basis_top, new_basis, num_basis,
+          bottom[i]->mutable_gpu_diff(), col_buffer);
+    }
+  }
+  if (need_weight_diff) {
+    Dtype* weight_diff = this->blobs_[0]->mutable_gpu_diff();
+    if (op == ConvolutionParameter_WeightOp_MUL) {
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      FactorizedWeightDiff<Dtype><<<CAFFE_GET_BLOCKS(weight_count),
+          CAFFE_CUDA_NUM_THREADS>>>(weight_count, num_coefficients,
+          basis_diff, basis, weight_diff);
+      CUDA_POST_KERNEL_CHECK;
+    } else {
+      caffe_gpu_axpy(weight_count, Dtype(1),
+          basis_diff + num_coefficients * weight_count, weight_diff);
+    }
+  }
+  if (propagate_down[basis_id]) {
+    const int count = num_coefficients * weight_count;
+    Dtype* bottom_basis_diff = bottom[basis_id]->mutable_gpu_diff();
+    if (op == ConvolutionParameter_WeightOp_MUL) {
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      DynamicWeightMul<Dtype><<<CAFFE_GET_BLOCKS(count),
+          CAFFE_CUDA_NUM_THREADS>>>(count, weight_count, weight, basis_diff,
+          bottom_basis_diff);
+      CUDA_POST_KERNEL_CHECK;
+    } else {
+      caffe_copy(count, basis_diff, bottom_basis_diff);
+    }
+  }
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* weight = this->blobs_[0]->gpu_data();
   int bottom_size = bottom.size();
   int top_size = top.size();
-  if(bottom_size - top_size == 1){
+  if(bottom_size - top_size == 2){
+    Forward_factorized_gpu(bottom, top);
+  }
+  else if(bottom_size - top_size == 1 &&
+      this->layer_param_.convolution_param().dynamic_engine() ==
+      ConvolutionParameter_DynamicEngine_BATCHED){
+    Forward_dynamic_batched_gpu(bottom, top);
+  }
+  else if(bottom_size - top_size == 1 && this->dynamic_fused()){
+    Forward_dynamic_fused_gpu(bottom, top);
+  }
+  else if(bottom_size - top_size == 1){
     //luojun
     const ConvolutionParameter_WeightOp op_ = this->layer_param_.convolution_param().weight_operation();
     //
@@ -90,7 +524,7 @@ void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
           caffe_gpu_add(weight_count, weight, bottom_weight + n * weight_count, new_weight);
           break;
         case ConvolutionParameter_WeightOp_COPY:
-          caffe_gpu_memcpy(weight_count, bottom_weight + n * weight_count, new_weight);
+          caffe_copy(weight_count, bottom_weight + n * weight_count, new_weight);
           break;
         default:
           LOG(FATAL) << "Unknown weight operation.";
@@ -128,7 +562,18 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   Dtype* weight_diff = this->blobs_[0]->mutable_gpu_diff();
   int bottom_size = bottom.size();
   int top_size = top.size();
-  if (bottom_size - top_size == 1){
+  if (bottom_size - top_size == 2){
+    Backward_factorized_gpu(top, propagate_down, bottom);
+  }
+  else if (bottom_size - top_size == 1 &&
+      this->layer_param_.convolution_param().dynamic_engine() ==
+      ConvolutionParameter_DynamicEngine_BATCHED){
+    Backward_dynamic_batched_gpu(top, propagate_down, bottom);
+  }
+  else if (bottom_size - top_size == 1 && this->dynamic_fused()){
+    Backward_dynamic_fused_gpu(top, propagate_down, bottom);
+  }
+  else if (bottom_size - top_size == 1){
         //luojun
     const ConvolutionParameter_WeightOp op_ = this->layer_param_.convolution_param().weight_operation();
     //
@@ -157,10 +602,24 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
           }
           // gradient w.r.t. bottom data, if necessary.
           if (propagate_down[i]) {
+            // new_weight only holds the filter of the last forward sample.
+            switch(op_){
+            case ConvolutionParameter_WeightOp_MUL:
+              caffe_gpu_mul(weight_count, weight, bottom_weight + n * weight_count, new_weight);
+              break;
+            case ConvolutionParameter_WeightOp_ADD:
+              caffe_gpu_add(weight_count, weight, bottom_weight + n * weight_count, new_weight);
+              break;
+            case ConvolutionParameter_WeightOp_COPY:
+              caffe_copy(weight_count, bottom_weight + n * weight_count, new_weight);
+              break;
+            default:
+              LOG(FATAL) << "Unknown weight operation.";
+            }
             this->backward_gpu_gemm(top_diff + n * this->top_dim_, new_weight,
                 bottom_diff + n * this->bottom_dim_);
           }
-          switch(op_){ 
+          switch(op_){
             case ConvolutionParameter_WeightOp_MUL:
               caffe_gpu_mul(weight_count, new_weight_diff, bottom_weight + n * weight_count, new_weight);
               caffe_gpu_axpy(weight_count, Dtype(1.0), new_weight, weight_diff);
@@ -168,10 +627,10 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
               break;
             case ConvolutionParameter_WeightOp_ADD:
               caffe_gpu_axpy(weight_count, Dtype(1.0), new_weight_diff, weight_diff);
-              caffe_gpu_memcpy(weight_count, new_weight_diff, bottom_weight_diff + n * weight_count);
+              caffe_copy(weight_count, new_weight_diff, bottom_weight_diff + n * weight_count);
               break;
             case ConvolutionParameter_WeightOp_COPY:
-              caffe_gpu_memcpy(weight_count, new_weight_diff, bottom_weight_diff + n * weight_count);
+              caffe_copy(weight_count, new_weight_diff, bottom_weight_diff + n * weight_count);
               break;
             default:
               LOG(FATAL) << "Unknown weight operation.";
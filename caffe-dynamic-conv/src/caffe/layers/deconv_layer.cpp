@@ -25,10 +25,19 @@ template <typename Dtype>
 void DeconvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* weight = this->blobs_[0]->cpu_data();
-  for (int i = 0; i < bottom.size(); ++i) {
+  // Given one more bottom than tops, the last one holds a filter per sample.
+  const bool dynamic = bottom.size() > top.size();
+  const int weight_count = this->blobs_[0]->count();
+  const Dtype* bottom_weight =
+      dynamic ? bottom[top.size()]->cpu_data() : NULL;
+  for (int i = 0; i < top.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
     for (int n = 0; n < this->num_; ++n) {
+      if (dynamic) {
+        weight = this->dynamic_combine_cpu(bottom_weight + n * weight_count,
+            this->new_weight_->mutable_cpu_data());
+      }
       this->backward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
           top_data + n * this->top_dim_);
       if (this->bias_term_) {
@@ -44,6 +53,16 @@ void DeconvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  const bool dynamic = bottom.size() > top.size();
+  const int filter_id = top.size();
+  const int weight_count = this->blobs_[0]->count();
+  // Dynamic filters go through the gradient w.r.t. each combined filter.
+  const bool need_filter_diff = dynamic &&
+      (this->param_propagate_down_[0] || propagate_down[filter_id]);
+  const Dtype* bottom_weight =
+      dynamic ? bottom[filter_id]->cpu_data() : NULL;
+  Dtype* bottom_weight_diff = (dynamic && propagate_down[filter_id]) ?
+      bottom[filter_id]->mutable_cpu_diff() : NULL;
   for (int i = 0; i < top.size(); ++i) {
     const Dtype* top_diff = top[i]->cpu_diff();
     const Dtype* bottom_data = bottom[i]->cpu_data();
@@ -55,10 +74,24 @@ void DeconvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
         this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
       }
     }
-    if (this->param_propagate_down_[0] || propagate_down[i]) {
+    if (this->param_propagate_down_[0] || propagate_down[i] ||
+        need_filter_diff) {
       for (int n = 0; n < this->num_; ++n) {
-        // Gradient w.r.t. weight. Note that we will accumulate diffs.
-        if (this->param_propagate_down_[0]) {
+        if (dynamic) {
+          weight = this->dynamic_combine_cpu(bottom_weight + n * weight_count,
+              this->new_weight_->mutable_cpu_data());
+        }
+        if (need_filter_diff) {
+          Dtype* new_weight_diff = this->new_weight_->mutable_cpu_diff();
+          this->weight_cpu_gemm2(top_diff + n * this->top_dim_,
+              bottom_data + n * this->bottom_dim_, new_weight_diff);
+          this->dynamic_combine_backward_cpu(bottom_weight + n * weight_count,
+              new_weight_diff,
+              this->param_propagate_down_[0] ? weight_diff : NULL,
+              bottom_weight_diff ?
+                  bottom_weight_diff + n * weight_count : NULL, i > 0);
+        } else if (this->param_propagate_down_[0]) {
+          // Gradient w.r.t. weight. Note that we will accumulate diffs.
           this->weight_cpu_gemm(top_diff + n * this->top_dim_,
               bottom_data + n * this->bottom_dim_, weight_diff);
         }
@@ -67,7 +100,7 @@ void DeconvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
         if (propagate_down[i]) {
           this->forward_cpu_gemm(top_diff + n * this->top_dim_, weight,
               bottom_diff + n * this->bottom_dim_,
-              this->param_propagate_down_[0]);
+              this->param_propagate_down_[0] || need_filter_diff);
         }
       }
     }
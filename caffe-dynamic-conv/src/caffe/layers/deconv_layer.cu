@@ -8,10 +8,19 @@ template <typename Dtype>
 void DeconvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* weight = this->blobs_[0]->gpu_data();
-  for (int i = 0; i < bottom.size(); ++i) {
+  // Given one more bottom than tops, the last one holds a filter per sample.
+  const bool dynamic = bottom.size() > top.size();
+  const int weight_count = this->blobs_[0]->count();
+  const Dtype* bottom_weight =
+      dynamic ? bottom[top.size()]->gpu_data() : NULL;
+  for (int i = 0; i < top.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->gpu_data();
     Dtype* top_data = top[i]->mutable_gpu_data();
     for (int n = 0; n < this->num_; ++n) {
+      if (dynamic) {
+        weight = this->dynamic_combine_gpu(bottom_weight + n * weight_count,
+            this->new_weight_->mutable_gpu_data());
+      }
       this->backward_gpu_gemm(bottom_data + n * this->bottom_dim_, weight,
           top_data + n * this->top_dim_);
       if (this->bias_term_) {
@@ -27,6 +36,16 @@ void DeconvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   const Dtype* weight = this->blobs_[0]->gpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_gpu_diff();
+  const bool dynamic = bottom.size() > top.size();
+  const int filter_id = top.size();
+  const int weight_count = this->blobs_[0]->count();
+  // Dynamic filters go through the gradient w.r.t. each combined filter.
+  const bool need_filter_diff = dynamic &&
+      (this->param_propagate_down_[0] || propagate_down[filter_id]);
+  const Dtype* bottom_weight =
+      dynamic ? bottom[filter_id]->gpu_data() : NULL;
+  Dtype* bottom_weight_diff = (dynamic && propagate_down[filter_id]) ?
+      bottom[filter_id]->mutable_gpu_diff() : NULL;
   for (int i = 0; i < top.size(); ++i) {
     const Dtype* top_diff = top[i]->gpu_diff();
     const Dtype* bottom_data = bottom[i]->gpu_data();
@@ -38,10 +57,24 @@ void DeconvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
         this->backward_gpu_bias(bias_diff, top_diff + n * this->top_dim_);
       }
     }
-    if (this->param_propagate_down_[0] || propagate_down[i]) {
+    if (this->param_propagate_down_[0] || propagate_down[i] ||
+        need_filter_diff) {
       for (int n = 0; n < this->num_; ++n) {
-        // gradient w.r.t. weight. Note that we will accumulate diffs.
-        if (this->param_propagate_down_[0]) {
+        if (dynamic) {
+          weight = this->dynamic_combine_gpu(bottom_weight + n * weight_count,
+              this->new_weight_->mutable_gpu_data());
+        }
+        if (need_filter_diff) {
+          Dtype* new_weight_diff = this->new_weight_->mutable_gpu_diff();
+          this->weight_gpu_gemm2(top_diff + n * this->top_dim_,
+              bottom_data + n * this->bottom_dim_, new_weight_diff);
+          this->dynamic_combine_backward_gpu(bottom_weight + n * weight_count,
+              new_weight_diff,
+              this->param_propagate_down_[0] ? weight_diff : NULL,
+              bottom_weight_diff ?
+                  bottom_weight_diff + n * weight_count : NULL, i > 0);
+        } else if (this->param_propagate_down_[0]) {
+          // gradient w.r.t. weight. Note that we will accumulate diffs.
           this->weight_gpu_gemm(top_diff + n * this->top_dim_,
               bottom_data + n * this->bottom_dim_, weight_diff);
         }
@@ -49,7 +82,7 @@ void DeconvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
         if (propagate_down[i]) {
           this->forward_gpu_gemm(top_diff + n * this->top_dim_, weight,
               bottom_diff + n * this->bottom_dim_,
-              this->param_propagate_down_[0]);
+              this->param_propagate_down_[0] || need_filter_diff);
         }
       }
     }
@@ -1,5 +1,7 @@
 #include <vector>
 #include "caffe/layers/depthwise_conv_layer.hpp"
+#include "caffe/util/depthwise_conv.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
@@ -20,18 +22,90 @@ void DepthwiseConvolutionLayer<Dtype>::compute_output_shape() {
   }
 }
 
+template <typename Dtype>
+void DepthwiseConvolutionLayer<Dtype>::forward_cpu_direct(const Dtype* input,
+    const Dtype* weight, const int weight_stride, Dtype* output) {
+  const int* kernel_shape = this->kernel_shape_.cpu_data();
+  const int* pad = this->pad_.cpu_data();
+  const int* stride = this->stride_.cpu_data();
+  const int* dilation = this->dilation_.cpu_data();
+  depthwise_conv_cpu(input, this->num_, this->channels_,
+      this->input_shape(1), this->input_shape(2), kernel_shape[0],
+      kernel_shape[1], pad[0], pad[1], stride[0], stride[1], dilation[0],
+      dilation[1], weight, weight_stride, output, Caffe::cpu_threads());
+}
+
+template <typename Dtype>
+void DepthwiseConvolutionLayer<Dtype>::backward_cpu_direct(const Dtype* output,
+    const Dtype* weight, const int weight_stride, Dtype* input) {
+  const int* kernel_shape = this->kernel_shape_.cpu_data();
+  const int* pad = this->pad_.cpu_data();
+  const int* stride = this->stride_.cpu_data();
+  const int* dilation = this->dilation_.cpu_data();
+  depthwise_conv_backward_cpu(output, this->num_, this->channels_,
+      this->input_shape(1), this->input_shape(2), kernel_shape[0],
+      kernel_shape[1], pad[0], pad[1], stride[0], stride[1], dilation[0],
+      dilation[1], weight, weight_stride, input, Caffe::cpu_threads());
+}
+
+template <typename Dtype>
+void DepthwiseConvolutionLayer<Dtype>::weight_cpu_direct(const Dtype* input,
+    const Dtype* output, Dtype* weight, const int weight_stride) {
+  const int* kernel_shape = this->kernel_shape_.cpu_data();
+  const int* pad = this->pad_.cpu_data();
+  const int* stride = this->stride_.cpu_data();
+  const int* dilation = this->dilation_.cpu_data();
+  depthwise_conv_weight_cpu(input, output, this->num_, this->channels_,
+      this->input_shape(1), this->input_shape(2), kernel_shape[0],
+      kernel_shape[1], pad[0], pad[1], stride[0], stride[1], dilation[0],
+      dilation[1], weight, weight_stride, Caffe::cpu_threads());
+}
+
+template <typename Dtype>
+const Dtype* DepthwiseConvolutionLayer<Dtype>::dynamic_weight_cpu(
+    const Dtype* bottom_weight) {
+  // One combined filter (and its diff) per sample.
+  const int weight_count = this->blobs_[0]->count();
+  vector<int> new_weight_shape(2, this->num_);
+  new_weight_shape[1] = weight_count;
+  this->new_weight_->Reshape(new_weight_shape);
+  if (this->layer_param_.convolution_param().weight_operation() ==
+      ConvolutionParameter_WeightOp_COPY) {
+    return bottom_weight;
+  }
+  Dtype* new_weight = this->new_weight_->mutable_cpu_data();
+  for (int n = 0; n < this->num_; ++n) {
+    this->dynamic_combine_cpu(bottom_weight + n * weight_count,
+        new_weight + n * weight_count);
+  }
+  return new_weight;
+}
+
 template <typename Dtype>
 void DepthwiseConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
 	const Dtype* weight = this->blobs_[0]->cpu_data();
-  for (int i = 0; i < bottom.size(); ++i) {
+  // Given one more bottom than tops, the last one holds a filter per sample.
+  const bool dynamic = bottom.size() > top.size();
+  int weight_stride = 0;
+  if (dynamic) {
+    weight = dynamic_weight_cpu(bottom[top.size()]->cpu_data());
+    weight_stride = this->blobs_[0]->count();
+  }
+  for (int i = 0; i < top.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
-    for (int n = 0; n < this->num_; ++n) {
-      this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
-          top_data + n * this->top_dim_);
-      if (this->bias_term_) {
-        const Dtype* bias = this->blobs_[1]->cpu_data();
+    if (direct_cpu()) {
+      forward_cpu_direct(bottom_data, weight, weight_stride, top_data);
+    } else {
+      for (int n = 0; n < this->num_; ++n) {
+        this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_,
+            weight + n * weight_stride, top_data + n * this->top_dim_);
+      }
+    }
+    if (this->bias_term_) {
+      const Dtype* bias = this->blobs_[1]->cpu_data();
+      for (int n = 0; n < this->num_; ++n) {
         this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
       }
     }
@@ -43,6 +117,23 @@ void DepthwiseConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>&
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  const bool dynamic = bottom.size() > top.size();
+  const int filter_id = top.size();
+  const int weight_count = this->blobs_[0]->count();
+  // Dynamic filters go through the gradient w.r.t. each combined filter.
+  const bool need_filter_diff = dynamic &&
+      (this->param_propagate_down_[0] || propagate_down[filter_id]);
+  const Dtype* bottom_weight = NULL;
+  Dtype* bottom_weight_diff = NULL;
+  int weight_stride = 0;
+  if (dynamic) {
+    bottom_weight = bottom[filter_id]->cpu_data();
+    weight = dynamic_weight_cpu(bottom_weight);
+    weight_stride = weight_count;
+    if (propagate_down[filter_id]) {
+      bottom_weight_diff = bottom[filter_id]->mutable_cpu_diff();
+    }
+  }
   for (int i = 0; i < top.size(); ++i) {
     const Dtype* top_diff = top[i]->cpu_diff();
     const Dtype* bottom_data = bottom[i]->cpu_data();
@@ -54,17 +145,46 @@ void DepthwiseConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>&
         this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
       }
     }
-    if (this->param_propagate_down_[0] || propagate_down[i]) {
+    if (need_filter_diff) {
+      // The gradient w.r.t. every combined filter, then through the
+      // combination.
+      Dtype* new_weight_diff = this->new_weight_->mutable_cpu_diff();
+      if (direct_cpu()) {
+        caffe_set(this->new_weight_->count(), Dtype(0), new_weight_diff);
+        weight_cpu_direct(bottom_data, top_diff, new_weight_diff,
+            weight_stride);
+      } else {
+        for (int n = 0; n < this->num_; ++n) {
+          this->weight_cpu_gemm2(bottom_data + n * this->bottom_dim_,
+              top_diff + n * this->top_dim_, new_weight_diff + n * weight_count);
+        }
+      }
       for (int n = 0; n < this->num_; ++n) {
-        // gradient w.r.t. weight. Note that we will accumulate diffs.
-        if (this->param_propagate_down_[0]) {
+        this->dynamic_combine_backward_cpu(bottom_weight + n * weight_count,
+            new_weight_diff + n * weight_count,
+            this->param_propagate_down_[0] ? weight_diff : NULL,
+            bottom_weight_diff ?
+                bottom_weight_diff + n * weight_count : NULL, i > 0);
+      }
+    } else if (this->param_propagate_down_[0]) {
+      // gradient w.r.t. weight. Note that we will accumulate diffs.
+      if (direct_cpu()) {
+        weight_cpu_direct(bottom_data, top_diff, weight_diff, 0);
+      } else {
+        for (int n = 0; n < this->num_; ++n) {
           this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
               top_diff + n * this->top_dim_, weight_diff);
         }
-        // gradient w.r.t. bottom data, if necessary.
-        if (propagate_down[i]) {
-          this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
-              bottom_diff + n * this->bottom_dim_);
+      }
+    }
+    // gradient w.r.t. bottom data, if necessary.
+    if (propagate_down[i]) {
+      if (direct_cpu()) {
+        backward_cpu_direct(top_diff, weight, weight_stride, bottom_diff);
+      } else {
+        for (int n = 0; n < this->num_; ++n) {
+          this->backward_cpu_gemm(top_diff + n * this->top_dim_,
+              weight + n * weight_stride, bottom_diff + n * this->bottom_dim_);
         }
       }
     }
@@ -17,7 +17,8 @@ __global__ void ConvForward(const int nthreads,
 		const int height, const int width,const int conved_height,
 		const int conved_width,const int kernel_h, const int kernel_w,
 		const int stride_h, const int stride_w, const int pad_h, const int pad_w,
-		Dtype* const top_data,const Dtype* const weight,const Dtype* const bias,const bool bias_term_) {
+		Dtype* const top_data,const Dtype* const weight,const Dtype* const bias,const bool bias_term_,
+		const int weight_stride) {
 	CUDA_KERNEL_LOOP(index, nthreads) {
 
 		const int pw = index % conved_width;
@@ -36,8 +37,10 @@ __global__ void ConvForward(const int nthreads,
 		Dtype aveval = 0;
 		const Dtype* const bottom_slice =
 		bottom_data + (n * channels + c) * height * width;
+		// weight_stride is 0 for blobs_[0], or the filter size for one
+		// dynamic filter per sample.
 		const Dtype* const weight_slice =
-		weight + c * kernel_h * kernel_w;
+		weight + n * weight_stride + c * kernel_h * kernel_w;
 //		if (index==1) {
 //			printf("pw%d ph%d c%d n%d \n",pw,ph,c,n);
 //			printf("hstart%d wstart%d hend%d wend%d \n",hstart,wstart,hend,wend);
@@ -62,16 +65,42 @@ __global__ void ConvForward(const int nthreads,
 	}
 }
 
+template <typename Dtype>
+const Dtype* DepthwiseConvolutionLayer<Dtype>::dynamic_weight_gpu(
+    const Dtype* bottom_weight) {
+  // One combined filter (and its diff) per sample.
+  const int weight_count = this->blobs_[0]->count();
+  vector<int> new_weight_shape(2, this->num_);
+  new_weight_shape[1] = weight_count;
+  this->new_weight_->Reshape(new_weight_shape);
+  if (this->layer_param_.convolution_param().weight_operation() ==
+      ConvolutionParameter_WeightOp_COPY) {
+    return bottom_weight;
+  }
+  Dtype* new_weight = this->new_weight_->mutable_gpu_data();
+  for (int n = 0; n < this->num_; ++n) {
+    this->dynamic_combine_gpu(bottom_weight + n * weight_count,
+        new_weight + n * weight_count);
+  }
+  return new_weight;
+}
+
 template<typename Dtype>
 void DepthwiseConvolutionLayer<Dtype>::Forward_gpu(
 		const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
 //	std::cout << "fp" << std::endl;
 	const Dtype* weight = this->blobs_[0]->gpu_data();
+	// Given one more bottom than tops, the last one holds a filter per sample.
+	int weight_stride = 0;
+	if (bottom.size() > top.size()) {
+		weight = dynamic_weight_gpu(bottom[top.size()]->gpu_data());
+		weight_stride = this->blobs_[0]->count();
+	}
 	int* kernel_shape_data = this->kernel_shape_.mutable_cpu_data();
 	int* stride_data = this->stride_.mutable_cpu_data();
 	int* pad_data = this->pad_.mutable_cpu_data();
 
-	for (int i = 0; i < bottom.size(); ++i) {
+	for (int i = 0; i < top.size(); ++i) {
 		const Dtype* bottom_data = bottom[i]->gpu_data();
 		Dtype* top_data = top[i]->mutable_gpu_data();
 		const int count = top[i]->count();
@@ -97,12 +126,14 @@ void DepthwiseConvolutionLayer<Dtype>::Forward_gpu(
 			ConvForward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
 					count, bottom_data, bottom[i]->num(), channels_,
 					height_, width_,conved_height,conved_weight,kernel_h_,
-					kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_, top_data,weight,bias,bias_term_);
+					kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_, top_data,weight,bias,bias_term_,
+					weight_stride);
 		} else {
 			ConvForward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
 					count, bottom_data, bottom[i]->num(), channels_,
 					height_, width_,conved_height,conved_weight,kernel_h_,
-					kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_, top_data,weight,0,bias_term_);
+					kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_, top_data,weight,0,bias_term_,
+					weight_stride);
 		}
 	}
 }
@@ -115,7 +146,7 @@ const int width, const int conved_height, const int conved_width,
 const int kernel_h, const int kernel_w, const int stride_h,
 const int stride_w, const int pad_h, const int pad_w,
 Dtype* const bottom_diff,
-const Dtype* const weight) {
+const Dtype* const weight, const int weight_stride) {
 
 	CUDA_KERNEL_LOOP(index, nthreads) {
 		const int w = index % width + pad_w;
@@ -135,7 +166,8 @@ const Dtype* const weight) {
 		const Dtype* const top_diff_slice =
 		top_diff + (n * channels + c) * conved_height * conved_width;
 		
-		const Dtype* const weight_slice =weight + c * kernel_h * kernel_w;
+		const Dtype* const weight_slice =
+		weight + n * weight_stride + c * kernel_h * kernel_w;
 		
 //		if (index==2) {
 //			printf("w%d h%d c%d n%d \n",w,h,c,n);
@@ -234,6 +266,44 @@ const Dtype* const bottom_data) {
 	}
 }
 
+// The gradient w.r.t. the filter of each sample (for dynamic filters),
+// overwriting weight_diff (num x channels x kernel_h x kernel_w).
+template <typename Dtype>
+__global__ void ConvBackwardSampleWeight(const int nthreads,
+const Dtype* const top_diff,
+const int num, const int channels, const int height,
+const int width, const int conved_height, const int conved_width,
+const int kernel_h, const int kernel_w, const int stride_h,
+const int stride_w, const int pad_h, const int pad_w,
+Dtype* const weight_diff,
+const Dtype* const bottom_data) {
+
+	CUDA_KERNEL_LOOP(index, nthreads) {
+		const int kw=index % kernel_w;
+		const int kh= (index /kernel_w)%kernel_h;
+		const int c=(index /kernel_w/kernel_h)%channels;
+		const int n=index /kernel_w/kernel_h/channels;
+
+		const Dtype* const top_diff_slice = top_diff + (n * channels + c) * conved_height * conved_width;
+		const Dtype* const bottom_data_slice = bottom_data + (n * channels + c) * height * width;
+
+		const int phstart=max(DIVIDE_CEIL((pad_h-kh),stride_h),0);
+		const int phend=min(DIVIDE_CEIL((height+pad_h-kh),stride_h),conved_height);
+		const int pwstart=max(DIVIDE_CEIL((pad_w-kw),stride_w),0);
+		const int pwend=min(DIVIDE_CEIL((width+pad_w-kw),stride_w),conved_width);
+
+		Dtype gradient = 0;
+		for(int ph=phstart;ph<phend;ph++){
+			for (int pw=pwstart;pw<pwend;pw++){
+				const int h=ph*stride_h+kh-pad_h;
+				const int w=pw*stride_w+kw-pad_w;
+				gradient+=top_diff_slice[ph * conved_width + pw]*bottom_data_slice[h*width+w];
+			}
+		}
+		weight_diff[index]=gradient;
+	}
+}
+
 template <typename Dtype>
 __global__ void ConvBackwardBias(const int nthreads,
 const Dtype* const top_diff,
@@ -286,6 +356,24 @@ const vector<Blob<Dtype>*>& bottom) {
 	const int conved_height = this->output_shape_[0];
 	const int conved_weight = this->output_shape_[1];
 
+	// Dynamic filters go through the gradient w.r.t. each combined filter.
+	const bool dynamic = bottom.size() > top.size();
+	const int filter_id = top.size();
+	const int weight_count = this->blobs_[0]->count();
+	int weight_stride = 0;
+	const Dtype* bottom_weight = 0;
+	Dtype* bottom_weight_diff = 0;
+	if (dynamic) {
+		bottom_weight = bottom[filter_id]->gpu_data();
+		weight = dynamic_weight_gpu(bottom_weight);
+		weight_stride = weight_count;
+		if (propagate_down[filter_id]) {
+			bottom_weight_diff = bottom[filter_id]->mutable_gpu_diff();
+		}
+	}
+	const bool need_filter_diff = dynamic &&
+			(weight_propagate_down_ || bottom_weight_diff);
+
 //	CHECK_EQ(stride_h_, 1)
 //	        << "The backward of the net whose stride is bigger than 1 is not implemented now. ";
 //	CHECK_EQ(stride_w_, 1)
@@ -312,8 +400,25 @@ const vector<Blob<Dtype>*>& bottom) {
 				kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_,
 				bias_diff);
 		}
+		if (need_filter_diff) {
+			Dtype* new_weight_diff = this->new_weight_->mutable_gpu_diff();
+			const int count_weight = this->num_ * weight_count;
+			ConvBackwardSampleWeight<Dtype><<<CAFFE_GET_BLOCKS(count_weight), CAFFE_CUDA_NUM_THREADS>>>(
+					count_weight, top_diff, bottom[i]->num(), channels_,
+				height_, width_,conved_height,conved_weight,kernel_h_,
+				kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_,
+				new_weight_diff,
+				bottom_data);
+			for (int n = 0; n < this->num_; ++n) {
+				this->dynamic_combine_backward_gpu(bottom_weight + n * weight_count,
+						new_weight_diff + n * weight_count,
+						weight_propagate_down_ ? weight_diff : 0,
+						bottom_weight_diff ? bottom_weight_diff + n * weight_count : 0,
+						i > 0);
+			}
+		}
 		// gradient w.r.t. weight. Note that we will accumulate diffs.
-		if (weight_propagate_down_) {
+		else if (weight_propagate_down_) {
 			const int count_weight = channels_ * kernel_h_ * kernel_w_;
 			ConvBackwardWeight<Dtype><<<CAFFE_GET_BLOCKS(count_weight), CAFFE_CUDA_NUM_THREADS>>>(
 					count_weight, top_diff, bottom[i]->num(), channels_,
@@ -330,7 +435,7 @@ const vector<Blob<Dtype>*>& bottom) {
 				height_, width_,conved_height,conved_weight,kernel_h_,
 				kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_, 
 				bottom_diff,
-				weight);
+				weight, weight_stride);
 		}
 	}
 
@@ -0,0 +1,130 @@
+#include <vector>
+
+#include "caffe/layers/dynamic_filter_generator_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void DynamicFilterGeneratorLayer<Dtype>::Reshape(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  rank_ = this->K_ + this->bias_term_;
+  if (top.size() == 1) {
+    InnerProductLayer<Dtype>::Reshape(bottom, top);
+    return;
+  }
+  // Not shaped as InnerProduct's top, which would reserve the N filters.
+  const int axis = bottom[0]->CanonicalAxisIndex(
+      this->layer_param_.inner_product_param().axis());
+  CHECK_EQ(this->K_, bottom[0]->count(axis))
+      << "Input size incompatible with inner product parameters.";
+  this->M_ = bottom[0]->count(0, axis);
+  vector<int> coefficient_shape(2, this->M_);
+  coefficient_shape[1] = rank_;
+  top[0]->Reshape(coefficient_shape);
+  vector<int> basis_shape(2, rank_);
+  basis_shape[1] = this->N_;
+  top[1]->Reshape(basis_shape);
+}
+
+template <typename Dtype>
+bool DynamicFilterGeneratorLayer<Dtype>::basis_stale(
+    const Blob<Dtype>& basis) const {
+  return !basis_sources_[0].Matches(this->blobs_[0]->data()) ||
+      !basis_sources_[2].Matches(basis.data()) || (this->bias_term_ &&
+      !basis_sources_[1].Matches(this->blobs_[1]->data()));
+}
+
+template <typename Dtype>
+void DynamicFilterGeneratorLayer<Dtype>::basis_rebuilt(
+    const Blob<Dtype>& basis) {
+  basis_sources_[0].Remember(this->blobs_[0]->data());
+  if (this->bias_term_) {
+    basis_sources_[1].Remember(this->blobs_[1]->data());
+  }
+  basis_sources_[2].Remember(basis.data());
+}
+
+template <typename Dtype>
+void DynamicFilterGeneratorLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (top.size() == 1) {
+    InnerProductLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  const int K = this->K_;
+  const int N = this->N_;
+  // The coefficients: each embedding followed by the bias coefficient 1.
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* coefficients = top[0]->mutable_cpu_data();
+  for (int m = 0; m < this->M_; ++m) {
+    caffe_copy(K, bottom_data + m * K, coefficients + m * rank_);
+    if (this->bias_term_) {
+      coefficients[m * rank_ + K] = Dtype(1);
+    }
+  }
+  // The basis: the columns of the weight, then the bias.
+  if (!basis_stale(*top[1])) {
+    return;
+  }
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* basis = top[1]->mutable_cpu_data();
+  if (this->transpose_) {
+    caffe_copy(K * N, weight, basis);
+  } else {
+    for (int k = 0; k < K; ++k) {
+      for (int j = 0; j < N; ++j) {
+        basis[k * N + j] = weight[j * K + k];
+      }
+    }
+  }
+  if (this->bias_term_) {
+    caffe_copy(N, this->blobs_[1]->cpu_data(), basis + K * N);
+  }
+  basis_rebuilt(*top[1]);
+}
+
+template <typename Dtype>
+void DynamicFilterGeneratorLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  if (top.size() == 1) {
+    InnerProductLayer<Dtype>::Backward_cpu(top, propagate_down, bottom);
+    return;
+  }
+  const int K = this->K_;
+  const int N = this->N_;
+  const Dtype* basis_diff = top[1]->cpu_diff();
+  if (this->param_propagate_down_[0]) {
+    Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+    if (this->transpose_) {
+      caffe_axpy(K * N, Dtype(1), basis_diff, weight_diff);
+    } else {
+      for (int k = 0; k < K; ++k) {
+        for (int j = 0; j < N; ++j) {
+          weight_diff[j * K + k] += basis_diff[k * N + j];
+        }
+      }
+    }
+  }
+  if (this->bias_term_ && this->param_propagate_down_[1]) {
+    caffe_axpy(N, Dtype(1), basis_diff + K * N,
+        this->blobs_[1]->mutable_cpu_diff());
+  }
+  if (propagate_down[0]) {
+    const Dtype* coefficient_diff = top[0]->cpu_diff();
+    Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+    for (int m = 0; m < this->M_; ++m) {
+      caffe_copy(K, coefficient_diff + m * rank_, bottom_diff + m * K);
+    }
+  }
+}
+
+#ifdef CPU_ONLY
+STUB_GPU(DynamicFilterGeneratorLayer);
+#endif
+
+INSTANTIATE_CLASS(DynamicFilterGeneratorLayer);
+REGISTER_LAYER_CLASS(DynamicFilterGenerator);
+
+}  // namespace caffe
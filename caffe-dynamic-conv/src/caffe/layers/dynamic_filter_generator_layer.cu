@@ -0,0 +1,115 @@
+#include <vector>
+
+#include "caffe/layers/dynamic_filter_generator_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+__global__ void GeneratorCoefficients(const int nthreads, const int K,
+    const int rank, const Dtype* bottom_data, Dtype* coefficients) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int m = index / rank;
+    const int k = index % rank;
+    coefficients[index] = (k < K) ? bottom_data[m * K + k] : Dtype(1);
+  }
+}
+
+template <typename Dtype>
+__global__ void GeneratorCoefficientsBackward(const int nthreads,
+    const int K, const int rank, const Dtype* coefficient_diff,
+    Dtype* bottom_diff) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    bottom_diff[index] = coefficient_diff[(index / K) * rank + index % K];
+  }
+}
+
+// basis (K x N) = weight^T, or weight_diff += basis^T when backward.
+template <typename Dtype>
+__global__ void GeneratorTranspose(const int nthreads, const int K,
+    const int N, const bool backward, const Dtype* in, Dtype* out) {
+  CUDA_KERNEL_LOOP(index, nthreads) {
+    const int k = index / N;
+    const int j = index % N;
+    if (backward) {
+      out[j * K + k] += in[index];
+    } else {
+      out[index] = in[j * K + k];
+    }
+  }
+}
+
+template <typename Dtype>
+void DynamicFilterGeneratorLayer<Dtype>::Forward_gpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (top.size() == 1) {
+    InnerProductLayer<Dtype>::Forward_gpu(bottom, top);
+    return;
+  }
+  const int K = this->K_;
+  const int N = this->N_;
+  const int coefficient_count = top[0]->count();
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  GeneratorCoefficients<Dtype><<<CAFFE_GET_BLOCKS(coefficient_count),
+      CAFFE_CUDA_NUM_THREADS>>>(coefficient_count, K, rank_,
+      bottom[0]->gpu_data(), top[0]->mutable_gpu_data());
+  CUDA_POST_KERNEL_CHECK;
+  if (!basis_stale(*top[1])) {
+    return;
+  }
+  const Dtype* weight = this->blobs_[0]->gpu_data();
+  Dtype* basis = top[1]->mutable_gpu_data();
+  if (this->transpose_) {
+    caffe_copy(K * N, weight, basis);
+  } else {
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    GeneratorTranspose<Dtype><<<CAFFE_GET_BLOCKS(K * N),
+        CAFFE_CUDA_NUM_THREADS>>>(K * N, K, N, false, weight, basis);
+    CUDA_POST_KERNEL_CHECK;
+  }
+  if (this->bias_term_) {
+    caffe_copy(N, this->blobs_[1]->gpu_data(), basis + K * N);
+  }
+  basis_rebuilt(*top[1]);
+}
+
+template <typename Dtype>
+void DynamicFilterGeneratorLayer<Dtype>::Backward_gpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  if (top.size() == 1) {
+    InnerProductLayer<Dtype>::Backward_gpu(top, propagate_down, bottom);
+    return;
+  }
+  const int K = this->K_;
+  const int N = this->N_;
+  const Dtype* basis_diff = top[1]->gpu_diff();
+  if (this->param_propagate_down_[0]) {
+    Dtype* weight_diff = this->blobs_[0]->mutable_gpu_diff();
+    if (this->transpose_) {
+      caffe_gpu_axpy(K * N, Dtype(1), basis_diff, weight_diff);
+    } else {
+      // NOLINT_NEXT_LINE(whitespace/operators)
+      GeneratorTranspose<Dtype><<<CAFFE_GET_BLOCKS(K * N),
+          CAFFE_CUDA_NUM_THREADS>>>(K * N, K, N, true, basis_diff,
+          weight_diff);
+      CUDA_POST_KERNEL_CHECK;
+    }
+  }
+  if (this->bias_term_ && this->param_propagate_down_[1]) {
+    caffe_gpu_axpy(N, Dtype(1), basis_diff + K * N,
+        this->blobs_[1]->mutable_gpu_diff());
+  }
+  if (propagate_down[0]) {
+    const int count = bottom[0]->count();
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    GeneratorCoefficientsBackward<Dtype><<<CAFFE_GET_BLOCKS(count),
+        CAFFE_CUDA_NUM_THREADS>>>(count, K, rank_, top[0]->gpu_diff(),
+        bottom[0]->mutable_gpu_diff());
+    CUDA_POST_KERNEL_CHECK;
+  }
+}
+
+INSTANTIATE_LAYER_GPU_FUNCS(DynamicFilterGeneratorLayer);
+
+}  // namespace caffe
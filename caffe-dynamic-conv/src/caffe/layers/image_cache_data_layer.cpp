@@ -0,0 +1,174 @@
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/data_transformer.hpp"
+#include "caffe/layers/base_data_layer.hpp"
+#include "caffe/layers/image_cache_data_layer.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+ImageCacheDataLayer<Dtype>::~ImageCacheDataLayer<Dtype>() {
+  this->StopInternalThread();
+}
+
+template <typename Dtype>
+void ImageCacheDataLayer<Dtype>::DataLayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  const string& source = image_data_param.source();
+  // The images were decoded and resized when the cache was written, and the
+  // cache holds no attention tables.
+  CHECK(!image_data_param.has_decoder())
+      << "ImageCacheData reads decoded images; decoder does not apply.";
+  CHECK(!image_data_param.attention_guided_crop())
+      << "ImageCacheData does not support attention_guided_crop.";
+  LOG(INFO) << "Opening image cache " << source;
+  cache_.reset(new ImageCache(source));
+  CHECK_GT(cache_->num(), 0) << "Image cache is empty";
+  this->ShardItems(cache_->num(), &order_);
+  LOG(INFO) << "A total of " << cache_->num() << " images of "
+      << cache_->height() << "x" << cache_->width() << "x"
+      << cache_->channels() << ".";
+
+  order_id_ = 0;
+  // Check if we would need to randomly skip a few data points
+  if (image_data_param.rand_skip()) {
+    unsigned int skip = caffe_rng_rand() % image_data_param.rand_skip();
+    LOG(INFO) << "Skipping first " << skip << " data points.";
+    CHECK_GT(order_.size(), skip) << "Not enough points to skip";
+    order_id_ = skip;
+  }
+  if (image_data_param.shuffle()) {
+    // randomly shuffle data, an image at a time
+    LOG(INFO) << "Shuffling data";
+    const unsigned int prefetch_rng_seed = caffe_rng_rand();
+    prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+    DrawItem();
+  }
+  this->SetUpTransformWorkers(image_data_param.batch_size(),
+      image_data_param.num_workers());
+  // Every cached image has the same shape.
+  const cv::Mat cv_img(cache_->height(), cache_->width(),
+      CV_8UC(cache_->channels()), const_cast<uint8_t*>(cache_->image(0)));
+  vector<int> top_shape = this->data_transformer_->InferBlobShape(cv_img);
+  this->transformed_data_.Reshape(top_shape);
+  const int batch_size = image_data_param.batch_size();
+  CHECK_GT(batch_size, 0) << "Positive batch size required";
+  top_shape[0] = batch_size;
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.Reshape(top_shape);
+  }
+  top[0]->Reshape(top_shape);
+  LOG(INFO) << "output data size: " << top[0]->num() << ","
+      << top[0]->channels() << "," << top[0]->height() << ","
+      << top[0]->width();
+  if (this->output_labels_) {
+    vector<int> label_shape(1, batch_size);
+    top[1]->Reshape(label_shape);
+    for (int i = 0; i < this->prefetch_.size(); ++i) {
+      this->prefetch_[i]->label_.Reshape(label_shape);
+    }
+  }
+  if (top.size() > 2) {
+    CHECK_GT(cache_->num_attributes(), 0) << source << " has no attributes.";
+    vector<int> extra_shape(4, 1);
+    extra_shape[0] = batch_size;
+    extra_shape[1] = cache_->num_attributes();
+    top[2]->Reshape(extra_shape);
+    for (int i = 0; i < this->prefetch_.size(); ++i) {
+      this->prefetch_[i]->extra_[0]->Reshape(extra_shape);
+    }
+  }
+}
+
+template <typename Dtype>
+void ImageCacheDataLayer<Dtype>::DrawItem() {
+  if (!this->layer_param_.image_data_param().shuffle()) {
+    return;
+  }
+  caffe::rng_t* prefetch_rng =
+      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  boost::uniform_int<int> dist(order_id_, order_.size() - 1);
+  std::swap(order_[order_id_], order_[dist(*prefetch_rng)]);
+}
+
+template <typename Dtype>
+void ImageCacheDataLayer<Dtype>::NextItem() {
+  order_id_++;
+  if (order_id_ >= order_.size()) {
+    // We have reached the end. Restart from the first.
+    DLOG(INFO) << "Restarting data prefetching from start.";
+    order_id_ = 0;
+  }
+  DrawItem();
+}
+
+namespace {
+
+// Transforms item item_id straight from the mapped cache into its slot.
+template <typename Dtype>
+void transform_cached_item(const ImageCache* cache, const int* ids,
+    const int channels, const int height, const int width, const int item_id,
+    DataTransformer<Dtype>* transformer, Dtype* transformed_data) {
+  const cv::Mat cv_img(cache->height(), cache->width(),
+      CV_8UC(cache->channels()),
+      const_cast<uint8_t*>(cache->image(ids[item_id])));
+  transformer->Transform(cv_img, channels, height, width, transformed_data);
+}
+
+}  // namespace
+
+// This function is called on prefetch thread
+template <typename Dtype>
+void ImageCacheDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
+  CPUTimer batch_timer;
+  batch_timer.Start();
+  CHECK(batch->data_.count());
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  const int batch_size = image_data_param.batch_size();
+  const bool extra = !batch->extra_.empty();
+  const int num_attributes = cache_->num_attributes();
+  Dtype* prefetch_label =
+      this->output_labels_ ? batch->label_.mutable_cpu_data() : NULL;
+  Dtype* prefetch_extra = extra ? batch->extra_[0]->mutable_cpu_data() : NULL;
+
+  vector<int> ids(batch_size);
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    const int id = order_[order_id_];
+    ids[item_id] = id;
+    if (prefetch_label) {
+      prefetch_label[item_id] = cache_->label(id);
+    }
+    if (extra) {
+      const float* attributes = cache_->attributes(id);
+      for (int j = 0; j < num_attributes; ++j) {
+        prefetch_extra[item_id * num_attributes + j] = attributes[j];
+      }
+    }
+    // go to the next iter
+    NextItem();
+  }
+
+  this->TransformBatch(batch, boost::bind(&transform_cached_item<Dtype>,
+      cache_.get(), &ids[0], batch->data_.channels(), batch->data_.height(),
+      batch->data_.width(), _1, _2, _3));
+  batch_timer.Stop();
+  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
+}
+
+INSTANTIATE_CLASS(ImageCacheDataLayer);
+REGISTER_LAYER_CLASS(ImageCacheData);
+
+}  // namespace caffe
+#endif  // USE_OPENCV
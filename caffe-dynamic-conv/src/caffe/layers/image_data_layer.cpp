@@ -1,6 +1,9 @@
 #ifdef USE_OPENCV
 #include <opencv2/core/core.hpp>
 
+#include <boost/bind.hpp>
+
+#include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <iostream>  // NOLINT(readability/streams)
 #include <string>
@@ -10,6 +13,7 @@
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/layers/image_data_layer.hpp"
+#include "caffe/util/attention_sampler.hpp"
 #include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -17,6 +21,96 @@
 
 namespace caffe {
 
+bool FilenameAttributes(const string& filename, float* attributes) {
+  bool found = true;
+  if (filename.find('f') != string::npos) {
+    attributes[0] = 1;
+  } else if (filename.find('m') != string::npos) {
+    attributes[0] = -1;
+  } else {
+    attributes[0] = 0;
+    found = false;
+  }
+  if (filename.find('y') != string::npos) {
+    attributes[1] = 1;
+  } else if (filename.find('w') != string::npos) {
+    attributes[1] = -1;
+  } else {
+    attributes[1] = 0;
+    found = false;
+  }
+  return found;
+}
+
+// Parses the whole of token as a number.
+static bool ParseNumber(const string& token, float* value) {
+  if (token.empty()) {
+    return false;
+  }
+  char* end;
+  *value = strtod(token.c_str(), &end);
+  return *end == '\0';
+}
+
+void ImageList::Add(const string& name, float label) {
+  arena_.insert(arena_.end(), name.begin(), name.end());
+  arena_.push_back('\0');
+  offsets_.push_back(arena_.size());
+  labels_.push_back(label);
+}
+
+int ReadImageList(const string& source, ImageList* lines,
+    vector<float>* attributes) {
+  std::ifstream infile(source.c_str());
+  CHECK(infile.good()) << "Failed to open " << source;
+  int num_attributes = -1;
+  string line;
+  vector<float> values;
+  while (std::getline(infile, line)) {
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+    if (line.empty()) {
+      continue;
+    }
+    // Split off the numeric columns at the end of the line, as many as on
+    // the first line.
+    const size_t max_values =
+        num_attributes < 0 ? line.size() : num_attributes + 1;
+    values.clear();
+    size_t end = line.size();
+    while (end > 0 && values.size() < max_values) {
+      const size_t pos = line.find_last_of(' ', end - 1);
+      float value;
+      if (pos == string::npos ||
+          !ParseNumber(line.substr(pos + 1, end - pos - 1), &value)) {
+        break;
+      }
+      values.push_back(value);
+      end = pos;
+    }
+    CHECK(!values.empty()) << "No label in line: " << line;
+    if (num_attributes < 0) {
+      num_attributes = static_cast<int>(values.size()) - 1;
+    }
+    CHECK_EQ(static_cast<int>(values.size()), num_attributes + 1) << "Expected "
+        << num_attributes << " attributes in line: " << line;
+    lines->Add(line.substr(0, end), values.back());
+    attributes->insert(attributes->end(), values.rbegin() + 1,
+        values.rend());
+  }
+  return std::max(num_attributes, 0);
+}
+
+// Reads an image of the list with the decoder the layer asks for.
+static cv::Mat ReadListImage(const string& filename, const int new_height,
+    const int new_width, const bool is_color, const bool scaled_decode) {
+  if (scaled_decode) {
+    return ReadImageToCVMatScaled(filename, new_height, new_width, is_color);
+  }
+  return ReadImageToCVMat(filename, new_height, new_width, is_color);
+}
+
 template <typename Dtype>
 ImageDataLayer<Dtype>::~ImageDataLayer<Dtype>() {
   this->StopInternalThread();
@@ -33,34 +127,27 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   CHECK((new_height == 0 && new_width == 0) ||
       (new_height > 0 && new_width > 0)) << "Current implementation requires "
       "new_height and new_width to be set at the same time.";
-  // Read the file with filenames and labels
+  // Read the file with filenames, labels and attributes
   const string& source = this->layer_param_.image_data_param().source();
   LOG(INFO) << "Opening file " << source;
-  std::ifstream infile(source.c_str());
-  string line;
-  size_t pos;
-  float label;
-  while (std::getline(infile, line)) {
-    pos = line.find_last_of(' ');
-    label = atof(line.substr(pos + 1).c_str());
-    lines_.push_back(std::make_pair(line.substr(0, pos), label));
-  }
-
+  vector<float> attributes;
+  num_attributes_ = ReadImageList(source, &lines_, &attributes);
   CHECK(!lines_.empty()) << "File is empty";
-
-  if (this->layer_param_.image_data_param().shuffle()) {
-    // randomly shuffle data
-    LOG(INFO) << "Shuffling data";
-    const unsigned int prefetch_rng_seed = caffe_rng_rand();
-    prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
-    ShuffleImages();
-  } else {
-    if (this->phase_ == TRAIN && Caffe::solver_rank() > 0 &&
-        this->layer_param_.image_data_param().rand_skip() == 0) {
-      LOG(WARNING) << "Shuffling or skipping recommended for multi-GPU";
+  if (num_attributes_ == 0 &&
+      !this->layer_param_.image_data_param().reference()) {
+    // Lists without attribute columns code them in the filenames.
+    num_attributes_ = 2;
+    attributes.resize(lines_.size() * num_attributes_);
+    for (int i = 0; i < lines_.size(); ++i) {
+      if (!FilenameAttributes(lines_.name(i), &attributes[i * 2])) {
+        LOG(ERROR) << "No attributes in filename " << lines_.name(i);
+      }
     }
   }
-  LOG(INFO) << "A total of " << lines_.size() << " images.";
+  attributes_.assign(attributes.begin(), attributes.end());
+  LOG(INFO) << "A total of " << lines_.size() << " images with "
+      << num_attributes_ << " attributes.";
+  this->ShardItems(lines_.size(), &lines_order_);
 
   lines_id_ = 0;
   // Check if we would need to randomly skip a few data points
@@ -68,13 +155,36 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     unsigned int skip = caffe_rng_rand() %
         this->layer_param_.image_data_param().rand_skip();
     LOG(INFO) << "Skipping first " << skip << " data points.";
-    CHECK_GT(lines_.size(), skip) << "Not enough points to skip";
+    CHECK_GT(lines_order_.size(), skip) << "Not enough points to skip";
     lines_id_ = skip;
   }
+  if (this->layer_param_.image_data_param().shuffle()) {
+    // randomly shuffle data, a line at a time
+    LOG(INFO) << "Shuffling data";
+    const unsigned int prefetch_rng_seed = caffe_rng_rand();
+    prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+    DrawLine();
+  }
+  const ImageDataParameter& image_data_param =
+      this->layer_param_.image_data_param();
+  attention_tables_.reset();
+  if (image_data_param.attention_guided_crop() && this->phase_ == TRAIN &&
+      this->transform_param_.random_crop()) {
+    CHECK(image_data_param.has_attention_tables()) << "Attention-guided "
+        "crops need the attention_tables of " << source;
+    attention_tables_.reset(
+        new AttentionTables(image_data_param.attention_tables()));
+    CHECK_EQ(attention_tables_->num(), lines_.size()) << "Expected an "
+        "attention map for every line of " << source;
+  }
+  this->SetUpTransformWorkers(image_data_param.batch_size(),
+      image_data_param.num_workers());
   // Read an image, and use it to initialize the top blob.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-                                    new_height, new_width, is_color);
-  CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
+  const char* filename = lines_.name(lines_order_[lines_id_]);
+  cv::Mat cv_img = ReadListImage(root_folder + filename, new_height,
+      new_width, is_color, image_data_param.decoder() ==
+      ImageDataParameter_Decoder_LIBJPEG_SCALED);
+  CHECK(cv_img.data) << "Could not load " << filename;
   // Use data_transformer to infer the expected blob shape from a cv_image.
   vector<int> top_shape = this->data_transformer_->InferBlobShape(cv_img);
   this->transformed_data_.Reshape(top_shape);
@@ -96,42 +206,98 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   for (int i = 0; i < this->prefetch_.size(); ++i) {
     this->prefetch_[i]->label_.Reshape(label_shape);
   }
-  // weijie & luobao
-  if (!this->layer_param_.image_data_param().reference()){
-    // vector<int> extra_shape({batch_size, 2, 1, 1});
+  // extra: the attributes of each image, prefetched with the images.
+  if (!this->layer_param_.image_data_param().reference()) {
+    CHECK_EQ(top.size(), 3) << "The extra attributes need a third top.";
+  }
+  if (top.size() > 2) {
+    CHECK_GT(num_attributes_, 0) << "The third top needs attribute columns "
+        "in " << source;
     vector<int> extra_shape(4, 1);
     extra_shape[0] = batch_size;
-    extra_shape[1] = 2; // ethnicity, gender
-    // extra_shape[1] = 20; // 8 facial ratios
+    extra_shape[1] = num_attributes_;
     top[2]->Reshape(extra_shape);
+    for (int i = 0; i < this->prefetch_.size(); ++i) {
+      this->prefetch_[i]->extra_[0]->Reshape(extra_shape);
+    }
   }
-
- // // gender, race as two extra input channels
- //  if (!this->layer_param_.image_data_param().reference()){
- //    vector<int> extra_shape(4, 1);
- //    extra_shape[0] = batch_size;
- //    extra_shape[1] = 2; 
- //    extra_shape[2] = 224;
- //    extra_shape[3] = 224; 
- //    top[2]->Reshape(extra_shape);
- //  }
 }
 
 template <typename Dtype>
-void ImageDataLayer<Dtype>::ShuffleImages() {
+void ImageDataLayer<Dtype>::DrawLine() {
+  if (!this->layer_param_.image_data_param().shuffle()) {
+    return;
+  }
   caffe::rng_t* prefetch_rng =
       static_cast<caffe::rng_t*>(prefetch_rng_->generator());
-  shuffle(lines_.begin(), lines_.end(), prefetch_rng);
+  boost::uniform_int<int> dist(lines_id_, lines_order_.size() - 1);
+  std::swap(lines_order_[lines_id_], lines_order_[dist(*prefetch_rng)]);
+}
+
+template <typename Dtype>
+void ImageDataLayer<Dtype>::NextLine() {
+  lines_id_++;
+  if (lines_id_ >= lines_order_.size()) {
+    // We have reached the end. Restart from the first.
+    DLOG(INFO) << "Restarting data prefetching from start.";
+    lines_id_ = 0;
+  }
+  DrawLine();
 }
 
+namespace {
+
+// What a decode worker needs to fill its slots of a batch, resolved on the
+// prefetch thread beforehand.
+template <typename Dtype>
+struct DecodeArgs {
+  const ImageList* lines;
+  const int* line_ids;
+  const cv::Mat* first_img;
+  string root_folder;
+  bool attention_guided_crop;
+  const AttentionTables* attention_tables;
+  int new_height;
+  int new_width;
+  bool is_color;
+  bool scaled_decode;
+  // The shape of a transformed item.
+  int channels;
+  int height;
+  int width;
+};
+
+// Decodes and transforms item item_id into its slot of the batch.
+template <typename Dtype>
+void decode_item(const DecodeArgs<Dtype>& args, const int item_id,
+    DataTransformer<Dtype>* transformer, Dtype* transformed_data) {
+  const char* filename = args.lines->name(args.line_ids[item_id]);
+  cv::Mat cv_img = (item_id == 0) ? *args.first_img :
+      ReadListImage(args.root_folder + filename, args.new_height,
+          args.new_width, args.is_color, args.scaled_decode);
+  CHECK(cv_img.data) << "Could not load " << filename;
+  // Apply transformations (mirror, crop...) to the image
+  if (!args.attention_guided_crop) {
+    transformer->Transform(cv_img, args.channels, args.height, args.width,
+        transformed_data);
+  } else if (!args.attention_tables) {
+    transformer->Attention_Transform(cv_img, args.channels, args.height,
+        args.width, transformed_data, NULL);
+  } else {
+    const AttentionSampler attention =
+        args.attention_tables->sampler(args.line_ids[item_id]);
+    transformer->Attention_Transform(cv_img, args.channels, args.height,
+        args.width, transformed_data, &attention);
+  }
+}
+
+}  // namespace
+
 // This function is called on prefetch thread
 template <typename Dtype>
 void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CPUTimer batch_timer;
   batch_timer.Start();
-  double read_time = 0;
-  double trans_time = 0;
-  CPUTimer timer;
   CHECK(batch->data_.count());
   CHECK(this->transformed_data_.count());
   ImageDataParameter image_data_param = this->layer_param_.image_data_param();
@@ -143,9 +309,12 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
 
   // Reshape according to the first image of each batch
   // on single input batches allows for inputs of varying dimension.
-  cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-      new_height, new_width, is_color);
-  CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
+  const bool scaled_decode = image_data_param.decoder() ==
+      ImageDataParameter_Decoder_LIBJPEG_SCALED;
+  const char* filename = lines_.name(lines_order_[lines_id_]);
+  cv::Mat cv_img = ReadListImage(root_folder + filename, new_height,
+      new_width, is_color, scaled_decode);
+  CHECK(cv_img.data) << "Could not load " << filename;
   // Use data_transformer to infer the expected blob shape from a cv_img.
   vector<int> top_shape = this->data_transformer_->InferBlobShape(cv_img);
   this->transformed_data_.Reshape(top_shape);
@@ -153,131 +322,43 @@ void ImageDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   top_shape[0] = batch_size;
   batch->data_.Reshape(top_shape);
 
-  Dtype* prefetch_data = batch->data_.mutable_cpu_data();
   Dtype* prefetch_label = batch->label_.mutable_cpu_data();
+  Dtype* prefetch_extra = batch->extra_.empty() ? NULL :
+      batch->extra_[0]->mutable_cpu_data();
 
-  // datum scales
-  const int lines_size = lines_.size();
+  vector<int> line_ids(batch_size);
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
-    timer.Start();
-    CHECK_GT(lines_size, lines_id_);
-    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-        new_height, new_width, is_color);
-    CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply transformations (mirror, crop...) to the image
-    int offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(prefetch_data + offset);
-    this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-    trans_time += timer.MicroSeconds();
-
-    prefetch_label[item_id] = lines_[lines_id_].second;
-    // go to the next iter
-    lines_id_++;
-    if (lines_id_ >= lines_size) {
-      // We have reached the end. Restart from the first.
-      DLOG(INFO) << "Restarting data prefetching from start.";
-      lines_id_ = 0;
-      if (this->layer_param_.image_data_param().shuffle()) {
-        ShuffleImages();
-      }
+    const int line_id = lines_order_[lines_id_];
+    line_ids[item_id] = line_id;
+    prefetch_label[item_id] = lines_.label(line_id);
+    if (prefetch_extra) {
+      caffe_copy(num_attributes_, &attributes_[line_id * num_attributes_],
+          prefetch_extra + item_id * num_attributes_);
     }
-  }
-  batch_timer.Stop();
-  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
-  DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
-  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
-}
-
-
-template <typename Dtype>
-void ImageDataLayer<Dtype>::Forward_cpu(
-    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  // if (prefetch_current_) {
-  //   prefetch_free_.push(prefetch_current_);
-  // }
-  // prefetch_current_ = prefetch_full_.pop("Waiting for data");
-  // // Reshape to loaded data.
-  // top[0]->ReshapeLike(prefetch_current_->data_);
-  // top[0]->set_cpu_data(prefetch_current_->data_.mutable_cpu_data());
-  // if (this->output_labels_) {
-  //   // Reshape to loaded labels.
-  //   top[1]->ReshapeLike(prefetch_current_->label_);
-  //   top[1]->set_cpu_data(prefetch_current_->label_.mutable_cpu_data());
-  // }
-  CPUTimer batch_timer;
-  batch_timer.Start();
-  double read_time = 0;
-  double trans_time = 0;
-  CPUTimer timer;
-  CHECK(this->transformed_data_.count());
-  ImageDataParameter image_data_param = this->layer_param_.image_data_param();
-  const int batch_size = image_data_param.batch_size();
-  const int new_height = image_data_param.new_height();
-  const int new_width = image_data_param.new_width();
-  const bool is_color = image_data_param.is_color();
-  string root_folder = image_data_param.root_folder();
-
-  Blob<Dtype>* top_data = top[0];
-  Dtype* top_label = top[1]->mutable_cpu_data();
-  Dtype* top_extra = top[2]->mutable_cpu_data();
-
-  // datum scales
-  const int lines_size = lines_.size();
-  for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // get a blob
-    timer.Start();
-    CHECK_GT(lines_size, lines_id_);
-    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-        new_height, new_width, is_color);
-    CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply transformations (mirror, crop...) to the image
-    int offset = top_data->offset(item_id);
-    this->transformed_data_.set_cpu_data(top_data->mutable_cpu_data() + offset);
-    this->data_transformer_->Transform(cv_img, &(this->transformed_data_));
-    trans_time += timer.MicroSeconds();
-
-    top_label[item_id] = lines_[lines_id_].second;
-
-    // add extra information such as ethnic, gender
-    if (!this->layer_param_.image_data_param().reference()){
-      std::string filename(lines_[lines_id_].first);
-      if (filename.find('f') != std::string::npos) {
-        top_extra[item_id * 2] = 0.1;       
-      } else if (filename.find('m') != std::string::npos) {
-        top_extra[item_id * 2] = -0.1;
-      } else {
-        LOG(ERROR) << "Filename error!";
-      }
-      if (filename.find('y') != std::string::npos) { 
-        top_extra[item_id * 2 + 1] = 0.1;
-      } else if (filename.find('w') != std::string::npos) {
-        top_extra[item_id * 2 + 1] = -0.1;
-      } else {
-        LOG(ERROR) << "Filename error!";
-      }
-      std::cout << top_extra[item_id * 2]<<" "<<top_extra[item_id * 2 + 1] << std::endl;
-    }
-
     // go to the next iter
-    lines_id_++;
-    if (lines_id_ >= lines_size) {
-      // We have reached the end. Restart from the first.
-      DLOG(INFO) << "Restarting data prefetching from start.";
-      lines_id_ = 0;
-      if (this->layer_param_.image_data_param().shuffle()) {
-        ShuffleImages();
-      }
-    }
+    NextLine();
   }
+
+  // Decode and transform the items in parallel, each into its own slot.
+  DecodeArgs<Dtype> args;
+  args.lines = &lines_;
+  args.line_ids = &line_ids[0];
+  args.first_img = &cv_img;
+  args.root_folder = root_folder;
+  args.attention_guided_crop = image_data_param.attention_guided_crop();
+  args.attention_tables = attention_tables_.get();
+  args.new_height = new_height;
+  args.new_width = new_width;
+  args.is_color = is_color;
+  args.scaled_decode = scaled_decode;
+  args.channels = batch->data_.channels();
+  args.height = batch->data_.height();
+  args.width = batch->data_.width();
+  this->TransformBatch(batch,
+      boost::bind(&decode_item<Dtype>, boost::cref(args), _1, _2, _3));
   batch_timer.Stop();
-  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
-  DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
-  DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+  DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms ("
+      << this->transformers_.size() << " decode workers).";
 }
 
 INSTANTIATE_CLASS(ImageDataLayer);
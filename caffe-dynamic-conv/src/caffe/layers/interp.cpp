@@ -1,12 +1,229 @@
 // Copyright 2014 George Papandreou
 
+#include <boost/bind.hpp>
+
 #include "caffe/common.hpp"
 #include "caffe/util/interp.hpp"
+#include "caffe/util/parallel_for.hpp"
 #include <algorithm>
 #include <cmath>
 
 namespace caffe {
 
+template <typename Dtype>
+void caffe_interp_taps(const int size1, const int size2,
+    InterpTaps<Dtype>* taps) {
+  CHECK(size1 > 0 && size2 > 0);
+  taps->size1 = size1;
+  taps->index.resize(size2);
+  taps->step.resize(size2);
+  taps->lambda.resize(size2);
+  // The same arithmetic as the per-pixel loops below, for the same results.
+  const float ratio = (size2 > 1) ?
+      static_cast<float>(size1 - 1) / (size2 - 1) : 0.f;
+  for (int i = 0; i < size2; ++i) {
+    const float i1r = ratio * i;
+    const int i1 = i1r;
+    taps->index[i] = i1;
+    taps->step[i] = (i1 < size1 - 1) ? 1 : 0;
+    taps->lambda[i] = i1r - i1;
+  }
+}
+
+namespace {
+
+// What the workers of the planar caffe_cpu_interp2 need. Image 1 is the
+// bottom and image 2 the top; each channel is a plane of plane* values with
+// rows of stride* values, the interpolated window starting at offset*.
+template <typename Dtype>
+struct Interp2Args {
+  const Dtype* data1;
+  Dtype* diff1;
+  Dtype* data2;
+  const Dtype* diff2;
+  int offset1, plane1, stride1;
+  int offset2, plane2, stride2;
+  const InterpTaps<Dtype>* taps_h;
+  const InterpTaps<Dtype>* taps_w;
+};
+
+// Interpolates a source row along the width.
+template <typename Dtype>
+inline void interp_row(const Dtype* src, const InterpTaps<Dtype>& taps,
+    Dtype* dst) {
+  const int size2 = taps.index.size();
+  const int* index = &taps.index[0];
+  const int* step = &taps.step[0];
+  const Dtype* lambda = &taps.lambda[0];
+  for (int i = 0; i < size2; ++i) {
+    const Dtype* pos = src + index[i];
+    dst[i] = (Dtype(1.) - lambda[i]) * pos[0] + lambda[i] * pos[step[i]];
+  }
+}
+
+// Channels [begin, end), a row of the top at a time.
+template <typename Dtype>
+void interp2_forward(const Interp2Args<Dtype>& args, const int begin,
+    const int end, const int worker) {
+  const InterpTaps<Dtype>& taps_h = *args.taps_h;
+  const InterpTaps<Dtype>& taps_w = *args.taps_w;
+  const int height2 = taps_h.index.size();
+  const int width2 = taps_w.index.size();
+  // The two source rows blended into the current top row, already
+  // interpolated along the width; zooming, most top rows reuse both.
+  vector<Dtype> rows(2 * width2);
+  const bool copy = (taps_h.size1 == height2 && taps_w.size1 == width2);
+  for (int c = begin; c < end; ++c) {
+    const Dtype* plane1 = args.data1 + c * args.plane1 + args.offset1;
+    Dtype* plane2 = args.data2 + c * args.plane2 + args.offset2;
+    if (copy) {
+      for (int h2 = 0; h2 < height2; ++h2) {
+        const Dtype* pos1 = plane1 + h2 * args.stride1;
+        std::copy(pos1, pos1 + width2, plane2 + h2 * args.stride2);
+      }
+      continue;
+    }
+    Dtype* row0 = &rows[0];
+    Dtype* row1 = &rows[width2];
+    int h0 = -1;
+    int h1 = -1;
+    for (int h2 = 0; h2 < height2; ++h2) {
+      const int top = taps_h.index[h2];
+      const int bottom = top + taps_h.step[h2];
+      if (top != h0) {
+        if (top == h1) {
+          std::swap(row0, row1);
+          h0 = h1;
+          h1 = -1;
+        } else {
+          interp_row(plane1 + top * args.stride1, taps_w, row0);
+          h0 = top;
+        }
+      }
+      if (bottom != h1) {
+        interp_row(plane1 + bottom * args.stride1, taps_w, row1);
+        h1 = bottom;
+      }
+      const Dtype lambda1 = taps_h.lambda[h2];
+      const Dtype lambda0 = Dtype(1.) - lambda1;
+      Dtype* pos2 = plane2 + h2 * args.stride2;
+      for (int w2 = 0; w2 < width2; ++w2) {
+        pos2[w2] = lambda0 * row0[w2] + lambda1 * row1[w2];
+      }
+    }
+  }
+}
+
+// Channels [begin, end), accumulating a row of the top diff at a time: its
+// adjoint along the width is taken within a row buffer, then added to the
+// two bottom rows it came from.
+template <typename Dtype>
+void interp2_backward(const Interp2Args<Dtype>& args, const int begin,
+    const int end, const int worker) {
+  const InterpTaps<Dtype>& taps_h = *args.taps_h;
+  const InterpTaps<Dtype>& taps_w = *args.taps_w;
+  const int height2 = taps_h.index.size();
+  const int width1 = taps_w.size1;
+  const int width2 = taps_w.index.size();
+  const int* index = &taps_w.index[0];
+  const int* step = &taps_w.step[0];
+  const Dtype* lambda = &taps_w.lambda[0];
+  vector<Dtype> row(width1);
+  const bool copy = (taps_h.size1 == height2 && width1 == width2);
+  for (int c = begin; c < end; ++c) {
+    Dtype* plane1 = args.diff1 + c * args.plane1 + args.offset1;
+    const Dtype* plane2 = args.diff2 + c * args.plane2 + args.offset2;
+    if (copy) {
+      for (int h2 = 0; h2 < height2; ++h2) {
+        Dtype* pos1 = plane1 + h2 * args.stride1;
+        const Dtype* pos2 = plane2 + h2 * args.stride2;
+        for (int w2 = 0; w2 < width2; ++w2) {
+          pos1[w2] += pos2[w2];
+        }
+      }
+      continue;
+    }
+    for (int h2 = 0; h2 < height2; ++h2) {
+      const Dtype* pos2 = plane2 + h2 * args.stride2;
+      std::fill(row.begin(), row.end(), Dtype(0));
+      for (int w2 = 0; w2 < width2; ++w2) {
+        Dtype* pos = &row[index[w2]];
+        pos[0] += (Dtype(1.) - lambda[w2]) * pos2[w2];
+        pos[step[w2]] += lambda[w2] * pos2[w2];
+      }
+      const Dtype lambda1 = taps_h.lambda[h2];
+      const Dtype lambda0 = Dtype(1.) - lambda1;
+      Dtype* top = plane1 + taps_h.index[h2] * args.stride1;
+      for (int w1 = 0; w1 < width1; ++w1) {
+        top[w1] += lambda0 * row[w1];
+      }
+      Dtype* bottom = top + taps_h.step[h2] * args.stride1;
+      for (int w1 = 0; w1 < width1; ++w1) {
+        bottom[w1] += lambda1 * row[w1];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+Interp2Args<Dtype> interp2_args(const int x1, const int y1, const int Height1,
+    const int Width1, const int x2, const int y2, const int Height2,
+    const int Width2, const InterpTaps<Dtype>& taps_h,
+    const InterpTaps<Dtype>& taps_w) {
+  const int height1 = taps_h.size1, width1 = taps_w.size1;
+  const int height2 = taps_h.index.size(), width2 = taps_w.index.size();
+  CHECK(x1 >= 0 && y1 >= 0 && height1 > 0 && width1 > 0 && x2 >= 0
+      && y2 >= 0 && height2 > 0 && width2 > 0);
+  CHECK(Width1 >= width1 + x1 && Height1 >= height1 + y1
+      && Width2 >= width2 + x2 && Height2 >= height2 + y2);
+  Interp2Args<Dtype> args = Interp2Args<Dtype>();
+  args.offset1 = y1 * Width1 + x1;
+  args.plane1 = Height1 * Width1;
+  args.stride1 = Width1;
+  args.offset2 = y2 * Width2 + x2;
+  args.plane2 = Height2 * Width2;
+  args.stride2 = Width2;
+  args.taps_h = &taps_h;
+  args.taps_w = &taps_w;
+  return args;
+}
+
+}  // namespace
+
+template <typename Dtype>
+void caffe_cpu_interp2(const int channels,
+    const Dtype *data1, const int x1, const int y1, const int Height1,
+    const int Width1,
+    Dtype *data2, const int x2, const int y2, const int Height2,
+    const int Width2,
+    const InterpTaps<Dtype>& taps_h, const InterpTaps<Dtype>& taps_w) {
+  Interp2Args<Dtype> args = interp2_args(x1, y1, Height1, Width1,
+      x2, y2, Height2, Width2, taps_h, taps_w);
+  args.data1 = data1;
+  args.data2 = data2;
+  caffe_parallel_ranges(channels,
+      caffe_parallel_grain(taps_h.index.size() * taps_w.index.size()),
+      Caffe::cpu_threads(), boost::bind(&interp2_forward<Dtype>,
+      boost::cref(args), _1, _2, _3));
+}
+
+template <typename Dtype>
+void caffe_cpu_interp2_backward(const int channels,
+    Dtype *data1, const int x1, const int y1, const int Height1,
+    const int Width1,
+    const Dtype *data2, const int x2, const int y2, const int Height2,
+    const int Width2,
+    const InterpTaps<Dtype>& taps_h, const InterpTaps<Dtype>& taps_w) {
+  Interp2Args<Dtype> args = interp2_args(x1, y1, Height1, Width1,
+      x2, y2, Height2, Width2, taps_h, taps_w);
+  args.diff1 = data1;
+  args.diff2 = data2;
+  caffe_parallel_ranges(channels,
+      caffe_parallel_grain(taps_h.index.size() * taps_w.index.size()),
+      Caffe::cpu_threads(), boost::bind(&interp2_backward<Dtype>,
+      boost::cref(args), _1, _2, _3));
+}
+
 // Bi-linear interpolation
 // IN : [channels height1 width1] cropped from a bigger [Height1 Width1] image
 // OUT: [channels height2 width2] cropped from a bigger [Height2 Width2] image
@@ -16,6 +233,15 @@ void caffe_cpu_interp2(const int channels,
     Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2) {
   CHECK(x1 >= 0 && y1 >= 0 && height1 > 0 && width1 > 0 && x2 >= 0 && y2 >= 0 && height2 > 0 && width2 > 0);
   CHECK(Width1 >= width1 + x1 && Height1 >= height1 + y1 && Width2 >= width2 + x2 && Height2 >= height2 + y2);
+  if (!packed) {
+    // Planar data goes a channel at a time instead.
+    InterpTaps<Dtype> taps_h, taps_w;
+    caffe_interp_taps(height1, height2, &taps_h);
+    caffe_interp_taps(width1, width2, &taps_w);
+    caffe_cpu_interp2(channels, data1, x1, y1, Height1, Width1,
+        data2, x2, y2, Height2, Width2, taps_h, taps_w);
+    return;
+  }
   // special case: just copy
   if (height1 == height2 && width1 == width2) {
     for (int h2 = 0; h2 < height2; ++h2) {
@@ -92,6 +318,14 @@ void caffe_cpu_interp2_backward(const int channels,
     const Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2) {
   CHECK(x1 >= 0 && y1 >= 0 && height1 > 0 && width1 > 0 && x2 >= 0 && y2 >= 0 && height2 > 0 && width2 > 0);
   CHECK(Width1 >= width1 + x1 && Height1 >= height1 + y1 && Width2 >= width2 + x2 && Height2 >= height2 + y2);
+  if (!packed) {
+    InterpTaps<Dtype> taps_h, taps_w;
+    caffe_interp_taps(height1, height2, &taps_h);
+    caffe_interp_taps(width1, width2, &taps_w);
+    caffe_cpu_interp2_backward(channels, data1, x1, y1, Height1, Width1,
+        data2, x2, y2, Height2, Width2, taps_h, taps_w);
+    return;
+  }
   // special case: same-size matching grids
   if (height1 == height2 && width1 == width2) {
     for (int h2 = 0; h2 < height2; ++h2) {
@@ -292,6 +526,15 @@ template void caffe_cpu_interp2<double,true>(const int, const double *, const in
 template void caffe_cpu_interp2_backward<float,false>(const int, float *, const int, const int, const int, const int, const int, const int, const float *, const int, const int, const int, const int, const int, const int);
 template void caffe_cpu_interp2_backward<double,false>(const int, double *, const int, const int, const int, const int, const int, const int, const double *, const int, const int, const int, const int, const int, const int);
 
+template void caffe_interp_taps<float>(const int, const int, InterpTaps<float>*);
+template void caffe_interp_taps<double>(const int, const int, InterpTaps<double>*);
+
+template void caffe_cpu_interp2<float>(const int, const float *, const int, const int, const int, const int, float *, const int, const int, const int, const int, const InterpTaps<float>&, const InterpTaps<float>&);
+template void caffe_cpu_interp2<double>(const int, const double *, const int, const int, const int, const int, double *, const int, const int, const int, const int, const InterpTaps<double>&, const InterpTaps<double>&);
+
+template void caffe_cpu_interp2_backward<float>(const int, float *, const int, const int, const int, const int, const float *, const int, const int, const int, const int, const InterpTaps<float>&, const InterpTaps<float>&);
+template void caffe_cpu_interp2_backward<double>(const int, double *, const int, const int, const int, const int, const double *, const int, const int, const int, const int, const InterpTaps<double>&, const InterpTaps<double>&);
+
 template void caffe_cpu_pyramid2<float,false>(const int, const float *, const int, const int, float *, const int);
 template void caffe_cpu_pyramid2<float,true>(const int, const float *, const int, const int, float *, const int);
 template void caffe_cpu_pyramid2<double,false>(const int, const double *, const int, const int, double *, const int);
@@ -36,6 +36,7 @@ void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       << "Stride is stride OR stride_h and stride_w are required.";
   global_pooling_ = pool_param.global_pooling();
   ceil_mode_ = pool_param.ceil_mode();
+  int_mask_ = pool_param.int_mask();
 
   if (global_pooling_) {
     kernel_h_ = bottom[0]->height();
@@ -145,8 +146,9 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int top_count = top[0]->count();
-  // We'll output the mask to top[1] if it's of size >1.
-  const bool use_top_mask = top.size() > 1;
+  // We'll output the mask to top[1] if it's of size >1, as Dtype values
+  // unless int_mask is set.
+  const bool use_top_mask = top.size() > 1 && !int_mask_;
   int* mask = NULL;  // suppress warnings about uninitalized variables
   Dtype* top_mask = NULL;
   // Different pooling methods. We explicitly do the switch outside the for
@@ -158,7 +160,9 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       top_mask = top[1]->mutable_cpu_data();
       caffe_set(top_count, Dtype(-1), top_mask);
     } else {
-      mask = max_idx_.mutable_cpu_data();
+      mask = (top.size() > 1) ?
+          reinterpret_cast<int*>(top[1]->mutable_cpu_data()) :
+          max_idx_.mutable_cpu_data();
       caffe_set(top_count, -1, mask);
     }
     caffe_set(top_count, Dtype(-FLT_MAX), top_data);
@@ -253,7 +257,7 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   // loop to save time, although this results in more codes.
   caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
   // We'll output the mask to top[1] if it's of size >1.
-  const bool use_top_mask = top.size() > 1;
+  const bool use_top_mask = top.size() > 1 && !int_mask_;
   const int* mask = NULL;  // suppress warnings about uninitialized variables
   const Dtype* top_mask = NULL;
   switch (this->layer_param_.pooling_param().pool()) {
@@ -262,7 +266,9 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     if (use_top_mask) {
       top_mask = top[1]->cpu_data();
     } else {
-      mask = max_idx_.cpu_data();
+      mask = (top.size() > 1) ?
+          reinterpret_cast<const int*>(top[1]->cpu_data()) :
+          max_idx_.cpu_data();
     }
     for (int n = 0; n < top[0]->num(); ++n) {
       for (int c = 0; c < channels_; ++c) {
@@ -1,3 +1,5 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
 #include <vector>
 
@@ -5,6 +7,7 @@
 #include "caffe/layer_factory.hpp"
 #include "caffe/layers/scale_layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 
 namespace caffe {
 
@@ -113,107 +116,162 @@ void ScaleLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+namespace {
+
+// What the workers of ScaleLayer need, resolved beforehand. Items are
+// either scale entries d or planes n * scale_dim + d of inner_dim values.
+template <typename Dtype>
+struct ScaleArgs {
+  const Dtype* bottom_data;
+  Dtype* top_data;
+  // The copy of the bottom kept when in place, or NULL.
+  Dtype* bottom_copy;
+  const Dtype* top_diff;
+  Dtype* bottom_diff;
+  const Dtype* scale_data;
+  const Dtype* bias_data;
+  Dtype* scale_diff;
+  Dtype* bias_diff;
+  // Whether scale_diff accumulates (a parameter) or is overwritten.
+  bool accumulate_scale;
+  int outer_dim;
+  int scale_dim;
+  int inner_dim;
+};
+
+// top = bottom * scale (+ bias) on planes [begin, end).
+template <typename Dtype>
+void scale_forward(const ScaleArgs<Dtype>& args, const int begin,
+    const int end, const int worker) {
+  const int inner_dim = args.inner_dim;
+  for (int plane = begin; plane < end; ++plane) {
+    const int d = plane % args.scale_dim;
+    const Dtype factor = args.scale_data[d];
+    const Dtype bias = args.bias_data ? args.bias_data[d] : Dtype(0);
+    const Dtype* x = args.bottom_data + plane * inner_dim;
+    Dtype* y = args.top_data + plane * inner_dim;
+    if (args.bottom_copy) {
+      Dtype* x_copy = args.bottom_copy + plane * inner_dim;
+      for (int i = 0; i < inner_dim; ++i) {
+        x_copy[i] = x[i];
+        y[i] = x[i] * factor + bias;
+      }
+    } else {
+      for (int i = 0; i < inner_dim; ++i) {
+        y[i] = x[i] * factor + bias;
+      }
+    }
+  }
+}
+
+// The scale and bias diffs of entries [begin, end), summed over the outer
+// and inner dimensions.
+template <typename Dtype>
+void scale_param_backward(const ScaleArgs<Dtype>& args, const int begin,
+    const int end, const int worker) {
+  const int inner_dim = args.inner_dim;
+  for (int d = begin; d < end; ++d) {
+    Dtype sum_dy = 0;
+    Dtype sum_dy_x = 0;
+    for (int n = 0; n < args.outer_dim; ++n) {
+      const int offset = (n * args.scale_dim + d) * inner_dim;
+      const Dtype* dy = args.top_diff + offset;
+      const Dtype* x = args.bottom_data + offset;
+      for (int i = 0; i < inner_dim; ++i) {
+        sum_dy += dy[i];
+        sum_dy_x += dy[i] * x[i];
+      }
+    }
+    if (args.scale_diff) {
+      args.scale_diff[d] =
+          (args.accumulate_scale ? args.scale_diff[d] : Dtype(0)) + sum_dy_x;
+    }
+    if (args.bias_diff) {
+      args.bias_diff[d] += sum_dy;
+    }
+  }
+}
+
+// bottom_diff = top_diff * scale on planes [begin, end).
+template <typename Dtype>
+void scale_backward(const ScaleArgs<Dtype>& args, const int begin,
+    const int end, const int worker) {
+  const int inner_dim = args.inner_dim;
+  for (int plane = begin; plane < end; ++plane) {
+    const Dtype factor = args.scale_data[plane % args.scale_dim];
+    const Dtype* dy = args.top_diff + plane * inner_dim;
+    Dtype* dx = args.bottom_diff + plane * inner_dim;
+    for (int i = 0; i < inner_dim; ++i) {
+      dx[i] = dy[i] * factor;
+    }
+  }
+}
+
+}  // namespace
+
 template <typename Dtype>
 void ScaleLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  const Dtype* bottom_data = bottom[0]->cpu_data();
+  // The (outer, scale) planes are split among Caffe::cpu_threads() workers,
+  // each adding the bias as it scales.
+  ScaleArgs<Dtype> args = ScaleArgs<Dtype>();
+  args.bottom_data = bottom[0]->cpu_data();
   if (bottom[0] == top[0]) {
     // In-place computation; need to store bottom data before overwriting it.
     // Note that this is only necessary for Backward; we could skip this if not
     // doing Backward, but Caffe currently provides no way of knowing whether
     // we'll need to do Backward at the time of the Forward call.
-    caffe_copy(bottom[0]->count(), bottom[0]->cpu_data(),
-               temp_.mutable_cpu_data());
+    args.bottom_copy = temp_.mutable_cpu_data();
   }
-  const Dtype* scale_data =
+  args.scale_data =
       ((bottom.size() > 1) ? bottom[1] : this->blobs_[0].get())->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
-  for (int n = 0; n < outer_dim_; ++n) {
-    for (int d = 0; d < scale_dim_; ++d) {
-      const Dtype factor = scale_data[d];
-      caffe_cpu_scale(inner_dim_, factor, bottom_data, top_data);
-      bottom_data += inner_dim_;
-      top_data += inner_dim_;
-    }
-  }
   if (bias_layer_) {
-    bias_layer_->Forward(bias_bottom_vec_, top);
+    CHECK_EQ(this->blobs_[bias_param_id_]->count(), scale_dim_);
+    args.bias_data = this->blobs_[bias_param_id_]->cpu_data();
   }
+  args.top_data = top[0]->mutable_cpu_data();
+  args.outer_dim = outer_dim_;
+  args.scale_dim = scale_dim_;
+  args.inner_dim = inner_dim_;
+  caffe_parallel_ranges(outer_dim_ * scale_dim_,
+      caffe_parallel_grain(inner_dim_), Caffe::cpu_threads(),
+      boost::bind(&scale_forward<Dtype>, boost::cref(args), _1, _2, _3));
 }
 
 template <typename Dtype>
 void ScaleLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  if (bias_layer_ &&
-      this->param_propagate_down_[this->param_propagate_down_.size() - 1]) {
-    bias_layer_->Backward(top, bias_propagate_down_, bias_bottom_vec_);
-  }
   const bool scale_param = (bottom.size() == 1);
   Blob<Dtype>* scale = scale_param ? this->blobs_[0].get() : bottom[1];
+  ScaleArgs<Dtype> args = ScaleArgs<Dtype>();
+  args.top_diff = top[0]->cpu_diff();
+  args.bottom_data = (bottom[0] == top[0] ? &temp_ : bottom[0])->cpu_data();
+  args.scale_data = scale->cpu_data();
+  args.accumulate_scale = scale_param;
+  args.outer_dim = outer_dim_;
+  args.scale_dim = scale_dim_;
+  args.inner_dim = inner_dim_;
   if ((!scale_param && propagate_down[1]) ||
       (scale_param && this->param_propagate_down_[0])) {
-    const Dtype* top_diff = top[0]->cpu_diff();
-    const bool in_place = (bottom[0] == top[0]);
-    const Dtype* bottom_data = (in_place ? &temp_ : bottom[0])->cpu_data();
-    // Hack: store big eltwise product in bottom[0] diff, except in the special
-    // case where this layer itself does the eltwise product, in which case we
-    // can store it directly in the scale diff, and we're done.
-    // If we're computing in-place (and not doing eltwise computation), this
-    // hack doesn't work and we store the product in temp_.
-    const bool is_eltwise = (bottom[0]->count() == scale->count());
-    Dtype* product = (is_eltwise ? scale->mutable_cpu_diff() :
-        (in_place ? temp_.mutable_cpu_data() : bottom[0]->mutable_cpu_diff()));
-    caffe_mul(top[0]->count(), top_diff, bottom_data, product);
-    if (!is_eltwise) {
-      Dtype* sum_result = NULL;
-      if (inner_dim_ == 1) {
-        sum_result = product;
-      } else if (sum_result_.count() == 1) {
-        const Dtype* sum_mult = sum_multiplier_.cpu_data();
-        Dtype* scale_diff = scale->mutable_cpu_diff();
-        if (scale_param) {
-          Dtype result = caffe_cpu_dot(inner_dim_, product, sum_mult);
-          *scale_diff += result;
-        } else {
-          *scale_diff = caffe_cpu_dot(inner_dim_, product, sum_mult);
-        }
-      } else {
-        const Dtype* sum_mult = sum_multiplier_.cpu_data();
-        sum_result = (outer_dim_ == 1) ?
-            scale->mutable_cpu_diff() : sum_result_.mutable_cpu_data();
-        caffe_cpu_gemv(CblasNoTrans, sum_result_.count(), inner_dim_,
-                       Dtype(1), product, sum_mult, Dtype(0), sum_result);
-      }
-      if (outer_dim_ != 1) {
-        const Dtype* sum_mult = sum_multiplier_.cpu_data();
-        Dtype* scale_diff = scale->mutable_cpu_diff();
-        if (scale_dim_ == 1) {
-          if (scale_param) {
-            Dtype result = caffe_cpu_dot(outer_dim_, sum_mult, sum_result);
-            *scale_diff += result;
-          } else {
-            *scale_diff = caffe_cpu_dot(outer_dim_, sum_mult, sum_result);
-          }
-        } else {
-          caffe_cpu_gemv(CblasTrans, outer_dim_, scale_dim_,
-                         Dtype(1), sum_result, sum_mult, Dtype(scale_param),
-                         scale_diff);
-        }
-      }
-    }
+    args.scale_diff = scale->mutable_cpu_diff();
+  }
+  if (bias_layer_ &&
+      this->param_propagate_down_[this->param_propagate_down_.size() - 1]) {
+    args.bias_diff = this->blobs_[bias_param_id_]->mutable_cpu_diff();
+  }
+  // The parameter diffs come first: in place, the bottom diff overwrites the
+  // top diff.
+  if (args.scale_diff || args.bias_diff) {
+    caffe_parallel_ranges(scale_dim_,
+        caffe_parallel_grain(outer_dim_ * inner_dim_), Caffe::cpu_threads(),
+        boost::bind(&scale_param_backward<Dtype>, boost::cref(args),
+        _1, _2, _3));
   }
   if (propagate_down[0]) {
-    const Dtype* top_diff = top[0]->cpu_diff();
-    const Dtype* scale_data = scale->cpu_data();
-    Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-    for (int n = 0; n < outer_dim_; ++n) {
-      for (int d = 0; d < scale_dim_; ++d) {
-        const Dtype factor = scale_data[d];
-        caffe_cpu_scale(inner_dim_, factor, top_diff, bottom_diff);
-        bottom_diff += inner_dim_;
-        top_diff += inner_dim_;
-      }
-    }
+    args.bottom_diff = bottom[0]->mutable_cpu_diff();
+    caffe_parallel_ranges(outer_dim_ * scale_dim_,
+        caffe_parallel_grain(inner_dim_), Caffe::cpu_threads(),
+        boost::bind(&scale_backward<Dtype>, boost::cref(args), _1, _2, _3));
   }
 }
 
@@ -1,3 +1,5 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
 #include <cfloat>
 #include <vector>
@@ -7,6 +9,7 @@
 // #include "caffe/layer.hpp"
 // #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel_for.hpp"
 #include "caffe/layers/upsample_layer.hpp"
 
 namespace caffe {
@@ -49,6 +52,7 @@ void UpsampleLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
         << "the output size is ill-defined.";
     upsample_h_ = upsample_w_ = -1;  // flag to calculate in Reshape
   }
+  int_mask_ = upsample_param.int_mask();
 }
 
 template <typename Dtype>
@@ -72,69 +76,162 @@ void UpsampleLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   channels_ = bottom[0]->channels();
   height_ = bottom[0]->height();
   width_ = bottom[0]->width();
+  tile_h_ = (upsample_h_ + height_ - 1) / height_;
+  tile_w_ = (upsample_w_ + width_ - 1) / width_;
 }
 
-template <typename Dtype>
-void UpsampleLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top) {
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  const Dtype* bottom_mask_data = bottom[1]->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
-
-  // Initialize
-  const int top_count = top[0]->count();
-  caffe_set(top_count, Dtype(0), top_data);
-  // The main loop
-  for (int n = 0; n < bottom[0]->num(); ++n) {
-    for (int c = 0; c < channels_; ++c) {
-      for (int i = 0; i < height_ * width_; ++i) {
-        const int idx = static_cast<int>(bottom_mask_data[i]);
-        if (idx >= upsample_h_ * upsample_w_) {
-          // this can happen if the pooling layer that created the input mask
-          // had an input with different size to top[0]
-          LOG(FATAL) << "upsample top index " << idx << " out of range - "
-            << "check scale settings match input pooling layer's "
-            << "downsample setup";
+namespace {
+
+// What the workers of UpsampleLayer need, resolved beforehand. Items are
+// (sample, channel) planes; the mask is Dtype or int.
+template <typename Dtype, typename Mask>
+struct UpsampleArgs {
+  const Dtype* bottom_data;
+  Dtype* bottom_diff;
+  const Mask* mask;
+  Dtype* top_data;
+  const Dtype* top_diff;
+  int height, width;
+  int upsample_h, upsample_w;
+  int tile_h, tile_w;
+};
+
+// A Dtype mask must hold whole indices: an int mask read as Dtype has
+// denormal values, which would all truncate to index 0.
+template <typename Mask>
+inline int upsample_index(const Mask* mask, const int i, const int top_size) {
+  const int idx = static_cast<int>(mask[i]);
+  if (idx < 0 || idx >= top_size || idx != mask[i]) {
+    // this can happen if the pooling layer that created the input mask
+    // had an input with different size to top[0], or a different int_mask
+    LOG(FATAL) << "upsample top index " << mask[i] << " out of range or not "
+        << "whole - check scale settings and int_mask match input pooling "
+        << "layer's downsample setup";
+  }
+  return idx;
+}
+
+// Planes [begin, end). Each bottom value covers a tile_h x tile_w tile of the
+// top, the window it was pooled from when the pooling windows tile the
+// bottom. The top is written once, row by row, each tile getting its value at
+// its index and 0 elsewhere. If an index lies outside its own tile, as with
+// overlapping windows, the plane's values are scattered again afterwards.
+template <typename Dtype, typename Mask>
+void upsample_forward(const UpsampleArgs<Dtype, Mask>& args, const int begin,
+    const int end, const int worker) {
+  const int bottom_size = args.height * args.width;
+  const int top_size = args.upsample_h * args.upsample_w;
+  for (int plane = begin; plane < end; ++plane) {
+    const Dtype* bottom_data = args.bottom_data + plane * bottom_size;
+    const Mask* mask = args.mask + plane * bottom_size;
+    Dtype* top_data = args.top_data + plane * top_size;
+    bool spilled = false;
+    for (int h = 0; h < args.height; ++h) {
+      const int row_begin = std::min(h * args.tile_h, args.upsample_h);
+      const int row_end = std::min(row_begin + args.tile_h, args.upsample_h);
+      for (int w = 0; w < args.width; ++w) {
+        const int idx = upsample_index(mask, h * args.width + w, top_size);
+        const int row = idx / args.upsample_w;
+        const int col = idx % args.upsample_w;
+        spilled |= (row < row_begin || row >= row_end
+            || col < w * args.tile_w || col >= (w + 1) * args.tile_w);
+      }
+      for (int row = row_begin; row < row_end; ++row) {
+        Dtype* top_row = top_data + row * args.upsample_w;
+        for (int w = 0; w < args.width; ++w) {
+          const int i = h * args.width + w;
+          const int col_max =
+              static_cast<int>(mask[i]) - row * args.upsample_w;
+          const int col_begin = std::min(w * args.tile_w, args.upsample_w);
+          const int col_end =
+              std::min(col_begin + args.tile_w, args.upsample_w);
+          for (int col = col_begin; col < col_end; ++col) {
+            top_row[col] = (col == col_max) ? bottom_data[i] : Dtype(0);
+          }
         }
-        top_data[idx] = bottom_data[i];
       }
-      // compute offset
-      bottom_data += bottom[0]->offset(0, 1);
-      bottom_mask_data += bottom[1]->offset(0, 1);
-      top_data += top[0]->offset(0, 1);
+    }
+    if (spilled) {
+      for (int i = 0; i < bottom_size; ++i) {
+        top_data[static_cast<int>(mask[i])] = bottom_data[i];
+      }
     }
   }
 }
 
+// Planes [begin, end); every bottom value is gathered from the top.
+template <typename Dtype, typename Mask>
+void upsample_backward(const UpsampleArgs<Dtype, Mask>& args,
+    const int begin, const int end, const int worker) {
+  const int bottom_size = args.height * args.width;
+  const int top_size = args.upsample_h * args.upsample_w;
+  for (int plane = begin; plane < end; ++plane) {
+    const Mask* mask = args.mask + plane * bottom_size;
+    const Dtype* top_diff = args.top_diff + plane * top_size;
+    Dtype* bottom_diff = args.bottom_diff + plane * bottom_size;
+    for (int i = 0; i < bottom_size; ++i) {
+      bottom_diff[i] = top_diff[upsample_index(mask, i, top_size)];
+    }
+  }
+}
+
+template <typename Dtype, typename Mask>
+void upsample_cpu(const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top, const Mask* mask, const int tile_h,
+    const int tile_w, const bool forward) {
+  UpsampleArgs<Dtype, Mask> args = UpsampleArgs<Dtype, Mask>();
+  args.mask = mask;
+  args.height = bottom[0]->height();
+  args.width = bottom[0]->width();
+  args.upsample_h = top[0]->height();
+  args.upsample_w = top[0]->width();
+  args.tile_h = tile_h;
+  args.tile_w = tile_w;
+  const int planes = bottom[0]->count(0, 2);
+  const int grain = caffe_parallel_grain(top[0]->count(2));
+  if (forward) {
+    args.bottom_data = bottom[0]->cpu_data();
+    args.top_data = top[0]->mutable_cpu_data();
+    caffe_parallel_ranges(planes, grain, Caffe::cpu_threads(),
+        boost::bind(&upsample_forward<Dtype, Mask>, boost::cref(args),
+        _1, _2, _3));
+  } else {
+    args.top_diff = top[0]->cpu_diff();
+    args.bottom_diff = bottom[0]->mutable_cpu_diff();
+    caffe_parallel_ranges(planes, grain, Caffe::cpu_threads(),
+        boost::bind(&upsample_backward<Dtype, Mask>, boost::cref(args),
+        _1, _2, _3));
+  }
+}
+
+}  // namespace
+
+template <typename Dtype>
+void UpsampleLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  if (int_mask_) {
+    upsample_cpu(bottom, top,
+        reinterpret_cast<const int*>(bottom[1]->cpu_data()), tile_h_, tile_w_,
+        true);
+  } else {
+    upsample_cpu(bottom, top, bottom[1]->cpu_data(), tile_h_, tile_w_,
+        true);
+  }
+}
+
 template <typename Dtype>
 void UpsampleLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  if (propagate_down[0]) {
-    const Dtype* top_diff = top[0]->cpu_diff();
-    const Dtype* bottom_mask_data = bottom[1]->cpu_data();
-    Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-
-    const int bottom_count = bottom[0]->count();
-    caffe_set(bottom_count, Dtype(0), bottom_diff);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int i = 0; i < height_ * width_; ++i) {
-          const int idx = static_cast<int>(bottom_mask_data[i]);
-          if (idx >= height_ * width_ * scale_h_ * scale_w_) {
-            // this can happen if the pooling layer that created
-            // the input mask had an input with different size to top[0]
-            LOG(FATAL) << "upsample top index " << idx << " out of range - "
-              << "check scale settings match input pooling layer's downsample setup";
-          }
-          bottom_diff[i] = top_diff[idx];
-        }
-        // compute offset
-        bottom_diff += bottom[0]->offset(0, 1);
-        bottom_mask_data += bottom[1]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-      }
-    }
+  if (!propagate_down[0]) {
+    return;
+  }
+  if (int_mask_) {
+    upsample_cpu(bottom, top,
+        reinterpret_cast<const int*>(bottom[1]->cpu_data()), tile_h_, tile_w_,
+        false);
+  } else {
+    upsample_cpu(bottom, top, bottom[1]->cpu_data(), tile_h_, tile_w_,
+        false);
   }
 }
 
@@ -8,14 +8,20 @@
 
 namespace caffe {
 
-template <typename Dtype>
+// The kernels cannot fail like the CPU path does, so an index outside the
+// top plane (a mask from a differently sized pooling layer, or with a
+// different int_mask) is dropped in forward and gets a zero diff in backward
+// rather than touching other memory.
+template <typename Dtype, typename Mask>
   __global__ void UpsampleForward(const int nthreads, int in_w, int in_h,
       int out_w, int out_h, const Dtype* bottom_data,
-      const Dtype* bottom_mask, Dtype* top_data) {
+      const Mask* bottom_mask, Dtype* top_data) {
     CUDA_KERNEL_LOOP(index, nthreads) {
       int offset = index / (in_w * in_h) * out_w * out_h;
       int upsample_idx = static_cast<int>(bottom_mask[index]);
-      top_data[offset + upsample_idx] = bottom_data[index];
+      if (upsample_idx >= 0 && upsample_idx < out_w * out_h) {
+        top_data[offset + upsample_idx] = bottom_data[index];
+      }
     }
   }
 
@@ -27,20 +33,28 @@ void UpsampleLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
   Dtype* top_data = top[0]->mutable_gpu_data();
   caffe_gpu_set(top[0]->count(), Dtype(0), top_data);
   int bottom_count = bottom[0]->count();
-  UpsampleForward<Dtype><<<CAFFE_GET_BLOCKS(bottom_count), CAFFE_CUDA_NUM_THREADS>>>(
-      bottom_count, bottom[0]->width(), bottom[0]->height(), 
-      top[0]->width(), top[0]->height(), bottom_data, bottom_mask, top_data);
+  if (int_mask_) {
+    UpsampleForward<Dtype, int><<<CAFFE_GET_BLOCKS(bottom_count), CAFFE_CUDA_NUM_THREADS>>>(
+        bottom_count, bottom[0]->width(), bottom[0]->height(),
+        top[0]->width(), top[0]->height(), bottom_data,
+        reinterpret_cast<const int*>(bottom_mask), top_data);
+  } else {
+    UpsampleForward<Dtype, Dtype><<<CAFFE_GET_BLOCKS(bottom_count), CAFFE_CUDA_NUM_THREADS>>>(
+        bottom_count, bottom[0]->width(), bottom[0]->height(),
+        top[0]->width(), top[0]->height(), bottom_data, bottom_mask, top_data);
+  }
   CUDA_POST_KERNEL_CHECK;
 }
 
-template <typename Dtype>
+template <typename Dtype, typename Mask>
   __global__ void UpsampleBackward(const int nthreads, int in_w, int in_h,
       int out_w, int out_h, const Dtype* top_diff,
-      const Dtype* bottom_mask, Dtype* bottom_diff) {
+      const Mask* bottom_mask, Dtype* bottom_diff) {
     CUDA_KERNEL_LOOP(index, nthreads) {
       int offset = index / (in_w * in_h) * out_w * out_h;
       int upsample_idx = static_cast<int>(bottom_mask[index]);
-      bottom_diff[index] = top_diff[offset + upsample_idx];
+      bottom_diff[index] = (upsample_idx >= 0 && upsample_idx < out_w * out_h) ?
+          top_diff[offset + upsample_idx] : Dtype(0);
     }
   }
 
@@ -52,10 +66,18 @@ void UpsampleLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const Dtype* bottom_mask = bottom[1]->gpu_data();
     Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
     const int bottom_count = bottom[0]->count();
-    caffe_gpu_set(bottom_count, Dtype(0.), bottom_diff);
-    UpsampleBackward<Dtype><<<CAFFE_GET_BLOCKS(bottom_count), CAFFE_CUDA_NUM_THREADS>>>(
-        bottom_count, bottom[0]->width(), bottom[0]->height(), 
-        top[0]->width(), top[0]->height(), top_diff, bottom_mask, bottom_diff);
+    // Every bottom value is gathered, so there is nothing to zero first.
+    if (int_mask_) {
+      UpsampleBackward<Dtype, int><<<CAFFE_GET_BLOCKS(bottom_count), CAFFE_CUDA_NUM_THREADS>>>(
+          bottom_count, bottom[0]->width(), bottom[0]->height(),
+          top[0]->width(), top[0]->height(), top_diff,
+          reinterpret_cast<const int*>(bottom_mask), bottom_diff);
+    } else {
+      UpsampleBackward<Dtype, Dtype><<<CAFFE_GET_BLOCKS(bottom_count), CAFFE_CUDA_NUM_THREADS>>>(
+          bottom_count, bottom[0]->width(), bottom[0]->height(),
+          top[0]->width(), top[0]->height(), top_diff, bottom_mask,
+          bottom_diff);
+    }
     CUDA_POST_KERNEL_CHECK;
   }
 }
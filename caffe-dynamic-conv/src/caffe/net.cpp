@@ -12,6 +12,7 @@
 #include "caffe/net.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/fold_batch_norm.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -48,6 +49,10 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   // the current NetState.
   NetParameter filtered_param;
   FilterNet(in_param, &filtered_param);
+  if (filtered_param.fold_batch_norm() && phase_ == TEST) {
+    unfolded_param_.CopyFrom(filtered_param);
+    FoldBatchNormLayers(unfolded_param_, &filtered_param);
+  }
   LOG_IF(INFO, Caffe::root_solver())
       << "Initializing net from parameters: " << std::endl
       << filtered_param.DebugString();
@@ -663,6 +668,13 @@ void Net<Dtype>::UpdateDebugInfo(const int param_id) {
 
 template <typename Dtype>
 void Net<Dtype>::ShareTrainedLayersWith(const Net* other) {
+  // Folding merges normalization layers into the layers before them, which
+  // changes their blobs, so only nets folded alike can share weights.
+  CHECK_EQ(unfolded_param_.layer_size() > 0,
+      other->unfolded_param_.layer_size() > 0)
+      << "A net with fold_batch_norm cannot share weights with a net "
+      << "without it (such as the TRAIN net of a solver); copy the trained "
+      << "weights from a binary proto instead.";
   int num_source_layers = other->layers().size();
   for (int i = 0; i < num_source_layers; ++i) {
     Layer<Dtype>* source_layer = other->layers()[i].get();
@@ -730,7 +742,14 @@ void Net<Dtype>::Reshape() {
 }
 
 template <typename Dtype>
-void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
+void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& in_param) {
+  // Fold the source's normalization layers as the net's were.
+  NetParameter folded_param;
+  if (unfolded_param_.layer_size()) {
+    FoldBatchNormWeights<Dtype>(unfolded_param_, in_param, &folded_param);
+  }
+  const NetParameter& param =
+      unfolded_param_.layer_size() ? folded_param : in_param;
   int num_source_layers = param.layer_size();
   for (int i = 0; i < num_source_layers; ++i) {
     const LayerParameter& source_layer = param.layer(i);
@@ -769,7 +788,8 @@ void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
       int target_size = target_blobs[j]->count();
       int source_size = source_blob.count();
       int min_size = target_size > source_size ? source_size : target_size;
-      caffe_gpu_memcpy(min_size * sizeof(Dtype), source_blob.gpu_data(), target_blobs[j]->mutable_gpu_data());
+      caffe_copy(min_size, source_blob.cpu_data(),
+          target_blobs[j]->mutable_cpu_data());
     }
   }
 }
@@ -793,6 +813,8 @@ void Net<Dtype>::CopyTrainedLayersFromBinaryProto(
 
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
+  CHECK_EQ(unfolded_param_.layer_size(), 0)
+      << "Weights for a net with fold_batch_norm must be a binary proto.";
   hid_t file_hid = H5Fopen(trained_filename.c_str(), H5F_ACC_RDONLY,
                            H5P_DEFAULT);
   CHECK_GE(file_hid, 0) << "Couldn't open " << trained_filename;
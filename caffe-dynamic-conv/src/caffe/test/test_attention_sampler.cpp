@@ -0,0 +1,93 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/attention_sampler.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class AttentionSamplerTest : public ::testing::Test {
+ protected:
+  // Builds the table of a height x width map into prob_ and alias_.
+  AttentionSampler Build(const float* attention, int height, int width) {
+    prob_.resize(height * width);
+    alias_.resize(height * width);
+    AttentionSampler::BuildTable(attention, height * width, &prob_[0],
+        &alias_[0]);
+    return AttentionSampler(&prob_[0], &alias_[0], height, width);
+  }
+
+  // Counts the positions drawn for a regular grid of (u, v) pairs.
+  vector<int> Histogram(const AttentionSampler& sampler, int steps) {
+    vector<int> histogram(sampler.height() * sampler.width(), 0);
+    for (int i = 0; i < steps; ++i) {
+      for (int j = 0; j < steps; ++j) {
+        int h, w;
+        sampler.Sample((i + 0.5f) / steps, (j + 0.5f) / steps, &h, &w);
+        EXPECT_GE(h, 0);
+        EXPECT_LT(h, sampler.height());
+        EXPECT_GE(w, 0);
+        EXPECT_LT(w, sampler.width());
+        ++histogram[h * sampler.width() + w];
+      }
+    }
+    return histogram;
+  }
+
+  vector<uint16_t> prob_;
+  vector<uint32_t> alias_;
+};
+
+TEST_F(AttentionSamplerTest, TestProportional) {
+  const float attention[6] = {0, 1, 2, 3, 0, 4};
+  AttentionSampler sampler = Build(attention, 2, 3);
+  const int steps = 600;
+  vector<int> histogram = Histogram(sampler, steps);
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_NEAR(static_cast<float>(histogram[i]) / (steps * steps),
+        attention[i] / 10, 1e-2);
+  }
+  // Positions without weight are never drawn.
+  EXPECT_EQ(histogram[0], 0);
+  EXPECT_EQ(histogram[4], 0);
+}
+
+TEST_F(AttentionSamplerTest, TestEmptyIsUniform) {
+  const float attention[4] = {0, 0, 0, 0};
+  AttentionSampler sampler = Build(attention, 4, 1);
+  const int steps = 400;
+  vector<int> histogram = Histogram(sampler, steps);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(histogram[i], steps * steps / 4);
+  }
+}
+
+TEST_F(AttentionSamplerTest, TestTablesFile) {
+  string filename;
+  MakeTempFilename(&filename);
+  const float first[6] = {0, 1, 2, 3, 0, 4};
+  const float second[3] = {5, 0, 0};
+  {
+    AttentionTablesWriter writer(filename);
+    writer.Add(first, 2, 3);
+    writer.Add(second, 1, 3);
+  }
+  AttentionTables tables(filename);
+  ASSERT_EQ(tables.num(), 2);
+  const AttentionSampler sampler = tables.sampler(0);
+  EXPECT_EQ(sampler.height(), 2);
+  EXPECT_EQ(sampler.width(), 3);
+  // The mapped table draws like the one built in memory.
+  const AttentionSampler built = Build(first, 2, 3);
+  const int steps = 100;
+  EXPECT_EQ(Histogram(sampler, steps), Histogram(built, steps));
+  vector<int> histogram = Histogram(tables.sampler(1), steps);
+  EXPECT_EQ(histogram[0], steps * steps);
+}
+
+}  // namespace caffe
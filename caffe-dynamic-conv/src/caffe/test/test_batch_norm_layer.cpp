@@ -130,4 +130,34 @@ namespace caffe {
         this->blob_top_vec_);
   }
 
+  TYPED_TEST(BatchNormLayerTest, TestThreads) {
+    typedef typename TypeParam::Dtype Dtype;
+    // Large enough for the channels and planes to be split among workers.
+    Blob<Dtype> blob_bottom(4, 8, 32, 64);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(&blob_bottom);
+    vector<Blob<Dtype>*> blob_bottom_vec(1, &blob_bottom);
+    Blob<Dtype> blob_top[2];
+    Blob<Dtype> blob_bottom_diff[2];
+    CPUThreadsGuard guard;
+    for (int i = 0; i < 2; ++i) {
+      Caffe::set_cpu_threads(i == 0 ? 1 : 4);
+      vector<Blob<Dtype>*> blob_top_vec(1, &blob_top[i]);
+      LayerParameter layer_param;
+      BatchNormLayer<Dtype> layer(layer_param);
+      layer.SetUp(blob_bottom_vec, blob_top_vec);
+      layer.Forward(blob_bottom_vec, blob_top_vec);
+      caffe_copy(blob_top[i].count(), blob_bottom.cpu_data(),
+          blob_top[i].mutable_cpu_diff());
+      layer.Backward(blob_top_vec, vector<bool>(1, true), blob_bottom_vec);
+      blob_bottom_diff[i].CopyFrom(blob_bottom, true, true);
+    }
+    for (int i = 0; i < blob_bottom.count(); ++i) {
+      EXPECT_NEAR(blob_top[0].cpu_data()[i], blob_top[1].cpu_data()[i], 1e-4);
+      EXPECT_NEAR(blob_bottom_diff[0].cpu_diff()[i],
+          blob_bottom_diff[1].cpu_diff()[i], 1e-4);
+    }
+  }
+
 }  // namespace caffe
@@ -0,0 +1,168 @@
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/bn_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class BNLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  BNLayerTest()
+      : blob_bottom_(new Blob<Dtype>(5, 2, 3, 4)),
+        blob_top_(new Blob<Dtype>()) {
+    // fill the values, away from zero to exercise the mean
+    FillerParameter filler_param;
+    filler_param.set_mean(10);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~BNLayerTest() { delete blob_bottom_; delete blob_top_; }
+
+  void SetAffine(LayerParameter* layer_param, float slope, float bias) {
+    BNParameter* bn_param = layer_param->mutable_bn_param();
+    bn_param->mutable_slope_filler()->set_value(slope);
+    bn_param->mutable_bias_filler()->set_value(bias);
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(BNLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(BNLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetAffine(&layer_param, 2, 1);
+  BNLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+  const int num = this->blob_bottom_->num();
+  const int channels = this->blob_bottom_->channels();
+  const int spatial_dim = this->blob_bottom_->count(2);
+  for (int c = 0; c < channels; ++c) {
+    Dtype sum = 0, sum_sq = 0;
+    for (int n = 0; n < num; ++n) {
+      const Dtype* top_data = this->blob_top_->cpu_data()
+          + this->blob_top_->offset(n, c);
+      for (int i = 0; i < spatial_dim; ++i) {
+        sum += top_data[i];
+        sum_sq += top_data[i] * top_data[i];
+      }
+    }
+    const Dtype mean = sum / (num * spatial_dim);
+    const Dtype var = sum_sq / (num * spatial_dim) - mean * mean;
+    const Dtype kErrorBound = 0.001;
+    // expect the bias as mean and the squared slope as variance
+    EXPECT_NEAR(1, mean, kErrorBound);
+    EXPECT_NEAR(4, var, kErrorBound * 4);
+  }
+}
+
+TYPED_TEST(BNLayerTest, TestInPlace) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetAffine(&layer_param, 2, 1);
+  Blob<Dtype> blob_inplace;
+  blob_inplace.CopyFrom(*this->blob_bottom_, false, true);
+  vector<Blob<Dtype>*> blob_inplace_vec(1, &blob_inplace);
+  BNLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  BNLayer<Dtype> layer_inplace(layer_param);
+  layer_inplace.SetUp(blob_inplace_vec, blob_inplace_vec);
+
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer_inplace.Forward(blob_inplace_vec, blob_inplace_vec);
+  for (int i = 0; i < blob_inplace.count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i], blob_inplace.cpu_data()[i],
+        1e-4);
+  }
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_top_);
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  caffe_copy(blob_inplace.count(), this->blob_top_->cpu_diff(),
+      blob_inplace.mutable_cpu_diff());
+  vector<bool> propagate_down(1, true);
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  layer_inplace.Backward(blob_inplace_vec, propagate_down, blob_inplace_vec);
+  for (int i = 0; i < blob_inplace.count(); ++i) {
+    EXPECT_NEAR(this->blob_bottom_->cpu_diff()[i], blob_inplace.cpu_diff()[i],
+        1e-4);
+  }
+  for (int i = 0; i < 2; ++i) {
+    const Blob<Dtype>& param = *layer.blobs()[i];
+    const Blob<Dtype>& param_inplace = *layer_inplace.blobs()[i];
+    for (int c = 0; c < param.count(); ++c) {
+      EXPECT_NEAR(param.cpu_diff()[c], param_inplace.cpu_diff()[c], 1e-3);
+    }
+  }
+}
+
+TYPED_TEST(BNLayerTest, TestFrozen) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetAffine(&layer_param, 2, 1);
+  layer_param.mutable_bn_param()->set_frozen(true);
+  BNLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int channels = this->blob_bottom_->channels();
+  for (int c = 0; c < channels; ++c) {
+    layer.blobs()[2]->mutable_cpu_data()[c] = 10 + c;
+    layer.blobs()[3]->mutable_cpu_data()[c] = 1 + c;
+  }
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_set(this->blob_top_->count(), Dtype(1),
+      this->blob_top_->mutable_cpu_diff());
+  vector<bool> propagate_down(1, true);
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+
+  const Dtype eps = layer_param.bn_param().eps();
+  for (int n = 0; n < this->blob_bottom_->num(); ++n) {
+    for (int c = 0; c < channels; ++c) {
+      const Dtype inv_std = 1 / std::sqrt(Dtype(1 + c) + eps);
+      const int offset = this->blob_bottom_->offset(n, c);
+      for (int i = 0; i < this->blob_bottom_->count(2); ++i) {
+        const Dtype x = this->blob_bottom_->cpu_data()[offset + i];
+        EXPECT_NEAR((x - 10 - c) * inv_std * 2 + 1,
+            this->blob_top_->cpu_data()[offset + i], 1e-4);
+        EXPECT_NEAR(2 * inv_std, this->blob_bottom_->cpu_diff()[offset + i],
+            1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(BNLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetAffine(&layer_param, 1, 0);
+  // zero mean input and unit output, for the finite differences to be
+  // precise in float
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  BNLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-4);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+}  // namespace caffe
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -6,6 +8,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #ifdef USE_CUDNN
 #include "caffe/layers/cudnn_conv_layer.hpp"
@@ -495,6 +498,377 @@ TYPED_TEST(ConvolutionLayerTest, TestSimpleConvolutionGroup) {
   }
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestDynamicConvolutionMul) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->set_weight_operation(ConvolutionParameter_WeightOp_MUL);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  // One 4 x 3 x 3 x 3 filter per sample.
+  Blob<Dtype> blob_bottom_weight(2, 4 * 3 * 3 * 3, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&blob_bottom_weight);
+  this->blob_bottom_vec_.push_back(&blob_bottom_weight);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check each sample against reference convolution with its own filter.
+  vector<shared_ptr<Blob<Dtype> > > weights(2);
+  weights[0].reset(new Blob<Dtype>());
+  weights[0]->ReshapeLike(*layer->blobs()[0]);
+  weights[1] = layer->blobs()[1];
+  const int weight_count = weights[0]->count();
+  const int top_dim = this->blob_top_->count(1);
+  for (int n = 0; n < this->blob_top_->num(); ++n) {
+    caffe_mul(weight_count, layer->blobs()[0]->cpu_data(),
+        blob_bottom_weight.cpu_data() + n * weight_count,
+        weights[0]->mutable_cpu_data());
+    caffe_conv(this->blob_bottom_, convolution_param, weights,
+        this->MakeReferenceTop(this->blob_top_));
+    const Dtype* top_data = this->blob_top_->cpu_data() + n * top_dim;
+    const Dtype* ref_top_data = this->ref_blob_top_->cpu_data() + n * top_dim;
+    for (int i = 0; i < top_dim; ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestDynamicBatchedAgainstPerSample) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(3);
+  convolution_param->set_weight_operation(ConvolutionParameter_WeightOp_MUL);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Blob<Dtype> blob_bottom_weight(2, 6 * 1 * 3 * 3, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&blob_bottom_weight);
+  this->blob_bottom_vec_.push_back(&blob_bottom_weight);
+  vector<bool> propagate_down(2, true);
+  // Run the per-sample engine and keep its results.
+  ConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> top_data, bottom_diff, bottom_weight_diff, weight_diff;
+  top_data.CopyFrom(*this->blob_top_, false, true);
+  filler.Fill(this->blob_top_);
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  caffe_copy(top_data.count(), this->blob_top_->cpu_diff(),
+      top_data.mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  bottom_diff.CopyFrom(*this->blob_bottom_, true, true);
+  bottom_weight_diff.CopyFrom(blob_bottom_weight, true, true);
+  weight_diff.CopyFrom(*layer.blobs()[0], true, true);
+  // Run the batched engine on the same parameters.
+  convolution_param->set_dynamic_engine(
+      ConvolutionParameter_DynamicEngine_BATCHED);
+  ConvolutionLayer<Dtype> batched_layer(layer_param);
+  batched_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    batched_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  batched_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < top_data.count(); ++i) {
+    EXPECT_NEAR(top_data.cpu_data()[i], this->blob_top_->cpu_data()[i], 1e-4);
+  }
+  caffe_copy(top_data.count(), top_data.cpu_diff(),
+      this->blob_top_->mutable_cpu_diff());
+  batched_layer.Backward(this->blob_top_vec_, propagate_down,
+      this->blob_bottom_vec_);
+  for (int i = 0; i < bottom_diff.count(); ++i) {
+    EXPECT_NEAR(bottom_diff.cpu_diff()[i],
+        this->blob_bottom_->cpu_diff()[i], 1e-4);
+  }
+  for (int i = 0; i < bottom_weight_diff.count(); ++i) {
+    EXPECT_NEAR(bottom_weight_diff.cpu_diff()[i],
+        blob_bottom_weight.cpu_diff()[i], 1e-4);
+  }
+  for (int i = 0; i < weight_diff.count(); ++i) {
+    EXPECT_NEAR(weight_diff.cpu_diff()[i],
+        batched_layer.blobs()[0]->cpu_diff()[i], 1e-4);
+  }
+}
+
+// Samples sharing a filter are grouped on the CPU; the results must not
+// change. The batched engine never groups, so it gives the reference.
+TYPED_TEST(ConvolutionLayerTest, TestDynamicGroupedAgainstBatched) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int num = 5;
+  const int num_output = 6;
+  const int kernel_sizes[] = {3, 1};
+  Blob<Dtype> blob_bottom(num, 3, 6, 4);
+  Blob<Dtype> blob_top;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&blob_bottom);
+  vector<Blob<Dtype>*> top_vec(1, &blob_top);
+  for (int k = 0; k < 2; ++k) {
+    const int weight_count = num_output * 1 * kernel_sizes[k] * kernel_sizes[k];
+    Blob<Dtype> blob_bottom_weight(num, weight_count, 1, 1);
+    filler.Fill(&blob_bottom_weight);
+    // Samples 0, 2 and 3 share a filter, and so do samples 1 and 4.
+    Dtype* filters = blob_bottom_weight.mutable_cpu_data();
+    caffe_copy(weight_count, filters, filters + 2 * weight_count);
+    caffe_copy(weight_count, filters, filters + 3 * weight_count);
+    caffe_copy(weight_count, filters + weight_count,
+        filters + 4 * weight_count);
+    vector<Blob<Dtype>*> bottom_vec(1, &blob_bottom);
+    bottom_vec.push_back(&blob_bottom_weight);
+    for (int propagate_filters = 0; propagate_filters < 2;
+         ++propagate_filters) {
+      vector<bool> propagate_down(2, true);
+      propagate_down[1] = propagate_filters;
+      LayerParameter layer_param;
+      ConvolutionParameter* convolution_param =
+          layer_param.mutable_convolution_param();
+      convolution_param->add_kernel_size(kernel_sizes[k]);
+      convolution_param->set_num_output(num_output);
+      convolution_param->set_group(3);
+      convolution_param->set_weight_operation(
+          ConvolutionParameter_WeightOp_MUL);
+      convolution_param->mutable_weight_filler()->set_type("gaussian");
+      convolution_param->mutable_bias_filler()->set_type("gaussian");
+      convolution_param->set_dynamic_engine(
+          ConvolutionParameter_DynamicEngine_BATCHED);
+      ConvolutionLayer<Dtype> batched_layer(layer_param);
+      batched_layer.SetUp(bottom_vec, top_vec);
+      batched_layer.Forward(bottom_vec, top_vec);
+      Blob<Dtype> top_data, bottom_diff, bottom_weight_diff, weight_diff;
+      top_data.CopyFrom(blob_top, false, true);
+      filler.Fill(&blob_top);
+      caffe_copy(blob_top.count(), blob_top.cpu_data(),
+          blob_top.mutable_cpu_diff());
+      caffe_copy(top_data.count(), blob_top.cpu_diff(),
+          top_data.mutable_cpu_diff());
+      batched_layer.Backward(top_vec, propagate_down, bottom_vec);
+      bottom_diff.CopyFrom(blob_bottom, true, true);
+      bottom_weight_diff.CopyFrom(blob_bottom_weight, true, true);
+      weight_diff.CopyFrom(*batched_layer.blobs()[0], true, true);
+      convolution_param->set_dynamic_engine(
+          ConvolutionParameter_DynamicEngine_PER_SAMPLE);
+      ConvolutionLayer<Dtype> layer(layer_param);
+      layer.SetUp(bottom_vec, top_vec);
+      for (int i = 0; i < batched_layer.blobs().size(); ++i) {
+        layer.blobs()[i]->CopyFrom(*batched_layer.blobs()[i]);
+      }
+      layer.Forward(bottom_vec, top_vec);
+      for (int i = 0; i < top_data.count(); ++i) {
+        EXPECT_NEAR(top_data.cpu_data()[i], blob_top.cpu_data()[i], 1e-4);
+      }
+      caffe_copy(top_data.count(), top_data.cpu_diff(),
+          blob_top.mutable_cpu_diff());
+      caffe_set(blob_bottom_weight.count(), Dtype(0),
+          blob_bottom_weight.mutable_cpu_diff());
+      layer.Backward(top_vec, propagate_down, bottom_vec);
+      for (int i = 0; i < bottom_diff.count(); ++i) {
+        EXPECT_NEAR(bottom_diff.cpu_diff()[i], blob_bottom.cpu_diff()[i],
+            1e-4);
+      }
+      for (int i = 0; propagate_filters && i < bottom_weight_diff.count();
+           ++i) {
+        EXPECT_NEAR(bottom_weight_diff.cpu_diff()[i],
+            blob_bottom_weight.cpu_diff()[i], 1e-4);
+      }
+      for (int i = 0; i < weight_diff.count(); ++i) {
+        EXPECT_NEAR(weight_diff.cpu_diff()[i],
+            layer.blobs()[0]->cpu_diff()[i], 1e-4);
+      }
+      // Two groups of five samples save three gemms per conv group, in the
+      // forward pass, for the bottom gradient and, when the filters need no
+      // gradient, for the blobs_[0] gradient.
+      if (Caffe::mode() == Caffe::CPU) {
+        EXPECT_EQ(layer.dynamic_gemms_saved(),
+            static_cast<uint64_t>((propagate_filters ? 2 : 3) * (num - 2) * 3));
+      }
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestDynamicFusedAgainstPerSample) {
+  typedef typename TypeParam::Dtype Dtype;
+  const ConvolutionParameter_WeightOp ops[] = {
+    ConvolutionParameter_WeightOp_MUL,
+    ConvolutionParameter_WeightOp_ADD
+  };
+  // Enough outputs for the CPU path to combine the filters in several tiles.
+  const int num_output = 1024;
+  Blob<Dtype> blob_bottom_weight(2, num_output * 3 * 3 * 3, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&blob_bottom_weight);
+  this->blob_bottom_vec_.push_back(&blob_bottom_weight);
+  vector<bool> propagate_down(2, true);
+  for (int op = 0; op < 2; ++op) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_stride(2);
+    convolution_param->set_num_output(num_output);
+    convolution_param->set_weight_operation(ops[op]);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    // Run the per-sample engine and keep its results.
+    ConvolutionLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    Blob<Dtype> top_data, bottom_diff, bottom_weight_diff, weight_diff;
+    top_data.CopyFrom(*this->blob_top_, false, true);
+    filler.Fill(this->blob_top_);
+    caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    caffe_copy(top_data.count(), this->blob_top_->cpu_diff(),
+        top_data.mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    bottom_diff.CopyFrom(*this->blob_bottom_, true, true);
+    bottom_weight_diff.CopyFrom(blob_bottom_weight, true, true);
+    weight_diff.CopyFrom(*layer.blobs()[0], true, true);
+    // Run the fused engine on the same parameters.
+    convolution_param->set_dynamic_engine(
+        ConvolutionParameter_DynamicEngine_FUSED);
+    ConvolutionLayer<Dtype> fused_layer(layer_param);
+    fused_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      fused_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+    }
+    fused_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    // The engines sum in different orders over 1024 outputs, so the
+    // tolerance scales with the magnitude.
+    for (int i = 0; i < top_data.count(); ++i) {
+      const Dtype expected = top_data.cpu_data()[i];
+      EXPECT_NEAR(expected, this->blob_top_->cpu_data()[i],
+          1e-4 * std::max(Dtype(1), std::fabs(expected)));
+    }
+    caffe_copy(top_data.count(), top_data.cpu_diff(),
+        this->blob_top_->mutable_cpu_diff());
+    fused_layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    for (int i = 0; i < bottom_diff.count(); ++i) {
+      const Dtype expected = bottom_diff.cpu_diff()[i];
+      EXPECT_NEAR(expected, this->blob_bottom_->cpu_diff()[i],
+          1e-4 * std::max(Dtype(1), std::fabs(expected)));
+    }
+    for (int i = 0; i < bottom_weight_diff.count(); ++i) {
+      const Dtype expected = bottom_weight_diff.cpu_diff()[i];
+      EXPECT_NEAR(expected, blob_bottom_weight.cpu_diff()[i],
+          1e-4 * std::max(Dtype(1), std::fabs(expected)));
+    }
+    for (int i = 0; i < weight_diff.count(); ++i) {
+      const Dtype expected = weight_diff.cpu_diff()[i];
+      EXPECT_NEAR(expected, fused_layer.blobs()[0]->cpu_diff()[i],
+          1e-4 * std::max(Dtype(1), std::fabs(expected)));
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestFactorizedAgainstDynamic) {
+  typedef typename TypeParam::Dtype Dtype;
+  const ConvolutionParameter_WeightOp ops[] = {
+    ConvolutionParameter_WeightOp_MUL,
+    ConvolutionParameter_WeightOp_ADD,
+    ConvolutionParameter_WeightOp_COPY
+  };
+  const int num = 2;
+  const int num_coefficients = 3;
+  const int weight_count = 2 * 3 * 3 * 3;
+  Blob<Dtype> blob_coefficients(num, num_coefficients, 1, 1);
+  Blob<Dtype> blob_basis(num_coefficients, weight_count, 1, 1);
+  Blob<Dtype> blob_filters(num, weight_count, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&blob_coefficients);
+  filler.Fill(&blob_basis);
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, weight_count,
+      num_coefficients, 1., blob_coefficients.cpu_data(),
+      blob_basis.cpu_data(), 0., blob_filters.mutable_cpu_data());
+  vector<Blob<Dtype>*> dynamic_bottom_vec(1, this->blob_bottom_);
+  dynamic_bottom_vec.push_back(&blob_filters);
+  this->blob_bottom_vec_.push_back(&blob_coefficients);
+  this->blob_bottom_vec_.push_back(&blob_basis);
+  vector<bool> propagate_down(3, true);
+  for (int op = 0; op < 3; ++op) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_stride(2);
+    convolution_param->set_num_output(2);
+    convolution_param->set_weight_operation(ops[op]);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    // The materialized filters give the reference results.
+    ConvolutionLayer<Dtype> layer(layer_param);
+    layer.SetUp(dynamic_bottom_vec, this->blob_top_vec_);
+    layer.Forward(dynamic_bottom_vec, this->blob_top_vec_);
+    Blob<Dtype> top_data, bottom_diff, weight_diff;
+    top_data.CopyFrom(*this->blob_top_, false, true);
+    filler.Fill(this->blob_top_);
+    caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    caffe_copy(top_data.count(), this->blob_top_->cpu_diff(),
+        top_data.mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, vector<bool>(2, true),
+        dynamic_bottom_vec);
+    bottom_diff.CopyFrom(*this->blob_bottom_, true, true);
+    weight_diff.CopyFrom(*layer.blobs()[0], true, true);
+    // Filter gradients mapped to the coefficients and the basis.
+    Blob<Dtype> coefficient_diff(num, num_coefficients, 1, 1);
+    Blob<Dtype> basis_diff(num_coefficients, weight_count, 1, 1);
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, num, num_coefficients,
+        weight_count, 1., blob_filters.cpu_diff(), blob_basis.cpu_data(), 0.,
+        coefficient_diff.mutable_cpu_data());
+    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, num_coefficients,
+        weight_count, num, 1., blob_coefficients.cpu_data(),
+        blob_filters.cpu_diff(), 0., basis_diff.mutable_cpu_data());
+    // Run the factorized path on the same parameters.
+    ConvolutionLayer<Dtype> factorized_layer(layer_param);
+    factorized_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      factorized_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+    }
+    factorized_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < top_data.count(); ++i) {
+      EXPECT_NEAR(top_data.cpu_data()[i], this->blob_top_->cpu_data()[i],
+          1e-4);
+    }
+    caffe_copy(top_data.count(), top_data.cpu_diff(),
+        this->blob_top_->mutable_cpu_diff());
+    factorized_layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    for (int i = 0; i < bottom_diff.count(); ++i) {
+      EXPECT_NEAR(bottom_diff.cpu_diff()[i],
+          this->blob_bottom_->cpu_diff()[i], 1e-4);
+    }
+    for (int i = 0; i < weight_diff.count(); ++i) {
+      EXPECT_NEAR(weight_diff.cpu_diff()[i],
+          factorized_layer.blobs()[0]->cpu_diff()[i], 1e-4);
+    }
+    for (int i = 0; i < coefficient_diff.count(); ++i) {
+      EXPECT_NEAR(coefficient_diff.cpu_data()[i],
+          blob_coefficients.cpu_diff()[i], 1e-4);
+    }
+    for (int i = 0; i < basis_diff.count(); ++i) {
+      EXPECT_NEAR(basis_diff.cpu_data()[i], blob_basis.cpu_diff()[i], 1e-4);
+    }
+  }
+}
+
 TYPED_TEST(ConvolutionLayerTest, TestSobelConvolution) {
   // Test separable convolution by computing the Sobel operator
   // as a single filter then comparing the result
@@ -811,6 +1185,211 @@ TYPED_TEST(ConvolutionLayerTest, TestGradientGroup) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestDynamicGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  const ConvolutionParameter_WeightOp ops[] = {
+    ConvolutionParameter_WeightOp_MUL,
+    ConvolutionParameter_WeightOp_ADD,
+    ConvolutionParameter_WeightOp_COPY
+  };
+  // Split the batch so that the per-worker weight gradients get reduced.
+  CPUThreadsGuard guard;
+  Caffe::set_cpu_threads(2);
+  Blob<Dtype> blob_bottom_weight(2, 2 * 3 * 3 * 3, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&blob_bottom_weight);
+  this->blob_bottom_vec_.push_back(&blob_bottom_weight);
+  for (int i = 0; i < 3; ++i) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_stride(2);
+    convolution_param->set_num_output(2);
+    convolution_param->set_weight_operation(ops[i]);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    ConvolutionLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-3);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestDynamicBatchedGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  const ConvolutionParameter_WeightOp ops[] = {
+    ConvolutionParameter_WeightOp_MUL,
+    ConvolutionParameter_WeightOp_ADD,
+    ConvolutionParameter_WeightOp_COPY
+  };
+  Blob<Dtype> blob_bottom_weight(2, 2 * 3 * 3 * 3, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&blob_bottom_weight);
+  this->blob_bottom_vec_.push_back(&blob_bottom_weight);
+  for (int i = 0; i < 3; ++i) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_stride(2);
+    convolution_param->set_num_output(2);
+    convolution_param->set_weight_operation(ops[i]);
+    convolution_param->set_dynamic_engine(
+        ConvolutionParameter_DynamicEngine_BATCHED);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    ConvolutionLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-3);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestDynamicGradientBatchSizes) {
+  typedef typename TypeParam::Dtype Dtype;
+  const ConvolutionParameter_WeightOp ops[] = {
+    ConvolutionParameter_WeightOp_MUL,
+    ConvolutionParameter_WeightOp_ADD
+  };
+  const ConvolutionParameter_DynamicEngine engines[] = {
+    ConvolutionParameter_DynamicEngine_PER_SAMPLE,
+    ConvolutionParameter_DynamicEngine_BATCHED
+  };
+  // More workers than samples for the smallest batch.
+  CPUThreadsGuard guard;
+  Caffe::set_cpu_threads(2);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> blob_bottom_weight;
+  this->blob_bottom_vec_.push_back(&blob_bottom_weight);
+  for (int num = 1; num <= 5; num += 2) {
+    this->blob_bottom_->Reshape(num, 3, 6, 4);
+    blob_bottom_weight.Reshape(num, 2 * 3 * 3 * 3, 1, 1);
+    filler.Fill(this->blob_bottom_);
+    filler.Fill(&blob_bottom_weight);
+    for (int engine = 0; engine < 2; ++engine) {
+      LayerParameter layer_param;
+      ConvolutionParameter* convolution_param =
+          layer_param.mutable_convolution_param();
+      convolution_param->add_kernel_size(3);
+      convolution_param->add_stride(2);
+      convolution_param->set_num_output(2);
+      convolution_param->set_weight_operation(ops[engine]);
+      convolution_param->set_dynamic_engine(engines[engine]);
+      convolution_param->mutable_weight_filler()->set_type("gaussian");
+      convolution_param->mutable_bias_filler()->set_type("gaussian");
+      ConvolutionLayer<Dtype> layer(layer_param);
+      GradientChecker<Dtype> checker(1e-2, 1e-3);
+      checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+          this->blob_top_vec_);
+    }
+  }
+}
+
+// Samples that share a filter are convolved together on the CPU.
+TYPED_TEST(ConvolutionLayerTest, TestDynamicGradientSharedFilters) {
+  typedef typename TypeParam::Dtype Dtype;
+  const ConvolutionParameter_WeightOp ops[] = {
+    ConvolutionParameter_WeightOp_MUL,
+    ConvolutionParameter_WeightOp_COPY
+  };
+  CPUThreadsGuard guard;
+  Caffe::set_cpu_threads(2);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  this->blob_bottom_->Reshape(4, 3, 6, 4);
+  filler.Fill(this->blob_bottom_);
+  const int weight_count = 2 * 3 * 3 * 3;
+  Blob<Dtype> blob_bottom_weight(4, weight_count, 1, 1);
+  filler.Fill(&blob_bottom_weight);
+  // Samples 0 and 2, and 1 and 3, share their filters.
+  Dtype* filters = blob_bottom_weight.mutable_cpu_data();
+  caffe_copy(2 * weight_count, filters, filters + 2 * weight_count);
+  this->blob_bottom_vec_.push_back(&blob_bottom_weight);
+  for (int i = 0; i < 2; ++i) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_stride(2);
+    convolution_param->set_num_output(2);
+    convolution_param->set_weight_operation(ops[i]);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    ConvolutionLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-3);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestDynamicFusedGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  const ConvolutionParameter_WeightOp ops[] = {
+    ConvolutionParameter_WeightOp_MUL,
+    ConvolutionParameter_WeightOp_ADD
+  };
+  Blob<Dtype> blob_bottom_weight(2, 3 * 1 * 3 * 3, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&blob_bottom_weight);
+  this->blob_bottom_vec_.push_back(&blob_bottom_weight);
+  for (int i = 0; i < 2; ++i) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_stride(2);
+    convolution_param->set_num_output(3);
+    convolution_param->set_group(3);
+    convolution_param->set_weight_operation(ops[i]);
+    convolution_param->set_dynamic_engine(
+        ConvolutionParameter_DynamicEngine_FUSED);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    ConvolutionLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-3);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestFactorizedGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  const ConvolutionParameter_WeightOp ops[] = {
+    ConvolutionParameter_WeightOp_MUL,
+    ConvolutionParameter_WeightOp_ADD,
+    ConvolutionParameter_WeightOp_COPY
+  };
+  Blob<Dtype> blob_coefficients(2, 2, 1, 1);
+  Blob<Dtype> blob_basis(2, 3 * 1 * 3 * 3, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&blob_coefficients);
+  filler.Fill(&blob_basis);
+  this->blob_bottom_vec_.push_back(&blob_coefficients);
+  this->blob_bottom_vec_.push_back(&blob_basis);
+  for (int i = 0; i < 3; ++i) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_stride(2);
+    convolution_param->set_num_output(3);
+    convolution_param->set_group(3);
+    convolution_param->set_weight_operation(ops[i]);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    ConvolutionLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-3);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+}
+
 #ifdef USE_CUDNN
 
 template <typename Dtype>
@@ -2,6 +2,8 @@
 #include <string>
 #include <vector>
 
+#include <opencv2/core/core.hpp>
+
 #include "gtest/gtest.h"
 
 #include "caffe/blob.hpp"
@@ -340,5 +342,214 @@ TYPED_TEST(DataTransformTest, TestMeanFile) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestMeanFileConstant) {
+  const int channels = 3;
+  const int height = 4;
+  const int width = 5;
+
+  // A mean file that is constant per channel
+  string mean_file;
+  MakeTempFilename(&mean_file);
+  BlobProto blob_mean;
+  blob_mean.set_num(1);
+  blob_mean.set_channels(channels);
+  blob_mean.set_height(height);
+  blob_mean.set_width(width);
+  for (int c = 0; c < channels; ++c) {
+    for (int j = 0; j < height * width; ++j) {
+      blob_mean.add_data(c + 1);
+    }
+  }
+  WriteProtoToBinaryFile(blob_mean, mean_file);
+
+  TransformationParameter transform_param;
+  transform_param.set_mean_file(mean_file);
+  transform_param.set_crop_size(3);
+  Datum datum;
+  FillDatum(0, channels, height, width, true, &datum);
+  Blob<TypeParam> blob(1, channels, 3, 3);
+  DataTransformer<TypeParam> transformer(transform_param, TRAIN);
+  transformer.InitRand(this->seed_);
+  TransformationParameter values_param;
+  values_param.add_mean_value(1);
+  values_param.add_mean_value(2);
+  values_param.add_mean_value(3);
+  values_param.set_crop_size(3);
+  Blob<TypeParam> values_blob(1, channels, 3, 3);
+  DataTransformer<TypeParam> values_transformer(values_param, TRAIN);
+  values_transformer.InitRand(this->seed_);
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    transformer.Transform(datum, &blob);
+    values_transformer.Transform(datum, &values_blob);
+    for (int j = 0; j < blob.count(); ++j) {
+      EXPECT_EQ(blob.cpu_data()[j], values_blob.cpu_data()[j]);
+    }
+  }
+}
+
+// Reseeding a transformer that has already drawn gives the crops and mirrors
+// of a new one seeded the same way.
+TYPED_TEST(DataTransformTest, TestInitRandReseeds) {
+  const int channels = 3;
+  const int height = 6;
+  const int width = 7;
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(3);
+  transform_param.set_mirror(true);
+  Datum datum;
+  FillDatum(0, channels, height, width, true, &datum);
+  DataTransformer<TypeParam> used(transform_param, TRAIN);
+  Blob<TypeParam> used_blob(1, channels, 3, 3);
+  used.InitRand(this->seed_ + 1);
+  used.Transform(datum, &used_blob);
+  used.InitRand(this->seed_);
+  DataTransformer<TypeParam> fresh(transform_param, TRAIN);
+  Blob<TypeParam> fresh_blob(1, channels, 3, 3);
+  fresh.InitRand(this->seed_);
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    used.Transform(datum, &used_blob);
+    fresh.Transform(datum, &fresh_blob);
+    for (int j = 0; j < used_blob.count(); ++j) {
+      EXPECT_EQ(fresh_blob.cpu_data()[j], used_blob.cpu_data()[j]);
+    }
+  }
+}
+
+// The color cv::Mat path gives the same crops, mirrors and values as the
+// Datum path on the same pixels.
+TYPED_TEST(DataTransformTest, TestMatMatchesDatum) {
+  const int channels = 3;
+  const int height = 6;
+  const int width = 7;
+  const int crop_size = 4;
+  Datum datum;
+  FillDatum(0, channels, height, width, true, &datum);
+  cv::Mat cv_img(height, width, CV_8UC3);
+  for (int c = 0; c < channels; ++c) {
+    for (int h = 0; h < height; ++h) {
+      for (int w = 0; w < width; ++w) {
+        cv_img.data[(h * width + w) * channels + c] =
+            datum.data()[(c * height + h) * width + w];
+      }
+    }
+  }
+  string mean_file;
+  MakeTempFilename(&mean_file);
+  BlobProto blob_mean;
+  blob_mean.set_num(1);
+  blob_mean.set_channels(channels);
+  blob_mean.set_height(height);
+  blob_mean.set_width(width);
+  for (int j = 0; j < channels * height * width; ++j) {
+    blob_mean.add_data(j % 5);
+  }
+  WriteProtoToBinaryFile(blob_mean, mean_file);
+
+  // At TEST the crop is centered and the cv::Mat path uses its cropped mean.
+  const Phase phases[2] = {TRAIN, TEST};
+  for (int phase = 0; phase < 2; ++phase) {
+    for (int mean = 0; mean < 3; ++mean) {
+      TransformationParameter transform_param;
+      transform_param.set_crop_size(crop_size);
+      transform_param.set_mirror(true);
+      transform_param.set_scale(0.5);
+      if (mean == 1) {
+        transform_param.add_mean_value(1);
+        transform_param.add_mean_value(2);
+        transform_param.add_mean_value(3);
+      } else if (mean == 2) {
+        transform_param.set_mean_file(mean_file);
+      }
+      DataTransformer<TypeParam> datum_transformer(transform_param,
+          phases[phase]);
+      DataTransformer<TypeParam> mat_transformer(transform_param,
+          phases[phase]);
+      datum_transformer.InitRand(this->seed_);
+      mat_transformer.InitRand(this->seed_);
+      Blob<TypeParam> datum_blob(1, channels, crop_size, crop_size);
+      Blob<TypeParam> mat_blob(1, channels, crop_size, crop_size);
+      for (int iter = 0; iter < this->num_iter_; ++iter) {
+        datum_transformer.Transform(datum, &datum_blob);
+        mat_transformer.Transform(cv_img, &mat_blob);
+        for (int j = 0; j < datum_blob.count(); ++j) {
+          EXPECT_EQ(datum_blob.cpu_data()[j], mat_blob.cpu_data()[j]);
+        }
+      }
+    }
+  }
+}
+
+// The random-area crop resamples the same window of the cv::Mat and the
+// Datum to the same values.
+TYPED_TEST(DataTransformTest, TestRandomCropMatMatchesDatum) {
+  const int channels = 3;
+  const int height = 9;
+  const int width = 11;
+  const int crop_size = 5;
+  Datum datum;
+  FillDatum(0, channels, height, width, true, &datum);
+  cv::Mat cv_img(height, width, CV_8UC3);
+  for (int c = 0; c < channels; ++c) {
+    for (int h = 0; h < height; ++h) {
+      for (int w = 0; w < width; ++w) {
+        cv_img.data[(h * width + w) * channels + c] =
+            datum.data()[(c * height + h) * width + w];
+      }
+    }
+  }
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(crop_size);
+  transform_param.set_mirror(true);
+  transform_param.set_random_crop(true);
+  transform_param.add_crop_area(0.3);
+  transform_param.add_crop_area(1);
+  transform_param.add_aspect_ratio(0.75);
+  transform_param.add_aspect_ratio(1.33);
+  transform_param.add_mean_value(1);
+  transform_param.add_mean_value(2);
+  transform_param.add_mean_value(3);
+  DataTransformer<TypeParam> datum_transformer(transform_param, TRAIN);
+  DataTransformer<TypeParam> mat_transformer(transform_param, TRAIN);
+  datum_transformer.InitRand(this->seed_);
+  mat_transformer.InitRand(this->seed_);
+  Blob<TypeParam> datum_blob(1, channels, crop_size, crop_size);
+  Blob<TypeParam> mat_blob(1, channels, crop_size, crop_size);
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    datum_transformer.Transform(datum, &datum_blob);
+    mat_transformer.Transform(cv_img, &mat_blob);
+    for (int j = 0; j < datum_blob.count(); ++j) {
+      EXPECT_EQ(datum_blob.cpu_data()[j], mat_blob.cpu_data()[j]);
+    }
+  }
+}
+
+TYPED_TEST(DataTransformTest, TestRandomCropConstant) {
+  const int label = 7;
+  const int channels = 3;
+  const int height = 8;
+  const int width = 6;
+  const int crop_size = 5;
+  TransformationParameter transform_param;
+  transform_param.set_crop_size(crop_size);
+  transform_param.set_random_crop(true);
+  transform_param.add_crop_area(0.1);
+  transform_param.add_crop_area(1);
+  transform_param.add_aspect_ratio(0.5);
+  transform_param.add_aspect_ratio(2);
+  transform_param.add_mean_value(3);
+  transform_param.set_scale(0.5);
+  Datum datum;
+  FillDatum(label, channels, height, width, false, &datum);
+  Blob<TypeParam> blob(1, channels, crop_size, crop_size);
+  DataTransformer<TypeParam> transformer(transform_param, TRAIN);
+  transformer.InitRand(this->seed_);
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    transformer.Transform(datum, &blob);
+    for (int j = 0; j < blob.count(); ++j) {
+      EXPECT_NEAR(blob.cpu_data()[j], (label - 3) * 0.5, 1e-5);
+    }
+  }
+}
+
 }  // namespace caffe
 #endif  // USE_OPENCV
@@ -6,6 +6,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/deconv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -154,6 +155,76 @@ TYPED_TEST(DeconvolutionLayerTest, TestGradient) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(DeconvolutionLayerTest, TestDynamicDeconvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->set_weight_operation(ConvolutionParameter_WeightOp_MUL);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  // One 3 x 4 x 3 x 3 filter per sample.
+  Blob<Dtype> blob_bottom_weight(2, 3 * 4 * 3 * 3, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&blob_bottom_weight);
+  this->blob_bottom_vec_.push_back(&blob_bottom_weight);
+  DeconvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check each sample against a static deconvolution with its own filter.
+  DeconvolutionLayer<Dtype> static_layer(layer_param);
+  vector<Blob<Dtype>*> bottom_vec(1, this->blob_bottom_);
+  vector<Blob<Dtype>*> top_vec(1, this->blob_top_2_);
+  static_layer.SetUp(bottom_vec, top_vec);
+  static_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  const int weight_count = layer.blobs()[0]->count();
+  const int top_dim = this->blob_top_->count(1);
+  for (int n = 0; n < this->blob_top_->num(); ++n) {
+    caffe_mul(weight_count, layer.blobs()[0]->cpu_data(),
+        blob_bottom_weight.cpu_data() + n * weight_count,
+        static_layer.blobs()[0]->mutable_cpu_data());
+    static_layer.Forward(bottom_vec, top_vec);
+    const Dtype* top_data = this->blob_top_->cpu_data() + n * top_dim;
+    const Dtype* ref_top_data = this->blob_top_2_->cpu_data() + n * top_dim;
+    for (int i = 0; i < top_dim; ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(DeconvolutionLayerTest, TestDynamicGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  const ConvolutionParameter_WeightOp ops[] = {
+    ConvolutionParameter_WeightOp_MUL,
+    ConvolutionParameter_WeightOp_ADD,
+    ConvolutionParameter_WeightOp_COPY
+  };
+  Blob<Dtype> blob_bottom_weight(2, 3 * 2 * 2 * 2, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&blob_bottom_weight);
+  this->blob_bottom_vec_.push_back(&blob_bottom_weight);
+  for (int i = 0; i < 3; ++i) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(2);
+    convolution_param->add_stride(1);
+    convolution_param->set_num_output(2);
+    convolution_param->set_weight_operation(ops[i]);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    DeconvolutionLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-3);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+}
+
 TYPED_TEST(DeconvolutionLayerTest, TestNDAgainst2D) {
   typedef typename TypeParam::Dtype Dtype;
   const int kernel_h = 11;
@@ -0,0 +1,230 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/depthwise_conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+// ConvolutionLayerTest checks the shared conv code in detail, so this covers
+// the direct CPU kernels and the dynamic (per-sample filter) path.
+template <typename TypeParam>
+class DepthwiseConvolutionLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  DepthwiseConvolutionLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 6, 5)),
+        blob_bottom_weight_(new Blob<Dtype>(2, 3 * 3 * 3, 1, 1)),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_2_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    // fill the values
+    FillerParameter filler_param;
+    filler_param.set_value(1.);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    filler.Fill(this->blob_bottom_weight_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_weight_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+
+  virtual ~DepthwiseConvolutionLayerTest() {
+    delete blob_bottom_;
+    delete blob_bottom_weight_;
+    delete blob_top_;
+    delete blob_top_2_;
+  }
+
+  // 3 x 3 filters with padding 1 on each of the 3 channels.
+  void SetUpParam(ConvolutionParameter_WeightOp op,
+      LayerParameter* layer_param) {
+    ConvolutionParameter* convolution_param =
+        layer_param->mutable_convolution_param();
+    convolution_param->add_kernel_size(3);
+    convolution_param->add_pad(1);
+    convolution_param->set_num_output(3);
+    convolution_param->set_group(3);
+    convolution_param->set_weight_operation(op);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_bottom_weight_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_2_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(DepthwiseConvolutionLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(DepthwiseConvolutionLayerTest, TestDynamicConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  const ConvolutionParameter_WeightOp ops[] = {
+    ConvolutionParameter_WeightOp_MUL,
+    ConvolutionParameter_WeightOp_ADD,
+    ConvolutionParameter_WeightOp_COPY
+  };
+  vector<Blob<Dtype>*> bottom_vec(1, this->blob_bottom_);
+  vector<Blob<Dtype>*> top_vec(1, this->blob_top_2_);
+  for (int op = 0; op < 3; ++op) {
+    LayerParameter layer_param;
+    this->SetUpParam(ops[op], &layer_param);
+    DepthwiseConvolutionLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    // Check each sample against a static layer with its combined filter.
+    DepthwiseConvolutionLayer<Dtype> static_layer(layer_param);
+    static_layer.SetUp(bottom_vec, top_vec);
+    static_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+    const int weight_count = layer.blobs()[0]->count();
+    const int top_dim = this->blob_top_->count(1);
+    for (int n = 0; n < this->blob_top_->num(); ++n) {
+      const Dtype* weight = layer.blobs()[0]->cpu_data();
+      const Dtype* filter =
+          this->blob_bottom_weight_->cpu_data() + n * weight_count;
+      Dtype* static_weight = static_layer.blobs()[0]->mutable_cpu_data();
+      for (int i = 0; i < weight_count; ++i) {
+        switch (ops[op]) {
+        case ConvolutionParameter_WeightOp_MUL:
+          static_weight[i] = weight[i] * filter[i];
+          break;
+        case ConvolutionParameter_WeightOp_ADD:
+          static_weight[i] = weight[i] + filter[i];
+          break;
+        default:
+          static_weight[i] = filter[i];
+        }
+      }
+      static_layer.Forward(bottom_vec, top_vec);
+      const Dtype* top_data = this->blob_top_->cpu_data() + n * top_dim;
+      const Dtype* ref_top_data = this->blob_top_2_->cpu_data() + n * top_dim;
+      for (int i = 0; i < top_dim; ++i) {
+        EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(DepthwiseConvolutionLayerTest, TestDynamicGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  const ConvolutionParameter_WeightOp ops[] = {
+    ConvolutionParameter_WeightOp_MUL,
+    ConvolutionParameter_WeightOp_ADD,
+    ConvolutionParameter_WeightOp_COPY
+  };
+  for (int op = 0; op < 3; ++op) {
+    LayerParameter layer_param;
+    this->SetUpParam(ops[op], &layer_param);
+    DepthwiseConvolutionLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-3);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+}
+
+// The direct kernels match the im2col path of a ConvolutionLayer with one
+// group per channel, with strides, padding and dilation.
+TYPED_TEST(DepthwiseConvolutionLayerTest, TestDirectAgainstIm2col) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The GPU kernels do not implement dilation.
+  if (Caffe::mode() == Caffe::GPU) {
+    return;
+  }
+  vector<Blob<Dtype>*> bottom_vec(1, this->blob_bottom_);
+  vector<Blob<Dtype>*> top_vec(1, this->blob_top_);
+  vector<Blob<Dtype>*> ref_top_vec(1, this->blob_top_2_);
+  Blob<Dtype> ref_bottom;
+  ref_bottom.CopyFrom(*this->blob_bottom_, false, true);
+  vector<Blob<Dtype>*> ref_bottom_vec(1, &ref_bottom);
+  const vector<bool> propagate_down(1, true);
+  for (int kernel = 1; kernel <= 3; kernel += 2) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(kernel);
+    convolution_param->add_stride(2);
+    convolution_param->add_stride(1);
+    convolution_param->add_pad(2);
+    convolution_param->add_pad(1);
+    convolution_param->add_dilation(kernel == 1 ? 1 : 2);
+    convolution_param->set_num_output(3);
+    convolution_param->set_group(3);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    DepthwiseConvolutionLayer<Dtype> layer(layer_param);
+    layer.SetUp(bottom_vec, top_vec);
+    ConvolutionLayer<Dtype> ref_layer(layer_param);
+    ref_layer.SetUp(ref_bottom_vec, ref_top_vec);
+    ASSERT_TRUE(top_vec[0]->shape() == ref_top_vec[0]->shape());
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      ref_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+    }
+    layer.Forward(bottom_vec, top_vec);
+    ref_layer.Forward(ref_bottom_vec, ref_top_vec);
+    const int count = this->blob_top_->count();
+    for (int i = 0; i < count; ++i) {
+      EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+          this->blob_top_2_->cpu_data()[i], 1e-4);
+    }
+    // Backward from the same top diff.
+    caffe_copy(count, this->blob_top_->cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    caffe_copy(count, this->blob_top_->cpu_data(),
+        this->blob_top_2_->mutable_cpu_diff());
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      caffe_set(layer.blobs()[i]->count(), Dtype(0),
+          layer.blobs()[i]->mutable_cpu_diff());
+      caffe_set(ref_layer.blobs()[i]->count(), Dtype(0),
+          ref_layer.blobs()[i]->mutable_cpu_diff());
+    }
+    layer.Backward(top_vec, propagate_down, bottom_vec);
+    ref_layer.Backward(ref_top_vec, propagate_down, ref_bottom_vec);
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_NEAR(this->blob_bottom_->cpu_diff()[i],
+          ref_bottom.cpu_diff()[i], 1e-4);
+    }
+    for (int b = 0; b < layer.blobs().size(); ++b) {
+      for (int i = 0; i < layer.blobs()[b]->count(); ++i) {
+        EXPECT_NEAR(layer.blobs()[b]->cpu_diff()[i],
+            ref_layer.blobs()[b]->cpu_diff()[i], 1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(DepthwiseConvolutionLayerTest, TestGradientStrideDilation) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The GPU kernels do not implement dilation.
+  if (Caffe::mode() == Caffe::GPU) {
+    return;
+  }
+  vector<Blob<Dtype>*> bottom_vec(1, this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->add_pad(2);
+  convolution_param->add_dilation(2);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  DepthwiseConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, bottom_vec, this->blob_top_vec_);
+}
+
+}  // namespace caffe
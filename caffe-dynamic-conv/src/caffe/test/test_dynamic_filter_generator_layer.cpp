@@ -0,0 +1,157 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/dynamic_filter_generator_layer.hpp"
+#include "caffe/layers/inner_product_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class DynamicFilterGeneratorLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+ protected:
+  DynamicFilterGeneratorLayerTest()
+      : blob_bottom_(new Blob<Dtype>(4, 3, 1, 1)),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_basis_(new Blob<Dtype>()) {
+    // fill the values
+    FillerParameter filler_param;
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~DynamicFilterGeneratorLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete blob_top_basis_;
+  }
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_basis_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(DynamicFilterGeneratorLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(DynamicFilterGeneratorLayerTest, TestSetUp) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_top_vec_.push_back(this->blob_top_basis_);
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  DynamicFilterGeneratorLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_->num_axes(), 2);
+  EXPECT_EQ(this->blob_top_->shape(0), 4);
+  EXPECT_EQ(this->blob_top_->shape(1), 4);
+  EXPECT_EQ(this->blob_top_basis_->num_axes(), 2);
+  EXPECT_EQ(this->blob_top_basis_->shape(0), 4);
+  EXPECT_EQ(this->blob_top_basis_->shape(1), 10);
+}
+
+// The factorized filters multiply out to the InnerProduct of the embedding.
+TYPED_TEST(DynamicFilterGeneratorLayerTest, TestForwardFactorized) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int num_output = 10;
+  for (int transpose = 0; transpose < 2; ++transpose) {
+    LayerParameter layer_param;
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(num_output);
+    inner_product_param->set_transpose(transpose);
+    inner_product_param->mutable_weight_filler()->set_type("uniform");
+    inner_product_param->mutable_bias_filler()->set_type("uniform");
+    inner_product_param->mutable_bias_filler()->set_min(1);
+    inner_product_param->mutable_bias_filler()->set_max(2);
+    InnerProductLayer<Dtype> ip_layer(layer_param);
+    Blob<Dtype> filters;
+    vector<Blob<Dtype>*> ip_top_vec(1, &filters);
+    ip_layer.SetUp(this->blob_bottom_vec_, ip_top_vec);
+    ip_layer.Forward(this->blob_bottom_vec_, ip_top_vec);
+    // The InnerProduct weights load unchanged.
+    DynamicFilterGeneratorLayer<Dtype> layer(layer_param);
+    vector<Blob<Dtype>*> top_vec(1, this->blob_top_);
+    top_vec.push_back(this->blob_top_basis_);
+    layer.SetUp(this->blob_bottom_vec_, top_vec);
+    ASSERT_EQ(layer.blobs().size(), ip_layer.blobs().size());
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      layer.blobs()[i]->CopyFrom(*ip_layer.blobs()[i]);
+    }
+    layer.Forward(this->blob_bottom_vec_, top_vec);
+    const int num = this->blob_bottom_->num();
+    const int rank = this->blob_top_->shape(1);
+    Blob<Dtype> product(num, num_output, 1, 1);
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num, num_output, rank,
+        1., this->blob_top_->cpu_data(), this->blob_top_basis_->cpu_data(),
+        0., product.mutable_cpu_data());
+    for (int i = 0; i < product.count(); ++i) {
+      EXPECT_NEAR(filters.cpu_data()[i], product.cpu_data()[i], 1e-5);
+    }
+    // With one top the filters are materialized like InnerProduct's.
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < filters.count(); ++i) {
+      EXPECT_NEAR(filters.cpu_data()[i], this->blob_top_->cpu_data()[i],
+          1e-5);
+    }
+  }
+}
+
+// The basis is only rewritten when the parameters change.
+TYPED_TEST(DynamicFilterGeneratorLayerTest, TestBasisRebuild) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_top_vec_.push_back(this->blob_top_basis_);
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->set_transpose(true);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  DynamicFilterGeneratorLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const SyncedMemory* basis = this->blob_top_basis_->data().get();
+  const uint64_t version = basis->version();
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(version, basis->version());
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(layer.blobs()[0].get());
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_NE(version, basis->version());
+  const Dtype* weight = layer.blobs()[0]->cpu_data();
+  for (int i = 0; i < layer.blobs()[0]->count(); ++i) {
+    EXPECT_EQ(weight[i], this->blob_top_basis_->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(DynamicFilterGeneratorLayerTest, TestGradientFactorized) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_top_vec_.push_back(this->blob_top_basis_);
+  for (int transpose = 0; transpose < 2; ++transpose) {
+    LayerParameter layer_param;
+    InnerProductParameter* inner_product_param =
+        layer_param.mutable_inner_product_param();
+    inner_product_param->set_num_output(10);
+    inner_product_param->set_transpose(transpose);
+    inner_product_param->mutable_weight_filler()->set_type("gaussian");
+    inner_product_param->mutable_bias_filler()->set_type("gaussian");
+    DynamicFilterGeneratorLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-3);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+}
+
+}  // namespace caffe
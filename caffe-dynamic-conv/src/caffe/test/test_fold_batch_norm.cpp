@@ -0,0 +1,172 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/fold_batch_norm.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class FoldBatchNormTest : public CPUDeviceTest<Dtype> {
+ protected:
+  // Runs the TEST net proto describes with random weights and statistics,
+  // and again folded with those weights copied in, and compares the "out"
+  // blobs. Returns the number of layers folding removed.
+  int CheckFolded(const string& proto) {
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    param.mutable_state()->set_phase(TEST);
+    Net<Dtype> net(param);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> gaussian(filler_param);
+    // Positive, for variances and the BatchNorm scale factor.
+    filler_param.set_min(0.5);
+    filler_param.set_max(2);
+    UniformFiller<Dtype> positive(filler_param);
+    for (int i = 0; i < net.layers().size(); ++i) {
+      const string type = net.layers()[i]->type();
+      vector<shared_ptr<Blob<Dtype> > >& blobs = net.layers()[i]->blobs();
+      for (int j = 0; j < blobs.size(); ++j) {
+        if (type == "BatchNorm" || type == "BN") {
+          positive.Fill(blobs[j].get());
+        } else {
+          gaussian.Fill(blobs[j].get());
+        }
+      }
+    }
+    for (int i = 0; i < net.input_blobs().size(); ++i) {
+      gaussian.Fill(net.input_blobs()[i]);
+    }
+    net.Forward();
+    NetParameter trained;
+    net.ToProto(&trained);
+
+    param.set_fold_batch_norm(true);
+    Net<Dtype> folded(param);
+    folded.CopyTrainedLayersFrom(trained);
+    for (int i = 0; i < net.input_blobs().size(); ++i) {
+      folded.input_blobs()[i]->CopyFrom(*net.input_blobs()[i]);
+    }
+    folded.Forward();
+    const Blob<Dtype>& out = *net.blob_by_name("out");
+    const Blob<Dtype>& folded_out = *folded.blob_by_name("out");
+    EXPECT_EQ(out.shape(), folded_out.shape());
+    for (int i = 0; i < out.count(); ++i) {
+      EXPECT_NEAR(out.cpu_data()[i], folded_out.cpu_data()[i], 1e-4);
+    }
+    return net.layers().size() - folded.layers().size();
+  }
+};
+
+TYPED_TEST_CASE(FoldBatchNormTest, TestDtypes);
+
+TYPED_TEST(FoldBatchNormTest, TestConvolutionBatchNormScale) {
+  const string proto =
+      "layer { name: 'data' type: 'Input' top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 5 dim: 5 } } } "
+      "layer { name: 'conv' type: 'Convolution' bottom: 'data' top: 'out' "
+      "  convolution_param { num_output: 4 kernel_size: 3"
+      "    bias_term: false } } "
+      "layer { name: 'bn' type: 'BatchNorm' bottom: 'out' top: 'out' } "
+      "layer { name: 'scale' type: 'Scale' bottom: 'out' top: 'out' "
+      "  scale_param { bias_term: true } } ";
+  EXPECT_EQ(2, this->CheckFolded(proto));
+}
+
+TYPED_TEST(FoldBatchNormTest, TestInnerProductBN) {
+  // Not in place, and with a transposed weight.
+  const string proto =
+      "layer { name: 'data' type: 'Input' top: 'data' "
+      "  input_param { shape { dim: 3 dim: 6 } } } "
+      "layer { name: 'fc' type: 'InnerProduct' bottom: 'data' top: 'fc' "
+      "  inner_product_param { num_output: 5 transpose: true } } "
+      "layer { name: 'bn' type: 'BN' bottom: 'fc' top: 'fc_bn' } "
+      "layer { name: 'relu' type: 'ReLU' bottom: 'fc_bn' top: 'out' } ";
+  EXPECT_EQ(1, this->CheckFolded(proto));
+}
+
+TYPED_TEST(FoldBatchNormTest, TestDynamicConvolution) {
+  // COPY takes the scale in the generator, ADD in both it and the weights.
+  const string proto =
+      "layer { name: 'data' type: 'Input' top: 'data' top: 'extra' "
+      "  input_param { shape { dim: 2 dim: 2 dim: 5 dim: 5 } "
+      "    shape { dim: 2 dim: 4 } } } "
+      "layer { name: 'filter_ip' type: 'InnerProduct' bottom: 'extra' "
+      "  top: 'filters' inner_product_param { num_output: 54 } } "
+      "layer { name: 'conv' type: 'Convolution' bottom: 'data' "
+      "  bottom: 'filters' top: 'conv' "
+      "  convolution_param { num_output: 3 kernel_size: 3 pad: 1 "
+      "    weight_operation: COPY } } "
+      "layer { name: 'bn' type: 'BatchNorm' bottom: 'conv' top: 'conv' } "
+      "layer { name: 'scale' type: 'Scale' bottom: 'conv' top: 'conv' "
+      "  scale_param { bias_term: true } } "
+      "layer { name: 'filter_ip2' type: 'InnerProduct' bottom: 'extra' "
+      "  top: 'filters2' inner_product_param { num_output: 9 } } "
+      "layer { name: 'conv2' type: 'Convolution' bottom: 'conv' "
+      "  bottom: 'filters2' top: 'out' "
+      "  convolution_param { num_output: 3 kernel_size: 1 "
+      "    weight_operation: ADD } } "
+      "layer { name: 'bn2' type: 'BatchNorm' bottom: 'out' top: 'out' } ";
+  EXPECT_EQ(3, this->CheckFolded(proto));
+}
+
+TYPED_TEST(FoldBatchNormTest, TestShareTrainedLayersWith) {
+  typedef TypeParam Dtype;
+  const string proto =
+      "fold_batch_norm: true "
+      "layer { name: 'data' type: 'Input' top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 5 dim: 5 } } } "
+      "layer { name: 'conv' type: 'Convolution' bottom: 'data' top: 'out' "
+      "  convolution_param { num_output: 4 kernel_size: 3 "
+      "    weight_filler { type: 'gaussian' } } } "
+      "layer { name: 'bn' type: 'BatchNorm' bottom: 'out' top: 'out' } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.mutable_state()->set_phase(TEST);
+  // Nets folded alike share the folded weights.
+  Net<Dtype> net(param);
+  Net<Dtype> other(param);
+  other.ShareTrainedLayersWith(&net);
+  ASSERT_EQ(net.layers().size(), other.layers().size());
+  for (int i = 0; i < net.layers().size(); ++i) {
+    const vector<shared_ptr<Blob<Dtype> > >& blobs = net.layers()[i]->blobs();
+    const vector<shared_ptr<Blob<Dtype> > >& other_blobs =
+        other.layers()[i]->blobs();
+    ASSERT_EQ(blobs.size(), other_blobs.size());
+    for (int j = 0; j < blobs.size(); ++j) {
+      EXPECT_EQ(blobs[j]->cpu_data(), other_blobs[j]->cpu_data());
+    }
+  }
+}
+
+TYPED_TEST(FoldBatchNormTest, TestKeepsUnfoldable) {
+  // The convolution's output is also read before normalization, and the
+  // second BatchNorm uses batch statistics.
+  const string proto =
+      "layer { name: 'data' type: 'Input' top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 5 dim: 5 } } } "
+      "layer { name: 'conv' type: 'Convolution' bottom: 'data' top: 'conv' "
+      "  convolution_param { num_output: 4 kernel_size: 1 } } "
+      "layer { name: 'relu' type: 'ReLU' bottom: 'conv' top: 'relu' } "
+      "layer { name: 'bn' type: 'BatchNorm' bottom: 'conv' top: 'bn' } "
+      "layer { name: 'conv2' type: 'Convolution' bottom: 'bn' top: 'out' "
+      "  convolution_param { num_output: 4 kernel_size: 1 } } "
+      "layer { name: 'bn2' type: 'BatchNorm' bottom: 'out' top: 'out' "
+      "  batch_norm_param { use_global_stats: false } } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  NetParameter folded;
+  FoldBatchNormLayers(param, &folded);
+  EXPECT_EQ(param.DebugString(), folded.DebugString());
+}
+
+}  // namespace caffe
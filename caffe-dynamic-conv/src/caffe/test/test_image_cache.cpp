@@ -0,0 +1,154 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layers/image_cache_data_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/image_cache.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Writes num 3 x 5 x 7 images whose pixel p of image i is (i * 11 + p) % 256,
+// labelled i with attributes (i, -i).
+static void WriteTestCache(const string& filename, int num) {
+  ImageCacheWriter writer(filename, 3, 5, 7, 2);
+  vector<uint8_t> image(3 * 5 * 7);
+  for (int i = 0; i < num; ++i) {
+    for (int p = 0; p < image.size(); ++p) {
+      image[p] = (i * 11 + p) % 256;
+    }
+    const float attributes[2] = {static_cast<float>(i),
+        static_cast<float>(-i)};
+    writer.Add(&image[0], i, attributes);
+  }
+}
+
+class ImageCacheTest : public ::testing::Test {};
+
+TEST_F(ImageCacheTest, TestReadWrite) {
+  string filename;
+  MakeTempFilename(&filename);
+  WriteTestCache(filename, 4);
+  ImageCache cache(filename);
+  EXPECT_EQ(cache.num(), 4);
+  EXPECT_EQ(cache.channels(), 3);
+  EXPECT_EQ(cache.height(), 5);
+  EXPECT_EQ(cache.width(), 7);
+  EXPECT_EQ(cache.num_attributes(), 2);
+  for (int i = 0; i < 4; ++i) {
+    // Every image is aligned for in-place reads.
+    EXPECT_EQ(reinterpret_cast<size_t>(cache.image(i)) % 64, 0);
+    for (int p = 0; p < 3 * 5 * 7; ++p) {
+      EXPECT_EQ(cache.image(i)[p], (i * 11 + p) % 256);
+    }
+    EXPECT_EQ(cache.label(i), i);
+    EXPECT_EQ(cache.attributes(i)[0], i);
+    EXPECT_EQ(cache.attributes(i)[1], -i);
+  }
+}
+
+#ifdef USE_OPENCV
+template <typename TypeParam>
+class ImageCacheDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  ImageCacheDataLayerTest()
+      : blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()),
+        blob_top_extra_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+    blob_top_vec_.push_back(blob_top_extra_);
+    Caffe::set_random_seed(1701);
+    MakeTempFilename(&filename_);
+    WriteTestCache(filename_, 5);
+  }
+
+  virtual ~ImageCacheDataLayerTest() {
+    delete blob_top_data_;
+    delete blob_top_label_;
+    delete blob_top_extra_;
+  }
+
+  string filename_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  Blob<Dtype>* const blob_top_extra_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(ImageCacheDataLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(ImageCacheDataLayerTest, TestRead) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(5);
+  image_data_param->set_source(this->filename_.c_str());
+  image_data_param->set_num_workers(2);
+  ImageCacheDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 5);
+  EXPECT_EQ(this->blob_top_data_->channels(), 3);
+  EXPECT_EQ(this->blob_top_data_->height(), 5);
+  EXPECT_EQ(this->blob_top_data_->width(), 7);
+  EXPECT_EQ(this->blob_top_extra_->num(), 5);
+  EXPECT_EQ(this->blob_top_extra_->channels(), 2);
+  // Go through the data twice
+  for (int iter = 0; iter < 2; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    const Dtype* data = this->blob_top_data_->cpu_data();
+    for (int i = 0; i < 5; ++i) {
+      EXPECT_EQ(i, this->blob_top_label_->cpu_data()[i]);
+      EXPECT_EQ(i, this->blob_top_extra_->cpu_data()[i * 2]);
+      EXPECT_EQ(-i, this->blob_top_extra_->cpu_data()[i * 2 + 1]);
+      // The interleaved pixels come out channel by channel.
+      for (int c = 0; c < 3; ++c) {
+        for (int p = 0; p < 5 * 7; ++p) {
+          EXPECT_EQ((i * 11 + p * 3 + c) % 256,
+              data[(i * 3 + c) * 5 * 7 + p]);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(ImageCacheDataLayerTest, TestShard) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.set_phase(TRAIN);
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(4);
+  image_data_param->set_source(this->filename_.c_str());
+  // The second of two solvers reads images 1 and 3, shuffled or not.
+  Caffe::set_solver_count(2);
+  Caffe::set_solver_rank(1);
+  for (int shuffle = 0; shuffle < 2; ++shuffle) {
+    image_data_param->set_shuffle(shuffle);
+    ImageCacheDataLayer<Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int iter = 0; iter < 2; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      const Dtype* label = this->blob_top_label_->cpu_data();
+      for (int i = 0; i < 4; i += 2) {
+        // Every epoch holds both images of the shard.
+        EXPECT_EQ(4, label[i] + label[i + 1]);
+        EXPECT_EQ(1, std::abs(label[i] - label[i + 1]) / 2);
+      }
+    }
+  }
+  Caffe::set_solver_count(1);
+  Caffe::set_solver_rank(0);
+}
+#endif  // USE_OPENCV
+
+}  // namespace caffe
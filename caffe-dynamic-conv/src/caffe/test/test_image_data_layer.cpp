@@ -52,6 +52,16 @@ class ImageDataLayerTest : public MultiDeviceTest<TypeParam> {
     spacefile << EXAMPLES_SOURCE_DIR "images/cat.jpg " << 0 << std::endl;
     spacefile << EXAMPLES_SOURCE_DIR "images/cat gray.jpg " << 1 << std::endl;
     spacefile.close();
+    // Create test input file with three attribute columns.
+    MakeTempFilename(&filename_attributes_);
+    std::ofstream attributesfile(filename_attributes_.c_str(),
+        std::ofstream::out);
+    LOG(INFO) << "Using temporary file " << filename_attributes_;
+    for (int i = 0; i < 5; ++i) {
+      attributesfile << EXAMPLES_SOURCE_DIR "images/cat.jpg " << i << " "
+          << i * 0.5 << " " << -i << " 1" << std::endl;
+    }
+    attributesfile.close();
   }
 
   virtual ~ImageDataLayerTest() {
@@ -63,6 +73,7 @@ class ImageDataLayerTest : public MultiDeviceTest<TypeParam> {
   string filename_;
   string filename_reshape_;
   string filename_space_;
+  string filename_attributes_;
   Blob<Dtype>* const blob_top_data_;
   Blob<Dtype>* const blob_top_label_;
   vector<Blob<Dtype>*> blob_bottom_vec_;
@@ -186,6 +197,102 @@ TYPED_TEST(ImageDataLayerTest, TestShuffle) {
   }
 }
 
+TYPED_TEST(ImageDataLayerTest, TestShard) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.set_phase(TRAIN);
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(4);
+  image_data_param->set_source(this->filename_.c_str());
+  // The second of two solvers reads lines 1 and 3, shuffled or not.
+  Caffe::set_solver_count(2);
+  Caffe::set_solver_rank(1);
+  for (int shuffle = 0; shuffle < 2; ++shuffle) {
+    image_data_param->set_shuffle(shuffle);
+    ImageDataLayer<Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int iter = 0; iter < 2; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      const Dtype* label = this->blob_top_label_->cpu_data();
+      for (int i = 0; i < 4; i += 2) {
+        // Every epoch holds both lines of the shard.
+        EXPECT_EQ(4, label[i] + label[i + 1]);
+        EXPECT_EQ(1, std::abs(label[i] - label[i + 1]) / 2);
+      }
+    }
+  }
+  Caffe::set_solver_count(1);
+  Caffe::set_solver_rank(0);
+}
+
+TYPED_TEST(ImageDataLayerTest, TestWorkersDeterministic) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.set_phase(TRAIN);
+  param.mutable_transform_param()->set_crop_size(100);
+  param.mutable_transform_param()->set_mirror(true);
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(5);
+  image_data_param->set_source(this->filename_.c_str());
+  image_data_param->set_shuffle(true);
+  // The same seed gives the same batches whatever the number of workers.
+  vector<vector<Dtype> > batches;
+  const int num_workers[] = {1, 3};
+  for (int i = 0; i < 2; ++i) {
+    image_data_param->set_num_workers(num_workers[i]);
+    Caffe::set_random_seed(this->seed_);
+    ImageDataLayer<Dtype> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int iter = 0; iter < 2; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      const Dtype* data = this->blob_top_data_->cpu_data();
+      const Dtype* label = this->blob_top_label_->cpu_data();
+      if (i == 0) {
+        batches.push_back(vector<Dtype>(data,
+            data + this->blob_top_data_->count()));
+        batches.push_back(vector<Dtype>(label, label + 5));
+        continue;
+      }
+      const vector<Dtype>& ref_data = batches[iter * 2];
+      const vector<Dtype>& ref_label = batches[iter * 2 + 1];
+      for (int j = 0; j < this->blob_top_data_->count(); ++j) {
+        EXPECT_EQ(ref_data[j], data[j]);
+      }
+      for (int j = 0; j < 5; ++j) {
+        EXPECT_EQ(ref_label[j], label[j]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(ImageDataLayerTest, TestAttributes) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  ImageDataParameter* image_data_param = param.mutable_image_data_param();
+  image_data_param->set_batch_size(5);
+  image_data_param->set_source(this->filename_attributes_.c_str());
+  image_data_param->set_shuffle(true);
+  Blob<Dtype> blob_top_extra;
+  this->blob_top_vec_.push_back(&blob_top_extra);
+  ImageDataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(blob_top_extra.num(), 5);
+  EXPECT_EQ(blob_top_extra.channels(), 3);
+  EXPECT_EQ(blob_top_extra.height(), 1);
+  EXPECT_EQ(blob_top_extra.width(), 1);
+  // Go through the data twice
+  for (int iter = 0; iter < 2; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < 5; ++i) {
+      // The attributes follow their line through the shuffle.
+      const Dtype label = this->blob_top_label_->cpu_data()[i];
+      EXPECT_EQ(label * 0.5, blob_top_extra.cpu_data()[i * 3]);
+      EXPECT_EQ(-label, blob_top_extra.cpu_data()[i * 3 + 1]);
+      EXPECT_EQ(1, blob_top_extra.cpu_data()[i * 3 + 2]);
+    }
+  }
+}
+
 TYPED_TEST(ImageDataLayerTest, TestSpace) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter param;
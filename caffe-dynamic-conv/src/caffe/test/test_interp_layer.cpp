@@ -64,4 +64,61 @@ TYPED_TEST(InterpLayerTest, TestGradient) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(InterpLayerTest, TestForwardZoomCrop) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  InterpParameter* interp_param =
+      layer_param.mutable_interp_param();
+  interp_param->set_zoom_factor(3);
+  interp_param->set_pad_beg(-1);
+  interp_param->set_pad_end(-1);
+  InterpLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // The cropped 4x3 input, zoomed, against the per-pixel formula.
+  const int height1 = 4, width1 = 3;
+  const int height2 = this->blob_top_->height();
+  const int width2 = this->blob_top_->width();
+  EXPECT_EQ(10, height2);
+  EXPECT_EQ(7, width2);
+  const float rheight = static_cast<float>(height1 - 1) / (height2 - 1);
+  const float rwidth = static_cast<float>(width1 - 1) / (width2 - 1);
+  for (int n = 0; n < 2; ++n) {
+    for (int c = 0; c < 3; ++c) {
+      for (int h2 = 0; h2 < height2; ++h2) {
+        const int h1 = rheight * h2;
+        const int h1p = (h1 < height1 - 1) ? 1 : 0;
+        const Dtype h1lambda = rheight * h2 - h1;
+        for (int w2 = 0; w2 < width2; ++w2) {
+          const int w1 = rwidth * w2;
+          const int w1p = (w1 < width1 - 1) ? 1 : 0;
+          const Dtype w1lambda = rwidth * w2 - w1;
+          const Dtype* pos1 = this->blob_bottom_->cpu_data()
+              + this->blob_bottom_->offset(n, c, h1 + 1, w1 + 1);
+          const int width = this->blob_bottom_->width();
+          const Dtype expected =
+              (1 - h1lambda) * ((1 - w1lambda) * pos1[0]
+                  + w1lambda * pos1[w1p])
+              + h1lambda * ((1 - w1lambda) * pos1[h1p * width]
+                  + w1lambda * pos1[h1p * width + w1p]);
+          EXPECT_NEAR(expected, this->blob_top_->data_at(n, c, h2, w2), 1e-5);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(InterpLayerTest, TestGradientShrinkCrop) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  InterpParameter* interp_param =
+      layer_param.mutable_interp_param();
+  interp_param->set_shrink_factor(2);
+  interp_param->set_pad_end(-1);
+  InterpLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
 }  // namespace caffe
@@ -4,6 +4,7 @@
 #include <opencv2/highgui/highgui_c.h>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include <cstdlib>
 #include <string>
 
 #include "gtest/gtest.h"
@@ -229,6 +230,43 @@ TEST_F(IOTest, TestReadImageToCVMatResizedGray) {
   EXPECT_EQ(cv_img.cols, 256);
 }
 
+#ifdef USE_LIBJPEG
+TEST_F(IOTest, TestReadImageToCVMatScaled) {
+  string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  cv::Mat cv_img = ReadImageToCVMatScaled(filename, 100, 200, true);
+  EXPECT_EQ(cv_img.channels(), 3);
+  EXPECT_EQ(cv_img.rows, 100);
+  EXPECT_EQ(cv_img.cols, 200);
+}
+
+TEST_F(IOTest, TestReadImageToCVMatScaledGray) {
+  string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  const bool is_color = false;
+  cv::Mat cv_img = ReadImageToCVMatScaled(filename, 90, 120, is_color);
+  EXPECT_EQ(cv_img.channels(), 1);
+  EXPECT_EQ(cv_img.rows, 90);
+  EXPECT_EQ(cv_img.cols, 120);
+}
+
+TEST_F(IOTest, TestReadImageToCVMatScaledContent) {
+  string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  // Without a target size the whole image is decoded as by OpenCV.
+  cv::Mat cv_img = ReadImageToCVMat(filename, 0, 0, true);
+  cv::Mat cv_img_scaled = ReadImageToCVMatScaled(filename, 0, 0, true);
+  EXPECT_EQ(cv_img_scaled.channels(), 3);
+  EXPECT_EQ(cv_img_scaled.rows, cv_img.rows);
+  EXPECT_EQ(cv_img_scaled.cols, cv_img.cols);
+  double difference = 0;
+  for (int h = 0; h < cv_img.rows; ++h) {
+    for (int w = 0; w < cv_img.cols * 3; ++w) {
+      difference += std::abs(cv_img.ptr<uchar>(h)[w] -
+          cv_img_scaled.ptr<uchar>(h)[w]);
+    }
+  }
+  EXPECT_LT(difference / (cv_img.rows * cv_img.cols * 3), 1);
+}
+#endif  // USE_LIBJPEG
+
 TEST_F(IOTest, TestCVMatToDatum) {
   string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
   cv::Mat cv_img = ReadImageToCVMat(filename);
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -504,4 +505,55 @@ TYPED_TEST(ScaleLayerTest, TestGradientScaleAxis2) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(ScaleLayerTest, TestThreadsInPlace) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Large enough for the scale entries and planes to be split among workers.
+  Blob<Dtype> blob_bottom(4, 8, 32, 64);
+  Blob<Dtype> blob_inplace;
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&blob_bottom);
+  vector<Blob<Dtype>*> blob_bottom_vec(1, &blob_bottom);
+  vector<Blob<Dtype>*> blob_inplace_vec(1, &blob_inplace);
+  LayerParameter layer_param;
+  ScaleParameter* scale_param = layer_param.mutable_scale_param();
+  scale_param->mutable_filler()->set_type("gaussian");
+  scale_param->set_bias_term(true);
+  scale_param->mutable_bias_filler()->set_type("gaussian");
+  ScaleLayer<Dtype> layer(layer_param);
+  layer.SetUp(blob_bottom_vec, this->blob_top_vec_);
+  ScaleLayer<Dtype> layer_inplace(layer_param);
+  layer_inplace.SetUp(blob_bottom_vec, this->blob_top_vec_);
+  for (int i = 0; i < 2; ++i) {
+    layer_inplace.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  // Out of place on one thread, in place on four.
+  CPUThreadsGuard guard;
+  Caffe::set_cpu_threads(1);
+  layer.Forward(blob_bottom_vec, this->blob_top_vec_);
+  caffe_copy(blob_bottom.count(), blob_bottom.cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, vector<bool>(1, true), blob_bottom_vec);
+  Caffe::set_cpu_threads(4);
+  blob_inplace.CopyFrom(blob_bottom, false, true);
+  caffe_copy(blob_bottom.count(), blob_bottom.cpu_data(),
+      blob_inplace.mutable_cpu_diff());
+  layer_inplace.Forward(blob_inplace_vec, blob_inplace_vec);
+  layer_inplace.Backward(blob_inplace_vec, vector<bool>(1, true),
+      blob_inplace_vec);
+  for (int i = 0; i < blob_bottom.count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i], blob_inplace.cpu_data()[i],
+        1e-5);
+    EXPECT_NEAR(blob_bottom.cpu_diff()[i], blob_inplace.cpu_diff()[i], 1e-5);
+  }
+  for (int i = 0; i < 2; ++i) {
+    const Blob<Dtype>& param = *layer.blobs()[i];
+    const Blob<Dtype>& param_inplace = *layer_inplace.blobs()[i];
+    for (int j = 0; j < param.count(); ++j) {
+      EXPECT_NEAR(param.cpu_diff()[j], param_inplace.cpu_diff()[j],
+          1e-3 * std::max(Dtype(1), std::fabs(param.cpu_diff()[j])));
+    }
+  }
+}
+
 }  // namespace caffe
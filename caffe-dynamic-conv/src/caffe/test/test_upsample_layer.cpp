@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/pooling_layer.hpp"
+#include "caffe/layers/upsample_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class UpsampleLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  UpsampleLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 6, 7)),
+        blob_pooled_(new Blob<Dtype>()),
+        blob_mask_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_pooled_vec_.push_back(blob_pooled_);
+    blob_pooled_vec_.push_back(blob_mask_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~UpsampleLayerTest() {
+    delete blob_bottom_;
+    delete blob_pooled_;
+    delete blob_mask_;
+    delete blob_top_;
+  }
+
+  // Max pools the bottom with a kernel of the given size and stride 2, and
+  // unpools the result to the bottom's size.
+  void PoolAndUpsample(const int kernel_size, const bool int_mask) {
+    LayerParameter pooling_param;
+    pooling_param.mutable_pooling_param()->set_kernel_size(kernel_size);
+    pooling_param.mutable_pooling_param()->set_stride(2);
+    pooling_param.mutable_pooling_param()->set_int_mask(int_mask);
+    PoolingLayer<Dtype> pooling_layer(pooling_param);
+    pooling_layer.SetUp(blob_bottom_vec_, blob_pooled_vec_);
+    pooling_layer.Forward(blob_bottom_vec_, blob_pooled_vec_);
+    LayerParameter upsample_param;
+    upsample_param.mutable_upsample_param()->set_upsample_h(
+        blob_bottom_->height());
+    upsample_param.mutable_upsample_param()->set_upsample_w(
+        blob_bottom_->width());
+    upsample_param.mutable_upsample_param()->set_int_mask(int_mask);
+    UpsampleLayer<Dtype> upsample_layer(upsample_param);
+    upsample_layer.SetUp(blob_pooled_vec_, blob_top_vec_);
+    upsample_layer.Forward(blob_pooled_vec_, blob_top_vec_);
+  }
+
+  // Each value of the top is its bottom value if it is the max of a pooling
+  // window, else 0.
+  void CheckUnpooled(const int kernel_size) {
+    ASSERT_EQ(blob_bottom_->shape(), blob_top_->shape());
+    const int height = blob_bottom_->height();
+    const int width = blob_bottom_->width();
+    for (int n = 0; n < blob_bottom_->num(); ++n) {
+      for (int c = 0; c < blob_bottom_->channels(); ++c) {
+        vector<bool> is_max(height * width, false);
+        for (int ph = 0; ph < blob_pooled_->height(); ++ph) {
+          for (int pw = 0; pw < blob_pooled_->width(); ++pw) {
+            int max_index = -1;
+            Dtype max_value = 0;
+            for (int h = 2 * ph; h < std::min(2 * ph + kernel_size, height);
+                 ++h) {
+              for (int w = 2 * pw; w < std::min(2 * pw + kernel_size, width);
+                   ++w) {
+                const Dtype value = blob_bottom_->data_at(n, c, h, w);
+                if (max_index < 0 || value > max_value) {
+                  max_index = h * width + w;
+                  max_value = value;
+                }
+              }
+            }
+            is_max[max_index] = true;
+          }
+        }
+        for (int h = 0; h < height; ++h) {
+          for (int w = 0; w < width; ++w) {
+            EXPECT_EQ(is_max[h * width + w] ?
+                blob_bottom_->data_at(n, c, h, w) : Dtype(0),
+                blob_top_->data_at(n, c, h, w));
+          }
+        }
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_pooled_;
+  Blob<Dtype>* const blob_mask_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_pooled_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(UpsampleLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(UpsampleLayerTest, TestForward) {
+  this->PoolAndUpsample(2, false);
+  this->CheckUnpooled(2);
+}
+
+TYPED_TEST(UpsampleLayerTest, TestForwardIntMask) {
+  this->PoolAndUpsample(2, true);
+  this->CheckUnpooled(2);
+}
+
+TYPED_TEST(UpsampleLayerTest, TestForwardOverlapping) {
+  // The windows overlap, and maxima can go below the two rows of the top
+  // each row of the bottom covers.
+  this->PoolAndUpsample(3, false);
+  this->CheckUnpooled(3);
+  this->PoolAndUpsample(3, true);
+  this->CheckUnpooled(3);
+}
+
+TYPED_TEST(UpsampleLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->PoolAndUpsample(2, false);
+  LayerParameter layer_param;
+  layer_param.mutable_upsample_param()->set_upsample_h(6);
+  layer_param.mutable_upsample_param()->set_upsample_w(7);
+  UpsampleLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_pooled_vec_,
+      this->blob_top_vec_, 0);
+}
+
+TYPED_TEST(UpsampleLayerTest, TestGradientIntMask) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->PoolAndUpsample(2, true);
+  LayerParameter layer_param;
+  layer_param.mutable_upsample_param()->set_upsample_h(6);
+  layer_param.mutable_upsample_param()->set_upsample_w(7);
+  layer_param.mutable_upsample_param()->set_int_mask(true);
+  UpsampleLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_pooled_vec_,
+      this->blob_top_vec_, 0);
+}
+
+}  // namespace caffe
@@ -0,0 +1,180 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/util/attention_sampler.hpp"
+
+namespace caffe {
+
+// The probability of keeping a cell, in units of 1 / kProbOne.
+static const uint32_t kProbOne = 65535;
+
+void AttentionSampler::BuildTable(const float* attention, int n,
+    uint16_t* prob, uint32_t* alias) {
+  CHECK_GT(n, 0);
+  double total = 0;
+  for (int i = 0; i < n; ++i) {
+    CHECK_GE(attention[i], 0) << "Attention weights must not be negative";
+    total += attention[i];
+  }
+  for (int i = 0; i < n; ++i) {
+    prob[i] = kProbOne;
+    alias[i] = i;
+  }
+  if (total <= 0) {
+    return;
+  }
+  // Vose's method: pair every position below the average weight with one
+  // above it that tops it up.
+  vector<double> scaled(n);
+  vector<int> small, large;
+  for (int i = 0; i < n; ++i) {
+    scaled[i] = attention[i] * n / total;
+    if (scaled[i] < 1) {
+      small.push_back(i);
+    } else {
+      large.push_back(i);
+    }
+  }
+  while (!small.empty() && !large.empty()) {
+    const int s = small.back();
+    small.pop_back();
+    const int l = large.back();
+    prob[s] = static_cast<uint16_t>(scaled[s] * kProbOne + 0.5);
+    alias[s] = l;
+    scaled[l] -= 1 - scaled[s];
+    if (scaled[l] < 1) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // What is left is within rounding of the average weight.
+}
+
+void AttentionSampler::Sample(float u, float v, int* h, int* w) const {
+  const int n = height_ * width_;
+  int i = std::min(static_cast<int>(u * n), n - 1);
+  if (v * kProbOne >= prob_[i]) {
+    i = alias_[i];
+  }
+  *h = i / width_;
+  *w = i % width_;
+}
+
+static const char kAttentionTablesMagic[8] = {'C', 'A', 'F', 'F', 'E', 'A',
+    'T', 'T'};
+static const uint32_t kAttentionTablesVersion = 1;
+// Every table starts on a cache line.
+static const uint64_t kTableAlignment = 64;
+
+static uint64_t align_up(const uint64_t n, const uint64_t alignment) {
+  return (n + alignment - 1) / alignment * alignment;
+}
+
+// The bytes of the prob array of an n-cell table, padded so that the alias
+// array after it is aligned.
+static uint64_t prob_bytes(const uint64_t n) {
+  return align_up(n * sizeof(uint16_t), sizeof(uint32_t));
+}
+
+AttentionTablesWriter::AttentionTablesWriter(const string& filename) {
+  file_ = fopen(filename.c_str(), "wb");
+  CHECK(file_) << "Failed to open " << filename;
+  memset(&header_, 0, sizeof(header_));
+  memcpy(header_.magic, kAttentionTablesMagic, sizeof(header_.magic));
+  header_.version = kAttentionTablesVersion;
+  offset_ = align_up(sizeof(header_), kTableAlignment);
+  CHECK_EQ(fseek(file_, offset_, SEEK_SET), 0);
+}
+
+AttentionTablesWriter::~AttentionTablesWriter() {
+  if (file_) {
+    Close();
+  }
+}
+
+void AttentionTablesWriter::Add(const float* attention, int height,
+    int width) {
+  CHECK(file_) << "The attention table file is closed.";
+  CHECK_GT(height, 0);
+  CHECK_GT(width, 0);
+  const int n = height * width;
+  // The prob array is padded with zeros up to the alias array.
+  prob_.assign(prob_bytes(n) / sizeof(uint16_t), 0);
+  alias_.resize(n);
+  AttentionSampler::BuildTable(attention, n, &prob_[0], &alias_[0]);
+  AttentionTablesEntry entry;
+  entry.offset = offset_;
+  entry.height = height;
+  entry.width = width;
+  index_.push_back(entry);
+  CHECK_EQ(fwrite(&prob_[0], sizeof(uint16_t), prob_.size(), file_),
+      prob_.size());
+  CHECK_EQ(fwrite(&alias_[0], sizeof(uint32_t), n, file_), n);
+  const uint64_t end = offset_ + prob_bytes(n) + n * sizeof(uint32_t);
+  offset_ = align_up(end, kTableAlignment);
+  const vector<char> padding(offset_ - end, 0);
+  if (padding.size()) {
+    CHECK_EQ(fwrite(&padding[0], 1, padding.size(), file_), padding.size());
+  }
+  ++header_.num;
+}
+
+void AttentionTablesWriter::Close() {
+  CHECK(file_) << "The attention table file is closed.";
+  header_.index_offset = offset_;
+  if (index_.size()) {
+    CHECK_EQ(fwrite(&index_[0], sizeof(AttentionTablesEntry), index_.size(),
+        file_), index_.size());
+  }
+  CHECK_EQ(fseek(file_, 0, SEEK_SET), 0);
+  CHECK_EQ(fwrite(&header_, sizeof(header_), 1, file_), 1);
+  CHECK_EQ(fclose(file_), 0);
+  file_ = NULL;
+}
+
+AttentionTables::AttentionTables(const string& filename) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Failed to open " << filename;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0) << "Failed to stat " << filename;
+  size_ = file_stat.st_size;
+  CHECK_GE(size_, sizeof(AttentionTablesHeader)) << filename
+      << " is not an attention table file.";
+  void* data = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(data != MAP_FAILED) << "Failed to map " << filename;
+  data_ = static_cast<const uint8_t*>(data);
+  header_ = reinterpret_cast<const AttentionTablesHeader*>(data_);
+  CHECK_EQ(memcmp(header_->magic, kAttentionTablesMagic,
+      sizeof(header_->magic)), 0) << filename
+      << " is not an attention table file.";
+  CHECK_EQ(header_->version, kAttentionTablesVersion)
+      << "Unsupported version of " << filename;
+  CHECK_EQ(header_->index_offset +
+      sizeof(AttentionTablesEntry) * header_->num, size_) << filename
+      << " is truncated.";
+  index_ = reinterpret_cast<const AttentionTablesEntry*>(
+      data_ + header_->index_offset);
+}
+
+AttentionTables::~AttentionTables() {
+  munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+AttentionSampler AttentionTables::sampler(int i) const {
+  const AttentionTablesEntry& entry = index_[i];
+  const uint64_t n = static_cast<uint64_t>(entry.height) * entry.width;
+  const uint8_t* table = data_ + entry.offset;
+  return AttentionSampler(reinterpret_cast<const uint16_t*>(table),
+      reinterpret_cast<const uint32_t*>(table + prob_bytes(n)),
+      entry.height, entry.width);
+}
+
+}  // namespace caffe
@@ -0,0 +1,66 @@
+#include "caffe/common.hpp"
+#include "caffe/util/combine_filter.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+const Dtype* caffe_combine_filter(const ConvolutionParameter_WeightOp op,
+    const int count, const Dtype* weight, const Dtype* filter,
+    Dtype* combined) {
+  switch (op) {
+  case ConvolutionParameter_WeightOp_MUL:
+    caffe_mul(count, weight, filter, combined);
+    return combined;
+  case ConvolutionParameter_WeightOp_ADD:
+    caffe_add(count, weight, filter, combined);
+    return combined;
+  case ConvolutionParameter_WeightOp_COPY:
+    return filter;
+  default:
+    LOG(FATAL) << "Unknown weight operation.";
+  }
+  return NULL;
+}
+
+template const float* caffe_combine_filter<float>(
+    const ConvolutionParameter_WeightOp op, const int count,
+    const float* weight, const float* filter, float* combined);
+template const double* caffe_combine_filter<double>(
+    const ConvolutionParameter_WeightOp op, const int count,
+    const double* weight, const double* filter, double* combined);
+
+template <typename Dtype>
+void caffe_combine_filter_backward(const ConvolutionParameter_WeightOp op,
+    const int count, const Dtype* weight, const Dtype* filter,
+    const Dtype* combined_diff, Dtype* weight_diff, Dtype* filter_diff,
+    const bool accumulate) {
+  const bool mul = op == ConvolutionParameter_WeightOp_MUL;
+  // COPY ignores the static weights.
+  if (op == ConvolutionParameter_WeightOp_COPY) {
+    weight_diff = NULL;
+  }
+  // Every value is read before it is written, for filter_diff ==
+  // combined_diff.
+  for (int i = 0; i < count; ++i) {
+    const Dtype diff = combined_diff[i];
+    if (weight_diff) {
+      weight_diff[i] += mul ? diff * filter[i] : diff;
+    }
+    if (filter_diff) {
+      const Dtype product = mul ? diff * weight[i] : diff;
+      filter_diff[i] = accumulate ? filter_diff[i] + product : product;
+    }
+  }
+}
+
+template void caffe_combine_filter_backward<float>(
+    const ConvolutionParameter_WeightOp op, const int count,
+    const float* weight, const float* filter, const float* combined_diff,
+    float* weight_diff, float* filter_diff, const bool accumulate);
+template void caffe_combine_filter_backward<double>(
+    const ConvolutionParameter_WeightOp op, const int count,
+    const double* weight, const double* filter, const double* combined_diff,
+    double* weight_diff, double* filter_diff, const bool accumulate);
+
+}  // namespace caffe
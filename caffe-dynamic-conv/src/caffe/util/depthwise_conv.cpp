@@ -0,0 +1,286 @@
+#include <boost/bind.hpp>
+#include <algorithm>
+
+#include "caffe/util/depthwise_conv.hpp"
+#include "caffe/util/parallel_for.hpp"
+
+namespace caffe {
+
+namespace {
+
+// The geometry and the buffers shared by every plane of one call. Each
+// routine uses the subset of buffers it needs; output is written (or
+// accumulated into, for the filter gradients).
+template <typename Dtype>
+struct DepthwiseArgs {
+  int channels, height, width, out_h, out_w;
+  int kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w;
+  int dilation_h, dilation_w;
+  const Dtype* data_im;
+  const Dtype* out_diff;
+  const Dtype* weight;
+  int weight_stride;
+  Dtype* output;
+};
+
+template <typename Dtype>
+DepthwiseArgs<Dtype> MakeArgs(const int channels, const int height,
+    const int width, const int kernel_h, const int kernel_w, const int pad_h,
+    const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const int weight_stride) {
+  DepthwiseArgs<Dtype> args;
+  args.channels = channels;
+  args.height = height;
+  args.width = width;
+  args.out_h = (height + 2 * pad_h - (dilation_h * (kernel_h - 1) + 1))
+      / stride_h + 1;
+  args.out_w = (width + 2 * pad_w - (dilation_w * (kernel_w - 1) + 1))
+      / stride_w + 1;
+  args.kernel_h = kernel_h;
+  args.kernel_w = kernel_w;
+  args.pad_h = pad_h;
+  args.pad_w = pad_w;
+  args.stride_h = stride_h;
+  args.stride_w = stride_w;
+  args.dilation_h = dilation_h;
+  args.dilation_w = dilation_w;
+  args.data_im = NULL;
+  args.out_diff = NULL;
+  args.weight = NULL;
+  args.weight_stride = weight_stride;
+  args.output = NULL;
+  return args;
+}
+
+// The output columns [*begin, *end) whose tap at offset (kernel column times
+// dilation, minus padding) reads inside a row of width input columns.
+inline void valid_columns(const int out_w, const int width, const int stride,
+    const int offset, int* begin, int* end) {
+  // ow * stride + offset must lie in [0, width).
+  *begin = offset >= 0 ? 0 : (stride - 1 - offset) / stride;
+  *end = (offset >= width) ? 0 :
+      std::min(out_w, (width - 1 - offset) / stride + 1);
+}
+
+template <typename Dtype>
+void forward_plane(const DepthwiseArgs<Dtype>& args, const Dtype* in,
+    const Dtype* weight, Dtype* out) {
+  for (int oh = 0; oh < args.out_h; ++oh) {
+    Dtype* out_row = out + oh * args.out_w;
+    std::fill(out_row, out_row + args.out_w, Dtype(0));
+    for (int kh = 0; kh < args.kernel_h; ++kh) {
+      const int ih = oh * args.stride_h + kh * args.dilation_h - args.pad_h;
+      if (ih < 0 || ih >= args.height) {
+        continue;
+      }
+      const Dtype* in_row = in + ih * args.width;
+      for (int kw = 0; kw < args.kernel_w; ++kw) {
+        const Dtype w = weight[kh * args.kernel_w + kw];
+        const int offset = kw * args.dilation_w - args.pad_w;
+        int begin, end;
+        valid_columns(args.out_w, args.width, args.stride_w, offset, &begin,
+            &end);
+        if (args.stride_w == 1) {
+          for (int ow = begin; ow < end; ++ow) {
+            out_row[ow] += w * in_row[ow + offset];
+          }
+        } else {
+          for (int ow = begin; ow < end; ++ow) {
+            out_row[ow] += w * in_row[ow * args.stride_w + offset];
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void backward_plane(const DepthwiseArgs<Dtype>& args, const Dtype* out_diff,
+    const Dtype* weight, Dtype* in_diff) {
+  std::fill(in_diff, in_diff + args.height * args.width, Dtype(0));
+  for (int oh = 0; oh < args.out_h; ++oh) {
+    const Dtype* out_row = out_diff + oh * args.out_w;
+    for (int kh = 0; kh < args.kernel_h; ++kh) {
+      const int ih = oh * args.stride_h + kh * args.dilation_h - args.pad_h;
+      if (ih < 0 || ih >= args.height) {
+        continue;
+      }
+      Dtype* in_row = in_diff + ih * args.width;
+      for (int kw = 0; kw < args.kernel_w; ++kw) {
+        const Dtype w = weight[kh * args.kernel_w + kw];
+        const int offset = kw * args.dilation_w - args.pad_w;
+        int begin, end;
+        valid_columns(args.out_w, args.width, args.stride_w, offset, &begin,
+            &end);
+        if (args.stride_w == 1) {
+          for (int ow = begin; ow < end; ++ow) {
+            in_row[ow + offset] += w * out_row[ow];
+          }
+        } else {
+          for (int ow = begin; ow < end; ++ow) {
+            in_row[ow * args.stride_w + offset] += w * out_row[ow];
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void weight_plane(const DepthwiseArgs<Dtype>& args, const Dtype* in,
+    const Dtype* out_diff, Dtype* weight_diff) {
+  for (int oh = 0; oh < args.out_h; ++oh) {
+    const Dtype* out_row = out_diff + oh * args.out_w;
+    for (int kh = 0; kh < args.kernel_h; ++kh) {
+      const int ih = oh * args.stride_h + kh * args.dilation_h - args.pad_h;
+      if (ih < 0 || ih >= args.height) {
+        continue;
+      }
+      const Dtype* in_row = in + ih * args.width;
+      for (int kw = 0; kw < args.kernel_w; ++kw) {
+        const int offset = kw * args.dilation_w - args.pad_w;
+        int begin, end;
+        valid_columns(args.out_w, args.width, args.stride_w, offset, &begin,
+            &end);
+        Dtype sum = 0;
+        for (int ow = begin; ow < end; ++ow) {
+          sum += out_row[ow] * in_row[ow * args.stride_w + offset];
+        }
+        weight_diff[kh * args.kernel_w + kw] += sum;
+      }
+    }
+  }
+}
+
+// The per-item bodies of caffe_parallel_for: a plane is one channel of one
+// sample, indexed n * channels + c.
+template <typename Dtype>
+void forward_item(const DepthwiseArgs<Dtype>& args, const int plane,
+    const int worker) {
+  const int n = plane / args.channels;
+  const int c = plane % args.channels;
+  forward_plane(args, args.data_im + plane * args.height * args.width,
+      args.weight + n * args.weight_stride + c * args.kernel_h * args.kernel_w,
+      args.output + plane * args.out_h * args.out_w);
+}
+
+template <typename Dtype>
+void backward_item(const DepthwiseArgs<Dtype>& args, const int plane,
+    const int worker) {
+  const int n = plane / args.channels;
+  const int c = plane % args.channels;
+  backward_plane(args, args.out_diff + plane * args.out_h * args.out_w,
+      args.weight + n * args.weight_stride + c * args.kernel_h * args.kernel_w,
+      args.output + plane * args.height * args.width);
+}
+
+// With per-sample filters the items are planes; with shared filters they are
+// channels, each summing its gradient over the batch, so that no two workers
+// write the same filter.
+template <typename Dtype>
+void weight_item(const DepthwiseArgs<Dtype>& args, const int num,
+    const int item, const int worker) {
+  const int kernel_dim = args.kernel_h * args.kernel_w;
+  const int last = args.weight_stride ? item + 1 : num * args.channels;
+  const int step = args.weight_stride ? 1 : args.channels;
+  for (int plane = item; plane < last; plane += step) {
+    const int n = plane / args.channels;
+    const int c = plane % args.channels;
+    weight_plane(args, args.data_im + plane * args.height * args.width,
+        args.out_diff + plane * args.out_h * args.out_w,
+        args.output + n * args.weight_stride + c * kernel_dim);
+  }
+}
+
+}  // namespace
+
+template <typename Dtype>
+void depthwise_conv_cpu(const Dtype* data_im, const int num,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const Dtype* weight, const int weight_stride,
+    Dtype* data_out, const int num_workers) {
+  DepthwiseArgs<Dtype> args = MakeArgs<Dtype>(channels, height, width,
+      kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w, dilation_h,
+      dilation_w, weight_stride);
+  args.data_im = data_im;
+  args.weight = weight;
+  args.output = data_out;
+  caffe_parallel_for(num * channels, num_workers,
+      boost::bind(&forward_item<Dtype>, boost::cref(args), _1, _2));
+}
+
+template <typename Dtype>
+void depthwise_conv_backward_cpu(const Dtype* out_diff, const int num,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const Dtype* weight, const int weight_stride,
+    Dtype* im_diff, const int num_workers) {
+  DepthwiseArgs<Dtype> args = MakeArgs<Dtype>(channels, height, width,
+      kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w, dilation_h,
+      dilation_w, weight_stride);
+  args.out_diff = out_diff;
+  args.weight = weight;
+  args.output = im_diff;
+  caffe_parallel_for(num * channels, num_workers,
+      boost::bind(&backward_item<Dtype>, boost::cref(args), _1, _2));
+}
+
+template <typename Dtype>
+void depthwise_conv_weight_cpu(const Dtype* data_im, const Dtype* out_diff,
+    const int num, const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, Dtype* weight_diff, const int weight_stride,
+    const int num_workers) {
+  DepthwiseArgs<Dtype> args = MakeArgs<Dtype>(channels, height, width,
+      kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w, dilation_h,
+      dilation_w, weight_stride);
+  args.data_im = data_im;
+  args.out_diff = out_diff;
+  args.output = weight_diff;
+  caffe_parallel_for(weight_stride ? num * channels : channels, num_workers,
+      boost::bind(&weight_item<Dtype>, boost::cref(args), num, _1, _2));
+}
+
+// Explicit instantiation
+template void depthwise_conv_cpu<float>(const float* data_im, const int num,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const float* weight, const int weight_stride,
+    float* data_out, const int num_workers);
+template void depthwise_conv_cpu<double>(const double* data_im,
+    const int num, const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const double* weight, const int weight_stride,
+    double* data_out, const int num_workers);
+template void depthwise_conv_backward_cpu<float>(const float* out_diff,
+    const int num, const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const float* weight, const int weight_stride,
+    float* im_diff, const int num_workers);
+template void depthwise_conv_backward_cpu<double>(const double* out_diff,
+    const int num, const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const double* weight, const int weight_stride,
+    double* im_diff, const int num_workers);
+template void depthwise_conv_weight_cpu<float>(const float* data_im,
+    const float* out_diff, const int num, const int channels,
+    const int height, const int width, const int kernel_h,
+    const int kernel_w, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    float* weight_diff, const int weight_stride, const int num_workers);
+template void depthwise_conv_weight_cpu<double>(const double* data_im,
+    const double* out_diff, const int num, const int channels,
+    const int height, const int width, const int kernel_h,
+    const int kernel_w, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    double* weight_diff, const int weight_stride, const int num_workers);
+
+}  // namespace caffe
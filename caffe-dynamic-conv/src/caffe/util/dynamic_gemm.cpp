@@ -0,0 +1,74 @@
+#include <algorithm>
+
+#include "caffe/util/combine_filter.hpp"
+#include "caffe/util/dynamic_gemm.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void caffe_cpu_gemm_combined(const CBLAS_TRANSPOSE TransA, const int M,
+    const int N, const int K, const ConvolutionParameter_WeightOp op,
+    const Dtype* W, const Dtype* F, const Dtype* B, Dtype* C, Dtype* tile,
+    const int tile_count) {
+  // Work through blocks of whole rows of the stored operand. Without
+  // transposition those are rows of C; with it they are a slice of the
+  // inner dimension, accumulated into C.
+  const int rows = (TransA == CblasNoTrans) ? M : K;
+  const int row_len = (TransA == CblasNoTrans) ? K : M;
+  CHECK_GE(tile_count, row_len);
+  const int block = tile_count / row_len;
+  for (int r = 0; r < rows; r += block) {
+    const int num_rows = std::min(block, rows - r);
+    const int offset = r * row_len;
+    const Dtype* combined = caffe_combine_filter(op, num_rows * row_len,
+        W + offset, F + offset, tile);
+    if (TransA == CblasNoTrans) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_rows, N, K,
+          (Dtype)1., combined, B, (Dtype)0., C + r * N);
+    } else {
+      caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, M, N, num_rows,
+          (Dtype)1., combined, B + r * N, (Dtype)(r > 0), C);
+    }
+  }
+}
+
+template void caffe_cpu_gemm_combined<float>(const CBLAS_TRANSPOSE TransA,
+    const int M, const int N, const int K,
+    const ConvolutionParameter_WeightOp op, const float* W, const float* F,
+    const float* B, float* C, float* tile, const int tile_count);
+template void caffe_cpu_gemm_combined<double>(const CBLAS_TRANSPOSE TransA,
+    const int M, const int N, const int K,
+    const ConvolutionParameter_WeightOp op, const double* W, const double* F,
+    const double* B, double* C, double* tile, const int tile_count);
+
+template <typename Dtype>
+void caffe_cpu_gemm_combined_diff(const int M, const int N, const int K,
+    const ConvolutionParameter_WeightOp op, const Dtype* A, const Dtype* B,
+    const Dtype* W, const Dtype* F, Dtype* weight_diff, Dtype* filter_diff,
+    const bool accumulate_filter_diff, Dtype* tile, const int tile_count) {
+  CHECK_GE(tile_count, N);
+  const int block = tile_count / N;
+  for (int r = 0; r < M; r += block) {
+    const int num_rows = std::min(block, M - r);
+    const int offset = r * N;
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, num_rows, N, K,
+        (Dtype)1., A + r * K, B, (Dtype)0., tile);
+    caffe_combine_filter_backward(op, num_rows * N, W + offset, F + offset,
+        tile, weight_diff ? weight_diff + offset : NULL,
+        filter_diff ? filter_diff + offset : NULL, accumulate_filter_diff);
+  }
+}
+
+template void caffe_cpu_gemm_combined_diff<float>(const int M, const int N,
+    const int K, const ConvolutionParameter_WeightOp op, const float* A,
+    const float* B, const float* W, const float* F, float* weight_diff,
+    float* filter_diff, const bool accumulate_filter_diff, float* tile,
+    const int tile_count);
+template void caffe_cpu_gemm_combined_diff<double>(const int M, const int N,
+    const int K, const ConvolutionParameter_WeightOp op, const double* A,
+    const double* B, const double* W, const double* F, double* weight_diff,
+    double* filter_diff, const bool accumulate_filter_diff, double* tile,
+    const int tile_count);
+
+}  // namespace caffe
@@ -0,0 +1,141 @@
+#include "caffe/common.hpp"
+#include "caffe/util/dynamic_gemm.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+#define COMBINED_TILE 16
+
+// C = (W (*|+) F) * B with one COMBINED_TILE x COMBINED_TILE block of C per
+// thread block; W and F are combined as the A tile is staged in shared
+// memory.
+template <typename Dtype>
+__global__ void gemm_combined_kernel(const bool trans_a, const int M,
+    const int N, const int K, const bool mul, const Dtype* W, const Dtype* F,
+    const Dtype* B, Dtype* C) {
+  __shared__ Dtype a_tile[COMBINED_TILE][COMBINED_TILE + 1];
+  __shared__ Dtype b_tile[COMBINED_TILE][COMBINED_TILE + 1];
+  const int row = blockIdx.y * COMBINED_TILE + threadIdx.y;
+  const int col = blockIdx.x * COMBINED_TILE + threadIdx.x;
+  Dtype sum = 0;
+  for (int k0 = 0; k0 < K; k0 += COMBINED_TILE) {
+    const int a_k = k0 + threadIdx.x;
+    if (row < M && a_k < K) {
+      const int index = trans_a ? a_k * M + row : row * K + a_k;
+      a_tile[threadIdx.y][threadIdx.x] =
+          mul ? W[index] * F[index] : W[index] + F[index];
+    } else {
+      a_tile[threadIdx.y][threadIdx.x] = 0;
+    }
+    const int b_k = k0 + threadIdx.y;
+    b_tile[threadIdx.y][threadIdx.x] =
+        (b_k < K && col < N) ? B[b_k * N + col] : Dtype(0);
+    __syncthreads();
+    for (int k = 0; k < COMBINED_TILE; ++k) {
+      sum += a_tile[threadIdx.y][k] * b_tile[k][threadIdx.x];
+    }
+    __syncthreads();
+  }
+  if (row < M && col < N) {
+    C[row * N + col] = sum;
+  }
+}
+
+// G = A * B^T, consumed in place as the gradient of the combined filter.
+template <typename Dtype>
+__global__ void gemm_combined_diff_kernel(const int M, const int N,
+    const int K, const bool mul, const Dtype* A, const Dtype* B,
+    const Dtype* W, const Dtype* F, Dtype* weight_diff, Dtype* filter_diff,
+    const bool accumulate_filter_diff) {
+  __shared__ Dtype a_tile[COMBINED_TILE][COMBINED_TILE + 1];
+  __shared__ Dtype b_tile[COMBINED_TILE][COMBINED_TILE + 1];
+  const int row = blockIdx.y * COMBINED_TILE + threadIdx.y;
+  const int col = blockIdx.x * COMBINED_TILE + threadIdx.x;
+  // B is read transposed: b_tile[k][j] = B[(block column j) * K + k].
+  const int b_row = blockIdx.x * COMBINED_TILE + threadIdx.y;
+  Dtype sum = 0;
+  for (int k0 = 0; k0 < K; k0 += COMBINED_TILE) {
+    const int k = k0 + threadIdx.x;
+    a_tile[threadIdx.y][threadIdx.x] =
+        (row < M && k < K) ? A[row * K + k] : Dtype(0);
+    b_tile[threadIdx.x][threadIdx.y] =
+        (b_row < N && k < K) ? B[b_row * K + k] : Dtype(0);
+    __syncthreads();
+    for (int kk = 0; kk < COMBINED_TILE; ++kk) {
+      sum += a_tile[threadIdx.y][kk] * b_tile[kk][threadIdx.x];
+    }
+    __syncthreads();
+  }
+  if (row < M && col < N) {
+    const int index = row * N + col;
+    if (weight_diff) {
+      weight_diff[index] += mul ? sum * F[index] : sum;
+    }
+    if (filter_diff) {
+      const Dtype diff = mul ? sum * W[index] : sum;
+      filter_diff[index] = accumulate_filter_diff ?
+          filter_diff[index] + diff : diff;
+    }
+  }
+}
+
+template <typename Dtype>
+void caffe_gpu_gemm_combined(const CBLAS_TRANSPOSE TransA, const int M,
+    const int N, const int K, const ConvolutionParameter_WeightOp op,
+    const Dtype* W, const Dtype* F, const Dtype* B, Dtype* C) {
+  if (op == ConvolutionParameter_WeightOp_COPY) {
+    caffe_gpu_gemm<Dtype>(TransA, CblasNoTrans, M, N, K, (Dtype)1., F, B,
+        (Dtype)0., C);
+    return;
+  }
+  const dim3 block(COMBINED_TILE, COMBINED_TILE);
+  const dim3 grid((N + COMBINED_TILE - 1) / COMBINED_TILE,
+      (M + COMBINED_TILE - 1) / COMBINED_TILE);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  gemm_combined_kernel<Dtype><<<grid, block>>>(TransA != CblasNoTrans,
+      M, N, K, op == ConvolutionParameter_WeightOp_MUL, W, F, B, C);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template void caffe_gpu_gemm_combined<float>(const CBLAS_TRANSPOSE TransA,
+    const int M, const int N, const int K,
+    const ConvolutionParameter_WeightOp op, const float* W, const float* F,
+    const float* B, float* C);
+template void caffe_gpu_gemm_combined<double>(const CBLAS_TRANSPOSE TransA,
+    const int M, const int N, const int K,
+    const ConvolutionParameter_WeightOp op, const double* W, const double* F,
+    const double* B, double* C);
+
+template <typename Dtype>
+void caffe_gpu_gemm_combined_diff(const int M, const int N, const int K,
+    const ConvolutionParameter_WeightOp op, const Dtype* A, const Dtype* B,
+    const Dtype* W, const Dtype* F, Dtype* weight_diff, Dtype* filter_diff,
+    const bool accumulate_filter_diff) {
+  // COPY ignores the static weights.
+  if (op == ConvolutionParameter_WeightOp_COPY) {
+    if (filter_diff) {
+      caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M, N, K, (Dtype)1., A,
+          B, (Dtype)accumulate_filter_diff, filter_diff);
+    }
+    return;
+  }
+  const dim3 block(COMBINED_TILE, COMBINED_TILE);
+  const dim3 grid((N + COMBINED_TILE - 1) / COMBINED_TILE,
+      (M + COMBINED_TILE - 1) / COMBINED_TILE);
+  // NOLINT_NEXT_LINE(whitespace/operators)
+  gemm_combined_diff_kernel<Dtype><<<grid, block>>>(M, N, K,
+      op == ConvolutionParameter_WeightOp_MUL, A, B, W, F, weight_diff,
+      filter_diff, accumulate_filter_diff);
+  CUDA_POST_KERNEL_CHECK;
+}
+
+template void caffe_gpu_gemm_combined_diff<float>(const int M, const int N,
+    const int K, const ConvolutionParameter_WeightOp op, const float* A,
+    const float* B, const float* W, const float* F, float* weight_diff,
+    float* filter_diff, const bool accumulate_filter_diff);
+template void caffe_gpu_gemm_combined_diff<double>(const int M, const int N,
+    const int K, const ConvolutionParameter_WeightOp op, const double* A,
+    const double* B, const double* W, const double* F, double* weight_diff,
+    double* filter_diff, const bool accumulate_filter_diff);
+
+}  // namespace caffe
@@ -0,0 +1,343 @@
+#include <cmath>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/fold_batch_norm.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+namespace {
+
+// A Convolution or InnerProduct layer and the normalization layers folded
+// into it, as indices into the layers of the unfolded net.
+struct BatchNormFold {
+  int layer;
+  // The BatchNorm, BN and Scale layers after it, in order.
+  vector<int> affine;
+  // The InnerProduct layer generating the filters of a dynamic convolution
+  // that takes the scale, or -1.
+  int generator;
+  // Whether the layer's own weights take the scale.
+  bool fold_weights;
+};
+
+bool IsAffine(const LayerParameter& layer) {
+  if (layer.bottom_size() != 1 || layer.top_size() != 1) {
+    return false;
+  }
+  if (layer.type() == "BatchNorm") {
+    // Batch statistics are no affine map.
+    return !layer.batch_norm_param().has_use_global_stats() ||
+        layer.batch_norm_param().use_global_stats();
+  }
+  return layer.type() == "BN" || layer.type() == "Scale";
+}
+
+// Whether a layer shares its weights with another one.
+bool SharesWeights(const LayerParameter& layer,
+    const map<string, int>& param_users) {
+  for (int j = 0; j < layer.param_size(); ++j) {
+    const string& name = layer.param(j).name();
+    if (!name.empty() && param_users.find(name)->second > 1) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int NumOutput(const LayerParameter& layer) {
+  return layer.type() == "Convolution" ?
+      layer.convolution_param().num_output() :
+      layer.inner_product_param().num_output();
+}
+
+vector<BatchNormFold> FindBatchNormFolds(const NetParameter& param) {
+  map<string, int> readers;
+  map<string, int> param_users;
+  map<string, int> producer;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer = param.layer(i);
+    for (int j = 0; j < layer.bottom_size(); ++j) {
+      ++readers[layer.bottom(j)];
+    }
+    for (int j = 0; j < layer.param_size(); ++j) {
+      if (!layer.param(j).name().empty()) {
+        ++param_users[layer.param(j).name()];
+      }
+    }
+    for (int j = 0; j < layer.top_size(); ++j) {
+      if (!producer.count(layer.top(j))) {
+        producer[layer.top(j)] = i;
+      }
+    }
+  }
+  vector<BatchNormFold> folds;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer = param.layer(i);
+    if ((layer.type() != "Convolution" && layer.type() != "InnerProduct") ||
+        layer.top_size() != 1 || SharesWeights(layer, param_users)) {
+      continue;
+    }
+    BatchNormFold fold;
+    fold.layer = i;
+    fold.generator = -1;
+    fold.fold_weights = true;
+    // The chain of normalization layers that are the first to read the
+    // output in turn. An output they do not compute in place must have no
+    // other reader.
+    string current = layer.top(0);
+    for (int j = i + 1; j < param.layer_size(); ++j) {
+      const LayerParameter& next = param.layer(j);
+      bool reads = false;
+      for (int k = 0; k < next.bottom_size(); ++k) {
+        reads = reads || next.bottom(k) == current;
+      }
+      if (!reads) {
+        continue;
+      }
+      if (!IsAffine(next) ||
+          (next.top(0) != current && readers[current] != 1)) {
+        break;
+      }
+      fold.affine.push_back(j);
+      current = next.top(0);
+    }
+    if (fold.affine.empty()) {
+      continue;
+    }
+    const int num_filter_bottoms = layer.bottom_size() - layer.top_size();
+    if (layer.type() == "InnerProduct" && num_filter_bottoms != 0) {
+      continue;
+    }
+    if (num_filter_bottoms == 2) {
+      LOG(INFO) << "Not folding into " << layer.name()
+          << ": its filters are factorized.";
+      continue;
+    }
+    if (num_filter_bottoms == 1) {
+      const ConvolutionParameter::WeightOp op =
+          layer.convolution_param().weight_operation();
+      fold.fold_weights = op != ConvolutionParameter_WeightOp_COPY;
+      if (op != ConvolutionParameter_WeightOp_MUL) {
+        // Scaling the filters scales the output channels they compute, so
+        // the generator's rows for channel c take its scale.
+        const string& filters = layer.bottom(1);
+        const map<string, int>::const_iterator it = producer.find(filters);
+        const LayerParameter* generator =
+            it == producer.end() ? NULL : &param.layer(it->second);
+        if (!generator || generator->type() != "InnerProduct" ||
+            generator->top_size() != 1 || readers[filters] != 1 ||
+            SharesWeights(*generator, param_users)) {
+          LOG(INFO) << "Not folding into " << layer.name()
+              << ": its filters do not come from an InnerProduct layer of "
+              << "their own.";
+          continue;
+        }
+        CHECK_EQ(NumOutput(*generator) % NumOutput(layer), 0)
+            << generator->name() << " does not generate " << layer.name()
+            << "'s filters.";
+        fold.generator = it->second;
+      }
+    }
+    folds.push_back(fold);
+  }
+  return folds;
+}
+
+// The scale and shift of the per-channel map y = scale * x + shift a
+// normalization layer applies to the output of a layer.
+template <typename Dtype>
+void ChannelAffine(const LayerParameter& layer,
+    const LayerParameter& trained, const int channels, vector<double>* scale,
+    vector<double>* shift) {
+  vector<shared_ptr<Blob<Dtype> > > blobs(trained.blobs_size());
+  for (int i = 0; i < blobs.size(); ++i) {
+    blobs[i].reset(new Blob<Dtype>());
+    blobs[i]->FromProto(trained.blobs(i));
+  }
+  scale->assign(channels, 1);
+  shift->assign(channels, 0);
+  if (layer.type() == "BatchNorm") {
+    CHECK_EQ(blobs.size(), 3) << layer.name();
+    CHECK_EQ(blobs[0]->count(), channels) << layer.name();
+    const Dtype factor = blobs[2]->cpu_data()[0];
+    const double scale_factor = factor == 0 ? 0 : 1. / factor;
+    for (int c = 0; c < channels; ++c) {
+      const double mean = blobs[0]->cpu_data()[c] * scale_factor;
+      const double variance = blobs[1]->cpu_data()[c] * scale_factor;
+      (*scale)[c] = 1 / std::sqrt(variance + layer.batch_norm_param().eps());
+      (*shift)[c] = -mean * (*scale)[c];
+    }
+  } else if (layer.type() == "BN") {
+    // slope, bias, moving mean and moving variance
+    CHECK_EQ(blobs.size(), 4) << layer.name();
+    CHECK_EQ(blobs[0]->count(), channels) << layer.name();
+    for (int c = 0; c < channels; ++c) {
+      const double inv_std = 1 / std::sqrt(blobs[3]->cpu_data()[c]
+          + layer.bn_param().eps());
+      (*scale)[c] = blobs[0]->cpu_data()[c] * inv_std;
+      (*shift)[c] = blobs[1]->cpu_data()[c]
+          - blobs[2]->cpu_data()[c] * (*scale)[c];
+    }
+  } else {
+    CHECK_EQ(layer.type(), "Scale");
+    CHECK_EQ(blobs[0]->count(), channels) << layer.name()
+        << " must scale each channel.";
+    for (int c = 0; c < channels; ++c) {
+      (*scale)[c] = blobs[0]->cpu_data()[c];
+      (*shift)[c] = blobs.size() > 1 ? blobs[1]->cpu_data()[c] : 0;
+    }
+  }
+}
+
+// Multiplies output u of the weights or bias of a layer with num_output
+// outputs by scale[u / (num_output / scale.size())].
+template <typename Dtype>
+void ScaleOutputs(const vector<double>& scale, const int num_output,
+    const bool transposed, BlobProto* proto) {
+  Blob<Dtype> blob;
+  blob.FromProto(*proto);
+  const int per_channel = num_output / scale.size();
+  const int inputs = blob.count() / num_output;
+  CHECK_EQ(inputs * num_output, blob.count());
+  Dtype* data = blob.mutable_cpu_data();
+  for (int i = 0; i < blob.count(); ++i) {
+    const int u = transposed ? i % num_output : i / inputs;
+    data[i] *= scale[u / per_channel];
+  }
+  blob.ToProto(proto);
+}
+
+}  // namespace
+
+void FoldBatchNormLayers(const NetParameter& param,
+    NetParameter* param_folded) {
+  const vector<BatchNormFold> folds = FindBatchNormFolds(param);
+  map<int, int> fold_of_layer;
+  set<int> folded;
+  for (int k = 0; k < folds.size(); ++k) {
+    fold_of_layer[folds[k].layer] = k;
+    folded.insert(folds[k].affine.begin(), folds[k].affine.end());
+  }
+  param_folded->CopyFrom(param);
+  param_folded->clear_layer();
+  for (int i = 0; i < param.layer_size(); ++i) {
+    if (folded.count(i)) {
+      continue;
+    }
+    LayerParameter* layer = param_folded->add_layer();
+    layer->CopyFrom(param.layer(i));
+    if (!fold_of_layer.count(i)) {
+      continue;
+    }
+    const BatchNormFold& fold = folds[fold_of_layer[i]];
+    layer->set_top(0, param.layer(fold.affine.back()).top(0));
+    if (layer->type() == "Convolution") {
+      layer->mutable_convolution_param()->set_bias_term(true);
+    } else {
+      layer->mutable_inner_product_param()->set_bias_term(true);
+    }
+    for (int j = 0; j < fold.affine.size(); ++j) {
+      LOG(INFO) << "Folding " << param.layer(fold.affine[j]).name()
+          << " into " << layer->name();
+    }
+  }
+}
+
+template <typename Dtype>
+void FoldBatchNormWeights(const NetParameter& param,
+    const NetParameter& weights, NetParameter* weights_folded) {
+  const vector<BatchNormFold> folds = FindBatchNormFolds(param);
+  map<string, int> trained;
+  for (int i = 0; i < weights.layer_size(); ++i) {
+    trained[weights.layer(i).name()] = i;
+  }
+  NetParameter scaled(weights);
+  set<string> folded;
+  for (int k = 0; k < folds.size(); ++k) {
+    const BatchNormFold& fold = folds[k];
+    const LayerParameter& layer = param.layer(fold.layer);
+    int num_trained = 0;
+    for (int j = 0; j < fold.affine.size(); ++j) {
+      num_trained += trained.count(param.layer(fold.affine[j]).name());
+    }
+    if (num_trained == 0) {
+      continue;
+    }
+    CHECK_EQ(num_trained, fold.affine.size()) << "The weights only hold "
+        << "some of the normalization layers after " << layer.name();
+    CHECK(trained.count(layer.name())) << "No weights for " << layer.name();
+    const int channels = NumOutput(layer);
+    // Compose the maps of the chain in order.
+    vector<double> scale(channels, 1);
+    vector<double> shift(channels, 0);
+    for (int j = 0; j < fold.affine.size(); ++j) {
+      const LayerParameter& affine = param.layer(fold.affine[j]);
+      vector<double> affine_scale, affine_shift;
+      ChannelAffine<Dtype>(affine, weights.layer(trained[affine.name()]),
+          channels, &affine_scale, &affine_shift);
+      for (int c = 0; c < channels; ++c) {
+        scale[c] *= affine_scale[c];
+        shift[c] = affine_scale[c] * shift[c] + affine_shift[c];
+      }
+      folded.insert(affine.name());
+    }
+
+    LayerParameter* target = scaled.mutable_layer(trained[layer.name()]);
+    const bool transposed = layer.type() == "InnerProduct" &&
+        layer.inner_product_param().transpose();
+    if (fold.fold_weights) {
+      ScaleOutputs<Dtype>(scale, channels, transposed,
+          target->mutable_blobs(0));
+    }
+    // bias = scale * bias + shift
+    Blob<Dtype> bias(vector<int>(1, channels));
+    if (target->blobs_size() > 1) {
+      bias.FromProto(target->blobs(1));
+      CHECK_EQ(bias.count(), channels) << layer.name();
+    } else {
+      caffe_set(channels, Dtype(0), bias.mutable_cpu_data());
+      target->add_blobs();
+    }
+    Dtype* bias_data = bias.mutable_cpu_data();
+    for (int c = 0; c < channels; ++c) {
+      bias_data[c] = scale[c] * bias_data[c] + shift[c];
+    }
+    bias.ToProto(target->mutable_blobs(1));
+
+    if (fold.generator >= 0) {
+      const LayerParameter& generator = param.layer(fold.generator);
+      CHECK(trained.count(generator.name()))
+          << "No weights for " << generator.name();
+      LayerParameter* generator_target =
+          scaled.mutable_layer(trained[generator.name()]);
+      const int num_output = NumOutput(generator);
+      ScaleOutputs<Dtype>(scale, num_output,
+          generator.inner_product_param().transpose(),
+          generator_target->mutable_blobs(0));
+      if (generator_target->blobs_size() > 1) {
+        ScaleOutputs<Dtype>(scale, num_output, false,
+            generator_target->mutable_blobs(1));
+      }
+    }
+  }
+  weights_folded->CopyFrom(scaled);
+  weights_folded->clear_layer();
+  for (int i = 0; i < scaled.layer_size(); ++i) {
+    if (!folded.count(scaled.layer(i).name())) {
+      weights_folded->add_layer()->CopyFrom(scaled.layer(i));
+    }
+  }
+}
+
+template void FoldBatchNormWeights<float>(const NetParameter& param,
+    const NetParameter& weights, NetParameter* weights_folded);
+template void FoldBatchNormWeights<double>(const NetParameter& param,
+    const NetParameter& weights, NetParameter* weights_folded);
+
+}  // namespace caffe
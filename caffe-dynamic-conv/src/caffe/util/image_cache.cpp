@@ -0,0 +1,109 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "caffe/util/image_cache.hpp"
+
+namespace caffe {
+
+static const char kImageCacheMagic[8] = {'C', 'A', 'F', 'F', 'E', 'I', 'M',
+    'C'};
+static const uint32_t kImageCacheVersion = 1;
+// The data section starts on a page; every image on a cache line.
+static const uint64_t kDataAlignment = 4096;
+static const uint64_t kItemAlignment = 64;
+
+static uint64_t align_up(const uint64_t n, const uint64_t alignment) {
+  return (n + alignment - 1) / alignment * alignment;
+}
+
+ImageCacheWriter::ImageCacheWriter(const string& filename, int channels,
+    int height, int width, int num_attributes) {
+  CHECK_GT(channels, 0);
+  CHECK_GT(height, 0);
+  CHECK_GT(width, 0);
+  CHECK_GE(num_attributes, 0);
+  file_ = fopen(filename.c_str(), "wb");
+  CHECK(file_) << "Failed to open " << filename;
+  memset(&header_, 0, sizeof(header_));
+  memcpy(header_.magic, kImageCacheMagic, sizeof(header_.magic));
+  header_.version = kImageCacheVersion;
+  header_.channels = channels;
+  header_.height = height;
+  header_.width = width;
+  header_.num_attributes = num_attributes;
+  header_.item_stride =
+      align_up(static_cast<uint64_t>(channels) * height * width,
+          kItemAlignment);
+  header_.data_offset = align_up(sizeof(header_), kDataAlignment);
+  CHECK_EQ(fseek(file_, header_.data_offset, SEEK_SET), 0);
+}
+
+ImageCacheWriter::~ImageCacheWriter() {
+  if (file_) {
+    Close();
+  }
+}
+
+void ImageCacheWriter::Add(const uint8_t* image, float label,
+    const float* attributes) {
+  CHECK(file_) << "The image cache is closed.";
+  const size_t image_size =
+      header_.channels * header_.height * header_.width;
+  CHECK_EQ(fwrite(image, 1, image_size, file_), image_size);
+  const vector<char> padding(header_.item_stride - image_size, 0);
+  if (padding.size()) {
+    CHECK_EQ(fwrite(&padding[0], 1, padding.size(), file_), padding.size());
+  }
+  index_.push_back(label);
+  index_.insert(index_.end(), attributes,
+      attributes + header_.num_attributes);
+  ++header_.num;
+}
+
+void ImageCacheWriter::Close() {
+  CHECK(file_) << "The image cache is closed.";
+  header_.index_offset = header_.data_offset +
+      header_.num * header_.item_stride;
+  if (index_.size()) {
+    CHECK_EQ(fwrite(&index_[0], sizeof(float), index_.size(), file_),
+        index_.size());
+  }
+  CHECK_EQ(fseek(file_, 0, SEEK_SET), 0);
+  CHECK_EQ(fwrite(&header_, sizeof(header_), 1, file_), 1);
+  CHECK_EQ(fclose(file_), 0);
+  file_ = NULL;
+}
+
+ImageCache::ImageCache(const string& filename) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Failed to open " << filename;
+  struct stat file_stat;
+  CHECK_EQ(fstat(fd, &file_stat), 0) << "Failed to stat " << filename;
+  size_ = file_stat.st_size;
+  CHECK_GE(size_, sizeof(ImageCacheHeader)) << filename
+      << " is not an image cache.";
+  void* data = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(data != MAP_FAILED) << "Failed to map " << filename;
+  data_ = static_cast<const uint8_t*>(data);
+  header_ = reinterpret_cast<const ImageCacheHeader*>(data_);
+  CHECK_EQ(memcmp(header_->magic, kImageCacheMagic, sizeof(header_->magic)),
+      0) << filename << " is not an image cache.";
+  CHECK_EQ(header_->version, kImageCacheVersion) << "Unsupported version of "
+      << filename;
+  CHECK_EQ(header_->index_offset + sizeof(float) * header_->num *
+      (header_->num_attributes + 1), size_) << filename << " is truncated.";
+  index_ = reinterpret_cast<const float*>(data_ + header_->index_offset);
+}
+
+ImageCache::~ImageCache() {
+  munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+}  // namespace caffe
@@ -8,7 +8,12 @@
 #include <opencv2/highgui/highgui_c.h>
 #include <opencv2/imgproc/imgproc.hpp>
 #endif  // USE_OPENCV
+#ifdef USE_LIBJPEG
+#include <jpeglib.h>
+#include <setjmp.h>
+#endif  // USE_LIBJPEG
 #include <stdint.h>
+#include <stdio.h>
 
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
@@ -103,6 +108,103 @@ cv::Mat ReadImageToCVMat(const string& filename) {
   return ReadImageToCVMat(filename, 0, 0, true);
 }
 
+#ifdef USE_LIBJPEG
+// libjpeg reports fatal errors through error_exit, which must not return.
+struct JPEGErrorManager {
+  jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+};
+
+static void JPEGErrorExit(j_common_ptr cinfo) {
+  JPEGErrorManager* err = reinterpret_cast<JPEGErrorManager*>(cinfo->err);
+  longjmp(err->setjmp_buffer, 1);
+}
+
+// Decodes the JPEG in file into *cv_img, at the smallest scale M/8 that is at
+// least height x width if both are given. Everything that changes after the
+// setjmp lives outside this frame.
+static bool DecodeJPEGScaled(FILE* file, const int height, const int width,
+    const bool is_color, jpeg_decompress_struct* cinfo, cv::Mat* cv_img) {
+  JPEGErrorManager err;
+  cinfo->err = jpeg_std_error(&err.pub);
+  err.pub.error_exit = JPEGErrorExit;
+  if (setjmp(err.setjmp_buffer)) {
+    jpeg_destroy_decompress(cinfo);
+    return false;
+  }
+  jpeg_create_decompress(cinfo);
+  jpeg_stdio_src(cinfo, file);
+  jpeg_read_header(cinfo, TRUE);
+#ifdef JCS_EXTENSIONS
+  // libjpeg-turbo writes OpenCV's channel order itself.
+  cinfo->out_color_space = is_color ? JCS_EXT_BGR : JCS_GRAYSCALE;
+#else
+  cinfo->out_color_space = is_color ? JCS_RGB : JCS_GRAYSCALE;
+#endif
+  if (height > 0 && width > 0) {
+    // Libraries without a given M/8 round it up to the next one they have.
+    cinfo->scale_denom = 8;
+    for (cinfo->scale_num = 1; cinfo->scale_num < 8; ++cinfo->scale_num) {
+      jpeg_calc_output_dimensions(cinfo);
+      if (cinfo->output_height >= static_cast<JDIMENSION>(height) &&
+          cinfo->output_width >= static_cast<JDIMENSION>(width)) {
+        break;
+      }
+    }
+  }
+  jpeg_start_decompress(cinfo);
+  cv_img->create(cinfo->output_height, cinfo->output_width,
+      is_color ? CV_8UC3 : CV_8UC1);
+  while (cinfo->output_scanline < cinfo->output_height) {
+    JSAMPROW row = cv_img->ptr<uchar>(cinfo->output_scanline);
+    jpeg_read_scanlines(cinfo, &row, 1);
+#ifndef JCS_EXTENSIONS
+    if (is_color) {
+      for (int w = 0; w < cv_img->cols; ++w) {
+        std::swap(row[3 * w], row[3 * w + 2]);
+      }
+    }
+#endif
+  }
+  jpeg_finish_decompress(cinfo);
+  jpeg_destroy_decompress(cinfo);
+  return true;
+}
+#endif  // USE_LIBJPEG
+
+cv::Mat ReadImageToCVMatScaled(const string& filename,
+    const int height, const int width, const bool is_color) {
+#ifdef USE_LIBJPEG
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (!file) {
+    LOG(ERROR) << "Could not open or find file " << filename;
+    return cv::Mat();
+  }
+  // JPEGs start with an SOI marker.
+  const bool is_jpeg = fgetc(file) == 0xFF && fgetc(file) == 0xD8;
+  rewind(file);
+  cv::Mat cv_img_origin;
+  jpeg_decompress_struct cinfo;
+  const bool decoded = is_jpeg && DecodeJPEGScaled(file, height, width,
+      is_color, &cinfo, &cv_img_origin);
+  fclose(file);
+  if (!decoded) {
+    return ReadImageToCVMat(filename, height, width, is_color);
+  }
+  if (height > 0 && width > 0 &&
+      (cv_img_origin.rows != height || cv_img_origin.cols != width)) {
+    cv::Mat cv_img;
+    cv::resize(cv_img_origin, cv_img, cv::Size(width, height));
+    return cv_img;
+  }
+  return cv_img_origin;
+#else
+  LOG(FATAL) << "Scaled JPEG decoding requires libjpeg; compile with "
+      "USE_LIBJPEG.";
+  return cv::Mat();
+#endif  // USE_LIBJPEG
+}
+
 // Do the file extension and encoding match?
 static bool matchExt(const std::string & fn,
                      std::string en) {
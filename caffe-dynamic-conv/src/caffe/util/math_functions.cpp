@@ -31,6 +31,29 @@ void caffe_cpu_gemm<double>(const CBLAS_TRANSPOSE TransA,
       ldb, beta, C, N);
 }
 
+template <typename Dtype>
+void caffe_cpu_gemm_strided_batched(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const Dtype alpha, const Dtype* A, const int stride_A, const Dtype* B,
+    const int stride_B, const Dtype beta, Dtype* C, const int stride_C,
+    const int batch_count) {
+  for (int i = 0; i < batch_count; ++i) {
+    caffe_cpu_gemm<Dtype>(TransA, TransB, M, N, K, alpha, A + i * stride_A,
+        B + i * stride_B, beta, C + i * stride_C);
+  }
+}
+
+template void caffe_cpu_gemm_strided_batched<float>(
+    const CBLAS_TRANSPOSE TransA, const CBLAS_TRANSPOSE TransB, const int M,
+    const int N, const int K, const float alpha, const float* A,
+    const int stride_A, const float* B, const int stride_B, const float beta,
+    float* C, const int stride_C, const int batch_count);
+template void caffe_cpu_gemm_strided_batched<double>(
+    const CBLAS_TRANSPOSE TransA, const CBLAS_TRANSPOSE TransB, const int M,
+    const int N, const int K, const double alpha, const double* A,
+    const int stride_A, const double* B, const int stride_B, const double beta,
+    double* C, const int stride_C, const int batch_count);
+
 template <>
 void caffe_cpu_gemv<float>(const CBLAS_TRANSPOSE TransA, const int M,
     const int N, const float alpha, const float* A, const float* x,
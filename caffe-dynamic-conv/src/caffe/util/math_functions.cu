@@ -42,6 +42,42 @@ void caffe_gpu_gemm<double>(const CBLAS_TRANSPOSE TransA,
       N, M, K, &alpha, B, ldb, A, lda, &beta, C, N));
 }
 
+template <>
+void caffe_gpu_gemm_strided_batched<float>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const float alpha, const float* A, const int stride_A, const float* B,
+    const int stride_B, const float beta, float* C, const int stride_C,
+    const int batch_count) {
+  // Note that cublas follows fortran order.
+  int lda = (TransA == CblasNoTrans) ? K : M;
+  int ldb = (TransB == CblasNoTrans) ? N : K;
+  cublasOperation_t cuTransA =
+      (TransA == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  cublasOperation_t cuTransB =
+      (TransB == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  CUBLAS_CHECK(cublasSgemmStridedBatched(Caffe::cublas_handle(), cuTransB,
+      cuTransA, N, M, K, &alpha, B, ldb, stride_B, A, lda, stride_A, &beta,
+      C, N, stride_C, batch_count));
+}
+
+template <>
+void caffe_gpu_gemm_strided_batched<double>(const CBLAS_TRANSPOSE TransA,
+    const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
+    const double alpha, const double* A, const int stride_A, const double* B,
+    const int stride_B, const double beta, double* C, const int stride_C,
+    const int batch_count) {
+  // Note that cublas follows fortran order.
+  int lda = (TransA == CblasNoTrans) ? K : M;
+  int ldb = (TransB == CblasNoTrans) ? N : K;
+  cublasOperation_t cuTransA =
+      (TransA == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  cublasOperation_t cuTransB =
+      (TransB == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  CUBLAS_CHECK(cublasDgemmStridedBatched(Caffe::cublas_handle(), cuTransB,
+      cuTransA, N, M, K, &alpha, B, ldb, stride_B, A, lda, stride_A, &beta,
+      C, N, stride_C, batch_count));
+}
+
 template <>
 void caffe_gpu_gemv<float>(const CBLAS_TRANSPOSE TransA, const int M,
     const int N, const float alpha, const float* A, const float* x,
@@ -0,0 +1,144 @@
+#include <stdint.h>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <deque>
+
+#include "caffe/common.hpp"
+#include "caffe/util/parallel_for.hpp"
+
+namespace caffe {
+
+namespace {
+
+// The threads that run the chunks of caffe_parallel_for and
+// caffe_parallel_ranges. They are started on first use, grown to the most
+// workers any call has asked for, and then wait for chunks until the process
+// exits, so a call only pays for waking them.
+class WorkerPool {
+ public:
+  // Never destroyed: its threads may still be waiting at exit.
+  static WorkerPool& Get() {
+    static WorkerPool* pool = new WorkerPool();
+    return *pool;
+  }
+
+  // Calls task(w) for every w in [0, workers), w = 0 on the calling thread,
+  // and returns once all have returned. A call from one of the pool's own
+  // threads runs every chunk there, as its siblings may all be waiting.
+  void Run(const int workers, const boost::function<void(int)>& task) {
+    if (workers == 1 || in_pool_.get()) {
+      for (int w = 0; w < workers; ++w) {
+        task(w);
+      }
+      return;
+    }
+    int pending = workers - 1;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (static_cast<int>(threads_.size()) < workers - 1) {
+        threads_.create_thread(boost::bind(&WorkerPool::Work, this));
+      }
+      for (int w = 1; w < workers; ++w) {
+        Chunk chunk = {&task, w, &pending};
+        chunks_.push_back(chunk);
+      }
+    }
+    chunk_ready_.notify_all();
+    task(0);
+    boost::mutex::scoped_lock lock(mutex_);
+    while (pending) {
+      chunk_done_.wait(lock);
+    }
+  }
+
+ private:
+  struct Chunk {
+    const boost::function<void(int)>* task;
+    int worker;
+    // The chunks of its call still running, guarded by mutex_.
+    int* pending;
+  };
+
+  WorkerPool() {}
+
+  void Work() {
+    in_pool_.reset(new bool(true));
+    for (;;) {
+      Chunk chunk;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        while (chunks_.empty()) {
+          chunk_ready_.wait(lock);
+        }
+        chunk = chunks_.front();
+        chunks_.pop_front();
+      }
+      (*chunk.task)(chunk.worker);
+      boost::mutex::scoped_lock lock(mutex_);
+      if (--*chunk.pending == 0) {
+        chunk_done_.notify_all();
+      }
+    }
+  }
+
+  boost::mutex mutex_;
+  boost::condition_variable chunk_ready_;
+  boost::condition_variable chunk_done_;
+  std::deque<Chunk> chunks_;
+  boost::thread_group threads_;
+  // Set on the pool's threads.
+  boost::thread_specific_ptr<bool> in_pool_;
+
+  DISABLE_COPY_AND_ASSIGN(WorkerPool);
+};
+
+// The start of chunk w when [0, n) is split among workers.
+int chunk_begin(const int n, const int workers, const int w) {
+  return static_cast<int>(static_cast<int64_t>(n) * w / workers);
+}
+
+void run_chunk(const boost::function<void(int, int)>& func, const int n,
+    const int workers, const int worker) {
+  const int end = chunk_begin(n, workers, worker + 1);
+  for (int i = chunk_begin(n, workers, worker); i < end; ++i) {
+    func(i, worker);
+  }
+}
+
+void run_range(const boost::function<void(int, int, int)>& func,
+    const int n, const int workers, const int worker) {
+  func(chunk_begin(n, workers, worker), chunk_begin(n, workers, worker + 1),
+      worker);
+}
+
+}  // namespace
+
+int caffe_parallel_workers(const int n, const int num_workers) {
+  return std::max(1, std::min(n, num_workers));
+}
+
+void caffe_parallel_for(const int n, const int num_workers,
+    const boost::function<void(int, int)>& func) {
+  if (n <= 0) { return; }
+  const int workers = caffe_parallel_workers(n, num_workers);
+  WorkerPool::Get().Run(workers,
+      boost::bind(&run_chunk, boost::cref(func), n, workers, _1));
+}
+
+void caffe_parallel_ranges(const int n, const int grain, const int num_workers,
+    const boost::function<void(int, int, int)>& func) {
+  if (n <= 0) { return; }
+  const int workers = caffe_parallel_workers(n / std::max(1, grain),
+      num_workers);
+  WorkerPool::Get().Run(workers,
+      boost::bind(&run_range, boost::cref(func), n, workers, _1));
+}
+
+int caffe_parallel_grain(const int item_size) {
+  // About the work that amortizes waking a thread.
+  const int kMinWorkerValues = 1 << 15;
+  return std::max(1, kMinWorkerValues / std::max(1, item_size));
+}
+
+}  // namespace caffe
@@ -0,0 +1,375 @@
+// This is a script to bake the filters of dynamic convolutions into static
+// weights for a fixed set of conditions, for deployment. It evaluates the
+// layers computed from the condition input alone (the embedding_fc* and
+// filter_ip* layers of examples/dynamic-conv/alexnet-deploy-dy.prototxt) for
+// every condition, combines the filters with the convolution weights as set
+// by weight_operation, and drops that subgraph from the net. The output is
+// either one static caffemodel per condition for a net of plain
+// convolutions, or with --multi_head a single model in which the
+// convolutions look their filters up by a per-sample integer condition index
+// through Embed layers. On the CPU, such a convolution groups the samples
+// that share a condition and convolves each group with one gemm.
+// Usage:
+//    bake_conditioned_filters [FLAGS] net_proto_in weights_in \
+//        conditions_file out_prefix
+// conditions_file holds one condition per line, as whitespace-separated
+// values. Conditions are keyed on their bytes, so a repeated condition is
+// evaluated once and gets the same filters. The net is written to
+// out_prefix.prototxt, and the weights to out_prefix_<i>.caffemodel for the
+// i-th condition (counting from 0), or to out_prefix.caffemodel with
+// --multi_head.
+
+#include <gflags/gflags.h>
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/combine_filter.hpp"
+#include "caffe/util/format.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using std::map;
+using std::set;
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_string(condition, "extra", "The input blob holding the condition.");
+DEFINE_bool(multi_head, false,
+    "Write a single model that selects the filters of each sample by the "
+    "index of its condition instead of one model per condition.");
+DEFINE_string(index_blob, "condition_index",
+    "With --multi_head, the input blob that replaces the condition and holds "
+    "the index of each sample's condition.");
+
+// The number of bottoms a convolution takes its filters from: one (the
+// filters) or two (coefficients and basis) more than its tops, else 0.
+static int NumFilterBottoms(const LayerParameter& layer) {
+  if (layer.type() != "Convolution") {
+    return 0;
+  }
+  const int extra = layer.bottom_size() - layer.top_size();
+  return (extra == 1 || extra == 2) ? extra : 0;
+}
+
+// Whether all bottoms of a layer (with at least one) are in blobs.
+static bool AllBottomsIn(const vector<string>& bottoms,
+    const set<string>& blobs) {
+  for (int i = 0; i < bottoms.size(); ++i) {
+    if (!blobs.count(bottoms[i])) {
+      return false;
+    }
+  }
+  return !bottoms.empty();
+}
+
+static vector<string> Bottoms(const LayerParameter& layer) {
+  return vector<string>(layer.bottom().begin(), layer.bottom().end());
+}
+
+// Marks the layers computed from the condition alone, adding the blobs they
+// produce to blobs.
+static vector<bool> ConditionedLayers(const NetParameter& net_param,
+    set<string>* blobs) {
+  vector<bool> conditioned(net_param.layer_size(), false);
+  for (int i = 0; i < net_param.layer_size(); ++i) {
+    const LayerParameter& layer = net_param.layer(i);
+    if (AllBottomsIn(Bottoms(layer), *blobs)) {
+      conditioned[i] = true;
+      blobs->insert(layer.top().begin(), layer.top().end());
+    }
+  }
+  return conditioned;
+}
+
+static vector<vector<float> > ReadConditions(const string& filename) {
+  std::ifstream infile(filename.c_str());
+  CHECK(infile.good()) << "Failed to open " << filename;
+  vector<vector<float> > conditions;
+  string line;
+  while (std::getline(infile, line)) {
+    std::istringstream values(line);
+    vector<float> condition;
+    float value;
+    while (values >> value) {
+      condition.push_back(value);
+    }
+    if (!condition.empty()) {
+      conditions.push_back(condition);
+    }
+  }
+  return conditions;
+}
+
+// Combines the filters the conditioned layers produced for conv with its
+// weights into filter.
+static void BakeFilter(const Net<float>& net, const LayerParameter& conv,
+    float* filter) {
+  const Blob<float>& weight =
+      *net.layer_by_name(conv.name())->blobs()[0];
+  const int weight_count = weight.count();
+  const int last = conv.bottom_size() - 1;
+  if (NumFilterBottoms(conv) == 1) {
+    const Blob<float>& filters = *net.blob_by_name(conv.bottom(last));
+    CHECK_EQ(filters.count(), weight_count) << conv.name();
+    caffe_copy(weight_count, filters.cpu_data(), filter);
+  } else {
+    // filter = sum_k coefficient(k) * basis(k)
+    const Blob<float>& coefficients =
+        *net.blob_by_name(conv.bottom(last - 1));
+    const Blob<float>& basis = *net.blob_by_name(conv.bottom(last));
+    CHECK_EQ(basis.count(), coefficients.count() * weight_count)
+        << conv.name();
+    caffe_cpu_gemv<float>(CblasTrans, coefficients.count(), weight_count, 1.,
+        basis.cpu_data(), coefficients.cpu_data(), 0., filter);
+  }
+  caffe_combine_filter(conv.convolution_param().weight_operation(),
+      weight_count, weight.cpu_data(), filter, filter);
+}
+
+// Removes (or, with --multi_head, replaces by the index blob) the condition
+// top of the Input layer that produces it.
+static void ReplaceConditionInput(LayerParameter* layer) {
+  for (int t = 0; t < layer->top_size(); ++t) {
+    if (layer->top(t) != FLAGS_condition) {
+      continue;
+    }
+    CHECK_EQ(layer->type(), "Input") << FLAGS_condition
+        << " must be a net input.";
+    InputParameter* input_param = layer->mutable_input_param();
+    CHECK_EQ(input_param->shape_size(), layer->top_size())
+        << layer->name() << " must give one shape per top.";
+    if (FLAGS_multi_head) {
+      // One index per sample.
+      layer->set_top(t, FLAGS_index_blob);
+      BlobShape* shape = input_param->mutable_shape(t);
+      const int num = shape->dim(0);
+      shape->clear_dim();
+      shape->add_dim(num);
+    } else {
+      layer->mutable_top()->DeleteSubrange(t, 1);
+      input_param->mutable_shape()->DeleteSubrange(t, 1);
+    }
+    return;
+  }
+}
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  gflags::SetUsageMessage("Bakes the filters of dynamic convolutions for "
+      "a fixed set of conditions into static weights.\n"
+      "Usage:\n"
+      "    bake_conditioned_filters [FLAGS] net_proto_in weights_in "
+      "conditions_file out_prefix\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0],
+        "tools/bake_conditioned_filters");
+    return 1;
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  set<string> conditioned_blobs;
+  conditioned_blobs.insert(FLAGS_condition);
+  const vector<bool> conditioned =
+      ConditionedLayers(net_param, &conditioned_blobs);
+  // Only dynamic convolutions may take their filters from the subgraph.
+  vector<int> dynamic;
+  for (int i = 0; i < net_param.layer_size(); ++i) {
+    const LayerParameter& layer = net_param.layer(i);
+    if (conditioned[i]) {
+      continue;
+    }
+    const int num_filter_bottoms = NumFilterBottoms(layer);
+    for (int b = 0; b < layer.bottom_size(); ++b) {
+      CHECK(!conditioned_blobs.count(layer.bottom(b)) ||
+          b >= layer.bottom_size() - num_filter_bottoms)
+          << layer.name() << " uses " << layer.bottom(b)
+          << ", computed from " << FLAGS_condition;
+    }
+    const vector<string> bottoms = Bottoms(layer);
+    if (num_filter_bottoms && AllBottomsIn(vector<string>(
+        bottoms.end() - num_filter_bottoms, bottoms.end()),
+        conditioned_blobs)) {
+      dynamic.push_back(i);
+    }
+  }
+  CHECK(!dynamic.empty()) << "No dynamic convolution takes its filters from "
+      << FLAGS_condition;
+  const vector<vector<float> > conditions = ReadConditions(argv[3]);
+  CHECK(!conditions.empty()) << "No condition in " << argv[3];
+
+  NetParameter run_param(net_param);
+  run_param.mutable_state()->set_phase(TEST);
+  Net<float> net(run_param);
+  net.CopyTrainedLayersFrom(argv[2]);
+  Blob<float>* condition = net.blob_by_name(FLAGS_condition).get();
+  vector<int> condition_shape = condition->shape();
+  condition_shape[0] = 1;
+  condition->Reshape(condition_shape);
+  // The layers to run, including the splits the net inserted.
+  vector<int> subgraph;
+  set<string> subgraph_blobs;
+  subgraph_blobs.insert(FLAGS_condition);
+  for (int i = 0; i < net.layers().size(); ++i) {
+    vector<string> bottoms;
+    for (int b = 0; b < net.bottom_ids(i).size(); ++b) {
+      bottoms.push_back(net.blob_names()[net.bottom_ids(i)[b]]);
+    }
+    if (AllBottomsIn(bottoms, subgraph_blobs)) {
+      subgraph.push_back(i);
+      for (int t = 0; t < net.top_ids(i).size(); ++t) {
+        subgraph_blobs.insert(net.blob_names()[net.top_ids(i)[t]]);
+      }
+    }
+  }
+
+  // The baked filters of each dynamic convolution, one row per condition.
+  vector<shared_ptr<Blob<float> > > baked(dynamic.size());
+  for (int k = 0; k < dynamic.size(); ++k) {
+    vector<int> shape(2, conditions.size());
+    shape[1] = net.layer_by_name(net_param.layer(dynamic[k]).name())
+        ->blobs()[0]->count();
+    baked[k].reset(new Blob<float>(shape));
+  }
+  // The first condition with the bytes of each key.
+  map<string, int> evaluated;
+  for (int c = 0; c < conditions.size(); ++c) {
+    CHECK_EQ(conditions[c].size(), condition->count())
+        << "Condition " << c << " has the wrong number of values.";
+    const string key(reinterpret_cast<const char*>(&conditions[c][0]),
+        conditions[c].size() * sizeof(float));
+    const map<string, int>::const_iterator hit = evaluated.find(key);
+    if (hit != evaluated.end()) {
+      for (int k = 0; k < dynamic.size(); ++k) {
+        const int count = baked[k]->count(1);
+        caffe_copy(count, baked[k]->cpu_data() + hit->second * count,
+            baked[k]->mutable_cpu_data() + c * count);
+      }
+      continue;
+    }
+    evaluated[key] = c;
+    caffe_copy(condition->count(), &conditions[c][0],
+        condition->mutable_cpu_data());
+    for (int i = 0; i < subgraph.size(); ++i) {
+      net.layers()[subgraph[i]]->Forward(net.bottom_vecs()[subgraph[i]],
+          net.top_vecs()[subgraph[i]]);
+    }
+    for (int k = 0; k < dynamic.size(); ++k) {
+      BakeFilter(net, net_param.layer(dynamic[k]),
+          baked[k]->mutable_cpu_data() + c * baked[k]->count(1));
+    }
+  }
+
+  // The served net: the subgraph is gone and the convolutions are static,
+  // or take their filters from an Embed layer indexed by condition.
+  NetParameter deploy(net_param);
+  deploy.clear_layer();
+  set<string> deploy_layers;
+  for (int i = 0, k = 0; i < net_param.layer_size(); ++i) {
+    if (conditioned[i]) {
+      continue;
+    }
+    if (k < dynamic.size() && dynamic[k] == i) {
+      const LayerParameter& conv = net_param.layer(i);
+      const int num_filter_bottoms = NumFilterBottoms(conv);
+      LayerParameter* layer = NULL;
+      if (FLAGS_multi_head) {
+        LayerParameter* embed = deploy.add_layer();
+        embed->set_name(conv.name() + "_filters");
+        embed->set_type("Embed");
+        embed->add_bottom(FLAGS_index_blob);
+        embed->add_top(conv.name() + "_filters");
+        EmbedParameter* embed_param = embed->mutable_embed_param();
+        embed_param->set_num_output(baked[k]->shape(1));
+        embed_param->set_input_dim(conditions.size());
+        embed_param->set_bias_term(false);
+        deploy_layers.insert(embed->name());
+        layer = deploy.add_layer();
+        layer->CopyFrom(conv);
+        layer->mutable_bottom()->DeleteSubrange(
+            conv.bottom_size() - num_filter_bottoms, num_filter_bottoms);
+        layer->add_bottom(embed->top(0));
+        layer->mutable_convolution_param()->set_weight_operation(
+            ConvolutionParameter_WeightOp_COPY);
+      } else {
+        layer = deploy.add_layer();
+        layer->CopyFrom(conv);
+        layer->mutable_bottom()->DeleteSubrange(
+            conv.bottom_size() - num_filter_bottoms, num_filter_bottoms);
+        layer->mutable_convolution_param()->clear_weight_operation();
+        layer->mutable_convolution_param()->clear_dynamic_engine();
+      }
+      deploy_layers.insert(layer->name());
+      ++k;
+      continue;
+    }
+    LayerParameter* layer = deploy.add_layer();
+    layer->CopyFrom(net_param.layer(i));
+    ReplaceConditionInput(layer);
+    if (layer->type() == "Input" && layer->top_size() == 0) {
+      deploy.mutable_layer()->RemoveLast();
+      continue;
+    }
+    deploy_layers.insert(layer->name());
+  }
+  const string prefix(argv[4]);
+  WriteProtoToTextFile(deploy, prefix + ".prototxt");
+
+  // The trained weights of the layers that remain.
+  NetParameter trained;
+  net.ToProto(&trained, false);
+  NetParameter weights(trained);
+  weights.clear_layer();
+  for (int i = 0; i < trained.layer_size(); ++i) {
+    if (deploy_layers.count(trained.layer(i).name())) {
+      weights.add_layer()->CopyFrom(trained.layer(i));
+    }
+  }
+  // Where each dynamic convolution's weights sit in weights.
+  vector<BlobProto*> conv_weights(dynamic.size());
+  for (int k = 0; k < dynamic.size(); ++k) {
+    for (int i = 0; i < weights.layer_size(); ++i) {
+      if (weights.layer(i).name() == net_param.layer(dynamic[k]).name()) {
+        conv_weights[k] = weights.mutable_layer(i)->mutable_blobs(0);
+      }
+    }
+  }
+  if (FLAGS_multi_head) {
+    for (int k = 0; k < dynamic.size(); ++k) {
+      LayerParameter* embed = weights.add_layer();
+      embed->set_name(net_param.layer(dynamic[k]).name() + "_filters");
+      embed->set_type("Embed");
+      baked[k]->ToProto(embed->add_blobs());
+    }
+    WriteProtoToBinaryFile(weights, prefix + ".caffemodel");
+    LOG(INFO) << "Wrote " << prefix << ".prototxt and " << prefix
+        << ".caffemodel for " << conditions.size() << " conditions ("
+        << evaluated.size() << " distinct)";
+    return 0;
+  }
+  for (int c = 0; c < conditions.size(); ++c) {
+    for (int k = 0; k < dynamic.size(); ++k) {
+      const Blob<float>& weight = *net.layer_by_name(
+          net_param.layer(dynamic[k]).name())->blobs()[0];
+      Blob<float> static_weight(weight.shape());
+      caffe_copy(weight.count(), baked[k]->cpu_data() + c * baked[k]->count(1),
+          static_weight.mutable_cpu_data());
+      static_weight.ToProto(conv_weights[k]);
+    }
+    WriteProtoToBinaryFile(weights,
+        prefix + "_" + format_int(c) + ".caffemodel");
+  }
+  LOG(INFO) << "Wrote " << prefix << ".prototxt and " << conditions.size()
+      << " caffemodels " << prefix << "_<condition>.caffemodel ("
+      << evaluated.size() << " distinct conditions)";
+  return 0;
+}
@@ -0,0 +1,113 @@
+// This is a microbenchmark of how the CPU BatchNorm, Scale and BN layers
+// scale with the number of threads they split the channels among: each layer
+// is timed with 1, 2, 4, ... threads up to --threads.
+// Usage:
+//    batch_norm_benchmark [--num=32] [--channels=64] [--height=56] \
+//        [--width=56] [--iterations=20] [--threads=0]
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/layers/batch_norm_layer.hpp"
+#include "caffe/layers/bn_layer.hpp"
+#include "caffe/layers/scale_layer.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_int32(num, 32, "The batch size.");
+DEFINE_int32(channels, 64, "The number of channels.");
+DEFINE_int32(height, 56, "The input height.");
+DEFINE_int32(width, 56, "The input width.");
+DEFINE_int32(iterations, 20, "The number of timed iterations.");
+DEFINE_int32(threads, 0,
+    "Optional; the most CPU threads to time, or 0 for Caffe's default.");
+
+struct Timing {
+  double forward_ms;
+  double backward_ms;
+};
+
+// Runs one warm-up and FLAGS_iterations timed forward/backward passes.
+static Timing TimeLayer(Layer<float>* layer, const vector<Blob<float>*>& bottom,
+    const vector<Blob<float>*>& top) {
+  const vector<bool> propagate_down(bottom.size(), true);
+  layer->Forward(bottom, top);
+  caffe_copy(top[0]->count(), top[0]->cpu_data(), top[0]->mutable_cpu_diff());
+  layer->Backward(top, propagate_down, bottom);
+  Timing timing = {0, 0};
+  CPUTimer timer;
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    timer.Start();
+    layer->Forward(bottom, top);
+    timing.forward_ms += timer.MilliSeconds();
+    timer.Start();
+    layer->Backward(top, propagate_down, bottom);
+    timing.backward_ms += timer.MilliSeconds();
+  }
+  timing.forward_ms /= FLAGS_iterations;
+  timing.backward_ms /= FLAGS_iterations;
+  return timing;
+}
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  gflags::SetUsageMessage("Times the CPU normalization layers against the "
+      "number of threads.\n"
+      "Usage:\n"
+      "    batch_norm_benchmark [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+  Caffe::set_mode(Caffe::CPU);
+  const int max_threads =
+      FLAGS_threads > 0 ? FLAGS_threads : Caffe::cpu_threads();
+
+  Blob<float> bottom(FLAGS_num, FLAGS_channels, FLAGS_height, FLAGS_width);
+  FillerParameter filler_param;
+  GaussianFiller<float> filler(filler_param);
+  filler.Fill(&bottom);
+  vector<Blob<float>*> bottom_vec(1, &bottom);
+  Blob<float> top;
+  vector<Blob<float>*> top_vec(1, &top);
+  LOG(INFO) << "Input " << bottom.shape_string() << ", up to " << max_threads
+      << " threads, " << FLAGS_iterations << " iterations";
+
+  const char* names[] = {"BatchNorm", "BatchNorm (global stats)",
+      "Scale (with bias)", "BN"};
+  for (int l = 0; l < 4; ++l) {
+    LayerParameter layer_param;
+    shared_ptr<Layer<float> > layer;
+    if (l < 2) {
+      layer_param.mutable_batch_norm_param()->set_use_global_stats(l == 1);
+      layer.reset(new BatchNormLayer<float>(layer_param));
+    } else if (l == 2) {
+      ScaleParameter* scale_param = layer_param.mutable_scale_param();
+      scale_param->mutable_filler()->set_type("gaussian");
+      scale_param->set_bias_term(true);
+      scale_param->mutable_bias_filler()->set_type("gaussian");
+      layer.reset(new ScaleLayer<float>(layer_param));
+    } else {
+      layer.reset(new BNLayer<float>(layer_param));
+    }
+    layer->SetUp(bottom_vec, top_vec);
+    Timing serial = {0, 0};
+    for (int threads = 1; ; threads = std::min(2 * threads, max_threads)) {
+      Caffe::set_cpu_threads(threads);
+      const Timing timing = TimeLayer(layer.get(), bottom_vec, top_vec);
+      if (threads == 1) {
+        serial = timing;
+      }
+      LOG(INFO) << names[l] << ", " << threads << " threads: forward "
+          << timing.forward_ms << " ms (" << serial.forward_ms /
+          timing.forward_ms << "x), backward " << timing.backward_ms
+          << " ms (" << serial.backward_ms / timing.backward_ms << "x)";
+      if (threads == max_threads) {
+        break;
+      }
+    }
+  }
+  return 0;
+}
@@ -48,6 +48,9 @@ DEFINE_string(weights, "",
     "separated by ','. Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_int32(cpu_threads, 0,
+    "Optional; the number of threads CPU layers split a batch across. "
+    "Defaults to the cores left over by the BLAS threads.");
 DEFINE_string(sigint_effect, "stop",
              "Optional; action to take when a SIGINT signal is received: "
               "snapshot, stop or none.");
@@ -441,6 +444,11 @@ int main(int argc, char** argv) {
       "  time            benchmark model execution time");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  if (FLAGS_cpu_threads > 0) {
+    CHECK(FLAGS_cpu_threads == 1 || caffe::BlasIsThreadSafe())
+        << "--cpu_threads above 1 needs a thread-safe BLAS.";
+    Caffe::set_cpu_threads(FLAGS_cpu_threads);
+  }
   if (argc == 2) {
 #ifdef WITH_PYTHON_LAYER
     try {
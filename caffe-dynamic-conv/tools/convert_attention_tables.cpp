@@ -0,0 +1,86 @@
+// This program reads the attention map of every image of a list once and
+// writes their alias tables into an attention table file, for the
+// attention_tables of an ImageData layer with attention_guided_crop.
+// Usage:
+//   convert_attention_tables [FLAGS] MASKFOLDER/ LISTFILE TABLES_NAME
+//
+// where MASKFOLDER holds a grayscale attention map of any resolution under
+// the name of each image, and LISTFILE is the image list of the layer, in
+// the format as
+//   subfolder1/file1.JPEG 7 [attribute ...]
+//   ....
+// The tables follow the lines of LISTFILE, so a missing map is fatal.
+
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+#endif  // USE_OPENCV
+
+#include "caffe/layers/image_data_layer.hpp"
+#include "caffe/util/attention_sampler.hpp"
+#include "caffe/util/io.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+#ifdef USE_OPENCV
+  ::google::InitGoogleLogging(argv[0]);
+  // Print output to stderr (while still logging)
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Precompute the alias tables of the attention "
+        "maps of an image list for attention-guided crops.\n"
+        "Usage:\n"
+        "    convert_attention_tables [FLAGS] MASKFOLDER/ LISTFILE "
+        "TABLES_NAME\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc < 4) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0],
+        "tools/convert_attention_tables");
+    return 1;
+  }
+
+  ImageList lines;
+  std::vector<float> attributes;
+  ReadImageList(argv[2], &lines, &attributes);
+  LOG(INFO) << "A total of " << lines.size() << " images.";
+
+  AttentionTablesWriter writer(argv[3]);
+  std::string mask_folder(argv[1]);
+  std::vector<float> attention;
+  for (int line_id = 0; line_id < lines.size(); ++line_id) {
+    const cv::Mat cv_mask =
+        ReadImageToCVMat(mask_folder + lines.name(line_id), false);
+    CHECK(cv_mask.data) << "Could not load the attention map "
+        << mask_folder + lines.name(line_id);
+    attention.resize(cv_mask.rows * cv_mask.cols);
+    for (int h = 0; h < cv_mask.rows; ++h) {
+      const uchar* ptr = cv_mask.ptr<uchar>(h);
+      for (int w = 0; w < cv_mask.cols; ++w) {
+        attention[h * cv_mask.cols + w] = ptr[w];
+      }
+    }
+    writer.Add(&attention[0], cv_mask.rows, cv_mask.cols);
+    if ((line_id + 1) % 1000 == 0) {
+      LOG(INFO) << "Processed " << line_id + 1 << " files.";
+    }
+  }
+  writer.Close();
+  if (lines.size() % 1000 != 0) {
+    LOG(INFO) << "Processed " << lines.size() << " files.";
+  }
+#else
+  LOG(FATAL) << "This tool requires OpenCV; compile with USE_OPENCV.";
+#endif  // USE_OPENCV
+  return 0;
+}
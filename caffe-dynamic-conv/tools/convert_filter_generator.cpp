@@ -0,0 +1,125 @@
+// This is a script to turn the InnerProduct layers that generate the filters
+// of dynamic convolutions into DynamicFilterGenerator layers, so that the
+// convolutions take the factorized (coefficient x basis) filters instead of
+// one materialized filter per sample. DynamicFilterGenerator keeps the
+// InnerProduct parameter blobs as they are, so the trained weights carry over
+// exactly; the basis has one filter per embedding value, plus the bias.
+// Usage:
+//    convert_filter_generator net_proto_in weights_in \
+//        net_proto_out weights_out
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using std::map;
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+// Whether the layer is a convolution whose last bottom holds the filters.
+static bool IsDynamicConvolution(const LayerParameter& layer) {
+  return layer.type() == "Convolution" &&
+      layer.bottom_size() == layer.top_size() + 1;
+}
+
+// Rewrites the filter generators of net_param in place and returns their
+// names.
+static vector<string> ConvertNet(NetParameter* net_param) {
+  vector<string> converted;
+  for (int i = 0; i < net_param->layer_size(); ++i) {
+    LayerParameter* generator = net_param->mutable_layer(i);
+    if (generator->type() != "InnerProduct" || generator->top_size() != 1) {
+      continue;
+    }
+    const string filters = generator->top(0);
+    // Every consumer (up to the next layer producing the same blob) must be
+    // a dynamic convolution taking it as its filter bottom.
+    vector<LayerParameter*> consumers;
+    string other_user;
+    for (int j = i + 1; j < net_param->layer_size(); ++j) {
+      LayerParameter* layer = net_param->mutable_layer(j);
+      for (int b = 0; b < layer->bottom_size(); ++b) {
+        if (layer->bottom(b) != filters) {
+          continue;
+        }
+        if (IsDynamicConvolution(*layer) && b == layer->bottom_size() - 1) {
+          consumers.push_back(layer);
+        } else {
+          other_user = layer->name();
+        }
+      }
+      bool produces = false;
+      for (int t = 0; t < layer->top_size(); ++t) {
+        produces |= (layer->top(t) == filters);
+      }
+      if (produces) {
+        break;
+      }
+    }
+    if (consumers.empty()) {
+      continue;
+    }
+    if (!other_user.empty()) {
+      LOG(WARNING) << "Skipping " << generator->name() << ": " << filters
+          << " is also used by " << other_user;
+      continue;
+    }
+    const string coefficients = filters + "_coefficients";
+    const string basis = filters + "_basis";
+    generator->set_type("DynamicFilterGenerator");
+    generator->set_top(0, coefficients);
+    generator->add_top(basis);
+    for (int c = 0; c < consumers.size(); ++c) {
+      consumers[c]->set_bottom(consumers[c]->bottom_size() - 1, coefficients);
+      consumers[c]->add_bottom(basis);
+    }
+    converted.push_back(generator->name());
+  }
+  return converted;
+}
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: convert_filter_generator net_proto_in weights_in "
+        << "net_proto_out weights_out";
+    return 1;
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  NetParameter weights;
+  ReadNetParamsFromBinaryFileOrDie(argv[2], &weights);
+
+  const vector<string> converted = ConvertNet(&net_param);
+  if (converted.empty()) {
+    LOG(ERROR) << "No InnerProduct filter generator found in " << argv[1];
+    return 2;
+  }
+  map<string, LayerParameter*> weight_layers;
+  for (int i = 0; i < weights.layer_size(); ++i) {
+    weight_layers[weights.layer(i).name()] = weights.mutable_layer(i);
+  }
+  for (int i = 0; i < converted.size(); ++i) {
+    if (!weight_layers.count(converted[i])) {
+      LOG(WARNING) << "No trained weights for " << converted[i];
+      continue;
+    }
+    // The parameter blobs are used as they are; only the description of
+    // the layer changes.
+    LayerParameter* layer = weight_layers[converted[i]];
+    layer->set_type("DynamicFilterGenerator");
+    LOG(INFO) << "Converted " << converted[i] << " ("
+        << layer->blobs_size() << " parameter blobs)";
+  }
+  WriteProtoToTextFile(net_param, argv[3]);
+  WriteProtoToBinaryFile(weights, argv[4]);
+  LOG(INFO) << "Wrote the converted net to " << argv[3] << " and its weights "
+      << "to " << argv[4];
+  return 0;
+}
@@ -0,0 +1,103 @@
+// This program decodes and resizes a set of images once into an image cache
+// for the ImageCacheData layer: a memory-mapped file of fixed-size uint8
+// images with their labels and attributes.
+// Usage:
+//   convert_image_cache [FLAGS] ROOTFOLDER/ LISTFILE CACHE_NAME
+//
+// where ROOTFOLDER is the root folder that holds all the images, and LISTFILE
+// should be a list of files as well as their labels and attributes, in the
+// format as
+//   subfolder1/file1.JPEG 7 [attribute ...]
+//   ....
+// Every image must be readable: the tool aborts on the first one that is not.
+
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+#endif  // USE_OPENCV
+
+#include "caffe/layers/image_data_layer.hpp"
+#include "caffe/util/image_cache.hpp"
+#include "caffe/util/io.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_bool(gray, false,
+    "When this option is on, treat images as grayscale ones");
+DEFINE_int32(resize_width, 256, "Width images are resized to");
+DEFINE_int32(resize_height, 256, "Height images are resized to");
+DEFINE_bool(filename_attributes, false,
+    "For lists without attribute columns, store the (gender, ethnicity) "
+    "attributes coded in the filenames");
+
+int main(int argc, char** argv) {
+#ifdef USE_OPENCV
+  ::google::InitGoogleLogging(argv[0]);
+  // Print output to stderr (while still logging)
+  FLAGS_alsologtostderr = 1;
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Decode and resize a set of images into the image "
+        "cache read by the ImageCacheData layer.\n"
+        "Usage:\n"
+        "    convert_image_cache [FLAGS] ROOTFOLDER/ LISTFILE CACHE_NAME\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc < 4) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/convert_image_cache");
+    return 1;
+  }
+  CHECK_GT(FLAGS_resize_height, 0) << "The cache holds images of one size.";
+  CHECK_GT(FLAGS_resize_width, 0) << "The cache holds images of one size.";
+
+  ImageList lines;
+  std::vector<float> attributes;
+  int num_attributes = ReadImageList(argv[2], &lines, &attributes);
+  if (num_attributes == 0 && FLAGS_filename_attributes) {
+    num_attributes = 2;
+    attributes.resize(lines.size() * num_attributes);
+    for (int line_id = 0; line_id < lines.size(); ++line_id) {
+      if (!FilenameAttributes(lines.name(line_id),
+          &attributes[line_id * num_attributes])) {
+        LOG(WARNING) << "No attributes in filename " << lines.name(line_id);
+      }
+    }
+  }
+  LOG(INFO) << "A total of " << lines.size() << " images with "
+      << num_attributes << " attributes.";
+
+  const bool is_color = !FLAGS_gray;
+  ImageCacheWriter writer(argv[3], is_color ? 3 : 1, FLAGS_resize_height,
+      FLAGS_resize_width, num_attributes);
+  std::string root_folder(argv[1]);
+  int count = 0;
+  for (int line_id = 0; line_id < lines.size(); ++line_id) {
+    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines.name(line_id),
+        FLAGS_resize_height, FLAGS_resize_width, is_color);
+    // Skipping it would silently renumber the images after it.
+    CHECK(cv_img.data) << "Could not load " << root_folder
+        << lines.name(line_id);
+    CHECK(cv_img.isContinuous());
+    writer.Add(cv_img.data, lines.label(line_id),
+        num_attributes ? &attributes[line_id * num_attributes] : NULL);
+    if (++count % 1000 == 0) {
+      LOG(INFO) << "Processed " << count << " files.";
+    }
+  }
+  writer.Close();
+  if (count % 1000 != 0) {
+    LOG(INFO) << "Processed " << count << " files.";
+  }
+#else
+  LOG(FATAL) << "This tool requires OpenCV; compile with USE_OPENCV.";
+#endif  // USE_OPENCV
+  return 0;
+}
@@ -0,0 +1,118 @@
+// This is a microbenchmark of the direct CPU depthwise convolution against
+// the im2col path, i.e. a ConvolutionLayer with one group per channel, for
+// 3x3 and 5x5 kernels.
+// Usage:
+//    depthwise_conv_benchmark [--num=32] [--channels=64] [--height=56] \
+//        [--width=56] [--stride=1] [--iterations=20] [--threads=0]
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/depthwise_conv_layer.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_int32(num, 32, "The batch size.");
+DEFINE_int32(channels, 64, "The number of channels.");
+DEFINE_int32(height, 56, "The input height.");
+DEFINE_int32(width, 56, "The input width.");
+DEFINE_int32(stride, 1, "The convolution stride.");
+DEFINE_int32(iterations, 20, "The number of timed iterations.");
+DEFINE_int32(threads, 0,
+    "Optional; the number of CPU threads, or 0 to keep Caffe's default.");
+
+struct Timing {
+  double forward_ms;
+  double backward_ms;
+};
+
+// Runs one warm-up and FLAGS_iterations timed forward/backward passes.
+static Timing TimeLayer(Layer<float>* layer, const vector<Blob<float>*>& bottom,
+    const vector<Blob<float>*>& top) {
+  const vector<bool> propagate_down(bottom.size(), true);
+  layer->Forward(bottom, top);
+  caffe_copy(top[0]->count(), top[0]->cpu_data(), top[0]->mutable_cpu_diff());
+  layer->Backward(top, propagate_down, bottom);
+  Timing timing = {0, 0};
+  CPUTimer timer;
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    timer.Start();
+    layer->Forward(bottom, top);
+    timing.forward_ms += timer.MilliSeconds();
+    timer.Start();
+    layer->Backward(top, propagate_down, bottom);
+    timing.backward_ms += timer.MilliSeconds();
+  }
+  timing.forward_ms /= FLAGS_iterations;
+  timing.backward_ms /= FLAGS_iterations;
+  return timing;
+}
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  gflags::SetUsageMessage("Times the direct depthwise convolution against "
+      "the im2col path.\n"
+      "Usage:\n"
+      "    depthwise_conv_benchmark [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+  Caffe::set_mode(Caffe::CPU);
+  if (FLAGS_threads > 0) {
+    Caffe::set_cpu_threads(FLAGS_threads);
+  }
+
+  Blob<float> bottom(FLAGS_num, FLAGS_channels, FLAGS_height, FLAGS_width);
+  FillerParameter filler_param;
+  GaussianFiller<float> filler(filler_param);
+  filler.Fill(&bottom);
+  vector<Blob<float>*> bottom_vec(1, &bottom);
+  Blob<float> top;
+  Blob<float> ref_top;
+  vector<Blob<float>*> top_vec(1, &top);
+  vector<Blob<float>*> ref_top_vec(1, &ref_top);
+  LOG(INFO) << "Input " << bottom.shape_string() << ", stride "
+      << FLAGS_stride << ", " << Caffe::cpu_threads() << " threads, "
+      << FLAGS_iterations << " iterations";
+
+  const int kernels[] = {3, 5};
+  for (int k = 0; k < 2; ++k) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(kernels[k]);
+    convolution_param->add_pad(kernels[k] / 2);
+    convolution_param->add_stride(FLAGS_stride);
+    convolution_param->set_num_output(FLAGS_channels);
+    convolution_param->set_group(FLAGS_channels);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    DepthwiseConvolutionLayer<float> direct_layer(layer_param);
+    direct_layer.SetUp(bottom_vec, top_vec);
+    ConvolutionLayer<float> im2col_layer(layer_param);
+    im2col_layer.SetUp(bottom_vec, ref_top_vec);
+    for (int i = 0; i < direct_layer.blobs().size(); ++i) {
+      im2col_layer.blobs()[i]->CopyFrom(*direct_layer.blobs()[i]);
+    }
+    const Timing direct = TimeLayer(&direct_layer, bottom_vec, top_vec);
+    const Timing im2col = TimeLayer(&im2col_layer, bottom_vec, ref_top_vec);
+    float max_diff = 0;
+    for (int i = 0; i < top.count(); ++i) {
+      max_diff = std::max(max_diff,
+          std::fabs(top.cpu_data()[i] - ref_top.cpu_data()[i]));
+    }
+    LOG(INFO) << kernels[k] << "x" << kernels[k] << " forward: direct "
+        << direct.forward_ms << " ms, im2col " << im2col.forward_ms
+        << " ms (" << im2col.forward_ms / direct.forward_ms << "x)";
+    LOG(INFO) << kernels[k] << "x" << kernels[k] << " backward: direct "
+        << direct.backward_ms << " ms, im2col " << im2col.backward_ms
+        << " ms (" << im2col.backward_ms / direct.backward_ms << "x)";
+    LOG(INFO) << kernels[k] << "x" << kernels[k]
+        << " max output difference: " << max_diff;
+  }
+  return 0;
+}
@@ -0,0 +1,111 @@
+// This is a microbenchmark of the dynamic (per-sample filter) CPU path of
+// ConvolutionLayer: every weight_operation under every dynamic_engine, with
+// the filters in group 2 as in the conv2 layer of the dynamic convolution
+// nets.
+// Usage:
+//    dynamic_conv_benchmark [--num=16] [--channels=16] [--height=16]
+//        [--width=16] [--iterations=5] [--threads=0]
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/layers/conv_layer.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_int32(num, 16, "The batch size.");
+DEFINE_int32(channels, 16, "The number of input and output channels.");
+DEFINE_int32(height, 16, "The input height.");
+DEFINE_int32(width, 16, "The input width.");
+DEFINE_int32(iterations, 5, "The number of timed iterations.");
+DEFINE_int32(threads, 0,
+    "Optional; the number of CPU threads, or 0 to keep Caffe's default.");
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  gflags::SetUsageMessage("Times the forward pass of the dynamic convolution "
+      "engines.\n"
+      "Usage:\n"
+      "    dynamic_conv_benchmark [FLAGS]\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+  Caffe::set_mode(Caffe::CPU);
+  if (FLAGS_threads > 0) {
+    Caffe::set_cpu_threads(FLAGS_threads);
+  }
+
+  const int group = 2;
+  Blob<float> bottom(FLAGS_num, FLAGS_channels, FLAGS_height, FLAGS_width);
+  Blob<float> bottom_weight(FLAGS_num,
+      FLAGS_channels * FLAGS_channels / group * 3 * 3, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<float> filler(filler_param);
+  filler.Fill(&bottom);
+  filler.Fill(&bottom_weight);
+  vector<Blob<float>*> bottom_vec;
+  bottom_vec.push_back(&bottom);
+  bottom_vec.push_back(&bottom_weight);
+  Blob<float> top;
+  vector<Blob<float>*> top_vec(1, &top);
+  LOG(INFO) << "Input " << bottom.shape_string() << ", "
+      << Caffe::cpu_threads() << " threads, " << FLAGS_iterations
+      << " iterations";
+
+  const ConvolutionParameter_WeightOp ops[] = {
+    ConvolutionParameter_WeightOp_MUL,
+    ConvolutionParameter_WeightOp_ADD,
+    ConvolutionParameter_WeightOp_COPY
+  };
+  const ConvolutionParameter_DynamicEngine engines[] = {
+    ConvolutionParameter_DynamicEngine_PER_SAMPLE,
+    ConvolutionParameter_DynamicEngine_BATCHED,
+    ConvolutionParameter_DynamicEngine_FUSED
+  };
+  for (int engine = 0; engine < 3; ++engine) {
+    for (int op = 0; op < 3; ++op) {
+      LayerParameter layer_param;
+      ConvolutionParameter* convolution_param =
+          layer_param.mutable_convolution_param();
+      convolution_param->add_kernel_size(3);
+      convolution_param->add_pad(1);
+      convolution_param->set_num_output(FLAGS_channels);
+      convolution_param->set_group(group);
+      convolution_param->set_weight_operation(ops[op]);
+      convolution_param->set_dynamic_engine(engines[engine]);
+      convolution_param->mutable_weight_filler()->set_type("gaussian");
+      convolution_param->mutable_bias_filler()->set_type("gaussian");
+      ConvolutionLayer<float> layer(layer_param);
+      layer.SetUp(bottom_vec, top_vec);
+      layer.Forward(bottom_vec, top_vec);
+      CPUTimer timer;
+      timer.Start();
+      for (int i = 0; i < FLAGS_iterations; ++i) {
+        layer.Forward(bottom_vec, top_vec);
+      }
+      const double seconds = timer.MicroSeconds() / 1e6;
+      // Combining a sample's MUL/ADD filter reads blobs_[0] and the filter
+      // and writes the combined filter; FUSED combines inside the gemms and
+      // writes nothing. COPY convolves with the filter bottom directly.
+      // BATCHED also writes the column buffers of the whole batch.
+      const bool combined = ops[op] != ConvolutionParameter_WeightOp_COPY;
+      const bool fused =
+          engines[engine] == ConvolutionParameter_DynamicEngine_FUSED;
+      const size_t filter_count = bottom_weight.count();
+      const size_t filter_bytes = !combined ? 0 :
+          (fused ? 2 : 3) * filter_count * sizeof(float);
+      const size_t column_bytes =
+          engines[engine] != ConvolutionParameter_DynamicEngine_BATCHED ? 0 :
+          static_cast<size_t>(FLAGS_num) * FLAGS_channels * 3 * 3 *
+          top.count(2) * sizeof(float);
+      LOG(INFO) << ConvolutionParameter_DynamicEngine_Name(engines[engine])
+          << " " << ConvolutionParameter_WeightOp_Name(ops[op]) << ": "
+          << FLAGS_num * FLAGS_iterations / seconds << " samples/s, "
+          << filter_bytes << " bytes of filter traffic and " << column_bytes
+          << " bytes of batched columns per forward";
+    }
+  }
+  return 0;
+}
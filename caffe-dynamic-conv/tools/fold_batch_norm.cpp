@@ -0,0 +1,45 @@
+// This is a script to fold the BatchNorm, BN and Scale layers of a net into
+// the Convolution and InnerProduct layers before them, for deployment: it
+// writes a net without those layers and the weights that give it the same
+// output in the TEST phase (see caffe/util/fold_batch_norm.hpp). A net can
+// also be folded as it is loaded by setting fold_batch_norm in its prototxt.
+// Usage:
+//    fold_batch_norm net_proto_in weights_in net_proto_out weights_out
+
+#include <gflags/gflags.h>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/fold_batch_norm.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  gflags::SetUsageMessage("Folds the normalization layers of a net into "
+      "the layers before them.\n"
+      "Usage:\n"
+      "    fold_batch_norm net_proto_in weights_in net_proto_out "
+      "weights_out\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/fold_batch_norm");
+    return 1;
+  }
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  NetParameter weights;
+  ReadNetParamsFromBinaryFileOrDie(argv[2], &weights);
+  NetParameter folded_param;
+  FoldBatchNormLayers(net_param, &folded_param);
+  NetParameter folded_weights;
+  FoldBatchNormWeights<float>(net_param, weights, &folded_weights);
+  WriteProtoToTextFile(folded_param, argv[3]);
+  WriteProtoToBinaryFile(folded_weights, argv[4]);
+  LOG(INFO) << "Folded " << net_param.layer_size() - folded_param.layer_size()
+      << " layers; wrote " << argv[3] << " and " << argv[4];
+  return 0;
+}
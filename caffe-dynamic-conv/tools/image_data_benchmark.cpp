@@ -0,0 +1,84 @@
+// This is a benchmark of the ImageData layer's decode workers: it reports
+// the images per second the prefetch thread sustains for 1, 2, 4, ... up to
+// max_workers decode workers.
+// Usage:
+//    image_data_benchmark [FLAGS] LISTFILE
+//
+// where LISTFILE is a list of images and labels as for the ImageData layer.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/layers/image_data_layer.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_string(root_folder, "", "The folder the listed images are relative to.");
+DEFINE_int32(batch_size, 32, "The batch size.");
+DEFINE_int32(resize_height, 256, "Height images are resized to.");
+DEFINE_int32(resize_width, 256, "Width images are resized to.");
+DEFINE_int32(crop_size, 224, "The random crop size.");
+DEFINE_bool(mirror, true, "Randomly mirror the images.");
+DEFINE_int32(max_workers, 8, "The largest number of decode workers.");
+DEFINE_int32(iterations, 20, "The number of timed batches per setting.");
+
+int main(int argc, char** argv) {
+#ifdef USE_OPENCV
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  gflags::SetUsageMessage("Times the ImageData layer for increasing numbers "
+      "of decode workers.\n"
+      "Usage:\n"
+      "    image_data_benchmark [FLAGS] LISTFILE\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 2) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/image_data_benchmark");
+    return 1;
+  }
+  Caffe::set_mode(Caffe::CPU);
+
+  LayerParameter layer_param;
+  layer_param.set_phase(TRAIN);
+  layer_param.mutable_transform_param()->set_crop_size(FLAGS_crop_size);
+  layer_param.mutable_transform_param()->set_mirror(FLAGS_mirror);
+  ImageDataParameter* image_data_param =
+      layer_param.mutable_image_data_param();
+  image_data_param->set_source(argv[1]);
+  image_data_param->set_root_folder(FLAGS_root_folder);
+  image_data_param->set_batch_size(FLAGS_batch_size);
+  image_data_param->set_new_height(FLAGS_resize_height);
+  image_data_param->set_new_width(FLAGS_resize_width);
+  image_data_param->set_shuffle(true);
+  const int prefetch = layer_param.data_param().prefetch();
+
+  Blob<float> data;
+  Blob<float> label;
+  vector<Blob<float>*> bottom_vec;
+  vector<Blob<float>*> top_vec;
+  top_vec.push_back(&data);
+  top_vec.push_back(&label);
+  for (int workers = 1; workers <= FLAGS_max_workers; workers *= 2) {
+    image_data_param->set_num_workers(workers);
+    ImageDataLayer<float> layer(layer_param);
+    layer.SetUp(bottom_vec, top_vec);
+    // Drain the batches prefetched ahead, so only steady state is timed.
+    for (int i = 0; i <= prefetch; ++i) {
+      layer.Forward(bottom_vec, top_vec);
+    }
+    CPUTimer timer;
+    timer.Start();
+    for (int i = 0; i < FLAGS_iterations; ++i) {
+      layer.Forward(bottom_vec, top_vec);
+    }
+    const double seconds = timer.MicroSeconds() / 1e6;
+    LOG(INFO) << workers << " decode workers: "
+        << FLAGS_batch_size * FLAGS_iterations / seconds << " images/s";
+  }
+#else
+  LOG(FATAL) << "This tool requires OpenCV; compile with USE_OPENCV.";
+#endif  // USE_OPENCV
+  return 0;
+}
@@ -0,0 +1,102 @@
+// This is a benchmark of image decoding on one thread: it reports the images
+// per second ReadImageToCVMat and ReadImageToCVMatScaled (libjpeg's scaled
+// IDCT) decode and resize a list of images at, and how far apart their
+// results are.
+// Usage:
+//    image_decode_benchmark [FLAGS] LISTFILE
+//
+// where LISTFILE is a list of images and labels as for the ImageData layer.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#ifdef USE_OPENCV
+#include <opencv2/core/core.hpp>
+#endif  // USE_OPENCV
+
+#include "caffe/caffe.hpp"
+#include "caffe/layers/image_data_layer.hpp"
+#include "caffe/util/io.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_string(root_folder, "", "The folder the listed images are relative to.");
+DEFINE_int32(resize_height, 256, "Height images are resized to.");
+DEFINE_int32(resize_width, 256, "Width images are resized to.");
+DEFINE_bool(gray, false, "Decode the images as grayscale ones.");
+DEFINE_int32(num_images, 1000, "The number of listed images to decode.");
+
+int main(int argc, char** argv) {
+#ifdef USE_OPENCV
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  gflags::SetUsageMessage("Times full and scaled JPEG decoding.\n"
+      "Usage:\n"
+      "    image_decode_benchmark [FLAGS] LISTFILE\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 2) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0],
+        "tools/image_decode_benchmark");
+    return 1;
+  }
+
+  ImageList lines;
+  vector<float> attributes;
+  ReadImageList(argv[1], &lines, &attributes);
+  CHECK(!lines.empty()) << "File is empty";
+  const int num_images = std::min(lines.size(), FLAGS_num_images);
+  const bool is_color = !FLAGS_gray;
+  // Read the files once so both decoders find them in the page cache.
+  for (int i = 0; i < num_images; ++i) {
+    Datum datum;
+    ReadFileToDatum(FLAGS_root_folder + lines.name(i), 0, &datum);
+  }
+
+  vector<cv::Mat> full(num_images);
+  CPUTimer timer;
+  timer.Start();
+  for (int i = 0; i < num_images; ++i) {
+    full[i] = ReadImageToCVMat(FLAGS_root_folder + lines.name(i),
+        FLAGS_resize_height, FLAGS_resize_width, is_color);
+  }
+  const double full_seconds = timer.MicroSeconds() / 1e6;
+  vector<cv::Mat> scaled(num_images);
+  timer.Start();
+  for (int i = 0; i < num_images; ++i) {
+    scaled[i] = ReadImageToCVMatScaled(FLAGS_root_folder + lines.name(i),
+        FLAGS_resize_height, FLAGS_resize_width, is_color);
+  }
+  const double scaled_seconds = timer.MicroSeconds() / 1e6;
+  LOG(INFO) << "full decode: " << num_images / full_seconds
+      << " images/s, scaled decode: " << num_images / scaled_seconds
+      << " images/s (" << full_seconds / scaled_seconds << "x)";
+
+  // The mean absolute difference per pixel level.
+  double difference = 0;
+  int count = 0;
+  for (int i = 0; i < num_images; ++i) {
+    if (!full[i].data || !scaled[i].data) {
+      continue;
+    }
+    CHECK_EQ(full[i].rows, scaled[i].rows);
+    CHECK_EQ(full[i].cols, scaled[i].cols);
+    const int row_size = full[i].cols * full[i].channels();
+    for (int h = 0; h < full[i].rows; ++h) {
+      const uchar* full_row = full[i].ptr<uchar>(h);
+      const uchar* scaled_row = scaled[i].ptr<uchar>(h);
+      for (int j = 0; j < row_size; ++j) {
+        difference += std::abs(full_row[j] - scaled_row[j]);
+      }
+    }
+    count += full[i].rows * row_size;
+  }
+  LOG(INFO) << "mean absolute difference: " << difference / count;
+#else
+  LOG(FATAL) << "This tool requires OpenCV; compile with USE_OPENCV.";
+#endif  // USE_OPENCV
+  return 0;
+}